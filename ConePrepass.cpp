@@ -0,0 +1,243 @@
+#include "ConePrepass.h"
+
+#include <stdexcept>
+
+// r32f is a mandatory color attachment and sampled format
+static const VkFormat kDepthFormat = VK_FORMAT_R32_SFLOAT;
+
+// ---------------------------------------------------------------------------
+// Public API
+// ---------------------------------------------------------------------------
+
+void ConePrepass::init(VkDevice device_, DeviceAllocator &allocator_,
+                       VkExtent2D fullExtent_) {
+  device = device_;
+  allocator = &allocator_;
+  fullExtent = fullExtent_;
+
+  createRenderPass();
+  createImage();
+  createDescriptors();
+  updateDescriptor();
+}
+
+void ConePrepass::beginPass(VkCommandBuffer commandBuffer,
+                            VkExtent2D renderExtent) {
+  VkExtent2D tiles = tileExtent(renderExtent);
+
+  VkRenderPassBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  beginInfo.renderPass = renderPass;
+  beginInfo.framebuffer = framebuffer;
+  beginInfo.renderArea.offset = {0, 0};
+  beginInfo.renderArea.extent = tiles;
+  vkCmdBeginRenderPass(commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+  VkViewport viewport{0, 0, (float)tiles.width, (float)tiles.height, 0, 1};
+  VkRect2D scissor{{0, 0}, tiles};
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+void ConePrepass::endPass(VkCommandBuffer commandBuffer) {
+  vkCmdEndRenderPass(commandBuffer);
+}
+
+void ConePrepass::bind(VkCommandBuffer commandBuffer, VkPipelineLayout layout,
+                       uint32_t set) {
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          layout, set, 1, &descriptorSet, 0, nullptr);
+}
+
+void ConePrepass::onSwapchainRecreate(VkExtent2D fullExtent_) {
+  fullExtent = fullExtent_;
+  destroyImage();
+  createImage();
+  updateDescriptor();
+}
+
+void ConePrepass::cleanup() {
+  if (device == VK_NULL_HANDLE)
+    return;
+  destroyImage();
+  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  vkDestroySampler(device, sampler, nullptr);
+  vkDestroyRenderPass(device, renderPass, nullptr);
+  descriptorPool = VK_NULL_HANDLE;
+  setLayout = VK_NULL_HANDLE;
+  sampler = VK_NULL_HANDLE;
+  renderPass = VK_NULL_HANDLE;
+}
+
+// ---------------------------------------------------------------------------
+// Setup
+// ---------------------------------------------------------------------------
+
+void ConePrepass::createRenderPass() {
+  VkAttachmentDescription attachment{};
+  attachment.format = kDepthFormat;
+  attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  // one fragment per tile overwrites every texel of the render area
+  attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  VkAttachmentReference colorRef{};
+  colorRef.attachment = 0;
+  colorRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpass{};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &colorRef;
+
+  // The previous raymarch pass must finish reading before we overwrite, and
+  // our writes must be visible to this frame's raymarch pass
+  VkSubpassDependency dependencies[2]{};
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[0].srcAccessMask = 0;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  VkRenderPassCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  info.attachmentCount = 1;
+  info.pAttachments = &attachment;
+  info.subpassCount = 1;
+  info.pSubpasses = &subpass;
+  info.dependencyCount = 2;
+  info.pDependencies = dependencies;
+
+  if (vkCreateRenderPass(device, &info, nullptr, &renderPass) != VK_SUCCESS)
+    throw std::runtime_error("ConePrepass: failed to create render pass");
+}
+
+void ConePrepass::createImage() {
+  VkExtent2D tiles = tileExtent(fullExtent);
+
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent = {tiles.width, tiles.height, 1};
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.format = kDepthFormat;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+  allocator->createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image,
+                         imageMemory);
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = kDepthFormat;
+  viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  if (vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+    throw std::runtime_error("ConePrepass: failed to create image view");
+
+  VkFramebufferCreateInfo framebufferInfo{};
+  framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebufferInfo.renderPass = renderPass;
+  framebufferInfo.attachmentCount = 1;
+  framebufferInfo.pAttachments = &view;
+  framebufferInfo.width = tiles.width;
+  framebufferInfo.height = tiles.height;
+  framebufferInfo.layers = 1;
+  if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffer) !=
+      VK_SUCCESS)
+    throw std::runtime_error("ConePrepass: failed to create framebuffer");
+}
+
+void ConePrepass::destroyImage() {
+  vkDestroyFramebuffer(device, framebuffer, nullptr);
+  vkDestroyImageView(device, view, nullptr);
+  allocator->destroyImage(image, imageMemory);
+  framebuffer = VK_NULL_HANDLE;
+  view = VK_NULL_HANDLE;
+}
+
+void ConePrepass::createDescriptors() {
+  // read with texelFetch(); the sampler only has to exist
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  if (vkCreateSampler(device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+    throw std::runtime_error("ConePrepass: failed to create sampler");
+
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &binding;
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout) !=
+      VK_SUCCESS)
+    throw std::runtime_error(
+        "ConePrepass: failed to create descriptor set layout");
+
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSize.descriptorCount = 1;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = 1;
+  if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) !=
+      VK_SUCCESS)
+    throw std::runtime_error("ConePrepass: failed to create descriptor pool");
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &setLayout;
+  if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) !=
+      VK_SUCCESS)
+    throw std::runtime_error("ConePrepass: failed to allocate descriptor set");
+}
+
+void ConePrepass::updateDescriptor() {
+  VkDescriptorImageInfo imageInfo{};
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  imageInfo.imageView = view;
+  imageInfo.sampler = sampler;
+
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = descriptorSet;
+  write.dstBinding = 0;
+  write.dstArrayElement = 0;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.descriptorCount = 1;
+  write.pImageInfo = &imageInfo;
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
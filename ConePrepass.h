@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+
+#include "DeviceAllocator.h"
+
+// Low-resolution cone-march pre-pass for the primary rays. Each texel of an
+// r32f image covers a kTileSize x kTileSize tile of the raymarch pass; the
+// raymarch shader (CONE_MODE 2) marches one cone enclosing all of the tile's
+// rays and writes the distance up to which the cone is known to be empty.
+// The full-resolution pass (CONE_MODE 1) starts each ray there.
+//
+// The pre-pass pipelines are the raymarch variants built against
+// getRenderPass(), so they share the raymarch pipeline layout; the depth is
+// read back through set 3 of that layout.
+class ConePrepass {
+public:
+  // Must match CONE_TILE in shader.frag
+  static constexpr uint32_t kTileSize = 8;
+
+  void init(VkDevice device, DeviceAllocator &allocator,
+            VkExtent2D fullExtent);
+
+  // Begins the pre-pass for a raymarch pass of `renderExtent` and sets
+  // viewport and scissor to its tile grid
+  void beginPass(VkCommandBuffer commandBuffer, VkExtent2D renderExtent);
+  void endPass(VkCommandBuffer commandBuffer);
+
+  VkRenderPass getRenderPass() const { return renderPass; }
+  // Layout of set 3 in the raymarch pipeline layout
+  VkDescriptorSetLayout getSetLayout() const { return setLayout; }
+  void bind(VkCommandBuffer commandBuffer, VkPipelineLayout layout,
+            uint32_t set);
+
+  static VkExtent2D tileExtent(VkExtent2D extent) {
+    return {(extent.width + kTileSize - 1) / kTileSize,
+            (extent.height + kTileSize - 1) / kTileSize};
+  }
+
+  void onSwapchainRecreate(VkExtent2D fullExtent);
+
+  void cleanup();
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator *allocator = nullptr;
+  VkExtent2D fullExtent{};
+
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  VkImage image = VK_NULL_HANDLE;
+  DeviceAllocation imageMemory;
+  VkImageView view = VK_NULL_HANDLE;
+  VkFramebuffer framebuffer = VK_NULL_HANDLE;
+  VkSampler sampler = VK_NULL_HANDLE;
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+  void createRenderPass();
+  void createImage();
+  void destroyImage();
+  void createDescriptors();
+  void updateDescriptor();
+};
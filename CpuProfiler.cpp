@@ -0,0 +1,152 @@
+#include "CpuProfiler.h"
+
+#include "GpuProfiler.h"
+
+#include <cstdio>
+#include <fstream>
+
+static const char *const stageNames[CpuProfiler::StageCount] = {
+    "poll", "wait_fence", "acquire", "record", "submit", "present"};
+
+const char *CpuProfiler::stageName(Stage stage) { return stageNames[stage]; }
+
+CpuProfiler::CpuProfiler() {
+  epoch = Clock::now();
+  frameStart = epoch;
+  lastSummary = epoch;
+}
+
+void CpuProfiler::beginFrame(int state) {
+  frameStart = Clock::now();
+  current = &ring[frameCounter % ringSize];
+  *current = FrameSample{};
+  current->frameNumber = frameCounter++;
+  current->state = state;
+  current->startUs = toUs(frameStart);
+}
+
+void CpuProfiler::endFrame() {
+  if (current == nullptr)
+    return;
+  current->durationUs = toUs(Clock::now()) - current->startUs;
+  if (ringCount < ringSize)
+    ringCount++;
+
+  if (current->state >= 0 && current->state < maxStates) {
+    StateTotals &t = totals[current->state];
+    t.frames++;
+    t.frameUs += current->durationUs;
+    for (int s = 0; s < StageCount; s++)
+      t.stageUs[s] += current->stageUs[s];
+  }
+  current = nullptr;
+}
+
+void CpuProfiler::addStage(Stage stage, Clock::time_point start,
+                           Clock::time_point end) {
+  if (current == nullptr)
+    return;
+  // A stage may run more than once per frame; keep the first start and the
+  // summed duration
+  if (current->stageUs[stage] == 0.0)
+    current->stageStartUs[stage] = toUs(start);
+  current->stageUs[stage] +=
+      std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+bool CpuProfiler::summaryDue() const {
+  return std::chrono::duration<double>(Clock::now() - lastSummary).count() >=
+         summaryInterval;
+}
+
+void CpuProfiler::printSummary(std::ostream &out, const GpuProfiler *gpu) {
+  lastSummary = Clock::now();
+
+  char line[256];
+  snprintf(line, sizeof(line), "%-5s %6s %8s", "state", "frames", "frame");
+  out << line;
+  for (int s = 0; s < StageCount; s++) {
+    snprintf(line, sizeof(line), " %10s", stageNames[s]);
+    out << line;
+  }
+  out << "  (avg ms)  bound\n";
+
+  for (int state = 0; state < maxStates; state++) {
+    StateTotals &t = totals[state];
+    if (t.frames == 0)
+      continue;
+
+    double avg[StageCount];
+    for (int s = 0; s < StageCount; s++)
+      avg[s] = t.stageUs[s] / t.frames / 1000.0;
+    double frameMs = t.frameUs / t.frames / 1000.0;
+
+    // Whatever the CPU spends its frame blocked on is the bottleneck: the
+    // fence means the GPU is still busy, acquire/present mean we are paced
+    // by the display, anything else is our own work.
+    double gpuWait = avg[WaitFence];
+    double presentWait = avg[Acquire] + avg[Present];
+    double cpuWork = avg[Poll] + avg[Record] + avg[Submit];
+    const char *bound = "cpu";
+    if (gpuWait >= presentWait && gpuWait >= cpuWork)
+      bound = "gpu";
+    else if (presentWait >= cpuWork)
+      bound = "present";
+
+    snprintf(line, sizeof(line), "%5d %6llu %8.2f", state,
+             (unsigned long long)t.frames, frameMs);
+    out << line;
+    for (int s = 0; s < StageCount; s++) {
+      snprintf(line, sizeof(line), " %10.3f", avg[s]);
+      out << line;
+    }
+    out << "            " << bound << "\n";
+    t = StateTotals{};
+  }
+
+  if (gpu != nullptr && gpu->isEnabled()) {
+    GpuProfiler::Stats frame = gpu->getStats(GpuProfiler::Frame);
+    snprintf(line, sizeof(line), "gpu frame avg %.2f ms, p99 %.2f ms\n",
+             frame.avgMs, frame.p99Ms);
+    out << line;
+  }
+  out.flush();
+}
+
+bool CpuProfiler::writeChromeTrace(const std::string &path) const {
+  std::ofstream file(path);
+  if (!file.is_open())
+    return false;
+
+  file << "{\"traceEvents\":[\n";
+  bool first = true;
+  auto event = [&](const char *name, double ts, double dur,
+                   const FrameSample &sample) {
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+             "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu,"
+             "\"state\":%d}}",
+             first ? "" : ",\n", name, ts, dur,
+             (unsigned long long)sample.frameNumber, sample.state);
+    file << buf;
+    first = false;
+  };
+
+  // Oldest first
+  uint64_t begin = frameCounter - ringCount;
+  for (uint64_t n = begin; n < begin + ringCount; n++) {
+    const FrameSample &sample = ring[n % ringSize];
+    if (sample.durationUs == 0.0)
+      continue; // still being recorded
+    event("frame", sample.startUs, sample.durationUs, sample);
+    for (int s = 0; s < StageCount; s++) {
+      if (sample.stageUs[s] > 0.0)
+        event(stageNames[s], sample.stageStartUs[s], sample.stageUs[s],
+              sample);
+    }
+  }
+
+  file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return file.good();
+}
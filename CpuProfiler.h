@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+class GpuProfiler;
+
+// Attributes CPU frame time to the stages of the main loop. Samples go into a
+// fixed ring of recent frames plus per-state totals, so nothing allocates
+// while frames are being timed.
+class CpuProfiler {
+public:
+  enum Stage { Poll, WaitFence, Acquire, Record, Submit, Present, StageCount };
+
+  using Clock = std::chrono::steady_clock;
+
+  // RAII timer that charges its lifetime to a stage of the current frame
+  class Scope {
+  public:
+    Scope(CpuProfiler &profiler, Stage stage)
+        : profiler(profiler), stage(stage), start(Clock::now()) {}
+    ~Scope() { profiler.addStage(stage, start, Clock::now()); }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    CpuProfiler &profiler;
+    Stage stage;
+    Clock::time_point start;
+  };
+
+  CpuProfiler();
+
+  void beginFrame(int state);
+  void endFrame();
+
+  void addStage(Stage stage, Clock::time_point start, Clock::time_point end);
+
+  // True once every `summaryInterval` seconds while frames are being timed
+  bool summaryDue() const;
+  // Per-state averages since the last summary with a bottleneck guess, then
+  // resets the totals. `gpu` (optional) adds the measured GPU frame time.
+  void printSummary(std::ostream &out, const GpuProfiler *gpu);
+
+  // Writes the frames still in the ring as Chrome trace events
+  // (load in chrome://tracing or ui.perfetto.dev)
+  bool writeChromeTrace(const std::string &path) const;
+
+  static const char *stageName(Stage stage);
+
+  double summaryInterval = 5.0; // seconds
+
+private:
+  static constexpr size_t ringSize = 1024;
+  static constexpr int maxStates = 32;
+
+  struct FrameSample {
+    uint64_t frameNumber = 0;
+    int state = 0;
+    double startUs = 0.0;
+    double durationUs = 0.0;
+    double stageStartUs[StageCount] = {};
+    double stageUs[StageCount] = {};
+  };
+  std::array<FrameSample, ringSize> ring;
+  size_t ringCount = 0;
+  uint64_t frameCounter = 0;
+  FrameSample *current = nullptr;
+
+  struct StateTotals {
+    uint64_t frames = 0;
+    double frameUs = 0.0;
+    double stageUs[StageCount] = {};
+  };
+  std::array<StateTotals, maxStates> totals;
+
+  Clock::time_point epoch;
+  Clock::time_point frameStart;
+  Clock::time_point lastSummary;
+
+  double toUs(Clock::time_point t) const {
+    return std::chrono::duration<double, std::micro>(t - epoch).count();
+  }
+};
@@ -0,0 +1,884 @@
+// Packet kernel of the CPU raymarcher: a port of shader.frag and
+// sdf_scene.glsl evaluated for kLanes rays at once. Included by
+// CpuRaymarcher.cpp once per instruction set, inside a namespace that first
+// defines the lane types and helpers this file uses:
+//
+//   F, M              kLanes floats and the mask a comparison yields
+//   kPacketW/H        pixel block of one packet, kPacketW * kPacketH lanes
+//   + - * / and unary -, < <= > >= on F; & | ! on M
+//   vmin vmax vabs vsqrt, vselect(m, ifTrue, ifFalse), anyOf allOf
+//   vload vstore (kLanes floats)
+//
+// Every function keeps the name and the order of operations of its GLSL
+// counterpart so the two can be compared side by side. Uniform values
+// (positions, rotations, colors) stay scalar; only the point varies.
+
+#define CPU_EPSILON 0.0001f
+#define CPU_MAX_DISTANCE 1000.0f
+#define CPU_MIN_DISTANCE 0.0001f
+
+struct V3 {
+  F x, y, z;
+};
+
+inline V3 v3(F x, F y, F z) { return {x, y, z}; }
+inline V3 v3(Vec3f v) { return {F(v.x), F(v.y), F(v.z)}; }
+inline V3 operator+(V3 a, V3 b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+inline V3 operator-(V3 a, V3 b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+inline V3 operator*(V3 a, V3 b) { return {a.x * b.x, a.y * b.y, a.z * b.z}; }
+inline V3 operator/(V3 a, V3 b) { return {a.x / b.x, a.y / b.y, a.z / b.z}; }
+inline V3 operator*(V3 a, F s) { return {a.x * s, a.y * s, a.z * s}; }
+inline V3 operator-(V3 a) { return {-a.x, -a.y, -a.z}; }
+inline V3 operator+(V3 a, Vec3f b) { return a + v3(b); }
+inline V3 operator-(V3 a, Vec3f b) { return a - v3(b); }
+
+inline F dot(V3 a, V3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline F length(V3 a) { return vsqrt(dot(a, a)); }
+inline V3 normalize(V3 a) { return a * (F(1.0f) / length(a)); }
+inline V3 cross(V3 a, V3 b) {
+  return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+          a.x * b.y - a.y * b.x};
+}
+inline V3 abs3(V3 a) { return {vabs(a.x), vabs(a.y), vabs(a.z)}; }
+inline V3 max3(V3 a, F b) { return {vmax(a.x, b), vmax(a.y, b), vmax(a.z, b)}; }
+inline V3 select3(M m, V3 a, V3 b) {
+  return {vselect(m, a.x, b.x), vselect(m, a.y, b.y), vselect(m, a.z, b.z)};
+}
+inline F clampf(F x, float lo, float hi) { return vmin(vmax(x, F(lo)), F(hi)); }
+inline F mixf(F a, F b, F t) { return a + (b - a) * t; }
+inline V3 mix3(V3 a, V3 b, F t) {
+  return {mixf(a.x, b.x, t), mixf(a.y, b.y, t), mixf(a.z, b.z, t)};
+}
+inline M equalf(F a, F b) { return (a <= b) & (a >= b); }
+inline V3 sign3(V3 a) {
+  F one(1.0f), zero(0.0f);
+  return {vselect(a.x > zero, one, vselect(a.x < zero, -one, zero)),
+          vselect(a.y > zero, one, vselect(a.y < zero, -one, zero)),
+          vselect(a.z > zero, one, vselect(a.z < zero, -one, zero))};
+}
+inline F smoothstepf(float e0, float e1, F x) {
+  F t = clampf((x - F(e0)) / F(e1 - e0), 0.0f, 1.0f);
+  return t * t * (F(3.0f) - F(2.0f) * t);
+}
+
+// GLSL m * v (m given by columns)
+inline V3 mul(const Mat3f &m, V3 v) {
+  if (m.identity)
+    return v;
+  return v3(m.c[0]) * v.x + v3(m.c[1]) * v.y + v3(m.c[2]) * v.z;
+}
+// GLSL v * m, i.e. transpose(m) * v
+inline V3 mulT(V3 v, const Mat3f &m) {
+  if (m.identity)
+    return v;
+  return {dot(v, v3(m.c[0])), dot(v, v3(m.c[1])), dot(v, v3(m.c[2]))};
+}
+
+// Applies a scalar function lane by lane (sin, pow)
+inline F perLane(F x, float (*fn)(float)) {
+  float values[kLanes];
+  vstore(values, x);
+  for (int i = 0; i < kLanes; i++)
+    values[i] = fn(values[i]);
+  return vload(values);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SDF struct, operators and primitives (sdf_scene.glsl)
+
+struct Sdf {
+  F dist;
+  V3 color;
+};
+
+inline Sdf sdf(F dist, Vec3f color) { return {dist, v3(color)}; }
+
+inline Sdf selectSdf(M m, Sdf a, Sdf b) {
+  return {vselect(m, a.dist, b.dist), select3(m, a.color, b.color)};
+}
+
+inline Sdf opUnion(Sdf a, Sdf b) {
+  M k = b.dist <= a.dist;
+  return {vmin(a.dist, b.dist), select3(k, b.color, a.color)};
+}
+
+inline Sdf opSubtraction(Sdf a, Sdf b) {
+  F d = vmax(-a.dist, b.dist);
+  M k = b.dist <= -a.dist;
+  return {d, select3(k, b.color, a.color)};
+}
+
+inline Sdf opSmoothUnion(Sdf a, Sdf b, float k) {
+  F h = clampf(F(0.5f) + F(0.5f) * (b.dist - a.dist) / F(k), 0.0f, 1.0f);
+  return {mixf(b.dist, a.dist, h) - F(k) * h * (F(1.0f) - h),
+          mix3(b.color, a.color, h)};
+}
+
+inline Sdf opSmoothSubtraction(Sdf a, Sdf b, float k) {
+  F h = clampf(F(0.5f) - F(0.5f) * (b.dist + a.dist) / F(k), 0.0f, 1.0f);
+  return {mixf(b.dist, -a.dist, h) + F(k) * h * (F(1.0f) - h),
+          mix3(b.color, a.color, h)};
+}
+
+inline Sdf sdfSphere(V3 p, Vec3f pos, const Mat3f &rot, float s,
+                     Vec3f color) {
+  V3 pl = mul(rot, p - pos);
+  return sdf(length(pl) - F(s), color);
+}
+
+inline Sdf sdfBox(V3 p, Vec3f pos, const Mat3f &rot, Vec3f b, Vec3f color) {
+  V3 pl = mul(rot, p - pos);
+  V3 q = abs3(pl) - b;
+  return sdf(length(max3(q, F(0.0f))) +
+                 vmin(vmax(q.x, vmax(q.y, q.z)), F(0.0f)),
+             color);
+}
+
+inline Sdf sdfRoundBox(V3 p, Vec3f pos, const Mat3f &rot, Vec3f b, float r,
+                       Vec3f color) {
+  V3 pl = mul(rot, p - pos);
+  V3 q = abs3(pl) - b + v3(Vec3f{r, r, r});
+  return sdf(length(max3(q, F(0.0f))) +
+                 vmin(vmax(q.x, vmax(q.y, q.z)), F(0.0f)) - F(r),
+             color);
+}
+
+inline Sdf sdfRoundedBoxFrame(V3 p, Vec3f pos, const Mat3f &rot, Vec3f b,
+                              float e, float r, Vec3f color) {
+  V3 pl = mul(rot, p - pos);
+  V3 pp = abs3(pl) - b;
+  V3 q = abs3(pp + Vec3f{e, e, e}) - Vec3f{e, e, e};
+  F zero(0.0f);
+  F d = vmin(vmin(length(max3(v3(pp.x, q.y, q.z), zero)) +
+                      vmin(vmax(pp.x, vmax(q.y, q.z)), zero),
+                  length(max3(v3(q.x, pp.y, q.z), zero)) +
+                      vmin(vmax(q.x, vmax(pp.y, q.z)), zero)),
+             length(max3(v3(q.x, q.y, pp.z), zero)) +
+                 vmin(vmax(q.x, vmax(q.y, pp.z)), zero));
+  return sdf(d - F(r), color);
+}
+
+inline Sdf sdfCappedCylinder(V3 p, Vec3f pos, const Mat3f &rot, float r,
+                             float h, Vec3f color) {
+  V3 pl = mul(rot, p - pos);
+  F dx = vabs(vsqrt(pl.x * pl.x + pl.z * pl.z)) - F(r);
+  F dy = vabs(pl.y) - F(h);
+  F outside = vsqrt(vmax(dx, F(0.0f)) * vmax(dx, F(0.0f)) +
+                    vmax(dy, F(0.0f)) * vmax(dy, F(0.0f)));
+  return sdf(vmin(vmax(dx, dy), F(0.0f)) + outside, color);
+}
+
+inline Sdf sdfRoundedCylinder(V3 p, Vec3f pos, const Mat3f &rot, float ra,
+                              float rb, float h, Vec3f color) {
+  V3 pl = mul(rot, p - pos);
+  F dx = vsqrt(pl.x * pl.x + pl.z * pl.z) - F(ra) + F(rb);
+  F dy = vabs(pl.y) - F(h) + F(rb);
+  F outside = vsqrt(vmax(dx, F(0.0f)) * vmax(dx, F(0.0f)) +
+                    vmax(dy, F(0.0f)) * vmax(dy, F(0.0f)));
+  return sdf(vmin(vmax(dx, dy), F(0.0f)) + outside - F(rb), color);
+}
+
+// r varies per lane for the mask's chin
+inline Sdf sdfEllipsoid(V3 p, Vec3f pos, const Mat3f &rot, V3 r,
+                        Vec3f color) {
+  V3 pl = mul(rot, p - pos);
+  F k0 = length(pl / r);
+  F k1 = length(pl / (r * r));
+  return sdf(k0 * (k0 - F(1.0f)) / k1, color);
+}
+
+// Exact gradient of sdfBox
+inline V3 gradBox(V3 p, Vec3f pos, const Mat3f &rot, Vec3f b) {
+  V3 pl = mul(rot, p - pos);
+  V3 q = abs3(pl) - b;
+  F zero(0.0f), one(1.0f);
+  V3 outside = max3(q, zero);
+  F len = length(outside);
+  V3 g = select3(q.y > q.z, v3(zero, one, zero), v3(zero, zero, one));
+  g = select3((q.x > q.y) & (q.x > q.z), v3(one, zero, zero), g);
+  g = select3(vmax(q.x, vmax(q.y, q.z)) > zero, outside / v3(len, len, len), g);
+  return mulT(g * sign3(pl), rot);
+}
+
+inline F boundDist(V3 p, Vec3f center, Vec3f halfSize) {
+  V3 q = abs3(p - center) - halfSize;
+  return length(max3(q, F(0.0f))) + vmin(vmax(q.x, vmax(q.y, q.z)), F(0.0f));
+}
+
+// Lanes whose bound is within reach, i.e. that the GPU would evaluate the
+// group for
+inline M groupLanes(V3 p, Vec3f center, Vec3f halfSize, F best, float k) {
+  return !(boundDist(p, center, halfSize) > best + F(k));
+}
+
+// A packet evaluates a group unless every lane may skip it; the lanes that
+// skip it keep their previous result through selectSdf(), as the pixels
+// that cull it do on the GPU.
+inline bool cullGroup(M lanes) { return !anyOf(lanes); }
+
+///////////////////////////////////////////////////////////////////////////////
+// Hit groups (SDF_GROUP in shader.frag)
+
+// GROUP_* ids of sdf_scene.glsl
+constexpr int kGroupRoom = 0;
+constexpr int kGroupBed = 1;
+constexpr int kGroupEndTable = 2;
+constexpr int kGroupPerson = 3;
+constexpr int kGroupMask = 4;
+constexpr int kGroupWalls = 5;
+constexpr int kGroupChair = 6;
+constexpr int kGroupSceneFile = 7;
+
+// gGroup and gGroupDist of one map() call; id -1 = none recorded
+struct GroupHit {
+  F dist;
+  F id;
+};
+
+inline GroupHit noGroup() { return {F(CPU_MAX_DISTANCE), F(-1.0f)}; }
+
+// SDF_GROUP(id, d) for the lanes in `lanes`; a null `groups` records nothing
+inline void recordGroup(GroupHit *groups, M lanes, int id, F d) {
+  if (!groups)
+    return;
+  M closer = lanes & (d < groups->dist);
+  groups->dist = vselect(closer, d, groups->dist);
+  groups->id = vselect(closer, F((float)id), groups->id);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Scene (sdf_scene.glsl bedroomStatic(), shader.frag map())
+
+// grad, when given, receives the exact gradient
+inline Sdf bedroomRoom(const CpuFrameParams &, V3 p, V3 *grad = nullptr) {
+  Vec3f roomPos{0.0f, 4.0f, 0.0f};
+  Vec3f roomSize{10.0f, 10.0f, 10.0f};
+  Vec3f holeSize{3.0f, 9.0f, 3.0f};
+  Vec3f roomColor{1.2f, 1.0f, 1.0f};
+  Sdf roomGeometry = sdfBox(p, roomPos, Mat3f(), roomSize, roomColor);
+  Sdf roomHole = sdfBox(p, roomPos, Mat3f(), holeSize, roomColor);
+  if (grad)
+    *grad = select3(-roomHole.dist > roomGeometry.dist,
+                    -gradBox(p, roomPos, Mat3f(), holeSize),
+                    gradBox(p, roomPos, Mat3f(), roomSize));
+  return opSubtraction(roomHole, roomGeometry);
+}
+
+inline Sdf bedroomBed(const CpuFrameParams &, V3 p) {
+  Vec3f bedColor{2.0f, 2.0f, 2.0f};
+  Sdf bed = sdfRoundBox(p, Vec3f{1.5f, -5.0f, 5.0f}, Mat3f(),
+                        Vec3f{1.0f, 0.5f, 5.0f}, 0.1f, bedColor);
+  Sdf bedRim = sdfRoundedBoxFrame(p, Vec3f{1.5f, -4.5f, 1.55f}, Mat3f(),
+                                  Vec3f{0.95f, 0.0f, 1.44f}, 0.0f, 0.02f,
+                                  bedColor);
+  return opSmoothUnion(bed, bedRim, 0.03f);
+}
+
+inline Sdf bedroomEndTable(const CpuFrameParams &params, V3 p) {
+  Vec3f endTablePos{-1.4f, -4.0f, 3.0f};
+  Vec3f cutoutPos{-1.4f, -3.0f, 3.0f};
+  Sdf endtable = sdfCappedCylinder(p, endTablePos, params.endTableRot, 1.0f,
+                                   0.5f, Vec3f{1.44f, 1.2f, 1.2f});
+  Sdf cutout = sdfBox(p, cutoutPos, Mat3f(), Vec3f{1.2f, 1.2f, 1.2f},
+                      Vec3f{1.2f, 1.0f, 1.0f});
+  return opSubtraction(cutout, endtable);
+}
+
+const Vec3f kBlanketPos{1.5f, -4.5f, 1.0f};
+
+// personDist is the distance to the parts alone
+inline Sdf bedroomPerson(const CpuFrameParams &params, V3 p, Sdf scene,
+                         F &personDist) {
+  Vec3f blanketColor{0.6f, 0.6f, 0.6f};
+  Vec3f b = kBlanketPos;
+  Sdf blanket = sdfRoundBox(p, b, Mat3f(), Vec3f{1.0f, 0.1f, 1.0f}, 0.1f,
+                            blanketColor);
+  scene = opSmoothUnion(blanket, scene, 0.1f);
+
+  Sdf torso = sdfRoundedCylinder(p, Vec3f{b.x, b.y + 0.1f, b.z},
+                                 params.torsoRot, 0.2f, 0.1f, 0.4f,
+                                 blanketColor);
+  scene = opSmoothUnion(torso, scene, 0.1f);
+
+  Sdf upperLeg = sdfRoundedCylinder(p, Vec3f{b.x - 0.2f, b.y + 0.1f, b.z - 0.2f},
+                                    params.upperLegRot, 0.1f, 0.1f, 0.4f,
+                                    blanketColor);
+  scene = opSmoothUnion(upperLeg, scene, 0.2f);
+
+  Sdf lowerLeg = sdfRoundedCylinder(p, Vec3f{b.x - 0.4f, b.y + 0.1f, b.z - 0.3f},
+                                    params.torsoRot, 0.1f, 0.1f, 0.4f,
+                                    blanketColor);
+  scene = opSmoothUnion(lowerLeg, scene, 0.1f);
+
+  Sdf headInBed = sdfSphere(p, Vec3f{b.x - 0.2f, b.y + 0.1f, b.z + 0.5f},
+                            Mat3f(), 0.2f, blanketColor);
+  scene = opSmoothUnion(headInBed, scene, 0.1f);
+
+  personDist = vmin(vmin(vmin(blanket.dist, torso.dist),
+                         vmin(upperLeg.dist, lowerLeg.dist)),
+                    headInBed.dist);
+  return scene;
+}
+
+// Groups are recorded only for the lanes the GPU evaluates them for, so a
+// packet records the same hit group per lane as the shader does per pixel
+inline Sdf bedroomStatic(const CpuFrameParams &params, V3 p,
+                         GroupHit *groups) {
+  Sdf scene = bedroomRoom(params, p);
+  M all = scene.dist <= scene.dist;
+  recordGroup(groups, all, kGroupRoom, scene.dist);
+
+  M lanes = groupLanes(p, Vec3f{1.5f, -5.0f, 5.0f}, Vec3f{1.1f, 0.6f, 5.1f},
+                       scene.dist, 0.0f);
+  if (!cullGroup(lanes)) {
+    Sdf bed = bedroomBed(params, p);
+    recordGroup(groups, lanes, kGroupBed, bed.dist);
+    scene = selectSdf(lanes, opUnion(bed, scene), scene);
+  }
+  lanes = groupLanes(p, Vec3f{-1.4f, -4.6f, 3.0f}, Vec3f{1.1f, 0.5f, 0.6f},
+                     scene.dist, 0.0f);
+  if (!cullGroup(lanes)) {
+    Sdf endtable = bedroomEndTable(params, p);
+    recordGroup(groups, lanes, kGroupEndTable, endtable.dist);
+    scene = selectSdf(lanes, opUnion(endtable, scene), scene);
+  }
+  Vec3f personCenter{kBlanketPos.x, kBlanketPos.y + 0.1f, kBlanketPos.z};
+  lanes = groupLanes(p, personCenter, Vec3f{1.15f, 0.45f, 1.2f}, scene.dist,
+                     0.2f);
+  if (!cullGroup(lanes)) {
+    F personDist;
+    scene = selectSdf(lanes, bedroomPerson(params, p, scene, personDist),
+                      scene);
+    recordGroup(groups, lanes, kGroupPerson, personDist);
+  }
+  return scene;
+}
+
+inline Sdf bedroomMask(const CpuFrameParams &params, V3 p) {
+  Vec3f m = params.maskPos;
+  Vec3f maskColor{1.3f, 355.0f / 255.0f, 355.0f / 255.0f};
+  Vec3f accentColor{0.0f, 0.0f, 0.0f};
+  V3 maskEllipseSize = v3(Vec3f{0.3f, 0.4f, 0.23f});
+  Sdf maskEllipse1 = sdfEllipsoid(p, m, Mat3f(), maskEllipseSize, maskColor);
+  Sdf maskEllipse2 = sdfEllipsoid(p, Vec3f{m.x - 0.13f, m.y, m.z}, Mat3f(),
+                                  maskEllipseSize, maskColor);
+
+  Sdf mask = maskEllipse1;
+
+  Sdf head = sdfEllipsoid(p, Vec3f{m.x + 0.1f, m.y + 0.1f, m.z}, Mat3f(),
+                          v3(Vec3f{0.25f, 0.28f, 0.2f}), maskColor);
+  mask = opSmoothUnion(head, mask, 0.05f);
+
+  V3 chinSize = v3(F(0.25f), F(0.28f), F(0.2f) - p.x * F(0.1f));
+  Sdf chin = sdfEllipsoid(p, Vec3f{m.x + 0.1f, m.y - 0.1f, m.z}, Mat3f(),
+                          chinSize, maskColor);
+  mask = opSmoothUnion(chin, mask, 0.05f);
+
+  V3 mirrorP = v3(p.x, p.y, vabs(p.z - F(m.z)) + F(m.z));
+  Sdf eyeBag = sdfEllipsoid(mirrorP, Vec3f{m.x + 0.35f, m.y, m.z + 0.1f},
+                            params.eyeBagRot, v3(Vec3f{0.03f, 0.06f, 0.03f}),
+                            accentColor);
+  mask = opSmoothSubtraction(eyeBag, mask, 0.1f);
+
+  Sdf eyeHole = sdfEllipsoid(mirrorP,
+                             Vec3f{m.x + 0.25f, m.y + 0.05f, m.z + 0.08f},
+                             params.eyeHoleRot, v3(Vec3f{0.06f, 0.02f, 0.04f}),
+                             maskColor);
+  mask = opSmoothSubtraction(eyeHole, mask, 0.05f);
+
+  Sdf noseBridge = sdfRoundedCylinder(p, Vec3f{m.x + 0.33f, m.y, m.z},
+                                      params.noseBridgeRot, 0.02f, 0.02f,
+                                      0.12f, maskColor);
+  mask = opSmoothUnion(noseBridge, mask, 0.05f);
+
+  Sdf nostril = sdfEllipsoid(mirrorP,
+                             Vec3f{m.x + 0.35f, m.y - 0.09f, m.z + 0.03f},
+                             params.eyeBagRot, v3(Vec3f{0.02f, 0.02f, 0.02f}),
+                             maskColor);
+  mask = opSmoothUnion(nostril, mask, 0.02f);
+
+  return opSmoothSubtraction(maskEllipse2, mask, 0.1f);
+}
+
+// grad, when given, receives the exact gradient of the nearest wall
+inline Sdf roomWalls(const CpuFrameParams &params, V3 p, V3 *grad = nullptr) {
+  Vec3f wallColor{2.0f, 2.0f, 2.0f};
+  Vec3f backWallPos{0.0f, 0.0f, 5.0f};
+  Vec3f backWallSize{4.0f, 2.0f, 0.1f};
+  Sdf backWall = sdfBox(p, backWallPos, Mat3f(), backWallSize, wallColor);
+
+  Vec3f sideWallPos{4.0f + params.wallOpen, 0.0f, 5.0f};
+  Vec3f sideWallSize{0.1f, 2.0f, 2.0f};
+  V3 pivot = v3(Vec3f{0.0f, 0.0f, 5.0f});
+  V3 sideWallp = pivot + mul(params.wallRot, p - pivot);
+  F mirror = vselect(sideWallp.x < F(0.0f), F(-1.0f), F(1.0f));
+  sideWallp.x = vabs(sideWallp.x);
+  Sdf sideWall =
+      sdfBox(sideWallp, sideWallPos, Mat3f(), sideWallSize, wallColor);
+
+  Vec3f topWallPos{0.0f, 1.9f + params.wallOpen, 5.0f};
+  Vec3f topWallSize{4.0f, 0.1f, 2.0f};
+  V3 topWallp = pivot + mul(params.wallRot, p - pivot);
+  Sdf topWall = sdfBox(topWallp, topWallPos, Mat3f(), topWallSize, wallColor);
+
+  Vec3f floorPos{0.0f, -1.9f, 5.0f};
+  Vec3f floorSize{4.0f, 0.1f, 2.0f};
+  Sdf floors = sdfBox(p, floorPos, Mat3f(), floorSize, wallColor);
+
+  Sdf wall = opUnion(backWall, sideWall);
+  wall = opUnion(wall, topWall);
+  wall = opUnion(wall, floors);
+
+  if (!grad)
+    return wall;
+  // the shader's if/else chain, last branch first
+  V3 g = gradBox(p, floorPos, Mat3f(), floorSize);
+  g = select3(equalf(wall.dist, topWall.dist),
+              mulT(gradBox(topWallp, topWallPos, Mat3f(), topWallSize),
+                   params.wallRot),
+              g);
+  V3 sideGrad = gradBox(sideWallp, sideWallPos, Mat3f(), sideWallSize);
+  g = select3(equalf(wall.dist, sideWall.dist),
+              mulT(sideGrad * v3(mirror, F(1.0f), F(1.0f)), params.wallRot), g);
+  *grad = select3(equalf(wall.dist, backWall.dist),
+                  gradBox(p, backWallPos, Mat3f(), backWallSize), g);
+  return wall;
+}
+
+// grad, when given, is exact on the seat and its back and zero on the legs
+inline Sdf roomChair(const CpuFrameParams &, V3 p, V3 *grad = nullptr) {
+  Vec3f wallColor{2.0f, 2.0f, 2.0f};
+  V3 chairp = v3(vabs(p.x), p.y, vabs(p.z - F(3.8f)) + F(3.8f));
+  Sdf chair = sdfCappedCylinder(chairp, Vec3f{0.5f, -1.5f, 4.0f}, Mat3f(),
+                                0.1f, 0.5f, wallColor);
+  Vec3f seatPos{0.0f, -1.0f, 4.0f};
+  Vec3f seatSize{0.6f, 0.1f, 0.6f};
+  Sdf seat = sdfBox(p, seatPos, Mat3f(), seatSize, wallColor);
+  chair = opUnion(seat, chair);
+  Vec3f seatBackPos{0.0f, 0.0f, 4.0f};
+  Vec3f seatBackSize{0.6f, 1.0f, 0.1f};
+  Sdf seatBack = sdfBox(p, seatBackPos, Mat3f(), seatBackSize, wallColor);
+  chair = opUnion(seatBack, chair);
+
+  if (!grad)
+    return chair;
+  F zero(0.0f);
+  V3 g = select3(equalf(chair.dist, seat.dist),
+                 gradBox(p, seatPos, Mat3f(), seatSize), v3(zero, zero, zero));
+  *grad = select3(equalf(chair.dist, seatBack.dist),
+                  gradBox(p, seatBackPos, Mat3f(), seatBackSize), g);
+  return chair;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Scene file interpreter (mapSceneBuffer() in shader.frag)
+
+inline F mirrorAxis(F x, float plane) {
+  return vabs(x - F(plane)) + F(plane);
+}
+
+inline Sdf scenePrimitive(const CpuSceneInstruction &ins, V3 p) {
+  if (ins.mirrorAxes & 1u)
+    p.x = mirrorAxis(p.x, ins.mirror.x);
+  if (ins.mirrorAxes & 2u)
+    p.y = mirrorAxis(p.y, ins.mirror.y);
+  if (ins.mirrorAxes & 4u)
+    p.z = mirrorAxis(p.z, ins.mirror.z);
+  const float *k = ins.params;
+  switch (ins.type) {
+  case SdfScene::Sphere:
+    return sdfSphere(p, ins.position, ins.rotation, k[0], ins.color);
+  case SdfScene::Box:
+    return sdfBox(p, ins.position, ins.rotation, Vec3f{k[0], k[1], k[2]},
+                  ins.color);
+  case SdfScene::RoundBox:
+    return sdfRoundBox(p, ins.position, ins.rotation,
+                       Vec3f{k[0], k[1], k[2]}, k[3], ins.color);
+  case SdfScene::RoundedBoxFrame:
+    return sdfRoundedBoxFrame(p, ins.position, ins.rotation,
+                              Vec3f{k[0], k[1], k[2]}, ins.edge, k[3],
+                              ins.color);
+  case SdfScene::CappedCylinder:
+    return sdfCappedCylinder(p, ins.position, ins.rotation, k[0], k[1],
+                             ins.color);
+  case SdfScene::RoundedCylinder:
+    return sdfRoundedCylinder(p, ins.position, ins.rotation, k[0], k[1], k[2],
+                              ins.color);
+  default:
+    return sdfEllipsoid(p, ins.position, ins.rotation,
+                        v3(Vec3f{k[0], k[1], k[2]}), ins.color);
+  }
+}
+
+inline Sdf sceneOperator(int type, float k, Sdf a, Sdf b) {
+  switch (type) {
+  case SdfScene::Union:
+    return opUnion(a, b);
+  case SdfScene::Subtraction:
+    return opSubtraction(a, b);
+  case SdfScene::SmoothUnion:
+    return opSmoothUnion(a, b, k);
+  default:
+    return opSmoothSubtraction(a, b, k);
+  }
+}
+
+inline Sdf mapScene(const CpuFrameParams &params, V3 p, Sdf scene) {
+  Sdf stack[SdfScene::kStackSize];
+  stack[0] = scene;
+  const CpuScene &file = *params.scene;
+  for (const SdfScene::Group &group : file.groups) {
+    if (((group.stateMask >> params.state) & 1u) == 0u)
+      continue;
+    M lanes;
+    if (group.bounded) {
+      lanes = groupLanes(p,
+                         Vec3f{group.boundCenter[0], group.boundCenter[1],
+                               group.boundCenter[2]},
+                         Vec3f{group.boundHalf[0], group.boundHalf[1],
+                               group.boundHalf[2]},
+                         stack[0].dist, group.boundCenter[3]);
+      if (cullGroup(lanes))
+        continue;
+    }
+    Sdf before = stack[0];
+    int top = 0;
+    for (int i = group.first; i < group.first + group.count; i++) {
+      const CpuSceneInstruction &ins = file.instructions[i];
+      if (ins.type < SdfScene::Union) {
+        stack[++top] = scenePrimitive(ins, p);
+      } else {
+        top--;
+        stack[top] = sceneOperator(ins.type, ins.k, stack[top + 1], stack[top]);
+      }
+    }
+    if (group.bounded)
+      stack[0] = selectSdf(lanes, stack[0], before);
+  }
+  return stack[0];
+}
+
+// Scene file geometry merged into `scene`, recorded as one group
+// (mapSceneFile() in shader.frag)
+inline Sdf mapSceneFile(const CpuFrameParams &params, V3 p, Sdf scene,
+                        GroupHit *groups) {
+  scene = mapScene(params, p, scene);
+  recordGroup(groups, scene.dist <= scene.dist, kGroupSceneFile, scene.dist);
+  return scene;
+}
+
+// `groups`, when given, receives the hit group of each lane
+inline Sdf map(const CpuFrameParams &params, V3 p,
+               GroupHit *groups = nullptr) {
+  if (groups)
+    *groups = noGroup();
+  if (params.state < 9) {
+    Sdf scene = params.scene
+                    ? mapSceneFile(params, p,
+                                   sdf(F(CPU_MAX_DISTANCE),
+                                       Vec3f{0.0f, 0.0f, 0.0f}),
+                                   groups)
+                    : bedroomStatic(params, p, groups);
+    Vec3f m = params.maskPos;
+    M lanes = groupLanes(p, Vec3f{m.x + 0.05f, m.y, m.z},
+                         Vec3f{0.5f, 0.55f, 0.35f}, scene.dist, 0.0f);
+    if (!cullGroup(lanes)) {
+      Sdf mask = bedroomMask(params, p);
+      recordGroup(groups, lanes, kGroupMask, mask.dist);
+      scene = selectSdf(lanes, opUnion(mask, scene), scene);
+    }
+    return scene;
+  }
+  Sdf scene = roomWalls(params, p);
+  recordGroup(groups, scene.dist <= scene.dist, kGroupWalls, scene.dist);
+  if (params.scene)
+    return mapSceneFile(params, p, scene, groups);
+  M lanes = groupLanes(p, Vec3f{0.0f, -0.5f, 4.0f}, Vec3f{0.7f, 1.6f, 0.7f},
+                       scene.dist, 0.0f);
+  if (cullGroup(lanes))
+    return scene;
+  Sdf chair = roomChair(params, p);
+  recordGroup(groups, lanes, kGroupChair, chair.dist);
+  return selectSdf(lanes, opUnion(scene, chair), scene);
+}
+
+// Distance to one group on its own, or to the whole scene for any id
+// without one in this state (mapGroup() in shader.frag)
+inline F mapGroup(const CpuFrameParams &params, V3 p, int group) {
+  F personDist;
+  if (params.state < 9) {
+    switch (group) {
+    case kGroupRoom:
+      return bedroomRoom(params, p).dist;
+    case kGroupBed:
+      return bedroomBed(params, p).dist;
+    case kGroupEndTable:
+      return bedroomEndTable(params, p).dist;
+    case kGroupPerson:
+      return bedroomPerson(params, p, bedroomBed(params, p), personDist).dist;
+    case kGroupMask:
+      return bedroomMask(params, p).dist;
+    }
+  } else {
+    if (group == kGroupWalls)
+      return roomWalls(params, p).dist;
+    if (group == kGroupChair)
+      return roomChair(params, p).dist;
+  }
+  return map(params, p).dist;
+}
+
+// mapGroup() for lanes that hit different groups: each group present is
+// evaluated once for the packet, every other lane sees the whole scene
+inline F mapGroup(const CpuFrameParams &params, V3 p, F group) {
+  F d(0.0f);
+  M rest = group <= group;
+  for (int id = kGroupRoom; id < kGroupSceneFile; id++) {
+    M lanes = equalf(group, F((float)id));
+    if (!anyOf(lanes))
+      continue;
+    d = vselect(lanes, mapGroup(params, p, id), d);
+    rest = rest & !lanes;
+  }
+  if (anyOf(rest))
+    d = vselect(rest, map(params, p).dist, d);
+  return d;
+}
+
+// Closed-form gradient of each lane's group, or zero where it has none
+inline V3 analyticGradient(const CpuFrameParams &params, V3 p, F group) {
+  F zero(0.0f);
+  V3 grad = v3(zero, zero, zero);
+  V3 g;
+  if (params.state < 9) {
+    M lanes = equalf(group, F((float)kGroupRoom));
+    if (anyOf(lanes)) {
+      bedroomRoom(params, p, &g);
+      grad = select3(lanes, g, grad);
+    }
+  } else {
+    M lanes = equalf(group, F((float)kGroupWalls));
+    if (anyOf(lanes)) {
+      roomWalls(params, p, &g);
+      grad = select3(lanes, g, grad);
+    }
+    lanes = equalf(group, F((float)kGroupChair));
+    if (anyOf(lanes)) {
+      roomChair(params, p, &g);
+      grad = select3(lanes, g, grad);
+    }
+  }
+  return grad;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Rays and lighting (shader.frag)
+
+inline float fractSin(float x) {
+  float s = std::sin(x) * 43758.5453f;
+  return s - std::floor(s);
+}
+
+inline F hash(V3 p) {
+  return perLane(dot(p, v3(Vec3f{127.1f, 311.7f, 74.7f})), fractSin);
+}
+
+// Returns the hit for lanes in `hit`; p holds their hit points and group
+// the group each one hit
+inline Sdf march(const CpuFrameParams &params, V3 &p, F &group, V3 origin,
+                 V3 dir, M &hit) {
+  F distance(0.0f);
+  M active = distance < F(CPU_MAX_DISTANCE);
+  hit = !active;
+  Sdf result{F(-1.0f), v3(Vec3f{1.0f, 1.0f, 1.0f})};
+  p = origin;
+  group = F(-1.0f);
+  for (int i = 0; i < params.marchSteps; i++) {
+    active = active & (distance < F(CPU_MAX_DISTANCE));
+    if (!anyOf(active))
+      break;
+    V3 pos = origin + dir * distance;
+    GroupHit groups;
+    Sdf s = map(params, pos, &groups);
+    p = select3(active, pos, p);
+    group = vselect(active, groups.id, group);
+    result.dist = vselect(active, s.dist, result.dist);
+    result.color = select3(active, s.color, result.color);
+    M done = active & (s.dist <= F(CPU_MIN_DISTANCE));
+    hit = hit | done;
+    active = active & !done;
+    distance = vselect(active, distance + s.dist, distance);
+  }
+  return result;
+}
+
+// Tetrahedral differences of each lane's group; -1 = the whole scene
+inline V3 normalTetra(const CpuFrameParams &params, V3 p, F group) {
+  // k.xyy, k.yyx, k.yxy, k.xxx with k = (1, -1)
+  V3 a = v3(Vec3f{1.0f, -1.0f, -1.0f});
+  V3 b = v3(Vec3f{-1.0f, -1.0f, 1.0f});
+  V3 c = v3(Vec3f{-1.0f, 1.0f, -1.0f});
+  V3 e = v3(Vec3f{1.0f, 1.0f, 1.0f});
+  F o(0.001f);
+  return normalize(a * mapGroup(params, p + a * o, group) +
+                   b * mapGroup(params, p + b * o, group) +
+                   c * mapGroup(params, p + c * o, group) +
+                   e * mapGroup(params, p + e * o, group));
+}
+
+// Normal at hit point p with scene distance d, which hit `group`
+inline V3 normal(const CpuFrameParams &params, V3 p, F d, F group) {
+  if (params.normalMode == CpuRaymarcher::NormalMode::Analytic) {
+    V3 grad = analyticGradient(params, p, group);
+    M known = dot(grad, grad) > F(0.0f);
+    if (allOf(known))
+      return normalize(grad);
+    return select3(known, normalize(grad), normalTetra(params, p, group));
+  }
+  if (params.normalMode == CpuRaymarcher::NormalMode::Group)
+    return normalTetra(params, p, group);
+  if (params.normalMode == CpuRaymarcher::NormalMode::Tetra)
+    return normalTetra(params, p, F(-1.0f));
+
+  float offset = 0.001f;
+  V3 distances = v3(map(params, p + Vec3f{offset, 0.0f, 0.0f}).dist - d,
+                    map(params, p + Vec3f{0.0f, offset, 0.0f}).dist - d,
+                    map(params, p + Vec3f{0.0f, 0.0f, offset}).dist - d);
+  return normalize(distances);
+}
+
+inline F calcShadow(const CpuFrameParams &params, V3 ro, V3 rd, float k) {
+  F res(1.0f);
+  F t = F(CPU_EPSILON) + hash(ro) * F(0.02f);
+  F zero(0.0f);
+  M active = t < F(CPU_MAX_DISTANCE);
+  M blocked = !active;
+  for (int i = 0; i < params.shadowSteps; i++) {
+    active = active & (t < F(CPU_MAX_DISTANCE));
+    if (!anyOf(active))
+      break;
+    F h = map(params, ro + rd * t).dist;
+    M hitNow = active & (h < F(CPU_MIN_DISTANCE));
+    blocked = blocked | hitNow;
+    active = active & !hitNow;
+
+    F s = F(k) * h / t;
+    F next = vmin(res, s);
+    next = mixf(next, s, F(0.2f));
+    res = vselect(active, next, res);
+    t = vselect(active, t + clampf(h, 0.02f, 0.25f), t);
+  }
+  return vselect(blocked, zero, clampf(res, 0.0f, 1.0f));
+}
+
+inline F calcOcclusion(const CpuFrameParams &params, V3 p, V3 norm) {
+  F occ(0.0f);
+  float sca = 1.0f;
+  for (int i = 1; i <= 5; i++) {
+    float h = (float)i * 0.02f;
+    F d = map(params, p + norm * F(h)).dist;
+    occ = occ + (F(h) - d) * F(sca);
+    sca *= 0.5f;
+  }
+  return clampf(F(1.0f) - occ, 0.0f, 1.0f);
+}
+
+inline float pow12(float x) { return std::pow(x, 1.2f); }
+inline float pow15(float x) { return std::pow(x, 1.5f); }
+
+inline V3 calcLighting(const CpuFrameParams &params, V3 color, V3 p, V3 norm,
+                       F sha, F occ) {
+  V3 lightPos = v3(Vec3f{0.0f, 0.0f, 0.0f});
+  V3 L = normalize(lightPos - p);
+
+  F sunLighting = clampf(dot(norm, L), 0.0f, 1.0f);
+  F skyLighting = clampf(F(0.5f) + F(0.5f) * norm.y, 0.0f, 1.0f);
+
+  V3 indirectDir = normalize(-L * v3(Vec3f{1.0f, 0.0f, 1.0f}));
+  F indirectLighting = clampf(dot(norm, indirectDir), 0.0f, 1.0f);
+
+  V3 shadow = v3(sha, perLane(sha, pow12), perLane(sha, pow15));
+  V3 lin = v3(Vec3f{0.64f, 0.67f, 0.69f}) * shadow * sunLighting;
+  lin = lin + v3(Vec3f{0.16f, 0.20f, 0.28f}) * (skyLighting * occ);
+  lin = lin + v3(Vec3f{0.40f, 0.28f, 0.20f}) * (indirectLighting * occ);
+
+  F distance = length(lightPos - p);
+  float radius = 6.0f - std::fabs(std::sin(params.time * 0.5f)) * 0.5f;
+  if (params.state >= 8)
+    radius += 2.0f;
+  F attenuation = F(1.0f) - smoothstepf(0.0f, radius, distance);
+
+  return color * lin * attenuation;
+}
+
+// Primary ray direction through fragment coordinates (fx, fy), before the
+// camera rotation; cameraDir(screenUV()) in shader.frag
+inline V3 cameraDir(const CpuFrameParams &params, F fx, F fy) {
+  float aspect = params.width / params.height;
+  F ux = (fx / F(params.width) * F(2.0f) - F(1.0f)) * F(aspect);
+  F uy = -(fy / F(params.height) * F(2.0f) - F(1.0f));
+
+  V3 forward = normalize(v3(ux, uy, F(1.0f)));
+  V3 worldUp = v3(Vec3f{0.0f, 1.0f, 0.0f});
+  V3 right = normalize(cross(forward, worldUp));
+  V3 up = cross(right, forward);
+
+  float halfHeight = std::tan(0.0174532925f / 2.0f);
+  float halfWidth = halfHeight * aspect;
+  return normalize(forward + right * (ux * F(halfWidth)) +
+                   up * (uy * F(halfHeight)));
+}
+
+// Shades the pixels [x0, x1) x [y0, y1) into linear RGB rows of
+// params.width floats * 3
+inline void renderTile(const CpuFrameParams &params, uint32_t x0, uint32_t y0,
+                       uint32_t x1, uint32_t y1, float *linear) {
+  uint32_t width = (uint32_t)params.width;
+  for (uint32_t y = y0; y < y1; y += kPacketH) {
+    for (uint32_t x = x0; x < x1; x += kPacketW) {
+      float fx[kLanes], fy[kLanes];
+      for (int l = 0; l < kLanes; l++) {
+        fx[l] = (float)(x + l % kPacketW) + 0.5f;
+        fy[l] = (float)(y + l / kPacketW) + 0.5f;
+      }
+
+      V3 origin = v3(params.cameraOrigin);
+      V3 dir = mulT(cameraDir(params, vload(fx), vload(fy)), params.cameraRot);
+
+      V3 p;
+      F group;
+      M hit;
+      Sdf surface = march(params, p, group, origin, dir, hit);
+      V3 color = v3(Vec3f{0.0f, 0.0f, 0.0f});
+      if (anyOf(hit)) {
+        V3 norm = normal(params, p, surface.dist, group);
+        V3 L = normalize(v3(Vec3f{0.0f, 0.0f, 0.0f}) - p);
+        F sha(1.0f), occ(1.0f);
+        if (params.shadows)
+          sha = smoothstepf(0.2f, 1.0f, calcShadow(params, p, L, 4.0f));
+        if (params.occlusion)
+          occ = calcOcclusion(params, p, norm);
+        V3 lit = calcLighting(params, surface.color, p, norm, sha, occ);
+        color = select3(hit, lit, color);
+      }
+
+      float r[kLanes], g[kLanes], b[kLanes];
+      vstore(r, color.x);
+      vstore(g, color.y);
+      vstore(b, color.z);
+      for (int l = 0; l < kLanes; l++) {
+        uint32_t px = x + l % kPacketW, py = y + l / kPacketW;
+        if (px >= x1 || py >= y1)
+          continue;
+        float *out = linear + ((size_t)py * width + px) * 3;
+        out[0] = r[l];
+        out[1] = g[l];
+        out[2] = b[l];
+      }
+    }
+  }
+}
+
+#undef CPU_EPSILON
+#undef CPU_MAX_DISTANCE
+#undef CPU_MIN_DISTANCE
@@ -0,0 +1,437 @@
+#include "CpuRaymarcher.h"
+
+#include "SdfScene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_RAYMARCH_X86 1
+#include <immintrin.h>
+#else
+#define CPU_RAYMARCH_X86 0
+#endif
+
+namespace {
+
+struct Vec3f {
+  float x, y, z;
+};
+
+// GLSL mat3, stored by columns. identity lets mat3(1.0) skip the multiply.
+struct Mat3f {
+  Vec3f c[3] = {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}};
+  bool identity = true;
+
+  Mat3f() = default;
+  Mat3f(Vec3f c0, Vec3f c1, Vec3f c2) : c{c0, c1, c2}, identity(false) {}
+};
+
+Mat3f operator*(const Mat3f &a, const Mat3f &b) {
+  Vec3f columns[3];
+  for (int j = 0; j < 3; j++) {
+    const Vec3f &v = b.c[j];
+    columns[j] = {a.c[0].x * v.x + a.c[1].x * v.y + a.c[2].x * v.z,
+                  a.c[0].y * v.x + a.c[1].y * v.y + a.c[2].y * v.z,
+                  a.c[0].z * v.x + a.c[1].z * v.y + a.c[2].z * v.z};
+  }
+  return Mat3f(columns[0], columns[1], columns[2]);
+}
+
+// Same column order as rotatex/y/z in sdf_scene.glsl
+Mat3f rotatex(float theta) {
+  float c = std::cos(theta), s = std::sin(theta);
+  return Mat3f({1.0f, 0.0f, 0.0f}, {0.0f, c, -s}, {0.0f, s, c});
+}
+
+Mat3f rotatey(float theta) {
+  float c = std::cos(theta), s = std::sin(theta);
+  return Mat3f({c, 0.0f, s}, {0.0f, 1.0f, 0.0f}, {-s, 0.0f, c});
+}
+
+Mat3f rotatez(float theta) {
+  float c = std::cos(theta), s = std::sin(theta);
+  return Mat3f({c, -s, 0.0f}, {s, c, 0.0f}, {0.0f, 0.0f, 1.0f});
+}
+
+// SdfScene::Instruction with the parameters the kernel passes on unpacked
+struct CpuSceneInstruction {
+  int type = 0;
+  float k = 0.0f;
+  uint32_t mirrorAxes = 0;
+  Vec3f mirror{};
+  Vec3f position{};
+  float edge = 0.0f;
+  float params[4] = {};
+  Vec3f color{};
+  Mat3f rotation;
+};
+
+} // namespace
+
+struct CpuScene {
+  std::vector<SdfScene::Group> groups;
+  std::vector<CpuSceneInstruction> instructions;
+};
+
+namespace {
+
+float smoothstep(float e0, float e1, float x) {
+  float t = std::min(std::max((x - e0) / (e1 - e0), 0.0f), 1.0f);
+  return t * t * (3.0f - 2.0f * t);
+}
+
+// Everything the kernel needs that is uniform over a frame: the
+// specialization constants and push constants of the GPU pass, plus the
+// time-dependent positions and rotations the shader recomputes per call
+struct CpuFrameParams {
+  int state = 0;
+  float time = 0.0f;
+  float width = 0.0f, height = 0.0f;
+  int marchSteps = 0, shadowSteps = 0;
+  bool shadows = true, occlusion = true;
+  CpuRaymarcher::NormalMode normalMode = CpuRaymarcher::NormalMode::Analytic;
+
+  Vec3f cameraOrigin{};
+  Mat3f cameraRot;
+  Vec3f maskPos{};
+  Mat3f endTableRot, torsoRot, upperLegRot;
+  Mat3f eyeBagRot, eyeHoleRot, noseBridgeRot;
+  Mat3f wallRot;
+  float wallOpen = 0.0f;
+
+  // static geometry from a scene file instead of the hand-written scene
+  const CpuScene *scene = nullptr;
+};
+
+CpuFrameParams frameParams(int state, float time, float startTime,
+                           uint32_t width, uint32_t height,
+                           const CpuRaymarcher::Settings &settings) {
+  CpuFrameParams p;
+  p.state = state;
+  p.time = time;
+  p.width = (float)width;
+  p.height = (float)height;
+  p.marchSteps = settings.marchSteps;
+  p.shadowSteps = settings.shadowSteps;
+  p.shadows = settings.shadows;
+  p.occlusion = settings.occlusion;
+  p.normalMode = settings.normalMode;
+
+  // cameraOrigin() and cameraRotation()
+  p.cameraOrigin = {-2.0f, -2.0f, 0.0f};
+  if (state == 3)
+    p.cameraOrigin = {1.0f, -3.5f, 0.0f};
+  else if (state >= 4 && state < 8)
+    p.cameraOrigin = {2.0f, -3.5f, 2.0f};
+  else if (state == 9)
+    p.cameraOrigin = {0.0f, 0.0f, -2.0f};
+  else if (state == 10)
+    p.cameraOrigin = {0.0f, 0.0f,
+                      -2.0f - smoothstep(0.0f, 10.0f, time - startTime) * 10.0f};
+  else if (state >= 11)
+    p.cameraOrigin = {0.0f, 0.0f, -12.0f};
+
+  if (state <= 2)
+    p.cameraRot = rotatex(0.7f) * rotatey(0.4f);
+  else if (state >= 4 && state < 8)
+    p.cameraRot = rotatey(-1.6f);
+
+  p.maskPos = {0.0f, -3.5f + std::sin(time) * 0.1f, 2.0f};
+  p.endTableRot = rotatex(1.6f);
+  p.torsoRot = rotatez(1.6f) * rotatey(1.3f);
+  p.upperLegRot = rotatez(1.6f) * rotatey(0.5f);
+  p.eyeBagRot = rotatez(-0.3f);
+  p.eyeHoleRot = rotatez(-0.6f);
+  p.noseBridgeRot = rotatez(0.5f);
+
+  // roomTime()
+  float localtime = state == 9 ? 0.0f : time - startTime;
+  p.wallRot = rotatez(localtime / 4.0f);
+  p.wallOpen = smoothstep(0.0f, 10.0f, localtime) * 10.0f;
+  return p;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Lane types, one namespace per instruction set
+
+namespace scalar {
+using F = float;
+using M = bool;
+constexpr int kLanes = 1;
+constexpr int kPacketW = 1;
+constexpr int kPacketH = 1;
+
+inline F vmin(F a, F b) { return b < a ? b : a; }
+inline F vmax(F a, F b) { return a < b ? b : a; }
+inline F vabs(F a) { return std::fabs(a); }
+inline F vsqrt(F a) { return std::sqrt(a); }
+inline F vselect(M m, F a, F b) { return m ? a : b; }
+inline bool anyOf(M m) { return m; }
+inline bool allOf(M m) { return m; }
+inline F vload(const float *p) { return *p; }
+inline void vstore(float *p, F a) { *p = a; }
+
+#include "CpuRaymarchKernel.inl"
+} // namespace scalar
+
+#if CPU_RAYMARCH_X86
+// SSE2 is part of x86-64, so this needs no target switch
+namespace sse {
+struct F {
+  __m128 v;
+  F() = default;
+  F(__m128 x) : v(x) {}
+  F(float s) : v(_mm_set1_ps(s)) {}
+};
+struct M {
+  __m128 v;
+};
+constexpr int kLanes = 4;
+constexpr int kPacketW = 2;
+constexpr int kPacketH = 2;
+
+inline F operator+(F a, F b) { return _mm_add_ps(a.v, b.v); }
+inline F operator-(F a, F b) { return _mm_sub_ps(a.v, b.v); }
+inline F operator*(F a, F b) { return _mm_mul_ps(a.v, b.v); }
+inline F operator/(F a, F b) { return _mm_div_ps(a.v, b.v); }
+inline F operator-(F a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+inline M operator<(F a, F b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline M operator<=(F a, F b) { return {_mm_cmple_ps(a.v, b.v)}; }
+inline M operator>(F a, F b) { return {_mm_cmpgt_ps(a.v, b.v)}; }
+inline M operator>=(F a, F b) { return {_mm_cmpge_ps(a.v, b.v)}; }
+inline M operator&(M a, M b) { return {_mm_and_ps(a.v, b.v)}; }
+inline M operator|(M a, M b) { return {_mm_or_ps(a.v, b.v)}; }
+inline M operator!(M a) {
+  return {_mm_xor_ps(a.v, _mm_castsi128_ps(_mm_set1_epi32(-1)))};
+}
+
+inline F vmin(F a, F b) { return _mm_min_ps(a.v, b.v); }
+inline F vmax(F a, F b) { return _mm_max_ps(a.v, b.v); }
+inline F vabs(F a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline F vsqrt(F a) { return _mm_sqrt_ps(a.v); }
+inline F vselect(M m, F a, F b) {
+  return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v));
+}
+inline bool anyOf(M m) { return _mm_movemask_ps(m.v) != 0; }
+inline bool allOf(M m) { return _mm_movemask_ps(m.v) == 0xF; }
+inline F vload(const float *p) { return _mm_loadu_ps(p); }
+inline void vstore(float *p, F a) { _mm_storeu_ps(p, a.v); }
+
+#include "CpuRaymarchKernel.inl"
+} // namespace sse
+
+// Compiled for AVX2 regardless of -march; only called after
+// CpuRaymarcher::supported() has checked the CPU. FMA stays off so that
+// contraction cannot make this path disagree with the scalar reference.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+namespace avx2 {
+struct F {
+  __m256 v;
+  F() = default;
+  F(__m256 x) : v(x) {}
+  F(float s) : v(_mm256_set1_ps(s)) {}
+};
+struct M {
+  __m256 v;
+};
+constexpr int kLanes = 8;
+constexpr int kPacketW = 4;
+constexpr int kPacketH = 2;
+
+inline F operator+(F a, F b) { return _mm256_add_ps(a.v, b.v); }
+inline F operator-(F a, F b) { return _mm256_sub_ps(a.v, b.v); }
+inline F operator*(F a, F b) { return _mm256_mul_ps(a.v, b.v); }
+inline F operator/(F a, F b) { return _mm256_div_ps(a.v, b.v); }
+inline F operator-(F a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+inline M operator<(F a, F b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+inline M operator<=(F a, F b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+inline M operator>(F a, F b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+inline M operator>=(F a, F b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+inline M operator&(M a, M b) { return {_mm256_and_ps(a.v, b.v)}; }
+inline M operator|(M a, M b) { return {_mm256_or_ps(a.v, b.v)}; }
+inline M operator!(M a) {
+  return {_mm256_xor_ps(a.v, _mm256_castsi256_ps(_mm256_set1_epi32(-1)))};
+}
+
+inline F vmin(F a, F b) { return _mm256_min_ps(a.v, b.v); }
+inline F vmax(F a, F b) { return _mm256_max_ps(a.v, b.v); }
+inline F vabs(F a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+inline F vsqrt(F a) { return _mm256_sqrt_ps(a.v); }
+inline F vselect(M m, F a, F b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+inline bool anyOf(M m) { return _mm256_movemask_ps(m.v) != 0; }
+inline bool allOf(M m) { return _mm256_movemask_ps(m.v) == 0xFF; }
+inline F vload(const float *p) { return _mm256_loadu_ps(p); }
+inline void vstore(float *p, F a) { _mm256_storeu_ps(p, a.v); }
+
+#include "CpuRaymarchKernel.inl"
+} // namespace avx2
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif // CPU_RAYMARCH_X86
+
+void renderTile(CpuRaymarcher::Isa isa, const CpuFrameParams &params,
+                uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1,
+                float *linear) {
+  switch (isa) {
+#if CPU_RAYMARCH_X86
+  case CpuRaymarcher::Isa::Avx2:
+    avx2::renderTile(params, x0, y0, x1, y1, linear);
+    return;
+  case CpuRaymarcher::Isa::Sse:
+    sse::renderTile(params, x0, y0, x1, y1, linear);
+    return;
+#endif
+  default:
+    scalar::renderTile(params, x0, y0, x1, y1, linear);
+    return;
+  }
+}
+
+// Linear -> 8-bit sRGB, as a B8G8R8A8_SRGB attachment stores it
+uint8_t encodeSrgb(float c) {
+  if (!(c > 0.0f))
+    return 0;
+  if (c >= 1.0f)
+    return 255;
+  float s = c <= 0.0031308f ? c * 12.92f
+                            : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+  return (uint8_t)(s * 255.0f + 0.5f);
+}
+
+} // namespace
+
+CpuRaymarcher::CpuRaymarcher(size_t threadCount)
+    : pool(threadCount), isa(bestIsa()) {}
+
+CpuRaymarcher::~CpuRaymarcher() = default;
+
+void CpuRaymarcher::setScene(const SdfScene *file) {
+  if (!file || file->empty()) {
+    scene.reset();
+    return;
+  }
+  scene = std::make_unique<CpuScene>();
+  scene->groups = file->getGroups();
+  for (const SdfScene::Instruction &ins : file->getInstructions()) {
+    CpuSceneInstruction out;
+    out.type = ins.type;
+    out.k = ins.k;
+    out.mirrorAxes = ins.mirrorAxes;
+    out.mirror = {ins.mirror[0], ins.mirror[1], ins.mirror[2]};
+    out.position = {ins.position[0], ins.position[1], ins.position[2]};
+    out.edge = ins.position[3];
+    std::copy(ins.params, ins.params + 4, out.params);
+    out.color = {ins.color[0], ins.color[1], ins.color[2]};
+    const float(*r)[4] = ins.rotation;
+    bool identity = true;
+    for (int j = 0; j < 3; j++)
+      for (int i = 0; i < 3; i++)
+        identity = identity && r[j][i] == (i == j ? 1.0f : 0.0f);
+    if (!identity)
+      out.rotation = Mat3f({r[0][0], r[0][1], r[0][2]},
+                           {r[1][0], r[1][1], r[1][2]},
+                           {r[2][0], r[2][1], r[2][2]});
+    scene->instructions.push_back(out);
+  }
+}
+
+bool CpuRaymarcher::supported(Isa isa) {
+  switch (isa) {
+  case Isa::Scalar:
+    return true;
+#if CPU_RAYMARCH_X86
+  case Isa::Sse:
+    return true;
+  case Isa::Avx2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+CpuRaymarcher::Isa CpuRaymarcher::bestIsa() {
+  if (supported(Isa::Avx2))
+    return Isa::Avx2;
+  if (supported(Isa::Sse))
+    return Isa::Sse;
+  return Isa::Scalar;
+}
+
+const char *CpuRaymarcher::isaName(Isa isa) {
+  switch (isa) {
+  case Isa::Avx2:
+    return "avx2";
+  case Isa::Sse:
+    return "sse";
+  default:
+    return "scalar";
+  }
+}
+
+int CpuRaymarcher::isaLanes(Isa isa) {
+  switch (isa) {
+  case Isa::Avx2:
+    return 8;
+  case Isa::Sse:
+    return 4;
+  default:
+    return 1;
+  }
+}
+
+void CpuRaymarcher::setIsa(Isa value) {
+  if (!supported(value))
+    throw std::runtime_error(std::string("CpuRaymarcher: ") +
+                             isaName(value) + " is not supported here");
+  isa = value;
+}
+
+void CpuRaymarcher::render(int state, float time, float startTime,
+                           uint32_t width, uint32_t height,
+                           std::vector<uint8_t> &rgb) {
+  auto start = std::chrono::steady_clock::now();
+
+  CpuFrameParams params =
+      frameParams(state, time, startTime, width, height, settings);
+  params.scene = scene.get();
+  linear.assign((size_t)width * height * 3, 0.0f);
+  rgb.resize((size_t)width * height * 3);
+
+  // Each job shades and encodes one tile; tiles never share pixels
+  std::vector<std::future<void>> jobs;
+  for (uint32_t y0 = 0; y0 < height; y0 += kTileSize) {
+    for (uint32_t x0 = 0; x0 < width; x0 += kTileSize) {
+      uint32_t x1 = std::min(x0 + kTileSize, width);
+      uint32_t y1 = std::min(y0 + kTileSize, height);
+      jobs.push_back(pool.submit([this, &params, &rgb, width, x0, y0, x1, y1] {
+        renderTile(isa, params, x0, y0, x1, y1, linear.data());
+        for (uint32_t y = y0; y < y1; y++) {
+          size_t row = ((size_t)y * width + x0) * 3;
+          for (size_t i = row; i < row + (x1 - x0) * 3; i++)
+            rgb[i] = encodeSrgb(linear[i]);
+        }
+      }));
+    }
+  }
+  for (auto &job : jobs)
+    job.get();
+
+  lastStats.rays = (uint64_t)width * height;
+  lastStats.ms = std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ThreadPool.h"
+
+class SdfScene;
+struct CpuScene;
+
+// CPU reference renderer: a port of the raymarch pass (map(), march(),
+// normal(), calcShadow(), calcOcclusion(), calcLighting()) that renders a
+// scene state without a GPU. Useful to check the shader against a ground
+// truth and to benchmark the scene itself in rays per second.
+//
+// Rays are traced in packets, one pixel block per SIMD register: 8 lanes
+// with AVX2, 4 with SSE2, 1 in the scalar fallback. The image is split into
+// 32x32 tiles shaded on a thread pool.
+//
+// Normals use the same estimators as the GPU, including the hit group's
+// tetrahedral differences and closed-form gradients. The static bedroom is
+// always evaluated analytically, and shadow history, the cone pre-pass and
+// the text overlay are not reproduced: the output is what the raymarch pass
+// computes from scratch for one frame.
+class CpuRaymarcher {
+public:
+  enum class Isa { Scalar, Sse, Avx2 };
+
+  // NORMAL_MODE of shader.frag, in the same order
+  enum class NormalMode { Forward, Tetra, Group, Analytic };
+
+  struct Settings {
+    int marchSteps = 500;
+    int shadowSteps = 500;
+    bool shadows = true;
+    bool occlusion = true;
+    NormalMode normalMode = NormalMode::Analytic;
+  };
+
+  struct Stats {
+    uint64_t rays = 0; // primary rays (pixels)
+    double ms = 0.0;
+    double raysPerSecond() const {
+      return ms > 0.0 ? (double)rays * 1000.0 / ms : 0.0;
+    }
+  };
+
+  // 0 = one worker per hardware thread
+  explicit CpuRaymarcher(size_t threadCount = 0);
+  ~CpuRaymarcher();
+
+  // Widest instruction set this CPU supports
+  static Isa bestIsa();
+  static bool supported(Isa isa);
+  static const char *isaName(Isa isa);
+  static int isaLanes(Isa isa);
+
+  // Throws if the CPU lacks `isa`
+  void setIsa(Isa isa);
+  Isa getIsa() const { return isa; }
+  size_t threadCount() const { return pool.size(); }
+
+  void setSettings(const Settings &value) { settings = value; }
+
+  // Interprets the scene file's groups in place of the hand-written static
+  // geometry, as SCENE_SOURCE 1 does on the GPU; nullptr restores it
+  void setScene(const SdfScene *scene);
+
+  // Renders scene `state` at shader time `time` (the state began at
+  // `startTime`) into tightly packed 8-bit RGB, top row first, encoded as
+  // the swapchain's sRGB format stores it
+  void render(int state, float time, float startTime, uint32_t width,
+              uint32_t height, std::vector<uint8_t> &rgb);
+
+  const Stats &getLastStats() const { return lastStats; }
+
+private:
+  static constexpr uint32_t kTileSize = 32;
+
+  ThreadPool pool;
+  Isa isa;
+  Settings settings;
+  Stats lastStats;
+  std::vector<float> linear;
+  std::unique_ptr<CpuScene> scene;
+};
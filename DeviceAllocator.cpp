@@ -0,0 +1,328 @@
+#include "DeviceAllocator.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return alignment > 1 ? (value + alignment - 1) / alignment * alignment
+                       : value;
+}
+
+void DeviceAllocator::init(VkDevice device_, VkPhysicalDevice physicalDevice_,
+                           VkDeviceSize blockSize_) {
+  device = device_;
+  physicalDevice = physicalDevice_;
+  blockSize = blockSize_;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  pools.assign(memoryProperties.memoryTypeCount * 4, Pool{});
+  for (uint32_t type = 0; type < memoryProperties.memoryTypeCount; type++) {
+    for (int image = 0; image < 2; image++) {
+      for (int strategy = FreeList; strategy <= Linear; strategy++) {
+        Pool &pool = pools[poolIndex(type, image, (Strategy)strategy)];
+        pool.memoryType = type;
+        pool.strategy = (Strategy)strategy;
+      }
+    }
+  }
+}
+
+uint32_t DeviceAllocator::findMemoryType(
+    uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+    if ((typeFilter & (1 << i)) &&
+        (memoryProperties.memoryTypes[i].propertyFlags & properties) ==
+            properties)
+      return i;
+  throw std::runtime_error(
+      "DeviceAllocator: failed to find suitable memory type");
+}
+
+bool DeviceAllocator::isHostVisible(uint32_t memoryType) const {
+  return memoryProperties.memoryTypes[memoryType].propertyFlags &
+         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+VkDeviceMemory DeviceAllocator::allocateMemory(uint32_t memoryType,
+                                               VkDeviceSize size,
+                                               char **mapped) {
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = memoryType;
+
+  VkDeviceMemory memory;
+  if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+    throw std::runtime_error("DeviceAllocator: failed to allocate " +
+                             std::to_string(size) + " bytes");
+
+  *mapped = nullptr;
+  if (isHostVisible(memoryType)) {
+    void *data;
+    if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+      throw std::runtime_error("DeviceAllocator: failed to map memory");
+    *mapped = static_cast<char *>(data);
+  }
+  return memory;
+}
+
+bool DeviceAllocator::allocateFromBlock(Block &block, Strategy strategy,
+                                        const VkMemoryRequirements &req,
+                                        VkDeviceSize &offset) {
+  if (strategy == Linear) {
+    VkDeviceSize start = alignUp(block.head, req.alignment);
+    if (start + req.size > block.size)
+      return false;
+    offset = start;
+    block.head = start + req.size;
+    return true;
+  }
+
+  // First fit; alignment padding in front stays in the free list
+  for (size_t i = 0; i < block.freeRanges.size(); i++) {
+    Range r = block.freeRanges[i];
+    VkDeviceSize start = alignUp(r.offset, req.alignment);
+    if (start + req.size > r.offset + r.size)
+      continue;
+
+    VkDeviceSize tailOffset = start + req.size;
+    VkDeviceSize tailSize = r.offset + r.size - tailOffset;
+    block.freeRanges.erase(block.freeRanges.begin() + i);
+    if (tailSize > 0)
+      block.freeRanges.insert(block.freeRanges.begin() + i,
+                              {tailOffset, tailSize});
+    if (start > r.offset)
+      block.freeRanges.insert(block.freeRanges.begin() + i,
+                              {r.offset, start - r.offset});
+    offset = start;
+    return true;
+  }
+  return false;
+}
+
+DeviceAllocation DeviceAllocator::allocate(const VkMemoryRequirements &req,
+                                           VkMemoryPropertyFlags properties,
+                                           bool image, Strategy strategy) {
+  uint32_t memoryType = findMemoryType(req.memoryTypeBits, properties);
+  DeviceAllocation allocation;
+  allocation.size = req.size;
+
+  // Keep blocks within a reasonable share of small heaps
+  VkDeviceSize heapSize =
+      memoryProperties
+          .memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex]
+          .size;
+  VkDeviceSize typeBlockSize = std::min(blockSize, heapSize / 8);
+
+  if (req.size > typeBlockSize / 2) {
+    char *mapped;
+    allocation.memory = allocateMemory(memoryType, req.size, &mapped);
+    allocation.mapped = mapped;
+    allocation.block = -1;
+    dedicatedCount++;
+    dedicatedBytes += req.size;
+    return allocation;
+  }
+
+  allocation.pool = poolIndex(memoryType, image, strategy);
+  Pool &pool = pools[allocation.pool];
+
+  VkDeviceSize offset = 0;
+  int32_t blockIndex = -1;
+  for (size_t i = 0; i < pool.blocks.size(); i++) {
+    if (pool.blocks[i].memory != VK_NULL_HANDLE &&
+        allocateFromBlock(pool.blocks[i], strategy, req, offset)) {
+      blockIndex = (int32_t)i;
+      break;
+    }
+  }
+
+  if (blockIndex < 0) {
+    Block block;
+    block.size = typeBlockSize;
+    block.memory = allocateMemory(memoryType, block.size, &block.mapped);
+    block.freeRanges.push_back({0, block.size});
+
+    // Reuse a slot released by an earlier empty block
+    auto slot = std::find_if(pool.blocks.begin(), pool.blocks.end(),
+                             [](const Block &b) {
+                               return b.memory == VK_NULL_HANDLE;
+                             });
+    if (slot == pool.blocks.end())
+      slot = pool.blocks.insert(pool.blocks.end(), Block{});
+    *slot = std::move(block);
+    blockIndex = (int32_t)(slot - pool.blocks.begin());
+    allocateFromBlock(*slot, strategy, req, offset);
+  }
+
+  Block &block = pool.blocks[blockIndex];
+  block.liveAllocations++;
+  block.usedBytes += req.size;
+
+  allocation.memory = block.memory;
+  allocation.offset = offset;
+  allocation.block = blockIndex;
+  allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+  return allocation;
+}
+
+void DeviceAllocator::free(DeviceAllocation &allocation) {
+  if (allocation.memory == VK_NULL_HANDLE)
+    return;
+
+  if (allocation.block < 0) {
+    vkFreeMemory(device, allocation.memory, nullptr);
+    dedicatedCount--;
+    dedicatedBytes -= allocation.size;
+    allocation = DeviceAllocation{};
+    return;
+  }
+
+  Pool &pool = pools[allocation.pool];
+  Block &block = pool.blocks[allocation.block];
+  block.liveAllocations--;
+  block.usedBytes -= allocation.size;
+
+  if (pool.strategy == Linear) {
+    // Linear blocks rewind once everything in them has been released
+    if (block.liveAllocations == 0)
+      block.head = 0;
+  } else {
+    Range freed{allocation.offset, allocation.size};
+    auto it = std::lower_bound(
+        block.freeRanges.begin(), block.freeRanges.end(), freed,
+        [](const Range &a, const Range &b) { return a.offset < b.offset; });
+    it = block.freeRanges.insert(it, freed);
+
+    // Merge with the following and preceding ranges
+    if (it + 1 != block.freeRanges.end() &&
+        it->offset + it->size == (it + 1)->offset) {
+      it->size += (it + 1)->size;
+      block.freeRanges.erase(it + 1);
+    }
+    if (it != block.freeRanges.begin() &&
+        (it - 1)->offset + (it - 1)->size == it->offset) {
+      (it - 1)->size += it->size;
+      block.freeRanges.erase(it);
+    }
+  }
+
+  // Give empty blocks back to the driver, but keep one per pool around so
+  // create/destroy cycles do not hit vkAllocateMemory every time
+  if (block.liveAllocations == 0) {
+    size_t liveBlocks = std::count_if(
+        pool.blocks.begin(), pool.blocks.end(),
+        [](const Block &b) { return b.memory != VK_NULL_HANDLE; });
+    if (liveBlocks > 1) {
+      vkFreeMemory(device, block.memory, nullptr);
+      block = Block{};
+    }
+  }
+
+  allocation = DeviceAllocation{};
+}
+
+void DeviceAllocator::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                                   VkMemoryPropertyFlags properties,
+                                   VkBuffer &buffer,
+                                   DeviceAllocation &allocation,
+                                   Strategy strategy) {
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+    throw std::runtime_error("DeviceAllocator: failed to create buffer");
+
+  VkMemoryRequirements memReq;
+  vkGetBufferMemoryRequirements(device, buffer, &memReq);
+  allocation = allocate(memReq, properties, false, strategy);
+  vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+}
+
+void DeviceAllocator::destroyBuffer(VkBuffer &buffer,
+                                    DeviceAllocation &allocation) {
+  if (buffer != VK_NULL_HANDLE)
+    vkDestroyBuffer(device, buffer, nullptr);
+  buffer = VK_NULL_HANDLE;
+  free(allocation);
+}
+
+void DeviceAllocator::createImage(const VkImageCreateInfo &info,
+                                  VkMemoryPropertyFlags properties,
+                                  VkImage &image,
+                                  DeviceAllocation &allocation) {
+  if (vkCreateImage(device, &info, nullptr, &image) != VK_SUCCESS)
+    throw std::runtime_error("DeviceAllocator: failed to create image");
+
+  VkMemoryRequirements memReq;
+  vkGetImageMemoryRequirements(device, image, &memReq);
+  // Linear-tiling images may share blocks with buffers
+  bool optimal = info.tiling == VK_IMAGE_TILING_OPTIMAL;
+  allocation = allocate(memReq, properties, optimal);
+  vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+}
+
+void DeviceAllocator::destroyImage(VkImage &image,
+                                   DeviceAllocation &allocation) {
+  if (image != VK_NULL_HANDLE)
+    vkDestroyImage(device, image, nullptr);
+  image = VK_NULL_HANDLE;
+  free(allocation);
+}
+
+DeviceAllocator::Stats DeviceAllocator::getStats() const {
+  Stats stats;
+  stats.reservedBytes = dedicatedBytes;
+  stats.usedBytes = dedicatedBytes;
+  stats.deviceMemoryCount = dedicatedCount;
+  stats.allocationCount = dedicatedCount;
+  stats.dedicatedCount = dedicatedCount;
+
+  VkDeviceSize totalFree = 0;
+  VkDeviceSize largestFree = 0;
+  for (const Pool &pool : pools) {
+    for (const Block &block : pool.blocks) {
+      if (block.memory == VK_NULL_HANDLE)
+        continue;
+      stats.reservedBytes += block.size;
+      stats.usedBytes += block.usedBytes;
+      stats.deviceMemoryCount++;
+      stats.allocationCount += block.liveAllocations;
+      if (pool.strategy == FreeList) {
+        for (const Range &r : block.freeRanges) {
+          totalFree += r.size;
+          largestFree = std::max(largestFree, r.size);
+        }
+      }
+    }
+  }
+  if (totalFree > 0)
+    stats.fragmentation = 1.0f - (float)largestFree / (float)totalFree;
+  return stats;
+}
+
+void DeviceAllocator::printStats(std::ostream &out) const {
+  Stats stats = getStats();
+  char line[192];
+  snprintf(line, sizeof(line),
+           "gpu memory: %.1f MiB used of %.1f MiB reserved, %u allocations "
+           "in %u device allocations (%u dedicated), fragmentation %.0f%%\n",
+           stats.usedBytes / (1024.0 * 1024.0),
+           stats.reservedBytes / (1024.0 * 1024.0), stats.allocationCount,
+           stats.deviceMemoryCount, stats.dedicatedCount,
+           stats.fragmentation * 100.0f);
+  out << line;
+}
+
+void DeviceAllocator::cleanup() {
+  for (Pool &pool : pools) {
+    for (Block &block : pool.blocks) {
+      if (block.memory != VK_NULL_HANDLE)
+        vkFreeMemory(device, block.memory, nullptr);
+    }
+    pool.blocks.clear();
+  }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// A sub-allocation handed out by DeviceAllocator. Bind resources at
+// (memory, offset); never vkMapMemory the memory yourself — host-visible
+// blocks are mapped once for their whole lifetime and `mapped` already
+// points at this allocation's first byte.
+struct DeviceAllocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  void *mapped = nullptr;
+
+  // Bookkeeping for free(); block < 0 means a dedicated allocation
+  uint32_t pool = 0;
+  int32_t block = -1;
+};
+
+// Block-based device memory allocator shared by every renderer. Memory is
+// requested from the driver in large blocks per memory type and carved up
+// with either a first-fit free list (long-lived resources) or a linear bump
+// pointer that rewinds once every allocation in the block is freed
+// (short-lived staging). Buffers and optimal-tiling images live in separate
+// blocks so bufferImageGranularity never has to be considered, and
+// resources larger than half a block get a dedicated allocation.
+class DeviceAllocator {
+public:
+  enum Strategy { FreeList, Linear };
+
+  struct Stats {
+    VkDeviceSize reservedBytes = 0; // total vkAllocateMemory size
+    VkDeviceSize usedBytes = 0;     // handed out to resources
+    uint32_t deviceMemoryCount = 0; // live vkAllocateMemory objects
+    uint32_t allocationCount = 0;   // live sub-allocations
+    uint32_t dedicatedCount = 0;
+    // 1 - largest free range / total free space in free-list blocks;
+    // 0 means all free space is contiguous
+    float fragmentation = 0.0f;
+  };
+
+  void init(VkDevice device, VkPhysicalDevice physicalDevice,
+            VkDeviceSize blockSize = 64ull * 1024 * 1024);
+
+  VkDevice getDevice() const { return device; }
+  VkPhysicalDevice getPhysicalDevice() const { return physicalDevice; }
+
+  // Memory properties are queried once in init()
+  uint32_t findMemoryType(uint32_t typeFilter,
+                          VkMemoryPropertyFlags properties) const;
+
+  DeviceAllocation allocate(const VkMemoryRequirements &requirements,
+                            VkMemoryPropertyFlags properties, bool image,
+                            Strategy strategy = FreeList);
+  void free(DeviceAllocation &allocation);
+
+  // Convenience wrappers: create + allocate + bind, and the reverse
+  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                    VkMemoryPropertyFlags properties, VkBuffer &buffer,
+                    DeviceAllocation &allocation,
+                    Strategy strategy = FreeList);
+  void destroyBuffer(VkBuffer &buffer, DeviceAllocation &allocation);
+
+  void createImage(const VkImageCreateInfo &info,
+                   VkMemoryPropertyFlags properties, VkImage &image,
+                   DeviceAllocation &allocation);
+  void destroyImage(VkImage &image, DeviceAllocation &allocation);
+
+  Stats getStats() const;
+  void printStats(std::ostream &out) const;
+
+  // Frees every block; all resources must already be destroyed
+  void cleanup();
+
+private:
+  struct Range {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+  };
+
+  struct Block {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    char *mapped = nullptr;
+    uint32_t liveAllocations = 0;
+    VkDeviceSize usedBytes = 0;
+    std::vector<Range> freeRanges; // FreeList: sorted by offset
+    VkDeviceSize head = 0;         // Linear: bump pointer
+  };
+
+  // One pool per (memory type, buffer/image, strategy)
+  struct Pool {
+    uint32_t memoryType = 0;
+    Strategy strategy = FreeList;
+    std::vector<Block> blocks;
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties{};
+  VkDeviceSize blockSize = 0;
+
+  std::vector<Pool> pools;
+
+  // Dedicated allocations (pool index unused)
+  uint32_t dedicatedCount = 0;
+  VkDeviceSize dedicatedBytes = 0;
+
+  uint32_t poolIndex(uint32_t memoryType, bool image, Strategy strategy) const {
+    return (memoryType * 2 + (image ? 1 : 0)) * 2 + strategy;
+  }
+  bool isHostVisible(uint32_t memoryType) const;
+  VkDeviceMemory allocateMemory(uint32_t memoryType, VkDeviceSize size,
+                                char **mapped);
+  bool allocateFromBlock(Block &block, Strategy strategy,
+                         const VkMemoryRequirements &requirements,
+                         VkDeviceSize &offset);
+};
@@ -0,0 +1,109 @@
+#include "GlyphTable.h"
+
+#include <stdexcept>
+
+GlyphTable::GlyphTable() { clear(); }
+
+void GlyphTable::clear() {
+  ascii.fill(kMissing);
+  pageIndex.clear();
+  pages.clear();
+  advance.clear();
+  bearingX.clear();
+  bearingY.clear();
+  atlasX.clear();
+  atlasY.clear();
+  atlasW.clear();
+  atlasH.clear();
+}
+
+uint16_t GlyphTable::add(uint32_t codepoint, float advance_, float bearingX_,
+                         float bearingY_, uint16_t atlasX_, uint16_t atlasY_,
+                         uint16_t atlasW_, uint16_t atlasH_) {
+  if (codepoint > kMaxCodepoint) {
+    throw std::runtime_error("GlyphTable: codepoint out of range");
+  }
+
+  uint16_t index = find(codepoint);
+  if (index == kMissing) {
+    if (size() >= kMissing) {
+      throw std::runtime_error("GlyphTable: too many glyphs");
+    }
+    index = static_cast<uint16_t>(size());
+    advance.push_back(0.0f);
+    bearingX.push_back(0.0f);
+    bearingY.push_back(0.0f);
+    atlasX.push_back(0);
+    atlasY.push_back(0);
+    atlasW.push_back(0);
+    atlasH.push_back(0);
+
+    if (codepoint < 128) {
+      ascii[codepoint] = index;
+    } else {
+      uint32_t page = codepoint >> 8;
+      if (page >= pageIndex.size()) {
+        pageIndex.resize(page + 1, kMissing);
+      }
+      if (pageIndex[page] == kMissing) {
+        pageIndex[page] = static_cast<uint16_t>(pages.size());
+        pages.emplace_back();
+        pages.back().fill(kMissing);
+      }
+      pages[pageIndex[page]][codepoint & 0xff] = index;
+    }
+  }
+
+  advance[index] = advance_;
+  bearingX[index] = bearingX_;
+  bearingY[index] = bearingY_;
+  atlasX[index] = atlasX_;
+  atlasY[index] = atlasY_;
+  atlasW[index] = atlasW_;
+  atlasH[index] = atlasH_;
+  return index;
+}
+
+uint32_t GlyphTable::decodeUtf8(const std::string &text, size_t &i) {
+  const uint32_t kReplacement = 0xfffd;
+  uint8_t lead = static_cast<uint8_t>(text[i++]);
+  if (lead < 0x80) {
+    return lead;
+  }
+
+  int extra;
+  uint32_t codepoint;
+  uint32_t minimum;
+  if ((lead & 0xe0) == 0xc0) {
+    extra = 1;
+    codepoint = lead & 0x1f;
+    minimum = 0x80;
+  } else if ((lead & 0xf0) == 0xe0) {
+    extra = 2;
+    codepoint = lead & 0x0f;
+    minimum = 0x800;
+  } else if ((lead & 0xf8) == 0xf0) {
+    extra = 3;
+    codepoint = lead & 0x07;
+    minimum = 0x10000;
+  } else {
+    return kReplacement;
+  }
+
+  size_t start = i;
+  for (int k = 0; k < extra; k++) {
+    if (i >= text.size() ||
+        (static_cast<uint8_t>(text[i]) & 0xc0) != 0x80) {
+      i = start;
+      return kReplacement;
+    }
+    codepoint = codepoint << 6 | (static_cast<uint8_t>(text[i++]) & 0x3f);
+  }
+  // overlong forms, surrogates and values past U+10FFFF
+  if (codepoint < minimum || codepoint > kMaxCodepoint ||
+      (codepoint >= 0xd800 && codepoint <= 0xdfff)) {
+    i = start;
+    return kReplacement;
+  }
+  return codepoint;
+}
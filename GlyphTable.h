@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Glyph metrics of the baked font atlas, looked up by Unicode codepoint.
+//
+// ASCII maps straight through a 128-entry array; every other codepoint goes
+// through a two-level page table (codepoint >> 8 selects a 256-entry page,
+// pages exist only where glyphs were added). Both yield a dense glyph index
+// into structure-of-arrays metrics, so the layout loop reads each field from
+// its own contiguous array.
+class GlyphTable {
+public:
+  static constexpr uint16_t kMissing = 0xffff;
+  static constexpr uint32_t kMaxCodepoint = 0x10ffff;
+
+  GlyphTable();
+
+  void clear();
+
+  // Returns the new glyph's index; adding a codepoint twice replaces it
+  uint16_t add(uint32_t codepoint, float advance, float bearingX,
+               float bearingY, uint16_t atlasX, uint16_t atlasY,
+               uint16_t atlasW, uint16_t atlasH);
+
+  uint16_t find(uint32_t codepoint) const {
+    if (codepoint < 128) {
+      return ascii[codepoint];
+    }
+    uint32_t page = codepoint >> 8;
+    if (page >= pageIndex.size() || pageIndex[page] == kMissing) {
+      return kMissing;
+    }
+    return pages[pageIndex[page]][codepoint & 0xff];
+  }
+
+  size_t size() const { return advance.size(); }
+
+  // Per glyph index; advance and bearings in pixels at the baked size,
+  // atlas rectangles in texels
+  std::vector<float> advance;
+  std::vector<float> bearingX;
+  std::vector<float> bearingY;
+  std::vector<uint16_t> atlasX;
+  std::vector<uint16_t> atlasY;
+  std::vector<uint16_t> atlasW;
+  std::vector<uint16_t> atlasH;
+
+  // Decodes the UTF-8 sequence at text[i] and moves i past it; malformed or
+  // truncated sequences decode to U+FFFD one byte at a time
+  static uint32_t decodeUtf8(const std::string &text, size_t &i);
+
+private:
+  std::array<uint16_t, 128> ascii;
+  std::vector<uint16_t> pageIndex; // per codepoint >> 8, into pages
+  std::vector<std::array<uint16_t, 256>> pages;
+};
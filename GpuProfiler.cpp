@@ -0,0 +1,202 @@
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+static const char *const scopeNames[GpuProfiler::ScopeCount] = {
+    "frame", "raymarch", "upscale", "flash", "text"};
+
+const char *GpuProfiler::scopeName(Scope scope) { return scopeNames[scope]; }
+
+void GpuProfiler::init(VkDevice device_, VkPhysicalDevice physicalDevice,
+                       uint32_t queueFamily, uint32_t framesInFlight_,
+                       size_t windowSize_) {
+  device = device_;
+  framesInFlight = framesInFlight_;
+  windowSize = windowSize_;
+
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(physicalDevice, &props);
+
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           families.data());
+
+  uint32_t validBits =
+      queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+  if (validBits == 0 || props.limits.timestampPeriod == 0.0f) {
+    // Leave queryPool null; every other call becomes a no-op
+    return;
+  }
+  timestampPeriod = props.limits.timestampPeriod;
+  timestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+
+  VkQueryPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  poolInfo.queryCount = framesInFlight * ScopeCount * 2;
+  if (vkCreateQueryPool(device, &poolInfo, nullptr, &queryPool) != VK_SUCCESS)
+    throw std::runtime_error("GpuProfiler: failed to create query pool");
+
+  slots.assign(framesInFlight, FrameSlot{});
+  for (int s = 0; s < ScopeCount; s++) {
+    window[s].clear();
+    window[s].reserve(windowSize);
+    windowHead[s] = 0;
+  }
+  records.reserve(4096);
+}
+
+void GpuProfiler::collect(uint32_t frameIndex) {
+  if (!isEnabled() || !slots[frameIndex].pending)
+    return;
+  FrameSlot &slot = slots[frameIndex];
+  slot.pending = false;
+
+  FrameRecord record;
+  record.frameNumber = slot.frameNumber;
+  record.state = slot.state;
+
+  for (int s = 0; s < ScopeCount; s++) {
+    record.ms[s] = -1.0f;
+    latestMs[s] = 0.0f;
+    if (!(slot.writtenMask & (1u << s)))
+      continue;
+
+    // {begin, beginAvailable, end, endAvailable}
+    uint64_t data[4] = {};
+    VkResult result = vkGetQueryPoolResults(
+        device, queryPool, queryIndex(frameIndex, (Scope)s, false), 2,
+        sizeof(data), data, sizeof(uint64_t) * 2,
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (result != VK_SUCCESS || data[1] == 0 || data[3] == 0)
+      continue;
+
+    uint64_t ticks = ((data[2] & timestampMask) - (data[0] & timestampMask)) &
+                     timestampMask;
+    float ms = (float)(ticks * (double)timestampPeriod * 1e-6);
+    record.ms[s] = ms;
+    latestMs[s] = ms;
+
+    if (window[s].size() < windowSize) {
+      window[s].push_back(ms);
+    } else {
+      window[s][windowHead[s]] = ms;
+      windowHead[s] = (windowHead[s] + 1) % windowSize;
+    }
+  }
+
+  if (records.size() < maxRecords)
+    records.push_back(record);
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer,
+                             uint32_t frameIndex, int state) {
+  if (!isEnabled())
+    return;
+  currentSlot = frameIndex;
+  FrameSlot &slot = slots[frameIndex];
+  slot.pending = true;
+  slot.writtenMask = 0;
+  slot.frameNumber = frameCounter++;
+  slot.state = state;
+
+  vkCmdResetQueryPool(commandBuffer, queryPool,
+                      queryIndex(frameIndex, (Scope)0, false),
+                      ScopeCount * 2);
+  beginScope(commandBuffer, Frame);
+}
+
+void GpuProfiler::endFrame(VkCommandBuffer commandBuffer) {
+  endScope(commandBuffer, Frame);
+}
+
+void GpuProfiler::beginScope(VkCommandBuffer commandBuffer, Scope scope) {
+  if (!isEnabled())
+    return;
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      queryPool, queryIndex(currentSlot, scope, false));
+}
+
+void GpuProfiler::endScope(VkCommandBuffer commandBuffer, Scope scope) {
+  if (!isEnabled())
+    return;
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      queryPool, queryIndex(currentSlot, scope, true));
+  slots[currentSlot].writtenMask |= 1u << scope;
+}
+
+GpuProfiler::Stats GpuProfiler::getStats(Scope scope) const {
+  Stats stats;
+  const std::vector<float> &samples = window[scope];
+  if (samples.empty())
+    return stats;
+
+  std::vector<float> sorted(samples);
+  std::sort(sorted.begin(), sorted.end());
+  double sum = 0.0;
+  for (float v : sorted)
+    sum += v;
+
+  stats.samples = sorted.size();
+  stats.minMs = sorted.front();
+  stats.avgMs = (float)(sum / sorted.size());
+  stats.p99Ms = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+  return stats;
+}
+
+float GpuProfiler::getLatestMs(Scope scope) const { return latestMs[scope]; }
+
+std::vector<std::string> GpuProfiler::formatOverlay() const {
+  std::vector<std::string> lines;
+  if (!isEnabled()) {
+    lines.push_back("gpu timestamps unavailable");
+    return lines;
+  }
+  lines.push_back("gpu ms      min    avg    p99");
+  for (int s = 0; s < ScopeCount; s++) {
+    Stats stats = getStats((Scope)s);
+    if (stats.samples == 0)
+      continue;
+    char line[96];
+    snprintf(line, sizeof(line), "%-9s %6.2f %6.2f %6.2f", scopeNames[s],
+             stats.minMs, stats.avgMs, stats.p99Ms);
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+bool GpuProfiler::writeCSV(const std::string &path) const {
+  std::ofstream file(path);
+  if (!file.is_open())
+    return false;
+
+  file << "frame,state";
+  for (int s = 0; s < ScopeCount; s++)
+    file << "," << scopeNames[s] << "_ms";
+  file << "\n";
+
+  for (const FrameRecord &record : records) {
+    file << record.frameNumber << "," << record.state;
+    for (int s = 0; s < ScopeCount; s++) {
+      file << ",";
+      if (record.ms[s] >= 0.0f)
+        file << record.ms[s];
+    }
+    file << "\n";
+  }
+  return file.good();
+}
+
+void GpuProfiler::cleanup() {
+  if (queryPool != VK_NULL_HANDLE)
+    vkDestroyQueryPool(device, queryPool, nullptr);
+  queryPool = VK_NULL_HANDLE;
+  slots.clear();
+  records.clear();
+}
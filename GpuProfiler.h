@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Timestamp-query profiler for the passes recorded in recordCommandBuffer().
+// Every frame in flight owns its own range of queries, so results are read
+// back without stalling once that frame's fence has been waited on, i.e.
+// MAX_FRAMES_IN_FLIGHT frames after they were recorded.
+class GpuProfiler {
+public:
+  enum Scope { Frame, Raymarch, Upscale, Flash, Text, ScopeCount };
+
+  struct Stats {
+    float minMs = 0.0f;
+    float avgMs = 0.0f;
+    float p99Ms = 0.0f;
+    size_t samples = 0;
+  };
+
+  // queueFamily is the family the profiled command buffers are submitted to;
+  // the profiler disables itself if that family has no timestamp support
+  void init(VkDevice device, VkPhysicalDevice physicalDevice,
+            uint32_t queueFamily, uint32_t framesInFlight,
+            size_t windowSize = 240);
+
+  // Call right after the fence for frameIndex has been waited on and before
+  // the command buffer is re-recorded. Never blocks.
+  void collect(uint32_t frameIndex);
+
+  // Call outside a render pass, before any scope. Resets this frame's queries
+  // and opens the Frame scope. `state` tags the samples in the CSV dump.
+  void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex,
+                  int state);
+  void endFrame(VkCommandBuffer commandBuffer);
+
+  void beginScope(VkCommandBuffer commandBuffer, Scope scope);
+  void endScope(VkCommandBuffer commandBuffer, Scope scope);
+
+  // Rolling min/avg/p99 over the last windowSize samples of a scope
+  Stats getStats(Scope scope) const;
+  // Sample of a scope from the last collected frame in milliseconds, or 0 if
+  // that frame did not record the scope
+  float getLatestMs(Scope scope) const;
+
+  // One "name  min avg p99" line per scope that has samples
+  std::vector<std::string> formatOverlay() const;
+
+  // Per-frame samples: frame,state,<scope>_ms...
+  bool writeCSV(const std::string &path) const;
+
+  static const char *scopeName(Scope scope);
+
+  bool isEnabled() const { return queryPool != VK_NULL_HANDLE; }
+
+  void cleanup();
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  VkQueryPool queryPool = VK_NULL_HANDLE;
+  uint32_t framesInFlight = 0;
+  float timestampPeriod = 1.0f; // nanoseconds per tick
+  uint64_t timestampMask = ~0ull;
+
+  // State of each frame-in-flight's query range
+  struct FrameSlot {
+    bool pending = false;    // recorded and not yet collected
+    uint32_t writtenMask = 0; // scopes that wrote both timestamps
+    uint64_t frameNumber = 0;
+    int state = 0;
+  };
+  std::vector<FrameSlot> slots;
+  uint32_t currentSlot = 0;
+  uint64_t frameCounter = 0;
+
+  // Rolling sample window per scope
+  size_t windowSize = 0;
+  std::vector<float> window[ScopeCount];
+  size_t windowHead[ScopeCount] = {};
+  float latestMs[ScopeCount] = {};
+
+  // Full per-frame log for the CSV dump; negative means "scope not recorded"
+  struct FrameRecord {
+    uint64_t frameNumber;
+    int state;
+    float ms[ScopeCount];
+  };
+  std::vector<FrameRecord> records;
+  static constexpr size_t maxRecords = 1 << 16;
+
+  uint32_t queryIndex(uint32_t slot, Scope scope, bool end) const {
+    return (slot * ScopeCount + scope) * 2 + (end ? 1 : 0);
+  }
+};
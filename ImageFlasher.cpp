@@ -3,11 +3,25 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
 
+// Streaming: at most this many decoded frames are uploaded per recorded
+// frame. At 0.1 s per image and 60 fps a new image is needed every 6 frames,
+// so 2 lets a fresh window fill quickly without a big per-frame stall.
+static const uint32_t kUploadsPerFrame = 2;
+
+// Matches the push constant block in image_flash.frag
+struct FlashPushConstants {
+  int32_t layerA;
+  int32_t layerB;
+  float blend;
+};
+
 // ---------------------------------------------------------------------------
 // Inline SPIR-V
 // Compile your own with:
@@ -33,34 +47,99 @@ static std::vector<char> readSPV(const std::string &path) {
 // Public API
 // ---------------------------------------------------------------------------
 
-void ImageFlasher::init(VkDevice device_, VkPhysicalDevice physicalDevice_,
-                        VkCommandPool commandPool_, VkQueue graphicsQueue_,
-                        VkRenderPass renderPass, VkExtent2D swapChainExtent,
+void ImageFlasher::init(VkDevice device_, DeviceAllocator &allocator_,
+                        UploadContext &uploads_, VkRenderPass renderPass,
+                        VkExtent2D swapChainExtent,
                         const std::vector<std::string> &imagePaths) {
   device = device_;
-  physicalDevice = physicalDevice_;
-  commandPool = commandPool_;
-  graphicsQueue = graphicsQueue_;
-
-  images.resize(imagePaths.size());
-  for (size_t i = 0; i < imagePaths.size(); i++)
-    loadImage(imagePaths[i], images[i]);
+  allocator = &allocator_;
+  uploads = &uploads_;
+
+  imageCount = (uint32_t)imagePaths.size();
+  createSampler();
+  if (streaming) {
+    sequence = imagePaths;
+    initStreaming();
+  } else {
+    loadImages(imagePaths);
+  }
 
   createDescriptorSetLayout();
-  createDescriptorPool((int)images.size());
+  createDescriptorPool(streaming || packed ? 1 : (int)images.size());
   allocateDescriptorSets();
   createPipeline(renderPass, swapChainExtent);
 }
 
-void ImageFlasher::draw(VkCommandBuffer commandBuffer, int flashIndex) {
-  if (images.empty())
-    return;
-  flashIndex = flashIndex % (int)images.size();
+void ImageFlasher::enableStreaming(uint32_t slotCount,
+                                   uint32_t framesInFlight_,
+                                   bool blockOnMiss_) {
+  streaming = true;
+  framesInFlight = std::max(1u, framesInFlight_);
+  blockOnMiss = blockOnMiss_;
+  // the shown frame plus one per frame in flight are never evictable
+  slots.resize(std::max(slotCount, framesInFlight + 2));
+}
+
+void ImageFlasher::draw(VkCommandBuffer commandBuffer, int flashIndex,
+                        float blend) {
+  VkDescriptorSet set = VK_NULL_HANDLE;
+  FlashPushConstants pc{0, 0, 0.0f};
+  if (streaming) {
+    if (sequence.empty())
+      return;
+    int count = (int)sequence.size();
+    int current = flashIndex % count;
+
+    // Show the requested frame, or on a miss the closest one before it
+    int best = -1;
+    int bestDistance = count;
+    for (size_t i = 0; i < slots.size(); i++) {
+      if (slots[i].frame < 0)
+        continue;
+      int distance = (current - slots[i].frame + count) % count;
+      if (distance < bestDistance) {
+        bestDistance = distance;
+        best = (int)i;
+      }
+    }
+    if (current != lastShown) {
+      if (bestDistance == 0)
+        streamStats.hits++;
+      else
+        streamStats.misses++;
+      lastShown = current;
+    }
+    if (best < 0)
+      return;
+    slots[best].lastUsed = frameNumber;
+    pc.layerA = pc.layerB = best;
+
+    // Fade only into the true next frame, and only when it is resident
+    int next = bestDistance == 0 ? findSlot((current + 1) % count) : -1;
+    if (next >= 0 && blend > 0.0f) {
+      slots[next].lastUsed = frameNumber;
+      pc.layerB = next;
+      pc.blend = blend;
+    }
+    set = arraySet;
+  } else if (packed) {
+    if (imageCount == 0)
+      return;
+    pc.layerA = flashIndex % (int)imageCount;
+    pc.layerB = (flashIndex + 1) % (int)imageCount;
+    pc.blend = blend;
+    set = arraySet;
+  } else {
+    if (images.empty())
+      return;
+    set = images[flashIndex % (int)images.size()].descriptorSet;
+  }
 
   vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
   vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          pipelineLayout, 0, 1,
-                          &images[flashIndex].descriptorSet, 0, nullptr);
+                          pipelineLayout, 0, 1, &set, 0, nullptr);
+  vkCmdPushConstants(commandBuffer, pipelineLayout,
+                     VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pc), &pc);
   // Fullscreen triangle — no vertex buffer needed
   vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 }
@@ -78,47 +157,134 @@ void ImageFlasher::cleanup() {
   vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
   for (auto &img : images) {
-    vkDestroySampler(device, img.sampler, nullptr);
     vkDestroyImageView(device, img.view, nullptr);
-    vkDestroyImage(device, img.image, nullptr);
-    vkFreeMemory(device, img.memory, nullptr);
+    allocator->destroyImage(img.image, img.memory);
   }
   images.clear();
+
+  if (streaming)
+    cleanupStreaming();
+  if (arrayView != VK_NULL_HANDLE)
+    vkDestroyImageView(device, arrayView, nullptr);
+  arrayView = VK_NULL_HANDLE;
+  allocator->destroyImage(arrayImage, arrayMemory);
+  if (sampler != VK_NULL_HANDLE)
+    vkDestroySampler(device, sampler, nullptr);
+  sampler = VK_NULL_HANDLE;
 }
 
 // ---------------------------------------------------------------------------
 // Image loading
 // ---------------------------------------------------------------------------
 
-void ImageFlasher::loadImage(const std::string &path, ImageData &out) {
-  int w, h, channels;
-  stbi_uc *pixels = stbi_load(path.c_str(), &w, &h, &channels, STBI_rgb_alpha);
-  if (!pixels)
-    throw std::runtime_error("ImageFlasher: failed to load image: " + path);
-
-  VkDeviceSize imageSize = w * h * 4;
-
-  // Staging buffer
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingMemory;
-  createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               stagingBuffer, stagingMemory);
-
-  void *data;
-  vkMapMemory(device, stagingMemory, 0, imageSize, 0, &data);
-  memcpy(data, pixels, (size_t)imageSize);
-  vkUnmapMemory(device, stagingMemory);
-  stbi_image_free(pixels);
-
-  // Create VkImage
+static std::runtime_error loadError(const std::string &path) {
+  return std::runtime_error("ImageFlasher: failed to load image: " + path +
+                            " (" + stbi_failure_reason() + ")");
+}
+
+// Decodes every image on a worker pool. Headers are read first so each
+// image's VkImage and its range of the upload ring exist before the pixels
+// do; workers then decode and copy straight into that mapped range, and
+// the main thread only queues GPU copies as decodes complete.
+//
+// stb_image always returns its own heap buffer, so one copy per image
+// remains, but it now happens on the decoding thread into staging memory
+// rather than through a second staging buffer on the main thread.
+void ImageFlasher::loadImages(const std::vector<std::string> &paths) {
+  ThreadPool pool;
+
+  std::vector<std::future<VkExtent3D>> headers;
+  headers.reserve(paths.size());
+  for (const std::string &path : paths) {
+    headers.push_back(pool.submit([&path] {
+      int w, h, channels;
+      if (!stbi_info(path.c_str(), &w, &h, &channels))
+        throw loadError(path);
+      return VkExtent3D{(uint32_t)w, (uint32_t)h, 1};
+    }));
+  }
+  std::vector<VkExtent3D> extents(paths.size());
+  for (size_t i = 0; i < paths.size(); i++)
+    extents[i] = headers[i].get();
+
+  // Same-sized images become layers of one array texture
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(allocator->getPhysicalDevice(), &props);
+  packed = !paths.empty() && paths.size() <= props.limits.maxImageArrayLayers;
+  for (const VkExtent3D &extent : extents)
+    packed = packed && extent.width == extents[0].width &&
+             extent.height == extents[0].height;
+
+  if (packed) {
+    createTexture(extents[0], (uint32_t)paths.size(), arrayImage, arrayMemory,
+                  arrayView);
+  } else {
+    images.resize(paths.size());
+    for (size_t i = 0; i < paths.size(); i++)
+      createTexture(extents[i], 1, images[i].image, images[i].memory,
+                    images[i].view);
+  }
+
+  // Batches never outgrow the ring, so a flush triggered by stage() can
+  // only recycle ranges whose decodes have already finished
+  struct Decode {
+    size_t index;
+    VkDeviceSize offset;
+    std::future<void> done;
+  };
+  size_t next = 0;
+  while (next < paths.size()) {
+    std::vector<Decode> batch;
+    while (next < paths.size()) {
+      VkDeviceSize size =
+          (VkDeviceSize)extents[next].width * extents[next].height * 4;
+      if (!batch.empty() && !uploads->fits(size))
+        break;
+
+      Decode decode;
+      decode.index = next;
+      void *dst = uploads->stage(size, decode.offset);
+      const std::string &path = paths[next];
+      decode.done = pool.submit([&path, dst, size] {
+        int w, h, channels;
+        stbi_uc *pixels =
+            stbi_load(path.c_str(), &w, &h, &channels, STBI_rgb_alpha);
+        if (!pixels)
+          throw loadError(path);
+        if ((VkDeviceSize)w * h * 4 != size) {
+          stbi_image_free(pixels);
+          throw std::runtime_error("ImageFlasher: image changed while "
+                                   "loading: " +
+                                   path);
+        }
+        memcpy(dst, pixels, (size_t)size);
+        stbi_image_free(pixels);
+      });
+      batch.push_back(std::move(decode));
+      next++;
+    }
+
+    for (Decode &decode : batch) {
+      decode.done.get();
+      if (packed)
+        uploads->copyToImage(arrayImage, extents[decode.index], decode.offset,
+                             (uint32_t)decode.index);
+      else
+        uploads->copyToImage(images[decode.index].image,
+                             extents[decode.index], decode.offset);
+    }
+  }
+}
+
+void ImageFlasher::createTexture(VkExtent3D extent, uint32_t layers,
+                                 VkImage &image, DeviceAllocation &memory,
+                                 VkImageView &view) {
   VkImageCreateInfo imageInfo{};
   imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
   imageInfo.imageType = VK_IMAGE_TYPE_2D;
-  imageInfo.extent = {(uint32_t)w, (uint32_t)h, 1};
+  imageInfo.extent = extent;
   imageInfo.mipLevels = 1;
-  imageInfo.arrayLayers = 1;
+  imageInfo.arrayLayers = layers;
   imageInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
   imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
   imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -127,44 +293,24 @@ void ImageFlasher::loadImage(const std::string &path, ImageData &out) {
   imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
   imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 
-  if (vkCreateImage(device, &imageInfo, nullptr, &out.image) != VK_SUCCESS)
-    throw std::runtime_error("ImageFlasher: failed to create image");
-
-  VkMemoryRequirements memReq;
-  vkGetImageMemoryRequirements(device, out.image, &memReq);
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memReq.size;
-  allocInfo.memoryTypeIndex = findMemoryType(
-      memReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-  if (vkAllocateMemory(device, &allocInfo, nullptr, &out.memory) != VK_SUCCESS)
-    throw std::runtime_error("ImageFlasher: failed to allocate image memory");
-  vkBindImageMemory(device, out.image, out.memory, 0);
-
-  transitionImageLayout(out.image, VK_IMAGE_LAYOUT_UNDEFINED,
-                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-  copyBufferToImage(stagingBuffer, out.image, (uint32_t)w, (uint32_t)h);
-  transitionImageLayout(out.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-  vkDestroyBuffer(device, stagingBuffer, nullptr);
-  vkFreeMemory(device, stagingMemory, nullptr);
-
-  // Image view
+  allocator->createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                         image, memory);
+
   VkImageViewCreateInfo viewInfo{};
   viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-  viewInfo.image = out.image;
-  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
   viewInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
   viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
   viewInfo.subresourceRange.baseMipLevel = 0;
   viewInfo.subresourceRange.levelCount = 1;
   viewInfo.subresourceRange.baseArrayLayer = 0;
-  viewInfo.subresourceRange.layerCount = 1;
-  if (vkCreateImageView(device, &viewInfo, nullptr, &out.view) != VK_SUCCESS)
+  viewInfo.subresourceRange.layerCount = layers;
+  if (vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS)
     throw std::runtime_error("ImageFlasher: failed to create image view");
+}
 
-  // Sampler
+void ImageFlasher::createSampler() {
   VkSamplerCreateInfo samplerInfo{};
   samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
   samplerInfo.magFilter = VK_FILTER_LINEAR;
@@ -178,11 +324,205 @@ void ImageFlasher::loadImage(const std::string &path, ImageData &out) {
   samplerInfo.unnormalizedCoordinates = VK_FALSE;
   samplerInfo.compareEnable = VK_FALSE;
   samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-  if (vkCreateSampler(device, &samplerInfo, nullptr, &out.sampler) !=
-      VK_SUCCESS)
+  if (vkCreateSampler(device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
     throw std::runtime_error("ImageFlasher: failed to create sampler");
 }
 
+// ---------------------------------------------------------------------------
+// Streaming
+// ---------------------------------------------------------------------------
+
+void ImageFlasher::initStreaming() {
+  if (sequence.empty())
+    return;
+
+  int w, h, channels;
+  if (!stbi_info(sequence[0].c_str(), &w, &h, &channels))
+    throw loadError(sequence[0]);
+  streamExtent = {(uint32_t)w, (uint32_t)h, 1};
+
+  createTexture(streamExtent, (uint32_t)slots.size(), arrayImage, arrayMemory,
+                arrayView);
+
+  VkDeviceSize frameBytes = (VkDeviceSize)w * h * 4;
+  streamStaging.resize(framesInFlight, VK_NULL_HANDLE);
+  streamStagingMemory.resize(framesInFlight);
+  for (uint32_t i = 0; i < framesInFlight; i++)
+    allocator->createBuffer(frameBytes * kUploadsPerFrame,
+                            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                            streamStaging[i], streamStagingMemory[i]);
+
+  // Decoding is paced by playback, so two workers are plenty and leave the
+  // remaining cores alone
+  decoder.reset(new ThreadPool(2));
+}
+
+void ImageFlasher::cleanupStreaming() {
+  // Joins the workers; anything still decoding finishes and is dropped
+  decoding.clear();
+  decoder.reset();
+
+  for (size_t i = 0; i < streamStaging.size(); i++)
+    allocator->destroyBuffer(streamStaging[i], streamStagingMemory[i]);
+  streamStaging.clear();
+  streamStagingMemory.clear();
+
+  for (Slot &slot : slots)
+    slot = Slot{};
+}
+
+int ImageFlasher::findSlot(int frame) const {
+  for (size_t i = 0; i < slots.size(); i++)
+    if (slots[i].frame == frame)
+      return (int)i;
+  return -1;
+}
+
+// A slot may be overwritten once no in-flight frame can still sample or
+// copy into it.
+// Empty slots go first, then frames outside the upcoming window (already
+// shown), least recently drawn first.
+ImageFlasher::Slot *ImageFlasher::pickVictim(int current, int window) {
+  int count = (int)sequence.size();
+  Slot *victim = nullptr;
+  for (Slot &slot : slots) {
+    if (slot.lastUsed + framesInFlight > frameNumber && slot.lastUsed != 0)
+      continue;
+    if (slot.frame < 0)
+      return &slot;
+    int ahead = (slot.frame - current + count) % count;
+    if (ahead < window)
+      continue;
+    if (!victim || slot.lastUsed < victim->lastUsed)
+      victim = &slot;
+  }
+  return victim;
+}
+
+void ImageFlasher::update(VkCommandBuffer commandBuffer, uint32_t frameSlot,
+                          int flashIndex) {
+  if (!streaming || sequence.empty())
+    return;
+  frameNumber++;
+
+  int count = (int)sequence.size();
+  int current = flashIndex % count;
+  // Frames [current, current + window) are kept resident or in flight
+  int window = std::min(count, (int)slots.size() - (int)framesInFlight);
+
+  auto inWindow = [&](int frame) {
+    return (frame - current + count) % count < window;
+  };
+
+  // Drop decodes that fell behind playback; a packaged task's future does
+  // not block on destruction, the worker just discards the result
+  for (auto it = decoding.begin(); it != decoding.end();) {
+    if (inWindow(it->first))
+      ++it;
+    else
+      it = decoding.erase(it);
+  }
+
+  for (int k = 0; k < window; k++) {
+    int frame = (current + k) % count;
+    if (findSlot(frame) >= 0 || decoding.count(frame))
+      continue;
+    const std::string &path = sequence[frame];
+    VkExtent3D extent = streamExtent;
+    decoding[frame] = decoder->submit([&path, extent] {
+      int w, h, channels;
+      stbi_uc *pixels =
+          stbi_load(path.c_str(), &w, &h, &channels, STBI_rgb_alpha);
+      if (!pixels)
+        throw loadError(path);
+      DecodedFrame decoded;
+      decoded.pixels.reset(pixels, stbi_image_free);
+      if ((uint32_t)w != extent.width || (uint32_t)h != extent.height)
+        throw std::runtime_error("ImageFlasher: streamed image " + path +
+                                 " differs in size from the first frame");
+      return decoded;
+    });
+  }
+
+  // Upload finished decodes nearest-first into evictable slots
+  VkDeviceSize frameBytes =
+      (VkDeviceSize)streamExtent.width * streamExtent.height * 4;
+  char *staging = static_cast<char *>(streamStagingMemory[frameSlot].mapped);
+  std::vector<VkImageMemoryBarrier> toDst, toRead;
+  std::vector<std::pair<Slot *, VkDeviceSize>> copies;
+
+  for (int k = 0; k < window && copies.size() < kUploadsPerFrame; k++) {
+    int frame = (current + k) % count;
+    auto it = decoding.find(frame);
+    if (it == decoding.end())
+      continue;
+    if (it->second.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready) {
+      if (k > 0 || !blockOnMiss)
+        continue;
+      it->second.wait();
+    }
+
+    Slot *slot = pickVictim(current, window);
+    if (!slot)
+      break;
+    DecodedFrame decoded = it->second.get();
+    decoding.erase(it);
+
+    VkDeviceSize offset = frameBytes * copies.size();
+    memcpy(staging + offset, decoded.pixels.get(), (size_t)frameBytes);
+    if (slot->frame >= 0)
+      streamStats.evictions++;
+    slot->frame = frame;
+    slot->lastUsed = frameNumber;
+    streamStats.uploads++;
+    copies.push_back({slot, offset});
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = arrayImage;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1,
+                                (uint32_t)(slot - slots.data()), 1};
+    // previous contents are discarded
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toDst.push_back(barrier);
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    toRead.push_back(barrier);
+  }
+  if (copies.empty())
+    return;
+
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, (uint32_t)toDst.size(), toDst.data());
+  for (auto &copy : copies) {
+    VkBufferImageCopy region{};
+    region.bufferOffset = copy.second;
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+                               (uint32_t)(copy.first - slots.data()), 1};
+    region.imageExtent = streamExtent;
+    vkCmdCopyBufferToImage(commandBuffer, streamStaging[frameSlot],
+                           arrayImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                           &region);
+  }
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, (uint32_t)toRead.size(), toRead.data());
+}
+
 // ---------------------------------------------------------------------------
 // Descriptor layout / pool / sets
 // ---------------------------------------------------------------------------
@@ -205,48 +545,59 @@ void ImageFlasher::createDescriptorSetLayout() {
         "ImageFlasher: failed to create descriptor set layout");
 }
 
-void ImageFlasher::createDescriptorPool(int imageCount) {
+void ImageFlasher::createDescriptorPool(int setCount) {
+  // a pool with maxSets = 0 is invalid
+  setCount = std::max(setCount, 1);
   VkDescriptorPoolSize poolSize{};
   poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  poolSize.descriptorCount = (uint32_t)imageCount;
+  poolSize.descriptorCount = (uint32_t)setCount;
 
   VkDescriptorPoolCreateInfo info{};
   info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
   info.poolSizeCount = 1;
   info.pPoolSizes = &poolSize;
-  info.maxSets = (uint32_t)imageCount;
+  info.maxSets = (uint32_t)setCount;
 
   if (vkCreateDescriptorPool(device, &info, nullptr, &descriptorPool) !=
       VK_SUCCESS)
     throw std::runtime_error("ImageFlasher: failed to create descriptor pool");
 }
 
+// One set for the array texture, or one per image when they differ in size
 void ImageFlasher::allocateDescriptorSets() {
-  std::vector<VkDescriptorSetLayout> layouts(images.size(),
-                                             descriptorSetLayout);
+  bool array = streaming || packed;
+  size_t count = array ? (arrayImage != VK_NULL_HANDLE ? 1 : 0)
+                       : images.size();
+  if (count == 0)
+    return;
+  std::vector<VkDescriptorSetLayout> layouts(count, descriptorSetLayout);
 
   VkDescriptorSetAllocateInfo allocInfo{};
   allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
   allocInfo.descriptorPool = descriptorPool;
-  allocInfo.descriptorSetCount = (uint32_t)images.size();
+  allocInfo.descriptorSetCount = (uint32_t)count;
   allocInfo.pSetLayouts = layouts.data();
 
-  std::vector<VkDescriptorSet> sets(images.size());
+  std::vector<VkDescriptorSet> sets(count);
   if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS)
     throw std::runtime_error(
         "ImageFlasher: failed to allocate descriptor sets");
 
-  for (size_t i = 0; i < images.size(); i++) {
-    images[i].descriptorSet = sets[i];
-
+  for (size_t i = 0; i < count; i++) {
     VkDescriptorImageInfo imageInfo{};
     imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    imageInfo.imageView = images[i].view;
-    imageInfo.sampler = images[i].sampler;
+    imageInfo.sampler = sampler;
+    if (array) {
+      arraySet = sets[i];
+      imageInfo.imageView = arrayView;
+    } else {
+      images[i].descriptorSet = sets[i];
+      imageInfo.imageView = images[i].view;
+    }
 
     VkWriteDescriptorSet write{};
     write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write.dstSet = images[i].descriptorSet;
+    write.dstSet = sets[i];
     write.dstBinding = 0;
     write.dstArrayElement = 0;
     write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -339,10 +690,17 @@ void ImageFlasher::createPipeline(VkRenderPass renderPass, VkExtent2D extent) {
   dynamicState.dynamicStateCount = (uint32_t)dynamicStates.size();
   dynamicState.pDynamicStates = dynamicStates.data();
 
+  VkPushConstantRange pushRange{};
+  pushRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  pushRange.offset = 0;
+  pushRange.size = sizeof(FlashPushConstants);
+
   VkPipelineLayoutCreateInfo layoutInfo{};
   layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
   layoutInfo.setLayoutCount = 1;
   layoutInfo.pSetLayouts = &descriptorSetLayout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &pushRange;
 
   if (vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout) !=
       VK_SUCCESS)
@@ -363,7 +721,7 @@ void ImageFlasher::createPipeline(VkRenderPass renderPass, VkExtent2D extent) {
   pipelineInfo.renderPass = renderPass;
   pipelineInfo.subpass = 0;
 
-  if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+  if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo,
                                 nullptr, &pipeline) != VK_SUCCESS)
     throw std::runtime_error(
         "ImageFlasher: failed to create graphics pipeline");
@@ -382,129 +740,3 @@ void ImageFlasher::destroyPipeline() {
     pipelineLayout = VK_NULL_HANDLE;
   }
 }
-
-// ---------------------------------------------------------------------------
-// Helpers
-// ---------------------------------------------------------------------------
-
-uint32_t ImageFlasher::findMemoryType(uint32_t typeFilter,
-                                      VkMemoryPropertyFlags properties) {
-  VkPhysicalDeviceMemoryProperties memProps;
-  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProps);
-  for (uint32_t i = 0; i < memProps.memoryTypeCount; i++)
-    if ((typeFilter & (1 << i)) &&
-        (memProps.memoryTypes[i].propertyFlags & properties) == properties)
-      return i;
-  throw std::runtime_error("ImageFlasher: failed to find suitable memory type");
-}
-
-void ImageFlasher::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-                                VkMemoryPropertyFlags properties,
-                                VkBuffer &buffer,
-                                VkDeviceMemory &bufferMemory) {
-  VkBufferCreateInfo bufferInfo{};
-  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferInfo.size = size;
-  bufferInfo.usage = usage;
-  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
-    throw std::runtime_error("ImageFlasher: failed to create buffer");
-
-  VkMemoryRequirements memReq;
-  vkGetBufferMemoryRequirements(device, buffer, &memReq);
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memReq.size;
-  allocInfo.memoryTypeIndex = findMemoryType(memReq.memoryTypeBits, properties);
-  if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) !=
-      VK_SUCCESS)
-    throw std::runtime_error("ImageFlasher: failed to allocate buffer memory");
-  vkBindBufferMemory(device, buffer, bufferMemory, 0);
-}
-
-VkCommandBuffer ImageFlasher::beginSingleTimeCommands() {
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandPool = commandPool;
-  allocInfo.commandBufferCount = 1;
-
-  VkCommandBuffer cb;
-  vkAllocateCommandBuffers(device, &allocInfo, &cb);
-
-  VkCommandBufferBeginInfo beginInfo{};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-  vkBeginCommandBuffer(cb, &beginInfo);
-  return cb;
-}
-
-void ImageFlasher::endSingleTimeCommands(VkCommandBuffer cb) {
-  vkEndCommandBuffer(cb);
-  VkSubmitInfo submitInfo{};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &cb;
-  vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(graphicsQueue);
-  vkFreeCommandBuffers(device, commandPool, 1, &cb);
-}
-
-void ImageFlasher::transitionImageLayout(VkImage image, VkImageLayout oldLayout,
-                                         VkImageLayout newLayout) {
-  VkCommandBuffer cb = beginSingleTimeCommands();
-
-  VkImageMemoryBarrier barrier{};
-  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  barrier.oldLayout = oldLayout;
-  barrier.newLayout = newLayout;
-  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.image = image;
-  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  barrier.subresourceRange.baseMipLevel = 0;
-  barrier.subresourceRange.levelCount = 1;
-  barrier.subresourceRange.baseArrayLayer = 0;
-  barrier.subresourceRange.layerCount = 1;
-
-  VkPipelineStageFlags srcStage, dstStage;
-  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-      newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-  } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-             newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-  } else {
-    throw std::runtime_error("ImageFlasher: unsupported layout transition");
-  }
-
-  vkCmdPipelineBarrier(cb, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1,
-                       &barrier);
-  endSingleTimeCommands(cb);
-}
-
-void ImageFlasher::copyBufferToImage(VkBuffer buffer, VkImage image,
-                                     uint32_t width, uint32_t height) {
-  VkCommandBuffer cb = beginSingleTimeCommands();
-
-  VkBufferImageCopy region{};
-  region.bufferOffset = 0;
-  region.bufferRowLength = 0;
-  region.bufferImageHeight = 0;
-  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  region.imageSubresource.mipLevel = 0;
-  region.imageSubresource.baseArrayLayer = 0;
-  region.imageSubresource.layerCount = 1;
-  region.imageOffset = {0, 0, 0};
-  region.imageExtent = {width, height, 1};
-
-  vkCmdCopyBufferToImage(cb, buffer, image,
-                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-  endSingleTimeCommands(cb);
-}
@@ -1,20 +1,63 @@
 #pragma once
 
 #include <vulkan/vulkan.h>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "DeviceAllocator.h"
+#include "ThreadPool.h"
+#include "UploadContext.h"
+
 class ImageFlasher {
 public:
-    // Call once after logical device is created
-    void init(VkDevice device, VkPhysicalDevice physicalDevice,
-              VkCommandPool commandPool, VkQueue graphicsQueue,
+    // Call once after logical device is created. Pixel uploads are queued on
+    // `uploads`; flush it before the first frame samples the images.
+    void init(VkDevice device, DeviceAllocator& allocator,
+              UploadContext& uploads,
               VkRenderPass renderPass, VkExtent2D swapChainExtent,
               const std::vector<std::string>& imagePaths);
 
     // Call in recordCommandBuffer when state >= 5
     // flashIndex = which image to show (compute from localTime on CPU)
-    void draw(VkCommandBuffer commandBuffer, int flashIndex);
+    // blend = 0..1 cross-fade towards flashIndex + 1; only possible when
+    // both images live in the same array texture (packed or streaming)
+    void draw(VkCommandBuffer commandBuffer, int flashIndex,
+              float blend = 0.0f);
+
+    // Optional cache for pipeline creation; call before init()
+    void setPipelineCache(VkPipelineCache cache) { pipelineCache = cache; }
+
+    // Streaming playback for long sequences; call before init(). Only
+    // `slots` textures are resident: a background thread decodes the frames
+    // about to be shown and update() uploads them over frames already shown.
+    // Every image in a streamed sequence must have the same size.
+    // blockOnMiss makes update() wait for a late frame instead of showing
+    // the previous one (for deterministic headless output).
+    void enableStreaming(uint32_t slots, uint32_t framesInFlight,
+                         bool blockOnMiss = false);
+    bool isStreaming() const { return streaming; }
+    // Preloaded images share one 2D array texture (all the same size)
+    bool isPacked() const { return packed; }
+
+    // Streaming only; call once per recorded frame, outside any render pass,
+    // with the flashIndex the next draw() will ask for. Schedules prefetch
+    // decodes and records uploads of finished ones into commandBuffer.
+    // frameSlot selects the staging buffer and must be the frame-in-flight
+    // index whose fence was just waited on.
+    void update(VkCommandBuffer commandBuffer, uint32_t frameSlot,
+                int flashIndex);
+
+    struct StreamStats {
+        uint64_t hits = 0;      // shown frames that were already resident
+        uint64_t misses = 0;    // shown late; the previous frame stayed up
+        uint64_t uploads = 0;
+        uint64_t evictions = 0; // uploads that replaced a shown frame
+    };
+    const StreamStats& getStreamStats() const { return streamStats; }
 
     // Call on swapchain recreate
     void onSwapchainRecreate(VkRenderPass renderPass, VkExtent2D swapChainExtent);
@@ -23,40 +66,74 @@ public:
 
 private:
     VkDevice device = VK_NULL_HANDLE;
-    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-    VkCommandPool commandPool = VK_NULL_HANDLE;
-    VkQueue graphicsQueue = VK_NULL_HANDLE;
+    DeviceAllocator* allocator = nullptr;
+    UploadContext* uploads = nullptr;
 
-    // Per-image resources
+    // Per-image resources, only when the images differ in size; views are
+    // single-layer arrays so the same shader samples them
     struct ImageData {
         VkImage image;
-        VkDeviceMemory memory;
+        DeviceAllocation memory;
         VkImageView view;
-        VkSampler sampler;
         VkDescriptorSet descriptorSet;
     };
     std::vector<ImageData> images;
 
+    // One layer per image (packed) or per slot (streaming), one descriptor
+    // set; the layer is chosen with a push constant
+    bool packed = false;
+    VkImage arrayImage = VK_NULL_HANDLE;
+    DeviceAllocation arrayMemory;
+    VkImageView arrayView = VK_NULL_HANDLE;
+    VkDescriptorSet arraySet = VK_NULL_HANDLE;
+    uint32_t imageCount = 0;
+
+    // Shared by every mode
+    VkSampler sampler = VK_NULL_HANDLE;
+
+    // Streaming state (see enableStreaming); slot i is array layer i
+    struct Slot {
+        int frame = -1;        // sequence index resident in this slot
+        uint64_t lastUsed = 0; // frameNumber of the last draw() using it
+    };
+    struct DecodedFrame {
+        std::shared_ptr<unsigned char> pixels; // freed with stbi_image_free
+    };
+    bool streaming = false;
+    bool blockOnMiss = false;
+    uint32_t framesInFlight = 1;
+    std::vector<std::string> sequence;
+    VkExtent3D streamExtent{};
+    std::vector<Slot> slots;
+    // One host-visible buffer per frame in flight, kUploadsPerFrame frames
+    std::vector<VkBuffer> streamStaging;
+    std::vector<DeviceAllocation> streamStagingMemory;
+    std::unique_ptr<ThreadPool> decoder;
+    std::map<int, std::future<DecodedFrame>> decoding;
+    uint64_t frameNumber = 0;
+    int lastShown = -1;
+    StreamStats streamStats;
+
     VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
     VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
     VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
     VkPipeline pipeline = VK_NULL_HANDLE;
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
 
     // Helpers
-    void loadImage(const std::string& path, ImageData& out);
+    void loadImages(const std::vector<std::string>& paths);
+    void createTexture(VkExtent3D extent, uint32_t layers, VkImage& image,
+                       DeviceAllocation& memory, VkImageView& view);
+    void createSampler();
+    void initStreaming();
+    void cleanupStreaming();
+    int findSlot(int frame) const;
+    Slot* pickVictim(int current, int window);
     void createDescriptorSetLayout();
-    void createDescriptorPool(int imageCount);
+    void createDescriptorPool(int setCount);
     void allocateDescriptorSets();
     void createPipeline(VkRenderPass renderPass, VkExtent2D extent);
     void destroyPipeline();
 
     VkShaderModule createShaderModule(const std::vector<uint32_t>& code);
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-                      VkMemoryPropertyFlags properties,
-                      VkBuffer& buffer, VkDeviceMemory& bufferMemory);
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
-    void transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout);
-    VkCommandBuffer beginSingleTimeCommands();
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer);
 };
@@ -0,0 +1,124 @@
+#include "ImageWriter.h"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+
+bool writePPM(const std::string &path, uint32_t width, uint32_t height,
+              const std::vector<uint8_t> &rgb) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file.is_open())
+    return false;
+  file << "P6\n" << width << " " << height << "\n255\n";
+  file.write(reinterpret_cast<const char *>(rgb.data()),
+             (std::streamsize)width * height * 3);
+  return file.good();
+}
+
+// ---------------------------------------------------------------------------
+// PNG
+// ---------------------------------------------------------------------------
+
+static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc) {
+  static const std::array<uint32_t, 256> table = [] {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      t[n] = c;
+    }
+    return t;
+  }();
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++)
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+static void putU32(std::vector<uint8_t> &out, uint32_t v) {
+  out.push_back((uint8_t)(v >> 24));
+  out.push_back((uint8_t)(v >> 16));
+  out.push_back((uint8_t)(v >> 8));
+  out.push_back((uint8_t)v);
+}
+
+static void writeChunk(std::ofstream &file, const char type[4],
+                       const std::vector<uint8_t> &payload) {
+  std::vector<uint8_t> chunk;
+  chunk.reserve(payload.size() + 12);
+  putU32(chunk, (uint32_t)payload.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), payload.begin(), payload.end());
+  putU32(chunk, crc32(chunk.data() + 4, payload.size() + 4, 0));
+  file.write(reinterpret_cast<const char *>(chunk.data()),
+             (std::streamsize)chunk.size());
+}
+
+bool writePNG(const std::string &path, uint32_t width, uint32_t height,
+              const std::vector<uint8_t> &rgb) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A,
+                                       '\n'};
+  file.write(reinterpret_cast<const char *>(signature), 8);
+
+  std::vector<uint8_t> header;
+  putU32(header, width);
+  putU32(header, height);
+  header.push_back(8); // bit depth
+  header.push_back(2); // colour type: RGB
+  header.push_back(0); // deflate
+  header.push_back(0); // adaptive filtering
+  header.push_back(0); // no interlace
+  writeChunk(file, "IHDR", header);
+
+  // Raw scanlines, each prefixed with filter type 0 (none)
+  size_t rowSize = (size_t)width * 3;
+  std::vector<uint8_t> raw;
+  raw.reserve((rowSize + 1) * height);
+  for (uint32_t y = 0; y < height; y++) {
+    raw.push_back(0);
+    raw.insert(raw.end(), rgb.begin() + y * rowSize,
+               rgb.begin() + (y + 1) * rowSize);
+  }
+
+  // zlib stream made of stored deflate blocks (max 65535 bytes each)
+  std::vector<uint8_t> zlib;
+  zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+  zlib.push_back(0x78);
+  zlib.push_back(0x01);
+  size_t pos = 0;
+  do {
+    size_t len = std::min<size_t>(65535, raw.size() - pos);
+    bool last = pos + len == raw.size();
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back((uint8_t)len);
+    zlib.push_back((uint8_t)(len >> 8));
+    zlib.push_back((uint8_t)~len);
+    zlib.push_back((uint8_t)(~len >> 8));
+    zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + len);
+    pos += len;
+  } while (pos < raw.size());
+
+  uint32_t a = 1, b = 0;
+  for (uint8_t v : raw) {
+    a = (a + v) % 65521;
+    b = (b + a) % 65521;
+  }
+  putU32(zlib, (b << 16) | a);
+  writeChunk(file, "IDAT", zlib);
+  writeChunk(file, "IEND", {});
+
+  return file.good();
+}
+
+bool writeImage(const std::string &path, uint32_t width, uint32_t height,
+                const std::vector<uint8_t> &rgb) {
+  if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".ppm") == 0)
+    return writePPM(path, width, height, rgb);
+  return writePNG(path, width, height, rgb);
+}
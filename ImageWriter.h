@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Minimal image file writers for frame dumps. Pixels are tightly packed
+// 8-bit RGB, top row first.
+
+bool writePPM(const std::string &path, uint32_t width, uint32_t height,
+              const std::vector<uint8_t> &rgb);
+
+// Writes an uncompressed (stored deflate) PNG; no zlib dependency needed.
+bool writePNG(const std::string &path, uint32_t width, uint32_t height,
+              const std::vector<uint8_t> &rgb);
+
+// Picks the writer from the file extension (.png or .ppm).
+bool writeImage(const std::string &path, uint32_t width, uint32_t height,
+                const std::vector<uint8_t> &rgb);
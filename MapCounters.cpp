@@ -0,0 +1,141 @@
+#include "MapCounters.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+void MapCounters::init(DeviceAllocator &allocator_, uint32_t framesInFlight) {
+  allocator = &allocator_;
+  device = allocator->getDevice();
+
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(allocator->getPhysicalDevice(), &props);
+  VkDeviceSize align = props.limits.minStorageBufferOffsetAlignment;
+  stride = (sizeof(Counts) + align - 1) / align * align;
+
+  allocator->createBuffer(stride * framesInFlight,
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          buffer, memory);
+  std::memset(memory.mapped, 0, stride * framesInFlight);
+
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &binding;
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout) !=
+      VK_SUCCESS)
+    throw std::runtime_error(
+        "MapCounters: failed to create descriptor set layout");
+
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSize.descriptorCount = framesInFlight;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = framesInFlight;
+  if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) !=
+      VK_SUCCESS)
+    throw std::runtime_error("MapCounters: failed to create descriptor pool");
+
+  std::vector<VkDescriptorSetLayout> layouts(framesInFlight, setLayout);
+  descriptorSets.resize(framesInFlight);
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = framesInFlight;
+  allocInfo.pSetLayouts = layouts.data();
+  if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) !=
+      VK_SUCCESS)
+    throw std::runtime_error("MapCounters: failed to allocate descriptor sets");
+
+  for (uint32_t i = 0; i < framesInFlight; i++) {
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = buffer;
+    bufferInfo.offset = i * stride;
+    bufferInfo.range = sizeof(Counts);
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSets[i];
+    write.dstBinding = 0;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.descriptorCount = 1;
+    write.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+  pending.assign(framesInFlight, false);
+}
+
+void MapCounters::bind(VkCommandBuffer commandBuffer, VkPipelineLayout layout,
+                       uint32_t frameIndex, bool counting) {
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          layout, 0, 1, &descriptorSets[frameIndex], 0,
+                          nullptr);
+  pending[frameIndex] = counting;
+}
+
+void MapCounters::endPass(VkCommandBuffer commandBuffer) {
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr,
+                       0, nullptr);
+}
+
+void MapCounters::collect(uint32_t frameIndex) {
+  if (frameIndex >= pending.size() || !pending[frameIndex])
+    return;
+  pending[frameIndex] = false;
+
+  // Host writes to coherent memory are visible to the next submit, so the
+  // range is zeroed here rather than with a transfer command
+  Counts *counts = frameCounts(frameIndex);
+  latest.mapCalls = counts->mapCalls;
+  latest.primEvals = counts->primEvals;
+  latest.pixels = counts->pixels;
+  latest.marchSteps = counts->marchSteps;
+  *counts = Counts{};
+
+  totals.mapCalls += latest.mapCalls;
+  totals.primEvals += latest.primEvals;
+  totals.pixels += latest.pixels;
+  totals.marchSteps += latest.marchSteps;
+}
+
+void MapCounters::printSummary(std::ostream &out) {
+  if (totals.pixels == 0)
+    return;
+  char line[128];
+  snprintf(line, sizeof(line),
+           "map counters: %.1f map/px  %.1f prims/px  %.1f steps/px",
+           totals.mapPerPixel(), totals.primPerPixel(),
+           totals.stepsPerPixel());
+  out << line << std::endl;
+  totals = Stats{};
+}
+
+void MapCounters::cleanup() {
+  if (device == VK_NULL_HANDLE)
+    return;
+  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  allocator->destroyBuffer(buffer, memory);
+  descriptorPool = VK_NULL_HANDLE;
+  setLayout = VK_NULL_HANDLE;
+  descriptorSets.clear();
+  pending.clear();
+  device = VK_NULL_HANDLE;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "DeviceAllocator.h"
+
+// Debug counters for the raymarch shader's map() calls. The shader adds its
+// per-pixel counts for every 4th pixel in x and y into a small host-visible
+// buffer (descriptor set 0, binding 0); each frame in flight owns its own
+// range, read back without stalling after that frame's fence, like the
+// GpuProfiler queries.
+class MapCounters {
+public:
+  // Mirrors the MapCounters block in shader.frag
+  struct Counts {
+    uint32_t mapCalls = 0;
+    uint32_t primEvals = 0; // primitives plus bound tests
+    uint32_t pixels = 0;    // sampled pixels
+    uint32_t marchSteps = 0; // primary ray iterations
+  };
+
+  struct Stats {
+    uint64_t mapCalls = 0;
+    uint64_t primEvals = 0;
+    uint64_t pixels = 0;
+    uint64_t marchSteps = 0;
+    double mapPerPixel() const {
+      return pixels ? (double)mapCalls / pixels : 0.0;
+    }
+    double primPerPixel() const {
+      return pixels ? (double)primEvals / pixels : 0.0;
+    }
+    double stepsPerPixel() const {
+      return pixels ? (double)marchSteps / pixels : 0.0;
+    }
+  };
+
+  void init(DeviceAllocator &allocator, uint32_t framesInFlight);
+
+  // Layout of set 0 in the raymarch pipeline layout
+  VkDescriptorSetLayout getSetLayout() const { return setLayout; }
+
+  // Binds this frame's range; `counting` marks the frame for collect().
+  // Call before the raymarch draws.
+  void bind(VkCommandBuffer commandBuffer, VkPipelineLayout layout,
+            uint32_t frameIndex, bool counting);
+  // Call after the raymarch pass; makes the shader's writes host-visible
+  void endPass(VkCommandBuffer commandBuffer);
+
+  // Call right after the fence for frameIndex has been waited on. Adds that
+  // frame's counts to the running totals and zeroes them for reuse.
+  void collect(uint32_t frameIndex);
+
+  // Counts of the last collected frame
+  const Stats &getLatest() const { return latest; }
+  // Totals since the last printSummary()
+  const Stats &getTotals() const { return totals; }
+  // "map/px  prims/px  steps/px" over the totals, then resets them
+  void printSummary(std::ostream &out);
+
+  void cleanup();
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator *allocator = nullptr;
+
+  VkBuffer buffer = VK_NULL_HANDLE;
+  DeviceAllocation memory;
+  VkDeviceSize stride = 0; // per-frame range, aligned for storage buffers
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  std::vector<VkDescriptorSet> descriptorSets;
+  std::vector<bool> pending;
+
+  Stats latest;
+  Stats totals;
+
+  Counts *frameCounts(uint32_t frameIndex) const {
+    return reinterpret_cast<Counts *>(static_cast<char *>(memory.mapped) +
+                                      frameIndex * stride);
+  }
+};
@@ -0,0 +1,120 @@
+#include "OffscreenTarget.h"
+
+#include <cstring>
+#include <stdexcept>
+
+void OffscreenTarget::init(VkDevice device_, DeviceAllocator &allocator_,
+                           VkRenderPass renderPass, VkFormat format_,
+                           VkExtent2D extent_) {
+  device = device_;
+  allocator = &allocator_;
+  format = format_;
+  extent = extent_;
+
+  // Color image
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent = {extent.width, extent.height, 1};
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.format = format;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  allocator->createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image,
+                         imageMemory);
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = format;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = 1;
+  if (vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+    throw std::runtime_error("OffscreenTarget: failed to create image view");
+
+  VkFramebufferCreateInfo framebufferInfo{};
+  framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebufferInfo.renderPass = renderPass;
+  framebufferInfo.attachmentCount = 1;
+  framebufferInfo.pAttachments = &view;
+  framebufferInfo.width = extent.width;
+  framebufferInfo.height = extent.height;
+  framebufferInfo.layers = 1;
+  if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffer) !=
+      VK_SUCCESS)
+    throw std::runtime_error("OffscreenTarget: failed to create framebuffer");
+
+  // Host-visible readback buffer, 4 bytes per pixel
+  allocator->createBuffer((VkDeviceSize)extent.width * extent.height * 4,
+                          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          readbackBuffer, readbackMemory);
+}
+
+void OffscreenTarget::recordReadback(VkCommandBuffer commandBuffer) {
+  // The render pass leaves the image in TRANSFER_SRC_OPTIMAL and its
+  // external dependency makes the color writes visible to the copy.
+  VkBufferImageCopy region{};
+  region.bufferOffset = 0;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = {0, 0, 0};
+  region.imageExtent = {extent.width, extent.height, 1};
+
+  vkCmdCopyImageToBuffer(commandBuffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer,
+                         1, &region);
+
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = readbackBuffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier,
+                       0, nullptr);
+}
+
+void OffscreenTarget::readPixels(std::vector<uint8_t> &rgb) const {
+  size_t pixelCount = (size_t)extent.width * extent.height;
+  rgb.resize(pixelCount * 3);
+
+  const uint8_t *src = static_cast<const uint8_t *>(readbackMemory.mapped);
+
+  bool bgra = format == VK_FORMAT_B8G8R8A8_SRGB ||
+              format == VK_FORMAT_B8G8R8A8_UNORM;
+  for (size_t i = 0; i < pixelCount; i++) {
+    rgb[i * 3 + 0] = src[i * 4 + (bgra ? 2 : 0)];
+    rgb[i * 3 + 1] = src[i * 4 + 1];
+    rgb[i * 3 + 2] = src[i * 4 + (bgra ? 0 : 2)];
+  }
+}
+
+void OffscreenTarget::cleanup() {
+  if (device == VK_NULL_HANDLE)
+    return;
+  vkDestroyFramebuffer(device, framebuffer, nullptr);
+  vkDestroyImageView(device, view, nullptr);
+  allocator->destroyImage(image, imageMemory);
+  allocator->destroyBuffer(readbackBuffer, readbackMemory);
+  framebuffer = VK_NULL_HANDLE;
+  view = VK_NULL_HANDLE;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+
+#include "DeviceAllocator.h"
+
+// Color image + framebuffer that stands in for the swapchain when running
+// headless. After the render pass, recordReadback() copies the image into a
+// host-visible buffer that readPixels() converts to tightly packed RGB.
+class OffscreenTarget {
+public:
+  // renderPass must have a single color attachment of `format` whose final
+  // layout is VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+  void init(VkDevice device, DeviceAllocator &allocator,
+            VkRenderPass renderPass, VkFormat format, VkExtent2D extent);
+
+  VkFramebuffer getFramebuffer() const { return framebuffer; }
+  VkExtent2D getExtent() const { return extent; }
+
+  // Call after vkCmdEndRenderPass, before vkEndCommandBuffer
+  void recordReadback(VkCommandBuffer commandBuffer);
+
+  // Call once the submission containing recordReadback() has completed
+  void readPixels(std::vector<uint8_t> &rgb) const;
+
+  void cleanup();
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator *allocator = nullptr;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent{};
+
+  VkImage image = VK_NULL_HANDLE;
+  DeviceAllocation imageMemory;
+  VkImageView view = VK_NULL_HANDLE;
+  VkFramebuffer framebuffer = VK_NULL_HANDLE;
+
+  VkBuffer readbackBuffer = VK_NULL_HANDLE;
+  DeviceAllocation readbackMemory; // persistently mapped
+};
@@ -0,0 +1,97 @@
+#include "PipelineCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+// Checks the VkPipelineCacheHeaderVersionOne at the start of a saved blob
+static bool headerMatches(const std::vector<char> &data,
+                          const VkPhysicalDeviceProperties &props) {
+  VkPipelineCacheHeaderVersionOne header;
+  if (data.size() < sizeof(header))
+    return false;
+  memcpy(&header, data.data(), sizeof(header));
+  return header.headerSize >= sizeof(header) &&
+         header.headerSize <= data.size() &&
+         header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         header.vendorID == props.vendorID &&
+         header.deviceID == props.deviceID &&
+         memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID,
+                VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::init(VkDevice device_, VkPhysicalDevice physicalDevice,
+                         const std::string &path_) {
+  device = device_;
+  path = path_;
+  loadedBytes = 0;
+
+  std::vector<char> data;
+  if (!path.empty()) {
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+      data.resize((size_t)file.tellg());
+      file.seekg(0);
+      file.read(data.data(), data.size());
+    }
+  }
+
+  if (!data.empty()) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+    if (!headerMatches(data, props)) {
+      std::cout << "PipelineCache: ignoring " << path
+                << " (written by a different device or driver)" << std::endl;
+      data.clear();
+    }
+  }
+
+  VkPipelineCacheCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  info.initialDataSize = data.size();
+  info.pInitialData = data.empty() ? nullptr : data.data();
+
+  if (vkCreatePipelineCache(device, &info, nullptr, &cache) != VK_SUCCESS) {
+    // A corrupt blob can still fail creation; fall back to an empty cache
+    info.initialDataSize = 0;
+    info.pInitialData = nullptr;
+    data.clear();
+    if (vkCreatePipelineCache(device, &info, nullptr, &cache) != VK_SUCCESS)
+      throw std::runtime_error("PipelineCache: failed to create cache");
+  }
+  loadedBytes = data.size();
+}
+
+bool PipelineCache::save() {
+  if (cache == VK_NULL_HANDLE || path.empty())
+    return false;
+
+  size_t size = 0;
+  if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS ||
+      size == 0)
+    return false;
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+    return false;
+
+  // Write next to the target and rename so a crash never leaves a torn file
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+      return false;
+    file.write(data.data(), (std::streamsize)size);
+    if (!file.good())
+      return false;
+  }
+  return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+void PipelineCache::cleanup() {
+  if (cache != VK_NULL_HANDLE)
+    vkDestroyPipelineCache(device, cache, nullptr);
+  cache = VK_NULL_HANDLE;
+}
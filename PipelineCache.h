@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <string>
+
+// VkPipelineCache persisted to a file between runs. The saved blob is only
+// reused when its header matches this device (vendor/device ID and cache
+// UUID); otherwise the cache starts empty and is overwritten on save().
+class PipelineCache {
+public:
+  // An empty path disables persistence but still creates a cache
+  void init(VkDevice device, VkPhysicalDevice physicalDevice,
+            const std::string &path);
+
+  VkPipelineCache get() const { return cache; }
+
+  // Bytes of valid cache data loaded at startup (0 = cold start)
+  size_t getLoadedBytes() const { return loadedBytes; }
+
+  // Writes the current cache contents back to the file
+  bool save();
+
+  void cleanup();
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  VkPipelineCache cache = VK_NULL_HANDLE;
+  std::string path;
+  size_t loadedBytes = 0;
+};
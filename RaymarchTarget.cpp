@@ -0,0 +1,561 @@
+#include "RaymarchTarget.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+static std::vector<char> readSPV(const std::string &path) {
+  std::ifstream file(path, std::ios::ate | std::ios::binary);
+  if (!file.is_open())
+    throw std::runtime_error("RaymarchTarget: failed to open shader: " + path);
+  size_t sz = (size_t)file.tellg();
+  std::vector<char> buf(sz);
+  file.seekg(0);
+  file.read(buf.data(), sz);
+  return buf;
+}
+
+// ---------------------------------------------------------------------------
+// Public API
+// ---------------------------------------------------------------------------
+
+void RaymarchTarget::init(VkDevice device_, DeviceAllocator &allocator_,
+                          VkRenderPass mainRenderPass, VkFormat format_,
+                          VkExtent2D fullExtent_) {
+  device = device_;
+  allocator = &allocator_;
+  format = format_;
+  fullExtent = fullExtent_;
+  updateRenderExtent();
+
+  createRenderPass();
+  createImage();
+  createDescriptors();
+  updateDescriptor();
+  createPipeline(mainRenderPass);
+}
+
+void RaymarchTarget::beginPass(VkCommandBuffer commandBuffer) {
+  // The pair read this frame has never been rendered to; move it out of
+  // UNDEFINED so the bound descriptors match. Its contents are not read
+  // while historyValid() is false.
+  uint32_t readIndex = 1 - writeIndex;
+  if (!layoutReady[readIndex]) {
+    VkImageMemoryBarrier barriers[2]{};
+    for (VkImageMemoryBarrier &barrier : barriers) {
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    }
+    barriers[0].image = images[readIndex];
+    barriers[1].image = historyImages[readIndex];
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+                         0, nullptr, 2, barriers);
+    layoutReady[readIndex] = true;
+  }
+
+  VkRenderPassBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  beginInfo.renderPass = renderPass;
+  beginInfo.framebuffer = framebuffers[writeIndex];
+  beginInfo.renderArea.offset = {0, 0};
+  beginInfo.renderArea.extent = renderExtent;
+  vkCmdBeginRenderPass(commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+  VkViewport viewport{0, 0, (float)renderExtent.width,
+                      (float)renderExtent.height, 0, 1};
+  VkRect2D scissor{{0, 0}, renderExtent};
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+void RaymarchTarget::endPass(VkCommandBuffer commandBuffer) {
+  vkCmdEndRenderPass(commandBuffer);
+  // the final layout transition leaves the written pair sampleable
+  layoutReady[writeIndex] = true;
+  writeIndex = 1 - writeIndex;
+  historyReady = true;
+  lastParity = checkerParity();
+  framesSinceReset++;
+}
+
+void RaymarchTarget::bindHistory(VkCommandBuffer commandBuffer,
+                                 VkPipelineLayout layout, uint32_t set) {
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          layout, set, 1, &historySets[writeIndex], 0,
+                          nullptr);
+}
+
+void RaymarchTarget::drawUpscale(VkCommandBuffer commandBuffer) {
+  struct {
+    float uvScale[2];
+    float texelSize[2];
+    float sharpness;
+    int checkerParity;
+  } pc;
+  pc.uvScale[0] = (float)renderExtent.width / fullExtent.width;
+  pc.uvScale[1] = (float)renderExtent.height / fullExtent.height;
+  pc.texelSize[0] = 1.0f / fullExtent.width;
+  pc.texelSize[1] = 1.0f / fullExtent.height;
+  // nothing to sharpen when nothing was scaled
+  pc.sharpness = scale < 1.0f ? sharpness : 0.0f;
+  pc.checkerParity = lastParity;
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  // the color endPass() just finished
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipelineLayout, 0, 1, &descriptorSets[1 - writeIndex],
+                          0, nullptr);
+  vkCmdPushConstants(commandBuffer, pipelineLayout,
+                     VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pc), &pc);
+  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+}
+
+void RaymarchTarget::setFixedScale(float scale_) {
+  targetMs = 0.0f;
+  scale = std::clamp(scale_, minScale, 1.0f);
+  updateRenderExtent();
+}
+
+void RaymarchTarget::setTargetMs(float targetMs_) {
+  targetMs = targetMs_;
+  msPerMegapixel = 0.0f;
+}
+
+void RaymarchTarget::adaptScale(float raymarchMs) {
+  if (targetMs <= 0.0f || raymarchMs <= 0.0f)
+    return;
+
+  // Raymarch cost is roughly proportional to pixel count, so track the cost
+  // per megapixel and solve for the pixel count that fits the budget.
+  float megapixels =
+      (float)renderExtent.width * renderExtent.height / 1000000.0f;
+  float sample = raymarchMs / megapixels;
+  msPerMegapixel = msPerMegapixel == 0.0f
+                       ? sample
+                       : msPerMegapixel + 0.1f * (sample - msPerMegapixel);
+
+  float fullMegapixels =
+      (float)fullExtent.width * fullExtent.height / 1000000.0f;
+  float desired = std::sqrt(targetMs / (msPerMegapixel * fullMegapixels));
+  desired = std::clamp(desired, minScale, 1.0f);
+
+  // Move gradually and ignore small differences so the image does not
+  // visibly pump from frame to frame
+  if (std::fabs(desired - scale) < 0.02f)
+    return;
+  scale += std::clamp(desired - scale, -0.05f, 0.05f);
+  updateRenderExtent();
+}
+
+void RaymarchTarget::onSwapchainRecreate(VkRenderPass mainRenderPass,
+                                         VkExtent2D fullExtent_) {
+  fullExtent = fullExtent_;
+  updateRenderExtent();
+  destroyPipeline();
+  destroyImage();
+  createImage();
+  updateDescriptor();
+  createPipeline(mainRenderPass);
+}
+
+void RaymarchTarget::cleanup() {
+  if (device == VK_NULL_HANDLE)
+    return;
+  destroyPipeline();
+  destroyImage();
+  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+  vkDestroyDescriptorSetLayout(device, historySetLayout, nullptr);
+  vkDestroySampler(device, sampler, nullptr);
+  vkDestroyRenderPass(device, renderPass, nullptr);
+  descriptorPool = VK_NULL_HANDLE;
+  descriptorSetLayout = VK_NULL_HANDLE;
+  historySetLayout = VK_NULL_HANDLE;
+  sampler = VK_NULL_HANDLE;
+  renderPass = VK_NULL_HANDLE;
+}
+
+// ---------------------------------------------------------------------------
+// Setup
+// ---------------------------------------------------------------------------
+
+void RaymarchTarget::updateRenderExtent() {
+  VkExtent2D previous = renderExtent;
+  renderExtent.width =
+      std::max(1u, (uint32_t)std::lround(fullExtent.width * scale));
+  renderExtent.height =
+      std::max(1u, (uint32_t)std::lround(fullExtent.height * scale));
+  // history pixels are addressed at the old resolution
+  if (renderExtent.width != previous.width ||
+      renderExtent.height != previous.height)
+    resetHistory();
+}
+
+void RaymarchTarget::createRenderPass() {
+  VkAttachmentDescription attachments[2]{};
+  VkAttachmentDescription &colorAttachment = attachments[0];
+  colorAttachment.format = format;
+  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  // every pixel in the render area is overwritten by the fullscreen draw,
+  // shaded or (in checkerboard mode) copied from the previous pair
+  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  // history is rewritten in full too, and sampled by the next frame
+  attachments[1] = colorAttachment;
+  attachments[1].format = historyFormat;
+
+  VkAttachmentReference colorRefs[2]{};
+  colorRefs[0].attachment = 0;
+  colorRefs[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  colorRefs[1].attachment = 1;
+  colorRefs[1].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpass{};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 2;
+  subpass.pColorAttachments = colorRefs;
+
+  // Earlier upscale and raymarch reads of this pair must finish before we
+  // overwrite it, and our writes must be visible to this frame's upscale
+  // and the next frame's raymarch
+  VkSubpassDependency dependencies[2]{};
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[0].srcAccessMask = 0;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  VkRenderPassCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  info.attachmentCount = 2;
+  info.pAttachments = attachments;
+  info.subpassCount = 1;
+  info.pSubpasses = &subpass;
+  info.dependencyCount = 2;
+  info.pDependencies = dependencies;
+
+  if (vkCreateRenderPass(device, &info, nullptr, &renderPass) != VK_SUCCESS)
+    throw std::runtime_error("RaymarchTarget: failed to create render pass");
+}
+
+void RaymarchTarget::createImage() {
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent = {fullExtent.width, fullExtent.height, 1};
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.format = format;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = format;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = 1;
+  for (uint32_t i = 0; i < 2; i++) {
+    allocator->createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                           images[i], imageMemory[i]);
+    viewInfo.image = images[i];
+    if (vkCreateImageView(device, &viewInfo, nullptr, &views[i]) != VK_SUCCESS)
+      throw std::runtime_error("RaymarchTarget: failed to create image view");
+  }
+
+  imageInfo.format = historyFormat;
+  viewInfo.format = historyFormat;
+  for (uint32_t i = 0; i < 2; i++) {
+    allocator->createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                           historyImages[i], historyMemory[i]);
+    viewInfo.image = historyImages[i];
+    if (vkCreateImageView(device, &viewInfo, nullptr, &historyViews[i]) !=
+        VK_SUCCESS)
+      throw std::runtime_error(
+          "RaymarchTarget: failed to create history image view");
+    layoutReady[i] = false;
+  }
+  writeIndex = 0;
+  resetHistory();
+
+  for (uint32_t i = 0; i < 2; i++) {
+    VkImageView attachments[] = {views[i], historyViews[i]};
+    VkFramebufferCreateInfo framebufferInfo{};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = renderPass;
+    framebufferInfo.attachmentCount = 2;
+    framebufferInfo.pAttachments = attachments;
+    framebufferInfo.width = fullExtent.width;
+    framebufferInfo.height = fullExtent.height;
+    framebufferInfo.layers = 1;
+    if (vkCreateFramebuffer(device, &framebufferInfo, nullptr,
+                            &framebuffers[i]) != VK_SUCCESS)
+      throw std::runtime_error("RaymarchTarget: failed to create framebuffer");
+  }
+}
+
+void RaymarchTarget::destroyImage() {
+  for (uint32_t i = 0; i < 2; i++) {
+    vkDestroyFramebuffer(device, framebuffers[i], nullptr);
+    vkDestroyImageView(device, historyViews[i], nullptr);
+    allocator->destroyImage(historyImages[i], historyMemory[i]);
+    vkDestroyImageView(device, views[i], nullptr);
+    allocator->destroyImage(images[i], imageMemory[i]);
+    framebuffers[i] = VK_NULL_HANDLE;
+    historyViews[i] = VK_NULL_HANDLE;
+    views[i] = VK_NULL_HANDLE;
+  }
+}
+
+void RaymarchTarget::createDescriptors() {
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+
+  if (vkCreateSampler(device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+    throw std::runtime_error("RaymarchTarget: failed to create sampler");
+
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &binding;
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr,
+                                  &descriptorSetLayout) != VK_SUCCESS)
+    throw std::runtime_error(
+        "RaymarchTarget: failed to create descriptor set layout");
+
+  // history and previous color, read by the raymarch pipelines' layout
+  VkDescriptorSetLayoutBinding historyBindings[2] = {binding, binding};
+  historyBindings[1].binding = 1;
+  layoutInfo.bindingCount = 2;
+  layoutInfo.pBindings = historyBindings;
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr,
+                                  &historySetLayout) != VK_SUCCESS)
+    throw std::runtime_error(
+        "RaymarchTarget: failed to create history set layout");
+
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSize.descriptorCount = 6;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = 4;
+  if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) !=
+      VK_SUCCESS)
+    throw std::runtime_error("RaymarchTarget: failed to create descriptor pool");
+
+  VkDescriptorSetLayout layouts[] = {descriptorSetLayout,
+                                     descriptorSetLayout};
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 2;
+  allocInfo.pSetLayouts = layouts;
+  if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets) !=
+      VK_SUCCESS)
+    throw std::runtime_error(
+        "RaymarchTarget: failed to allocate descriptor sets");
+
+  VkDescriptorSetLayout historyLayouts[] = {historySetLayout,
+                                            historySetLayout};
+  allocInfo.descriptorSetCount = 2;
+  allocInfo.pSetLayouts = historyLayouts;
+  if (vkAllocateDescriptorSets(device, &allocInfo, historySets) != VK_SUCCESS)
+    throw std::runtime_error(
+        "RaymarchTarget: failed to allocate history descriptor sets");
+}
+
+void RaymarchTarget::updateDescriptor() {
+  VkDescriptorImageInfo imageInfo{};
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  imageInfo.sampler = sampler;
+
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstBinding = 0;
+  write.dstArrayElement = 0;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.descriptorCount = 1;
+  write.pImageInfo = &imageInfo;
+  for (uint32_t i = 0; i < 2; i++) {
+    imageInfo.imageView = views[i];
+    write.dstSet = descriptorSets[i];
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+
+  // the shader texelFetch()es both, so the sampler's filter is unused
+  for (uint32_t i = 0; i < 2; i++) {
+    imageInfo.imageView = historyViews[1 - i];
+    write.dstSet = historySets[i];
+    write.dstBinding = 0;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+    imageInfo.imageView = views[1 - i];
+    write.dstBinding = 1;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+}
+
+void RaymarchTarget::createPipeline(VkRenderPass mainRenderPass) {
+  auto vertCode = readSPV("image_flash.vert.spv");
+  auto fragCode = readSPV("upscale.frag.spv");
+
+  auto makeModule = [&](const std::vector<char> &code) {
+    VkShaderModuleCreateInfo ci{};
+    ci.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    ci.codeSize = code.size();
+    ci.pCode = reinterpret_cast<const uint32_t *>(code.data());
+    VkShaderModule mod;
+    if (vkCreateShaderModule(device, &ci, nullptr, &mod) != VK_SUCCESS)
+      throw std::runtime_error(
+          "RaymarchTarget: failed to create shader module");
+    return mod;
+  };
+
+  VkShaderModule vertModule = makeModule(vertCode);
+  VkShaderModule fragModule = makeModule(fragCode);
+
+  VkPipelineShaderStageCreateInfo stages[2]{};
+  stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  stages[0].module = vertModule;
+  stages[0].pName = "main";
+  stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  stages[1].module = fragModule;
+  stages[1].pName = "main";
+
+  VkPipelineVertexInputStateCreateInfo vertexInput{};
+  vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+  inputAssembly.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+  VkPipelineViewportStateCreateInfo viewportState{};
+  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewportState.viewportCount = 1;
+  viewportState.scissorCount = 1;
+
+  VkPipelineRasterizationStateCreateInfo rasterizer{};
+  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizer.cullMode = VK_CULL_MODE_NONE;
+  rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+  rasterizer.lineWidth = 1.0f;
+
+  VkPipelineMultisampleStateCreateInfo multisampling{};
+  multisampling.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  VkPipelineColorBlendAttachmentState blendAttachment{};
+  blendAttachment.colorWriteMask =
+      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  blendAttachment.blendEnable = VK_FALSE;
+
+  VkPipelineColorBlendStateCreateInfo colorBlending{};
+  colorBlending.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  colorBlending.attachmentCount = 1;
+  colorBlending.pAttachments = &blendAttachment;
+
+  std::vector<VkDynamicState> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT,
+                                               VK_DYNAMIC_STATE_SCISSOR};
+  VkPipelineDynamicStateCreateInfo dynamicState{};
+  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicState.dynamicStateCount = (uint32_t)dynamicStates.size();
+  dynamicState.pDynamicStates = dynamicStates.data();
+
+  VkPushConstantRange pushRange{};
+  pushRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  pushRange.offset = 0;
+  pushRange.size = sizeof(float) * 5 + sizeof(int32_t);
+
+  VkPipelineLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &descriptorSetLayout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &pushRange;
+
+  if (vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout) !=
+      VK_SUCCESS)
+    throw std::runtime_error("RaymarchTarget: failed to create pipeline layout");
+
+  VkGraphicsPipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.stageCount = 2;
+  pipelineInfo.pStages = stages;
+  pipelineInfo.pVertexInputState = &vertexInput;
+  pipelineInfo.pInputAssemblyState = &inputAssembly;
+  pipelineInfo.pViewportState = &viewportState;
+  pipelineInfo.pRasterizationState = &rasterizer;
+  pipelineInfo.pMultisampleState = &multisampling;
+  pipelineInfo.pColorBlendState = &colorBlending;
+  pipelineInfo.pDynamicState = &dynamicState;
+  pipelineInfo.layout = pipelineLayout;
+  pipelineInfo.renderPass = mainRenderPass;
+  pipelineInfo.subpass = 0;
+
+  if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo,
+                                nullptr, &pipeline) != VK_SUCCESS)
+    throw std::runtime_error(
+        "RaymarchTarget: failed to create graphics pipeline");
+
+  vkDestroyShaderModule(device, vertModule, nullptr);
+  vkDestroyShaderModule(device, fragModule, nullptr);
+}
+
+void RaymarchTarget::destroyPipeline() {
+  if (pipeline != VK_NULL_HANDLE) {
+    vkDestroyPipeline(device, pipeline, nullptr);
+    pipeline = VK_NULL_HANDLE;
+  }
+  if (pipelineLayout != VK_NULL_HANDLE) {
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    pipelineLayout = VK_NULL_HANDLE;
+  }
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+
+#include "DeviceAllocator.h"
+
+// Offscreen color target for the raymarch pass so it can run below native
+// resolution. The images are sized for the full swapchain; each frame renders
+// into its top-left `renderExtent` corner and drawUpscale() stretches that
+// region back over the swapchain inside the main render pass.
+//
+// The pass has a second color attachment for the raymarch shader's
+// shadow/occlusion history. Color and history come in two pairs that
+// alternate: each frame writes one pair while the shader samples the other
+// (set bound by bindHistory()), and endPass() swaps them. The raymarch
+// pipelines are built against getRenderPass().
+//
+// In checkerboard mode each pass shades only the pixels of one parity
+// (checkerParity(), alternating every pass) and copies the previous pass's
+// color and history into the rest. drawUpscale() then rebuilds the copied
+// pixels from that color clamped to their freshly shaded neighbours.
+class RaymarchTarget {
+public:
+  void init(VkDevice device, DeviceAllocator &allocator,
+            VkRenderPass mainRenderPass, VkFormat format,
+            VkExtent2D fullExtent);
+
+  // Begins the raymarch render pass at the current scale and sets viewport
+  // and scissor to the scaled extent
+  void beginPass(VkCommandBuffer commandBuffer);
+  void endPass(VkCommandBuffer commandBuffer);
+
+  // Binds the previous frame's history (binding 0) and color (binding 1) as
+  // `set` of the raymarch layout
+  void bindHistory(VkCommandBuffer commandBuffer, VkPipelineLayout layout,
+                   uint32_t set);
+  // False until a pass has been rendered since the last reset, scale change
+  // or swapchain recreation; the shader must not read the history then
+  bool historyValid() const { return historyReady; }
+  void resetHistory() {
+    historyReady = false;
+    framesSinceReset = 0;
+  }
+
+  void setCheckerboard(bool enabled) { checkerboard = enabled; }
+  bool getCheckerboard() const { return checkerboard; }
+  // Parity ((x + y) & 1) of the pixels the next pass shades, or -1 when it
+  // shades every pixel: always the case for the first pass after a reset,
+  // which has no previous color to copy from. Each pass writes every pixel,
+  // shaded or copied, so the parity alternates every pass and a copied
+  // pixel is never older than the previous pass.
+  int checkerParity() const {
+    return checkerboard && framesSinceReset >= 1
+               ? (int)(framesSinceReset & 1)
+               : -1;
+  }
+
+  VkRenderPass getRenderPass() const { return renderPass; }
+  VkDescriptorSetLayout getHistorySetLayout() const {
+    return historySetLayout;
+  }
+
+  // Call inside the main render pass
+  void drawUpscale(VkCommandBuffer commandBuffer);
+
+  // Size the raymarch shader should treat as its resolution this frame
+  VkExtent2D getRenderExtent() const { return renderExtent; }
+  float getScale() const { return scale; }
+
+  // Fixed scale in [minScale, 1]; turns off adaptation
+  void setFixedScale(float scale);
+  // Adaptive mode: steer the scale so the raymarch pass takes targetMs
+  void setTargetMs(float targetMs);
+  // Feed the last measured raymarch GPU time (ms at the current scale)
+  void adaptScale(float raymarchMs);
+
+  float minScale = 0.35f;
+  // 0 = bilinear, up to ~1 for a strong edge-aware sharpen
+  float sharpness = 0.5f;
+
+  // Optional cache for the upscale pipeline; call before init()
+  void setPipelineCache(VkPipelineCache cache) { pipelineCache = cache; }
+
+  void onSwapchainRecreate(VkRenderPass mainRenderPass, VkExtent2D fullExtent);
+
+  void cleanup();
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator *allocator = nullptr;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D fullExtent{};
+  VkExtent2D renderExtent{};
+
+  float scale = 1.0f;
+  float targetMs = 0.0f; // 0 = fixed scale
+  // Smoothed cost of one full-resolution pixel, in ms per megapixel
+  float msPerMegapixel = 0.0f;
+
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  VkImage images[2]{};
+  DeviceAllocation imageMemory[2];
+  VkImageView views[2]{};
+  VkSampler sampler = VK_NULL_HANDLE;
+
+  // shadow, occlusion, hit distance; written by the raymarch shader
+  static constexpr VkFormat historyFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+  VkImage historyImages[2]{};
+  DeviceAllocation historyMemory[2];
+  VkImageView historyViews[2]{};
+  // layoutReady[i]: images[i] and historyImages[i] have left UNDEFINED and
+  // may be sampled
+  bool layoutReady[2]{};
+  // framebuffers[i] writes images[i] and historyImages[i]
+  VkFramebuffer framebuffers[2]{};
+  // historySets[i] samples historyImages[1 - i] and images[1 - i]
+  VkDescriptorSet historySets[2]{};
+  VkDescriptorSetLayout historySetLayout = VK_NULL_HANDLE;
+  // pair the next pass writes
+  uint32_t writeIndex = 0;
+  bool historyReady = false;
+
+  bool checkerboard = false;
+  // passes since the images were (re)created or the history reset
+  uint32_t framesSinceReset = 0;
+  // checkerParity() of the last pass, read by drawUpscale()
+  int lastParity = -1;
+
+  VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  // descriptorSets[i] samples images[i] for the upscale
+  VkDescriptorSet descriptorSets[2]{};
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+
+  void createRenderPass();
+  void createImage();
+  void destroyImage();
+  void createDescriptors();
+  void updateDescriptor();
+  void createPipeline(VkRenderPass mainRenderPass);
+  void destroyPipeline();
+  void updateRenderExtent();
+};
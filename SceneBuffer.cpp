@@ -0,0 +1,97 @@
+#include "SceneBuffer.h"
+
+#include <stdexcept>
+
+#include "SdfScene.h"
+
+void SceneBuffer::init(DeviceAllocator &allocator_, const SdfScene *scene) {
+  allocator = &allocator_;
+  device = allocator->getDevice();
+
+  if (scene) {
+    data = scene->packBuffer();
+  } else {
+    SdfScene::Header header;
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&header);
+    data.assign(bytes, bytes + sizeof(header));
+  }
+
+  allocator->createBuffer(data.size(),
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
+
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &binding;
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout) !=
+      VK_SUCCESS)
+    throw std::runtime_error(
+        "SceneBuffer: failed to create descriptor set layout");
+
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSize.descriptorCount = 1;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = 1;
+  if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) !=
+      VK_SUCCESS)
+    throw std::runtime_error("SceneBuffer: failed to create descriptor pool");
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &setLayout;
+  if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) !=
+      VK_SUCCESS)
+    throw std::runtime_error("SceneBuffer: failed to allocate descriptor set");
+
+  VkDescriptorBufferInfo bufferInfo{};
+  bufferInfo.buffer = buffer;
+  bufferInfo.offset = 0;
+  bufferInfo.range = VK_WHOLE_SIZE;
+
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = descriptorSet;
+  write.dstBinding = 0;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  write.descriptorCount = 1;
+  write.pBufferInfo = &bufferInfo;
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+void SceneBuffer::upload(UploadContext &uploads) {
+  uploads.uploadBuffer(buffer, 0, data.data(), data.size());
+}
+
+void SceneBuffer::bind(VkCommandBuffer commandBuffer, VkPipelineLayout layout,
+                       uint32_t set) {
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          layout, set, 1, &descriptorSet, 0, nullptr);
+}
+
+void SceneBuffer::cleanup() {
+  if (device == VK_NULL_HANDLE)
+    return;
+  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  allocator->destroyBuffer(buffer, memory);
+  descriptorPool = VK_NULL_HANDLE;
+  setLayout = VK_NULL_HANDLE;
+  descriptorSet = VK_NULL_HANDLE;
+  data.clear();
+  device = VK_NULL_HANDLE;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+
+#include "DeviceAllocator.h"
+#include "UploadContext.h"
+
+class SdfScene;
+
+// Device-local copy of a scene file's packed groups and instructions
+// (SdfScene::packBuffer()), read by mapSceneBuffer() in shader.frag through
+// descriptor set 4, binding 0. Without a scene the buffer holds just an
+// empty header so the set stays valid for pipelines that never read it.
+class SceneBuffer {
+public:
+  // Creates the buffer and descriptor set; the data goes up with upload()
+  void init(DeviceAllocator &allocator, const SdfScene *scene);
+
+  // Queues the packed scene on the upload context; call before its flush()
+  void upload(UploadContext &uploads);
+
+  // Layout of set 4 in the raymarch pipeline layout
+  VkDescriptorSetLayout getSetLayout() const { return setLayout; }
+
+  void bind(VkCommandBuffer commandBuffer, VkPipelineLayout layout,
+            uint32_t set);
+
+  VkDeviceSize getSize() const { return data.size(); }
+
+  void cleanup();
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator *allocator = nullptr;
+
+  std::vector<uint8_t> data;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  DeviceAllocation memory;
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+};
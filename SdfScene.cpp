@@ -0,0 +1,619 @@
+#include "SdfScene.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+// Just enough JSON for scene files: no \u escapes, numbers as double
+struct Json {
+  enum Kind { Null, Bool, Number, String, Array, Object };
+  Kind kind = Null;
+  bool boolean = false;
+  double number = 0.0;
+  std::string string;
+  std::vector<Json> items;
+  std::vector<std::pair<std::string, Json>> members;
+
+  const Json *find(const char *key) const {
+    for (const auto &member : members)
+      if (member.first == key)
+        return &member.second;
+    return nullptr;
+  }
+};
+
+class JsonParser {
+public:
+  explicit JsonParser(const std::string &text) : text(text) {}
+
+  Json parseDocument() {
+    Json value = parseValue();
+    skipSpace();
+    if (pos != text.size())
+      fail("trailing characters");
+    return value;
+  }
+
+private:
+  // Arrays and objects nested deeper than this are rejected rather than
+  // recursed into, so hostile input cannot exhaust the stack
+  static constexpr int kMaxDepth = 256;
+
+  const std::string &text;
+  size_t pos = 0;
+  int depth = 0;
+
+  [[noreturn]] void fail(const std::string &message) const {
+    int line = 1;
+    for (size_t i = 0; i < pos && i < text.size(); i++)
+      if (text[i] == '\n')
+        line++;
+    throw std::runtime_error("line " + std::to_string(line) + ": " + message);
+  }
+
+  void skipSpace() {
+    while (pos < text.size() && std::isspace((unsigned char)text[pos]))
+      pos++;
+  }
+
+  bool consume(char c) {
+    skipSpace();
+    if (pos < text.size() && text[pos] == c) {
+      pos++;
+      return true;
+    }
+    return false;
+  }
+
+  void expect(char c) {
+    if (!consume(c))
+      fail(std::string("expected '") + c + "'");
+  }
+
+  bool keyword(const char *word) {
+    size_t length = std::strlen(word);
+    if (text.compare(pos, length, word) != 0)
+      return false;
+    pos += length;
+    return true;
+  }
+
+  std::string parseString() {
+    expect('"');
+    std::string out;
+    while (pos < text.size() && text[pos] != '"') {
+      char c = text[pos++];
+      if (c == '\\' && pos < text.size()) {
+        char e = text[pos++];
+        c = e == 'n' ? '\n' : e == 't' ? '\t' : e;
+      }
+      out += c;
+    }
+    if (pos >= text.size())
+      fail("unterminated string");
+    pos++;
+    return out;
+  }
+
+  Json parseValue() {
+    skipSpace();
+    if (pos >= text.size())
+      fail("unexpected end of file");
+    Json value;
+    char c = text[pos];
+    if ((c == '{' || c == '[') && depth >= kMaxDepth)
+      fail("nested deeper than " + std::to_string(kMaxDepth) + " levels");
+    if (c == '{') {
+      value.kind = Json::Object;
+      pos++;
+      if (consume('}'))
+        return value;
+      depth++;
+      do {
+        skipSpace();
+        std::string key = parseString();
+        expect(':');
+        value.members.emplace_back(key, parseValue());
+      } while (consume(','));
+      expect('}');
+      depth--;
+    } else if (c == '[') {
+      value.kind = Json::Array;
+      pos++;
+      if (consume(']'))
+        return value;
+      depth++;
+      do {
+        value.items.push_back(parseValue());
+      } while (consume(','));
+      expect(']');
+      depth--;
+    } else if (c == '"') {
+      value.kind = Json::String;
+      value.string = parseString();
+    } else if (keyword("true")) {
+      value.kind = Json::Bool;
+      value.boolean = true;
+    } else if (keyword("false")) {
+      value.kind = Json::Bool;
+    } else if (keyword("null")) {
+      value.kind = Json::Null;
+    } else {
+      const char *start = text.c_str() + pos;
+      char *end = nullptr;
+      value.number = std::strtod(start, &end);
+      if (end == start)
+        fail("unexpected character '" + std::string(1, c) + "'");
+      value.kind = Json::Number;
+      pos += end - start;
+    }
+    return value;
+  }
+};
+
+// Turns the parsed document into groups and postfix instructions
+class SceneCompiler {
+public:
+  std::vector<SdfScene::Group> groups;
+  std::vector<std::string> groupNames;
+  std::vector<SdfScene::Instruction> instructions;
+
+  void compile(const Json &document) {
+    const Json *list = document.find("groups");
+    if (!list || list->kind != Json::Array)
+      throw std::runtime_error("expected a \"groups\" array");
+    if ((int)list->items.size() > SdfScene::kMaxGroups)
+      throw std::runtime_error("more than " +
+                               std::to_string(SdfScene::kMaxGroups) +
+                               " groups");
+    for (const Json &group : list->items)
+      compileGroup(group);
+  }
+
+private:
+  int top = 0; // stack entries above the scene
+
+  [[noreturn]] static void fail(const std::string &where,
+                                const std::string &message) {
+    throw std::runtime_error(where + ": " + message);
+  }
+
+  static float number(const Json &object, const char *key,
+                      const std::string &where) {
+    const Json *value = object.find(key);
+    if (!value || value->kind != Json::Number)
+      fail(where, std::string("expected number \"") + key + "\"");
+    return (float)value->number;
+  }
+
+  static float numberOr(const Json &object, const char *key, float fallback) {
+    const Json *value = object.find(key);
+    return value && value->kind == Json::Number ? (float)value->number
+                                                : fallback;
+  }
+
+  static void vec3(const Json &object, const char *key, float *out,
+                   const std::string &where, bool required = true) {
+    const Json *value = object.find(key);
+    if (!value) {
+      if (required)
+        fail(where, std::string("expected \"") + key + "\": [x, y, z]");
+      return;
+    }
+    if (value->kind != Json::Array || value->items.size() != 3)
+      fail(where, std::string("\"") + key + "\" must be [x, y, z]");
+    for (int i = 0; i < 3; i++) {
+      if (value->items[i].kind != Json::Number)
+        fail(where, std::string("\"") + key + "\" must be numbers");
+      out[i] = (float)value->items[i].number;
+    }
+  }
+
+  static uint32_t stateMask(const Json &states, const std::string &where) {
+    if (states.kind != Json::Array)
+      fail(where, "\"states\" must be an array");
+    uint32_t mask = 0;
+    for (const Json &entry : states.items) {
+      int first = 0, last = 0;
+      if (entry.kind == Json::Number) {
+        first = last = (int)entry.number;
+      } else if (entry.kind != Json::String ||
+                 std::sscanf(entry.string.c_str(), "%d-%d", &first, &last) !=
+                     2) {
+        fail(where, "states are numbers or \"first-last\" ranges");
+      }
+      if (first < 0 || last >= SdfScene::kMaxStates || first > last)
+        fail(where, "state out of range 0-" +
+                        std::to_string(SdfScene::kMaxStates - 1));
+      for (int s = first; s <= last; s++)
+        mask |= 1u << s;
+    }
+    return mask;
+  }
+
+  static void multiply(float (*m)[4], const float (*r)[4]) {
+    float out[3][4] = {};
+    for (int j = 0; j < 3; j++)
+      for (int i = 0; i < 3; i++)
+        out[j][i] = m[0][i] * r[j][0] + m[1][i] * r[j][1] + m[2][i] * r[j][2];
+    std::memcpy(m, out, sizeof(out));
+  }
+
+  // "rotate": [[axis, radians], ...] multiplied left to right, columns as
+  // rotatex/y/z in sdf_scene.glsl build them
+  static void rotation(const Json &node, SdfScene::Instruction &ins,
+                       const std::string &where) {
+    const Json *list = node.find("rotate");
+    if (!list)
+      return;
+    if (list->kind != Json::Array)
+      fail(where, "\"rotate\" must be a list of [axis, radians]");
+    for (const Json &step : list->items) {
+      if (step.kind != Json::Array || step.items.size() != 2 ||
+          step.items[0].kind != Json::String ||
+          step.items[1].kind != Json::Number)
+        fail(where, "\"rotate\" entries are [\"x\"|\"y\"|\"z\", radians]");
+      float c = std::cos((float)step.items[1].number);
+      float s = std::sin((float)step.items[1].number);
+      const std::string &axis = step.items[0].string;
+      float r[3][4] = {};
+      if (axis == "x") {
+        float m[3][4] = {{1, 0, 0}, {0, c, -s}, {0, s, c}};
+        std::memcpy(r, m, sizeof(r));
+      } else if (axis == "y") {
+        float m[3][4] = {{c, 0, s}, {0, 1, 0}, {-s, 0, c}};
+        std::memcpy(r, m, sizeof(r));
+      } else if (axis == "z") {
+        float m[3][4] = {{c, -s, 0}, {s, c, 0}, {0, 0, 1}};
+        std::memcpy(r, m, sizeof(r));
+      } else {
+        fail(where, "unknown rotation axis \"" + axis + "\"");
+      }
+      multiply(ins.rotation, r);
+    }
+  }
+
+  static void mirror(const Json &node, SdfScene::Instruction &ins,
+                     const std::string &where) {
+    const Json *value = node.find("mirror");
+    if (!value)
+      return;
+    const Json *axes = value->find("axes");
+    if (!axes || axes->kind != Json::String)
+      fail(where, "\"mirror\" needs \"axes\", e.g. \"xz\"");
+    for (char axis : axes->string) {
+      if (axis < 'x' || axis > 'z')
+        fail(where, "mirror axes are x, y and z");
+      ins.mirrorAxes |= 1u << (axis - 'x');
+    }
+    vec3(*value, "plane", ins.mirror, where, false);
+  }
+
+  static SdfScene::Type opType(const std::string &name,
+                               const std::string &where) {
+    if (name == "union")
+      return SdfScene::Union;
+    if (name == "subtraction")
+      return SdfScene::Subtraction;
+    if (name == "smoothUnion")
+      return SdfScene::SmoothUnion;
+    if (name == "smoothSubtraction")
+      return SdfScene::SmoothSubtraction;
+    fail(where, "unknown operator \"" + name + "\"");
+  }
+
+  void push(const std::string &where) {
+    if (++top >= SdfScene::kStackSize)
+      fail(where, "nested deeper than the shader's stack of " +
+                      std::to_string(SdfScene::kStackSize));
+  }
+
+  // op(a, b) reads a from the top of the stack and b below it, so b is
+  // emitted first
+  void emitOperator(SdfScene::Type type, float k) {
+    SdfScene::Instruction ins;
+    ins.type = type;
+    ins.k = k;
+    instructions.push_back(ins);
+    top--;
+  }
+
+  void compileNode(const Json &node, const std::string &where) {
+    if (node.kind != Json::Object)
+      fail(where, "a node must be an object");
+    if (const Json *op = node.find("op")) {
+      if (op->kind != Json::String)
+        fail(where, "\"op\" must be a string");
+      SdfScene::Type type = opType(op->string, where);
+      bool smooth =
+          type == SdfScene::SmoothUnion || type == SdfScene::SmoothSubtraction;
+      float k = smooth ? number(node, "k", where) : 0.0f;
+      const Json *a = node.find("a");
+      const Json *b = node.find("b");
+      if (!a || !b)
+        fail(where, "operator needs \"a\" and \"b\"");
+      compileNode(*b, where + ".b");
+      compileNode(*a, where + ".a");
+      emitOperator(type, k);
+      return;
+    }
+
+    const Json *typeName = node.find("type");
+    if (!typeName || typeName->kind != Json::String)
+      fail(where, "node needs \"type\" or \"op\"");
+    const std::string &type = typeName->string;
+    SdfScene::Instruction ins;
+    vec3(node, "position", ins.position, where, false);
+    ins.color[0] = ins.color[1] = ins.color[2] = 1.0f;
+    vec3(node, "color", ins.color, where, false);
+    rotation(node, ins, where);
+    mirror(node, ins, where);
+    if (type == "sphere") {
+      ins.type = SdfScene::Sphere;
+      ins.params[0] = number(node, "radius", where);
+    } else if (type == "box") {
+      ins.type = SdfScene::Box;
+      vec3(node, "size", ins.params, where);
+    } else if (type == "roundBox") {
+      ins.type = SdfScene::RoundBox;
+      vec3(node, "size", ins.params, where);
+      ins.params[3] = number(node, "radius", where);
+    } else if (type == "roundedBoxFrame") {
+      ins.type = SdfScene::RoundedBoxFrame;
+      vec3(node, "size", ins.params, where);
+      ins.params[3] = number(node, "radius", where);
+      ins.position[3] = numberOr(node, "edge", 0.0f);
+    } else if (type == "cappedCylinder") {
+      ins.type = SdfScene::CappedCylinder;
+      ins.params[0] = number(node, "radius", where);
+      ins.params[1] = number(node, "height", where);
+    } else if (type == "roundedCylinder") {
+      ins.type = SdfScene::RoundedCylinder;
+      ins.params[0] = number(node, "radius", where);
+      ins.params[1] = number(node, "rounding", where);
+      ins.params[2] = number(node, "height", where);
+    } else if (type == "ellipsoid") {
+      ins.type = SdfScene::Ellipsoid;
+      vec3(node, "radii", ins.params, where);
+    } else {
+      fail(where, "unknown primitive \"" + type + "\"");
+    }
+    push(where);
+    instructions.push_back(ins);
+  }
+
+  void compileGroup(const Json &group) {
+    std::string name = "group " + std::to_string(groups.size());
+    if (const Json *value = group.find("name"))
+      if (value->kind == Json::String)
+        name = value->string;
+
+    SdfScene::Group out;
+    out.first = (int32_t)instructions.size();
+    if (const Json *states = group.find("states"))
+      out.stateMask = stateMask(*states, name);
+    if (const Json *bound = group.find("bound")) {
+      out.bounded = 1;
+      vec3(*bound, "center", out.boundCenter, name);
+      vec3(*bound, "half", out.boundHalf, name);
+      out.boundCenter[3] = numberOr(*bound, "k", 0.0f);
+    }
+
+    const Json *objects = group.find("objects");
+    if (!objects || objects->kind != Json::Array || objects->items.empty())
+      fail(name, "expected a non-empty \"objects\" array");
+    for (size_t i = 0; i < objects->items.size(); i++) {
+      const Json &object = objects->items[i];
+      std::string where = name + ".objects[" + std::to_string(i) + "]";
+      const Json *node = object.find("node");
+      if (!node)
+        fail(where, "expected \"node\"");
+      compileNode(*node, where);
+
+      std::string merge = "union";
+      if (const Json *value = object.find("merge"))
+        if (value->kind == Json::String)
+          merge = value->string;
+      SdfScene::Type type = opType(merge, where);
+      bool smooth =
+          type == SdfScene::SmoothUnion || type == SdfScene::SmoothSubtraction;
+      emitOperator(type, smooth ? number(object, "k", where) : 0.0f);
+    }
+    out.count = (int32_t)instructions.size() - out.first;
+    groups.push_back(out);
+    groupNames.push_back(name);
+  }
+};
+
+// Shortest text that reads back as the same float, always with a decimal
+// point so GLSL parses it as a float literal
+std::string glslFloat(float value) {
+  char text[32];
+  for (int precision = 6; precision <= 9; precision++) {
+    std::snprintf(text, sizeof(text), "%.*g", precision, value);
+    if (std::strtof(text, nullptr) == value)
+      break;
+  }
+  std::string out = text;
+  if (out.find_first_of(".e") == std::string::npos)
+    out += ".0";
+  return out;
+}
+
+std::string glslVec3(const float *v) {
+  return "vec3(" + glslFloat(v[0]) + ", " + glslFloat(v[1]) + ", " +
+         glslFloat(v[2]) + ")";
+}
+
+std::string glslMat3(const float (*m)[4]) {
+  bool identity = true;
+  for (int j = 0; j < 3; j++)
+    for (int i = 0; i < 3; i++)
+      identity = identity && m[j][i] == (i == j ? 1.0f : 0.0f);
+  if (identity)
+    return "mat3(1.0)";
+  return "mat3(" + glslVec3(m[0]) + ", " + glslVec3(m[1]) + ", " +
+         glslVec3(m[2]) + ")";
+}
+
+} // namespace
+
+void SdfScene::load(const std::string &file) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in)
+    throw std::runtime_error("SdfScene: cannot open " + file);
+  std::stringstream text;
+  text << in.rdbuf();
+
+  SceneCompiler compiler;
+  try {
+    std::string source = text.str();
+    compiler.compile(JsonParser(source).parseDocument());
+  } catch (const std::runtime_error &e) {
+    throw std::runtime_error("SdfScene: " + file + ": " + e.what());
+  }
+  path = file;
+  groups = std::move(compiler.groups);
+  groupNames = std::move(compiler.groupNames);
+  instructions = std::move(compiler.instructions);
+}
+
+std::vector<uint8_t> SdfScene::packBuffer() const {
+  Header header;
+  header.groupCount = (int32_t)groups.size();
+  for (size_t i = 0; i < groups.size(); i++)
+    header.groups[i] = groups[i];
+
+  std::vector<uint8_t> bytes(sizeof(Header) +
+                             instructions.size() * sizeof(Instruction));
+  std::memcpy(bytes.data(), &header, sizeof(Header));
+  if (!instructions.empty())
+    std::memcpy(bytes.data() + sizeof(Header), instructions.data(),
+                instructions.size() * sizeof(Instruction));
+  return bytes;
+}
+
+std::string SdfScene::generateGlsl() const {
+  std::ostringstream out;
+  out << "// Generated by --gen-scene from " << path << "; do not edit.\n"
+      << "// mapSceneBuffer() with the scene unrolled, see SdfScene.h\n"
+      << "SDF mapSceneGenerated(vec3 p, SDF scene) {\n";
+
+  int temp = 0;
+  for (size_t g = 0; g < groups.size(); g++) {
+    const Group &group = groups[g];
+    std::vector<std::string> conditions;
+    if (group.stateMask != ~0u) {
+      char mask[32];
+      std::snprintf(mask, sizeof(mask), "0x%08xu", group.stateMask);
+      conditions.push_back("((" + std::string(mask) +
+                           " >> uint(SCENE_STATE)) & 1u) != 0u");
+    }
+    if (group.bounded)
+      conditions.push_back("!cullGroup(p, " + glslVec3(group.boundCenter) +
+                           ", " + glslVec3(group.boundHalf) +
+                           ", scene.dist, " +
+                           glslFloat(group.boundCenter[3]) + ")");
+
+    out << "  // " << groupNames[g] << "\n";
+    if (!conditions.empty()) {
+      out << "  if (" << conditions[0];
+      for (size_t i = 1; i < conditions.size(); i++)
+        out << " &&\n      " << conditions[i];
+      out << ") {\n";
+    } else {
+      out << "  {\n";
+    }
+    const std::string indent = "    ";
+
+    std::vector<std::string> stack = {"scene"};
+    int primitives = 0;
+    for (int i = group.first; i < group.first + group.count; i++) {
+      const Instruction &ins = instructions[i];
+      if (ins.type >= Union) {
+        std::string a = stack.back();
+        stack.pop_back();
+        std::string b = stack.back();
+        stack.pop_back();
+        static const char *names[] = {"opUnion", "opSubtraction",
+                                      "opSmoothUnion", "opSmoothSubtraction"};
+        std::string call = std::string(names[ins.type - Union]) + "(" + a +
+                           ", " + b;
+        if (ins.type == SmoothUnion || ins.type == SmoothSubtraction)
+          call += ", " + glslFloat(ins.k);
+        call += ")";
+        if (b == "scene") {
+          out << indent << "scene = " << call << ";\n";
+          stack.push_back("scene");
+        } else {
+          std::string name = "s" + std::to_string(temp++);
+          out << indent << "SDF " << name << " = " << call << ";\n";
+          stack.push_back(name);
+        }
+        continue;
+      }
+
+      std::string point = "p";
+      if (ins.mirrorAxes) {
+        point = "q" + std::to_string(temp);
+        out << indent << "vec3 " << point << " = p;\n";
+        for (int axis = 0; axis < 3; axis++) {
+          if (!(ins.mirrorAxes & (1u << axis)))
+            continue;
+          std::string c = point + "." + char('x' + axis);
+          std::string plane = glslFloat(ins.mirror[axis]);
+          out << indent << c << " = abs(" << c << " - " << plane << ") + "
+              << plane << ";\n";
+        }
+      }
+      std::string common = point + ", " + glslVec3(ins.position) + ", " +
+                           glslMat3(ins.rotation);
+      std::string color = glslVec3(ins.color);
+      const float *k = ins.params;
+      std::string call;
+      switch (ins.type) {
+      case Sphere:
+        call = "sdfSphere(" + common + ", " + glslFloat(k[0]);
+        break;
+      case Box:
+        call = "sdfBox(" + common + ", " + glslVec3(k);
+        break;
+      case RoundBox:
+        call = "sdfRoundBox(" + common + ", " + glslVec3(k) + ", " +
+               glslFloat(k[3]);
+        break;
+      case RoundedBoxFrame:
+        call = "sdfRoundedBoxFrame(" + common + ", " + glslVec3(k) + ", " +
+               glslFloat(ins.position[3]) + ", " + glslFloat(k[3]);
+        break;
+      case CappedCylinder:
+        call = "sdfCappedCylinder(" + common + ", " + glslFloat(k[0]) + ", " +
+               glslFloat(k[1]);
+        break;
+      case RoundedCylinder:
+        call = "sdfRoundedCylinder(" + common + ", " + glslFloat(k[0]) +
+               ", " + glslFloat(k[1]) + ", " + glslFloat(k[2]);
+        break;
+      default:
+        call = "sdfEllipsoid(" + common + ", " + glslVec3(k);
+        break;
+      }
+      std::string name = "s" + std::to_string(temp++);
+      out << indent << "SDF " << name << " = " << call << ", " << color
+          << ");\n";
+      stack.push_back(name);
+      primitives++;
+    }
+    out << indent << "SDF_COUNT(" << primitives << ");\n";
+    out << "  }\n";
+  }
+  out << "  return scene;\n}\n";
+  return out.str();
+}
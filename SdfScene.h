@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scene description for the raymarcher's static geometry, loaded from JSON
+// instead of being written into map() by hand:
+//
+//   { "groups": [ {
+//       "name": "bed",
+//       "states": [0, 1, "3-8"],           // optional, default: every state
+//       "bound": { "center": [x, y, z], "half": [x, y, z], "k": 0.0 },
+//       "objects": [ { "merge": "union", "k": 0.0, "node": NODE }, ... ]
+//   } ] }
+//
+// A NODE is a primitive
+//   { "type": "roundBox", "position": [..], "size": [..], "radius": 0.1,
+//     "color": [r, g, b], "rotate": [["z", 1.6], ["y", 1.3]],
+//     "mirror": { "axes": "xz", "plane": [0, 0, 3.8] } }
+// or an operator { "op": "smoothUnion", "k": 0.03, "a": NODE, "b": NODE }
+// evaluated as op(a, b) like the sdf_scene.glsl functions of the same name.
+// Each object is merged into the scene so far with its "merge" operator,
+// again as op(object, scene); a group is skipped when its state list does
+// not contain SCENE_STATE or, like cullGroup(), when its bound is further
+// than the scene so far plus k.
+//
+// Loading compiles every group into a postfix program over a stack whose
+// bottom entry is the scene: primitives push, operators pop two entries and
+// push one. The packed groups and instructions are uploaded as is (see
+// SceneBuffer) and walked by mapSceneBuffer() in shader.frag, or turned into
+// straight-line GLSL by generateGlsl().
+class SdfScene {
+public:
+  // Must match SCENE_MAX_GROUPS and SCENE_STACK in shader.frag
+  static constexpr int kMaxGroups = 32;
+  static constexpr int kStackSize = 8;
+  static constexpr int kMaxStates = 32; // bits of Group::stateMask
+
+  // Instruction types, SCENE_* in shader.frag
+  enum Type : int32_t {
+    Sphere = 0,          // params.x = radius
+    Box = 1,             // params.xyz = half size
+    RoundBox = 2,        // params.xyz = half size, w = rounding radius
+    RoundedBoxFrame = 3, // params.xyz = half size, w = radius; position.w = edge
+    CappedCylinder = 4,  // params.x = radius, y = half height
+    RoundedCylinder = 5, // params.x = radius, y = rounding, z = half height
+    Ellipsoid = 6,       // params.xyz = radii
+    Union = 16,
+    Subtraction = 17,
+    SmoothUnion = 18,
+    SmoothSubtraction = 19,
+  };
+
+  // std430 layouts of SceneInstr and SceneGroup in shader.frag
+  struct Instruction {
+    int32_t type = Sphere;
+    float k = 0.0f;            // smooth operator radius
+    uint32_t mirrorAxes = 0;   // bit 0/1/2: mirror x/y/z about mirror[]
+    int32_t pad = 0;
+    float position[4] = {};    // w: see Type
+    float params[4] = {};
+    float color[4] = {};
+    float mirror[4] = {};      // mirror plane offsets per axis
+    float rotation[3][4] = {{1.0f, 0.0f, 0.0f, 0.0f},
+                            {0.0f, 1.0f, 0.0f, 0.0f},
+                            {0.0f, 0.0f, 1.0f, 0.0f}}; // mat3 columns
+  };
+  static_assert(sizeof(Instruction) == 128, "SceneInstr is 128 bytes");
+
+  struct Group {
+    int32_t first = 0; // first instruction
+    int32_t count = 0;
+    uint32_t stateMask = ~0u;
+    int32_t bounded = 0;
+    float boundCenter[4] = {}; // w = k
+    float boundHalf[4] = {};
+  };
+  static_assert(sizeof(Group) == 48, "SceneGroup is 48 bytes");
+
+  // Start of the SceneData buffer; the instructions follow it
+  struct Header {
+    int32_t groupCount = 0;
+    int32_t pad[3] = {};
+    Group groups[kMaxGroups];
+  };
+
+  // Throws std::runtime_error with the file name on parse or validation
+  // errors
+  void load(const std::string &path);
+
+  bool empty() const { return groups.empty(); }
+  const std::string &getPath() const { return path; }
+  const std::vector<Group> &getGroups() const { return groups; }
+  const std::vector<std::string> &getGroupNames() const { return groupNames; }
+  const std::vector<Instruction> &getInstructions() const {
+    return instructions;
+  }
+
+  // Header followed by the instructions, ready to upload
+  std::vector<uint8_t> packBuffer() const;
+
+  // GLSL source of mapSceneGenerated(p, scene): the same groups unrolled
+  // with every parameter a literal, for shader.frag's SCENE_GENERATED build
+  std::string generateGlsl() const;
+
+private:
+  std::string path;
+  std::vector<Group> groups;
+  std::vector<std::string> groupNames;
+  std::vector<Instruction> instructions;
+};
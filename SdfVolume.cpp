@@ -0,0 +1,263 @@
+#include "SdfVolume.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static const VkFormat volumeFormat = VK_FORMAT_R32_SFLOAT;
+// sdf_bake.comp's local size in every dimension
+static const uint32_t bakeGroupSize = 4;
+
+static std::vector<char> readSPV(const std::string &path) {
+  std::ifstream file(path, std::ios::ate | std::ios::binary);
+  if (!file.is_open())
+    throw std::runtime_error("SdfVolume: failed to open shader: " + path);
+  size_t sz = (size_t)file.tellg();
+  std::vector<char> buf(sz);
+  file.seekg(0);
+  file.read(buf.data(), sz);
+  return buf;
+}
+
+// ---------------------------------------------------------------------------
+// Public API
+// ---------------------------------------------------------------------------
+
+void SdfVolume::init(VkDevice device_, DeviceAllocator &allocator_,
+                     VkExtent3D extent_) {
+  device = device_;
+  allocator = &allocator_;
+  extent = extent_;
+  baked = false;
+
+  VkFormatProperties props;
+  vkGetPhysicalDeviceFormatProperties(allocator->getPhysicalDevice(),
+                                      volumeFormat, &props);
+  VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT |
+                                VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+                                VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  available = (props.optimalTilingFeatures & needed) == needed;
+
+  createImage();
+  createDescriptors();
+  if (available)
+    createBakePipeline();
+}
+
+void SdfVolume::bake(VkCommandBuffer commandBuffer) {
+  if (!available || baked)
+    return;
+
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    bakePipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          bakeLayout, 0, 1, &bakeSet, 0, nullptr);
+  vkCmdDispatch(commandBuffer,
+                (extent.width + bakeGroupSize - 1) / bakeGroupSize,
+                (extent.height + bakeGroupSize - 1) / bakeGroupSize,
+                (extent.depth + bakeGroupSize - 1) / bakeGroupSize);
+
+  barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  baked = true;
+}
+
+void SdfVolume::bind(VkCommandBuffer commandBuffer, VkPipelineLayout layout,
+                     uint32_t set) {
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          layout, set, 1, &sampleSet, 0, nullptr);
+}
+
+void SdfVolume::cleanup() {
+  if (device == VK_NULL_HANDLE)
+    return;
+  vkDestroyPipeline(device, bakePipeline, nullptr);
+  vkDestroyPipelineLayout(device, bakeLayout, nullptr);
+  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(device, sampleSetLayout, nullptr);
+  vkDestroyDescriptorSetLayout(device, bakeSetLayout, nullptr);
+  vkDestroySampler(device, sampler, nullptr);
+  vkDestroyImageView(device, view, nullptr);
+  allocator->destroyImage(image, imageMemory);
+  bakePipeline = VK_NULL_HANDLE;
+  bakeLayout = VK_NULL_HANDLE;
+  descriptorPool = VK_NULL_HANDLE;
+  sampleSetLayout = VK_NULL_HANDLE;
+  bakeSetLayout = VK_NULL_HANDLE;
+  sampler = VK_NULL_HANDLE;
+  view = VK_NULL_HANDLE;
+  device = VK_NULL_HANDLE;
+}
+
+// ---------------------------------------------------------------------------
+// Setup
+// ---------------------------------------------------------------------------
+
+void SdfVolume::createImage() {
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_3D;
+  imageInfo.extent = extent;
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.format = volumeFormat;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+  if (available)
+    imageInfo.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+  allocator->createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image,
+                         imageMemory);
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_3D;
+  viewInfo.format = volumeFormat;
+  viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  if (vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+    throw std::runtime_error("SdfVolume: failed to create image view");
+
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  if (vkCreateSampler(device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+    throw std::runtime_error("SdfVolume: failed to create sampler");
+}
+
+void SdfVolume::createDescriptors() {
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &binding;
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr,
+                                  &sampleSetLayout) != VK_SUCCESS)
+    throw std::runtime_error(
+        "SdfVolume: failed to create descriptor set layout");
+
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr,
+                                  &bakeSetLayout) != VK_SUCCESS)
+    throw std::runtime_error(
+        "SdfVolume: failed to create descriptor set layout");
+
+  VkDescriptorPoolSize poolSizes[2]{};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[0].descriptorCount = 1;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  poolSizes[1].descriptorCount = 1;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 2;
+  poolInfo.pPoolSizes = poolSizes;
+  poolInfo.maxSets = 2;
+  if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) !=
+      VK_SUCCESS)
+    throw std::runtime_error("SdfVolume: failed to create descriptor pool");
+
+  VkDescriptorSetLayout layouts[2] = {sampleSetLayout, bakeSetLayout};
+  VkDescriptorSet sets[2];
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 2;
+  allocInfo.pSetLayouts = layouts;
+  if (vkAllocateDescriptorSets(device, &allocInfo, sets) != VK_SUCCESS)
+    throw std::runtime_error("SdfVolume: failed to allocate descriptor sets");
+  sampleSet = sets[0];
+  bakeSet = sets[1];
+
+  VkDescriptorImageInfo sampleInfo{};
+  sampleInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  sampleInfo.imageView = view;
+  sampleInfo.sampler = sampler;
+
+  VkDescriptorImageInfo storageInfo{};
+  storageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  storageInfo.imageView = view;
+
+  VkWriteDescriptorSet writes[2]{};
+  writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  writes[0].dstSet = sampleSet;
+  writes[0].dstBinding = 0;
+  writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  writes[0].descriptorCount = 1;
+  writes[0].pImageInfo = &sampleInfo;
+  writes[1] = writes[0];
+  writes[1].dstSet = bakeSet;
+  writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  writes[1].pImageInfo = &storageInfo;
+  // the storage view is only valid when the image has STORAGE usage
+  vkUpdateDescriptorSets(device, available ? 2 : 1, writes, 0, nullptr);
+}
+
+void SdfVolume::createBakePipeline() {
+  auto code = readSPV("sdf_bake.comp.spv");
+  VkShaderModuleCreateInfo moduleInfo{};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = code.size();
+  moduleInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
+  VkShaderModule module;
+  if (vkCreateShaderModule(device, &moduleInfo, nullptr, &module) !=
+      VK_SUCCESS)
+    throw std::runtime_error("SdfVolume: failed to create shader module");
+
+  VkPipelineLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &bakeSetLayout;
+  if (vkCreatePipelineLayout(device, &layoutInfo, nullptr, &bakeLayout) !=
+      VK_SUCCESS)
+    throw std::runtime_error("SdfVolume: failed to create pipeline layout");
+
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = module;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = bakeLayout;
+  VkResult result = vkCreateComputePipelines(device, pipelineCache, 1,
+                                             &pipelineInfo, nullptr,
+                                             &bakePipeline);
+  vkDestroyShaderModule(device, module, nullptr);
+  if (result != VK_SUCCESS)
+    throw std::runtime_error("SdfVolume: failed to create bake pipeline");
+}
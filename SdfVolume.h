@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+
+#include "DeviceAllocator.h"
+
+// Baked distance field of the static bedroom geometry. sdf_bake.comp samples
+// bedroomStatic() (sdf_scene.glsl) into an r32f 3D image once, recorded into
+// the first frame that shows the bedroom; afterwards the raymarch shader
+// reads far-field distances with one trilinear fetch and only evaluates the
+// static primitives analytically near their surfaces.
+//
+// The fragment-side descriptor set (set 1 of the raymarch pipeline layout)
+// always exists so every variant can share one layout, even when the device
+// cannot filter r32f and the volume is unused.
+class SdfVolume {
+public:
+  // extent must match VOLUME_SIZE / 0.1 in sdf_scene.glsl to keep the
+  // shader's VOLUME_ERROR bound valid
+  void init(VkDevice device, DeviceAllocator &allocator,
+            VkExtent3D extent = {64, 192, 64});
+
+  // Optional cache for the bake pipeline; call before init()
+  void setPipelineCache(VkPipelineCache cache) { pipelineCache = cache; }
+
+  // False when r32f cannot be linearly filtered or stored to
+  bool isAvailable() const { return available; }
+  bool isBaked() const { return baked; }
+
+  // Records the bake and the barrier that makes it readable from fragment
+  // shaders. Call outside a render pass.
+  void bake(VkCommandBuffer commandBuffer);
+
+  // Layout of set 1 in the raymarch pipeline layout
+  VkDescriptorSetLayout getSetLayout() const { return sampleSetLayout; }
+  void bind(VkCommandBuffer commandBuffer, VkPipelineLayout layout,
+            uint32_t set);
+
+  VkExtent3D getExtent() const { return extent; }
+  VkDeviceSize getSizeBytes() const {
+    return (VkDeviceSize)extent.width * extent.height * extent.depth *
+           sizeof(float);
+  }
+
+  void cleanup();
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator *allocator = nullptr;
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+  VkExtent3D extent{};
+  bool available = false;
+  bool baked = false;
+
+  VkImage image = VK_NULL_HANDLE;
+  DeviceAllocation imageMemory;
+  VkImageView view = VK_NULL_HANDLE;
+  VkSampler sampler = VK_NULL_HANDLE;
+
+  VkDescriptorSetLayout sampleSetLayout = VK_NULL_HANDLE;
+  VkDescriptorSetLayout bakeSetLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet sampleSet = VK_NULL_HANDLE;
+  VkDescriptorSet bakeSet = VK_NULL_HANDLE;
+  VkPipelineLayout bakeLayout = VK_NULL_HANDLE;
+  VkPipeline bakePipeline = VK_NULL_HANDLE;
+
+  void createImage();
+  void createDescriptors();
+  void createBakePipeline();
+};
@@ -1,4 +1,5 @@
 #include "TextRenderer.h"
+#include <algorithm>
 #include <cstring>
 #include <fstream>
 #include <iostream>
@@ -7,45 +8,31 @@
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "stb_truetype.h"
 TextRenderer::TextRenderer()
-    : device(VK_NULL_HANDLE), physicalDevice(VK_NULL_HANDLE),
-      fontAtlasImage(VK_NULL_HANDLE), fontAtlasMemory(VK_NULL_HANDLE),
+    : device(VK_NULL_HANDLE), fontAtlasImage(VK_NULL_HANDLE),
       fontAtlasView(VK_NULL_HANDLE), fontSampler(VK_NULL_HANDLE),
       descriptorPool(VK_NULL_HANDLE), descriptorSetLayout(VK_NULL_HANDLE),
       descriptorSet(VK_NULL_HANDLE), pipelineLayout(VK_NULL_HANDLE),
       pipeline(VK_NULL_HANDLE), vertexBuffer(VK_NULL_HANDLE),
-      vertexMemory(VK_NULL_HANDLE), fontBuffer(nullptr), bitmapBuffer(nullptr),
-      atlasWidth(512), atlasHeight(512), fontSize(32.0f), vertexCount(0) {}
+      fontBuffer(nullptr), bitmapBuffer(nullptr),
+      atlasWidth(512), atlasHeight(512), fontSize(32.0f), glyphCount(0) {}
 
 TextRenderer::~TextRenderer() { cleanup(); }
 
-bool TextRenderer::init(VkDevice device, VkPhysicalDevice physicalDevice,
-                        VkCommandPool commandPool, VkQueue graphicsQueue,
-                        const char *fontPath, float fontSize) {
+bool TextRenderer::init(VkDevice device, DeviceAllocator &allocator,
+                        UploadContext &uploads, const char *fontPath,
+                        float fontSize, uint32_t framesInFlight) {
   this->device = device;
-  this->physicalDevice = physicalDevice;
+  this->allocator = &allocator;
   this->fontSize = fontSize;
+  this->framesInFlight = framesInFlight > 0 ? framesInFlight : 1;
 
-  if (!loadFont(fontPath, fontSize)) {
+  if (!loadGlyphs(fontPath, fontSize)) {
     return false;
   }
 
-  createFontAtlas();
-
   // Create texture image
   VkDeviceSize imageSize = atlasWidth * atlasHeight;
 
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               stagingBuffer, stagingBufferMemory);
-
-  void *data;
-  vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-  memcpy(data, bitmapBuffer, static_cast<size_t>(imageSize));
-  vkUnmapMemory(device, stagingBufferMemory);
-
   // Create image
   VkImageCreateInfo imageInfo{};
   imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -63,39 +50,11 @@ bool TextRenderer::init(VkDevice device, VkPhysicalDevice physicalDevice,
   imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
   imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-  if (vkCreateImage(device, &imageInfo, nullptr, &fontAtlasImage) !=
-      VK_SUCCESS) {
-    throw std::runtime_error("failed to create font atlas image!");
-  }
-
-  VkMemoryRequirements memRequirements;
-  vkGetImageMemoryRequirements(device, fontAtlasImage, &memRequirements);
-
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = findMemoryType(
-      memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  allocator.createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        fontAtlasImage, fontAtlasMemory);
 
-  if (vkAllocateMemory(device, &allocInfo, nullptr, &fontAtlasMemory) !=
-      VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate font atlas memory!");
-  }
-
-  vkBindImageMemory(device, fontAtlasImage, fontAtlasMemory, 0);
-
-  transitionImageLayout(commandPool, graphicsQueue, fontAtlasImage,
-                        VK_FORMAT_R8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED,
-                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-  copyBufferToImage(commandPool, graphicsQueue, stagingBuffer, fontAtlasImage,
-                    atlasWidth, atlasHeight);
-  transitionImageLayout(commandPool, graphicsQueue, fontAtlasImage,
-                        VK_FORMAT_R8_UNORM,
-                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-  vkDestroyBuffer(device, stagingBuffer, nullptr);
-  vkFreeMemory(device, stagingBufferMemory, nullptr);
+  uploads.uploadImage(fontAtlasImage, imageInfo.extent, bitmapBuffer,
+                      imageSize);
 
   // Create image view
   VkImageViewCreateInfo viewInfo{};
@@ -150,12 +109,17 @@ void TextRenderer::cleanup() {
     if (pipelineLayout != VK_NULL_HANDLE) {
       vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
     }
-    if (vertexBuffer != VK_NULL_HANDLE) {
-      vkDestroyBuffer(device, vertexBuffer, nullptr);
-    }
-    if (vertexMemory != VK_NULL_HANDLE) {
-      vkFreeMemory(device, vertexMemory, nullptr);
+    allocator->destroyBuffer(vertexBuffer, vertexMemory);
+    for (RetiredBuffer &retired : retiredBuffers) {
+      allocator->destroyBuffer(retired.buffer, retired.memory);
     }
+    retiredBuffers.clear();
+    allocator->destroyBuffer(layoutBuffer, layoutMemory);
+    layouts.clear();
+    freeRanges.clear();
+    pendingFrees.clear();
+    layoutCapacity = 0;
+    layoutTop = 0;
     if (descriptorPool != VK_NULL_HANDLE) {
       vkDestroyDescriptorPool(device, descriptorPool, nullptr);
     }
@@ -168,12 +132,9 @@ void TextRenderer::cleanup() {
     if (fontAtlasView != VK_NULL_HANDLE) {
       vkDestroyImageView(device, fontAtlasView, nullptr);
     }
-    if (fontAtlasImage != VK_NULL_HANDLE) {
-      vkDestroyImage(device, fontAtlasImage, nullptr);
-    }
-    if (fontAtlasMemory != VK_NULL_HANDLE) {
-      vkFreeMemory(device, fontAtlasMemory, nullptr);
-    }
+    allocator->destroyImage(fontAtlasImage, fontAtlasMemory);
+    // the destructor calls cleanup() again; make that a no-op
+    device = VK_NULL_HANDLE;
   }
 
   if (fontBuffer) {
@@ -186,6 +147,15 @@ void TextRenderer::cleanup() {
   }
 }
 
+bool TextRenderer::loadGlyphs(const char *fontPath, float fontSize) {
+  this->fontSize = fontSize;
+  if (!loadFont(fontPath, fontSize)) {
+    return false;
+  }
+  createFontAtlas();
+  return true;
+}
+
 bool TextRenderer::loadFont(const char *fontPath, float fontSize) {
   std::ifstream file(fontPath, std::ios::binary | std::ios::ate);
   if (!file.is_open()) {
@@ -216,9 +186,13 @@ void TextRenderer::createFontAtlas() {
 
   int x = 0, y = 0;
   int maxHeight = 0;
+  glyphTable.clear();
 
-  // Bake ASCII characters (32-126)
-  for (int c = 32; c < 127; ++c) {
+  // Bake ASCII characters (32-126) and Latin-1 (160-255)
+  for (int c = 32; c < 256; ++c) {
+    if (c == 127) {
+      c = 160;
+    }
     int advance, lsb, x0, y0, x1, y1;
     stbtt_GetCodepointHMetrics(&font, c, &advance, &lsb);
     stbtt_GetCodepointBitmapBox(&font, c, scale, scale, &x0, &y0, &x1, &y1);
@@ -239,17 +213,10 @@ void TextRenderer::createFontAtlas() {
     stbtt_MakeCodepointBitmap(&font, bitmapBuffer + x + y * atlasWidth, w, h,
                               atlasWidth, scale, scale, c);
 
-    CharacterInfo charInfo;
-    charInfo.ax = advance * scale;
-    charInfo.ay = 0;
-    charInfo.bw = static_cast<float>(w);
-    charInfo.bh = static_cast<float>(h);
-    charInfo.bl = static_cast<float>(x0);
-    charInfo.bt = static_cast<float>(y0);
-    charInfo.tx = static_cast<float>(x) / atlasWidth;
-    charInfo.ty = static_cast<float>(y) / atlasHeight;
-
-    characterMap[static_cast<char>(c)] = charInfo;
+    glyphTable.add(c, advance * scale, static_cast<float>(x0),
+                   static_cast<float>(y0), static_cast<uint16_t>(x),
+                   static_cast<uint16_t>(y), static_cast<uint16_t>(w),
+                   static_cast<uint16_t>(h));
 
     if (h > maxHeight) {
       maxHeight = h;
@@ -326,158 +293,467 @@ void TextRenderer::createDescriptorSet() {
 }
 
 void TextRenderer::createVertexBuffer() {
-  VkDeviceSize bufferSize =
-      sizeof(TextVertex) * 10000; // Reserve space for vertices
+  if (sliceSize == 0) {
+    sliceSize = sizeof(TextGlyph) * 4096; // Reserve space for glyphs
+  }
 
-  createBuffer(bufferSize,
-               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-                   VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               vertexBuffer, vertexMemory);
+  allocator->createBuffer(sliceSize * framesInFlight,
+                          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                              VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          vertexBuffer, vertexMemory);
 }
 
-void TextRenderer::prepareText(const std::string &text, float x, float y,
-                               float scale) {
-  vertices.clear();
+void TextRenderer::retireBuffer(VkBuffer &buffer, DeviceAllocation &memory) {
+  // This frame's earlier draws and the frames in flight may still read the
+  // buffer, so it lives until each of their fences has been waited on
+  retiredBuffers.push_back({buffer, memory, framesInFlight});
+  buffer = VK_NULL_HANDLE;
+  memory = DeviceAllocation{};
+}
 
-  float cursorX = x;
-  float cursorY = y;
+void TextRenderer::growRing(VkDeviceSize minSliceSize) {
+  retireBuffer(vertexBuffer, vertexMemory);
 
-  for (char c : text) {
-    if (characterMap.find(c) == characterMap.end()) {
-      continue;
-    }
+  while (sliceSize < minSliceSize) {
+    sliceSize *= 2;
+  }
+  createVertexBuffer();
+  ringHead = 0;
+  std::cout << "text: glyph ring grown to " << sliceSize / 1024
+            << " KiB per frame" << std::endl;
+}
+
+TextGlyph *TextRenderer::allocateGlyphs(uint32_t count,
+                                        VkDeviceSize &offset) {
+  VkDeviceSize bytes = sizeof(TextGlyph) * count;
+  if (ringHead + bytes > sliceSize) {
+    growRing(ringHead + bytes);
+  }
+  offset = sliceSize * frameIndex + ringHead;
+  ringHead += bytes;
+  return reinterpret_cast<TextGlyph *>(
+      static_cast<char *>(vertexMemory.mapped) + offset);
+}
 
-    CharacterInfo &ch = characterMap[c];
+uint32_t TextRenderer::packColor(const float color[4]) {
+  uint32_t packed = 0;
+  for (int i = 0; i < 4; i++) {
+    float c = std::min(std::max(color[i], 0.0f), 1.0f);
+    packed |= static_cast<uint32_t>(c * 255.0f + 0.5f) << (8 * i);
+  }
+  return packed;
+}
 
-    float xpos = cursorX + ch.bl * scale;
-    float ypos = cursorY + ch.bt * scale;
-    float w = ch.bw * scale;
-    float h = ch.bh * scale;
+// Parses the "{#rrggbb}" / "{#rrggbbaa}" span at text[i]; returns its length,
+// or 0 if there is none
+static size_t parseColorSpan(const std::string &text, size_t i,
+                             uint32_t &color) {
+  if (text.compare(i, 2, "{#") != 0) {
+    return 0;
+  }
+  size_t close = text.find('}', i + 2);
+  if (close == std::string::npos) {
+    return 0;
+  }
+  size_t digits = close - (i + 2);
+  if (digits != 6 && digits != 8) {
+    return 0;
+  }
+
+  uint32_t rgba[4] = {0, 0, 0, 255};
+  for (size_t d = 0; d < digits; d++) {
+    char h = text[i + 2 + d];
+    uint32_t v;
+    if (h >= '0' && h <= '9') {
+      v = h - '0';
+    } else if (h >= 'a' && h <= 'f') {
+      v = h - 'a' + 10;
+    } else if (h >= 'A' && h <= 'F') {
+      v = h - 'A' + 10;
+    } else {
+      return 0;
+    }
+    if (d % 2 == 0) {
+      rgba[d / 2] = 0;
+    }
+    rgba[d / 2] = rgba[d / 2] * 16 + v;
+  }
+  color = rgba[0] | rgba[1] << 8 | rgba[2] << 16 | rgba[3] << 24;
+  return close - i + 1;
+}
 
-    float texX = ch.tx;
-    float texY = ch.ty;
-    float texW = ch.bw / atlasWidth;
-    float texH = ch.bh / atlasHeight;
+void TextRenderer::layoutText(const std::string &text, float x, float y,
+                              float scale, uint32_t color,
+                              std::vector<TextGlyph> &out) {
+  // Pass 1: decode, apply colour spans and look glyphs up; the pen is the
+  // only serial dependency, so it is resolved here for every visible glyph.
+  // There are at most text.size() glyphs: each slot is written and only
+  // kept (count advanced) when the glyph has a bitmap.
+  if (layoutIndex.size() < text.size()) {
+    layoutIndex.resize(text.size());
+    layoutPen.resize(text.size());
+    layoutColor.resize(text.size());
+  }
+  uint16_t *index = layoutIndex.data();
+  float *penX = layoutPen.data();
+  uint32_t *colors = layoutColor.data();
+  const float *advance = glyphTable.advance.data();
+  const uint16_t *atlasW = glyphTable.atlasW.data();
+  const uint16_t *atlasH = glyphTable.atlasH.data();
+  const uint32_t baseColor = color;
+  size_t count = 0;
+  float pen = 0.0f;
+
+  for (size_t i = 0; i < text.size();) {
+    uint8_t byte = static_cast<uint8_t>(text[i]);
+    uint32_t codepoint;
+    if (byte == '{') {
+      if (text.compare(i, 3, "{/}") == 0) {
+        color = baseColor;
+        i += 3;
+        continue;
+      }
+      size_t span = parseColorSpan(text, i, color);
+      if (span > 0) {
+        i += span;
+        continue;
+      }
+    }
+    if (byte < 0x80) {
+      codepoint = byte;
+      i++;
+    } else {
+      codepoint = GlyphTable::decodeUtf8(text, i);
+    }
 
-    // Triangle 1
-    vertices.push_back({{xpos, ypos}, {texX, texY}});
-    vertices.push_back({{xpos + w, ypos}, {texX + texW, texY}});
-    vertices.push_back({{xpos, ypos + h}, {texX, texY + texH}});
+    uint16_t glyph = glyphTable.find(codepoint);
+    if (glyph == GlyphTable::kMissing) {
+      continue;
+    }
+    index[count] = glyph;
+    penX[count] = pen;
+    colors[count] = color;
+    count += atlasW[glyph] > 0 && atlasH[glyph] > 0;
+    pen += advance[glyph];
+  }
 
-    // Triangle 2
-    vertices.push_back({{xpos + w, ypos}, {texX + texW, texY}});
-    vertices.push_back({{xpos + w, ypos + h}, {texX + texW, texY + texH}});
-    vertices.push_back({{xpos, ypos + h}, {texX, texY + texH}});
-    cursorX += ch.ax * scale;
+  // Pass 2: every glyph independent, each field from its own array
+  size_t first = out.size();
+  out.resize(first + count);
+  TextGlyph *dst = out.data() + first;
+  const float *bearingX = glyphTable.bearingX.data();
+  const float *bearingY = glyphTable.bearingY.data();
+  const uint16_t *atlasX = glyphTable.atlasX.data();
+  const uint16_t *atlasY = glyphTable.atlasY.data();
+  for (size_t k = 0; k < count; k++) {
+    uint16_t g = index[k];
+    dst[k].pos[0] = x + (penX[k] + bearingX[g]) * scale;
+    dst[k].pos[1] = y + bearingY[g] * scale;
+    dst[k].atlas[0] = atlasX[g];
+    dst[k].atlas[1] = atlasY[g];
+    dst[k].atlas[2] = atlasW[g];
+    dst[k].atlas[3] = atlasH[g];
+    dst[k].scale = scale;
+    dst[k].color = colors[k];
   }
+}
+
+void TextRenderer::layoutGlyphs(const std::string &text, float x, float y,
+                                float scale, float color[4],
+                                std::vector<TextGlyph> &out) {
+  layoutText(text, x, y, scale, packColor(color), out);
+}
+
+void TextRenderer::prepareText(const std::string &text, float x, float y,
+                               float scale, float color[4]) {
+  glyphs.clear();
+  layoutText(text, x, y, scale, packColor(color), glyphs);
 
-  vertexCount = static_cast<uint32_t>(vertices.size());
+  glyphCount = static_cast<uint32_t>(glyphs.size());
   updateVertexBuffer();
 }
 
-void TextRenderer::beginBatch() {
-  batchEntries.clear();
+void TextRenderer::beginBatch(uint32_t frameIndex_) {
+  frameIndex = frameIndex_ % framesInFlight;
+  ringHead = 0;
+
+  for (size_t i = 0; i < retiredBuffers.size();) {
+    if (--retiredBuffers[i].framesLeft == 0) {
+      allocator->destroyBuffer(retiredBuffers[i].buffer,
+                               retiredBuffers[i].memory);
+      retiredBuffers.erase(retiredBuffers.begin() + i);
+    } else {
+      i++;
+    }
+  }
+  for (size_t i = 0; i < pendingFrees.size();) {
+    if (--pendingFrees[i].framesLeft == 0) {
+      freeRange(pendingFrees[i].range);
+      pendingFrees.erase(pendingFrees.begin() + i);
+    } else {
+      i++;
+    }
+  }
+
+  batchGlyphs.clear();
+  queuedLayouts.clear();
+  relayoutCount = 0;
   inBatch = true;
 }
 
 void TextRenderer::addText(const std::string &text, float x, float y,
                            float scale, float color[4]) {
-  TextBatchEntry entry;
-  memcpy(entry.color, color, sizeof(float) * 4);
+  layoutText(text, x, y, scale, packColor(color), batchGlyphs);
+}
 
-  float cursorX = x;
-  float cursorY = y;
+void TextRenderer::endBatch(VkCommandBuffer commandBuffer) {
+  inBatch = false;
+  if (!layoutCopies.empty())
+    throw std::runtime_error(
+        "TextRenderer: layouts set without recordLayoutUploads()");
+  if (batchGlyphs.empty() && queuedLayouts.empty())
+    return;
 
-  for (char c : text) {
-    if (characterMap.find(c) == characterMap.end())
-      continue;
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
 
-    CharacterInfo &ch = characterMap[c];
-    float xpos = cursorX + ch.bl * scale;
-    float ypos = cursorY + ch.bt * scale;
-    float w = ch.bw * scale;
-    float h = ch.bh * scale;
-    float texX = ch.tx;
-    float texY = ch.ty;
-    float texW = ch.bw / atlasWidth;
-    float texH = ch.bh / atlasHeight;
+  // Retained layouts draw from the arena, one draw per run of adjacent
+  // ranges
+  if (!queuedLayouts.empty()) {
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &layoutBuffer, &offset);
+    GlyphRange run;
+    for (uint32_t id : queuedLayouts) {
+      const GlyphRange &range = layouts[id].range;
+      if (run.count > 0 && range.first == run.first + run.count) {
+        run.count += range.count;
+        continue;
+      }
+      if (run.count > 0) {
+        vkCmdDraw(commandBuffer, 4, run.count, 0, run.first);
+      }
+      run = range;
+    }
+    vkCmdDraw(commandBuffer, 4, run.count, 0, run.first);
+    queuedLayouts.clear();
+  }
 
-    entry.vertices.push_back({{xpos, ypos}, {texX, texY}});
-    entry.vertices.push_back({{xpos + w, ypos}, {texX + texW, texY}});
-    entry.vertices.push_back({{xpos, ypos + h}, {texX, texY + texH}});
-    entry.vertices.push_back({{xpos + w, ypos}, {texX + texW, texY}});
-    entry.vertices.push_back(
-        {{xpos + w, ypos + h}, {texX + texW, texY + texH}});
-    entry.vertices.push_back({{xpos, ypos + h}, {texX, texY + texH}});
+  if (batchGlyphs.empty())
+    return;
 
-    cursorX += ch.ax * scale;
-  }
+  // Copy the whole batch into this frame's slice of the ring at once
+  VkDeviceSize batchOffset = 0;
+  TextGlyph *dst = allocateGlyphs(
+      static_cast<uint32_t>(batchGlyphs.size()), batchOffset);
+  memcpy(dst, batchGlyphs.data(), sizeof(TextGlyph) * batchGlyphs.size());
+
+  VkBuffer vertexBuffers[] = {vertexBuffer};
+  VkDeviceSize offsets[] = {batchOffset};
+  vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+  // Every string of the batch in one draw, one quad instance per glyph
+  vkCmdDraw(commandBuffer, 4, static_cast<uint32_t>(batchGlyphs.size()), 0,
+            0);
+
+  batchGlyphs.clear();
+}
 
-  if (!entry.vertices.empty()) {
-    batchEntries.push_back(std::move(entry));
+TextLayout TextRenderer::createLayout() {
+  TextLayout handle;
+  for (uint32_t i = 0; i < layouts.size(); i++) {
+    if (!layouts[i].used) {
+      handle.id = i;
+      break;
+    }
+  }
+  if (!handle.valid()) {
+    handle.id = static_cast<uint32_t>(layouts.size());
+    layouts.emplace_back();
   }
+  layouts[handle.id] = RetainedLayout{};
+  layouts[handle.id].used = true;
+  return handle;
 }
 
-void TextRenderer::endBatch(VkCommandBuffer commandBuffer) {
-  if (batchEntries.empty())
+void TextRenderer::setLayoutText(TextLayout handle, const std::string &text,
+                                 float x, float y, float scale,
+                                 float color[4]) {
+  RetainedLayout &layout = layouts.at(handle.id);
+  uint32_t packed = packColor(color);
+  if (!layout.dirty && layout.text == text && layout.x == x &&
+      layout.y == y && layout.scale == scale && layout.color == packed) {
     return;
+  }
 
-  // Collect all vertices into one big buffer upload
-  std::vector<TextVertex> allVertices;
-  for (auto &entry : batchEntries) {
-    allVertices.insert(allVertices.end(), entry.vertices.begin(),
-                       entry.vertices.end());
+  layout.text = text;
+  layout.x = x;
+  layout.y = y;
+  layout.scale = scale;
+  layout.color = packed;
+  layout.dirty = false;
+  relayoutCount++;
+
+  layout.glyphs.clear();
+  layoutText(text, x, y, scale, packed, layout.glyphs);
+
+  // Frames in flight may still draw the old glyphs: write a new range
+  releaseRange(layout.range);
+  uint32_t count = static_cast<uint32_t>(layout.glyphs.size());
+  if (count == 0) {
+    return;
+  }
+  if (!allocateRange(count, layout.range)) {
+    growLayoutArena(layoutTop + count);
+    allocateRange(count, layout.range);
   }
+  uploadLayout(layout);
+}
 
-  // Upload all vertices at once
-  void *data;
-  vkMapMemory(device, vertexMemory, 0, sizeof(TextVertex) * allVertices.size(),
-              0, &data);
-  memcpy(data, allVertices.data(), sizeof(TextVertex) * allVertices.size());
-  vkUnmapMemory(device, vertexMemory);
+bool TextRenderer::allocateRange(uint32_t count, GlyphRange &range) {
+  for (size_t i = 0; i < freeRanges.size(); i++) {
+    if (freeRanges[i].count >= count) {
+      range = {freeRanges[i].first, count};
+      freeRanges[i].first += count;
+      freeRanges[i].count -= count;
+      if (freeRanges[i].count == 0) {
+        freeRanges.erase(freeRanges.begin() + i);
+      }
+      return true;
+    }
+  }
+  if (layoutTop + count > layoutCapacity) {
+    return false;
+  }
+  range = {layoutTop, count};
+  layoutTop += count;
+  return true;
+}
 
-  // Bind pipeline and descriptor once
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
-  VkBuffer vertexBuffers[] = {vertexBuffer};
-  VkDeviceSize offsets[] = {0};
-  vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+void TextRenderer::releaseRange(GlyphRange &range) {
+  if (range.count > 0) {
+    pendingFrees.push_back({range, framesInFlight});
+  }
+  range = GlyphRange{};
+}
 
-  // Draw each text entry with its color, using firstVertex offset
-  uint32_t vertexOffset = 0;
-  for (auto &entry : batchEntries) {
-    vkCmdPushConstants(commandBuffer, pipelineLayout,
-                       VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float) * 4,
-                       entry.color);
-    vkCmdDraw(commandBuffer, static_cast<uint32_t>(entry.vertices.size()), 1,
-              vertexOffset, 0);
-    vertexOffset += static_cast<uint32_t>(entry.vertices.size());
+void TextRenderer::freeRange(GlyphRange range) {
+  auto it = std::lower_bound(
+      freeRanges.begin(), freeRanges.end(), range,
+      [](const GlyphRange &a, const GlyphRange &b) { return a.first < b.first; });
+  it = freeRanges.insert(it, range);
+  // merge with the following and then the preceding range
+  if (it + 1 != freeRanges.end() && it->first + it->count == (it + 1)->first) {
+    it->count += (it + 1)->count;
+    freeRanges.erase(it + 1);
+  }
+  if (it != freeRanges.begin() &&
+      (it - 1)->first + (it - 1)->count == it->first) {
+    (it - 1)->count += it->count;
+    it = freeRanges.erase(it) - 1;
+  }
+  // free space at the top goes back to the bump allocator
+  if (it + 1 == freeRanges.end() && it->first + it->count == layoutTop) {
+    layoutTop = it->first;
+    freeRanges.erase(it);
   }
+}
 
-  batchEntries.clear();
-  inBatch = false;
+void TextRenderer::growLayoutArena(uint32_t minCapacity) {
+  if (layoutBuffer != VK_NULL_HANDLE) {
+    retireBuffer(layoutBuffer, layoutMemory);
+  }
+  uint32_t capacity = std::max(layoutCapacity * 2, 1024u);
+  while (capacity < minCapacity) {
+    capacity *= 2;
+  }
+  layoutCapacity = capacity;
+  // every layout is copied again below, into the new buffer
+  layoutCopies.clear();
+  allocator->createBuffer(sizeof(TextGlyph) * layoutCapacity,
+                          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, layoutBuffer,
+                          layoutMemory);
+  for (const RetainedLayout &layout : layouts) {
+    if (layout.used && layout.range.count > 0) {
+      uploadLayout(layout);
+    }
+  }
+}
+
+void TextRenderer::uploadLayout(const RetainedLayout &layout) {
+  LayoutCopy copy{};
+  TextGlyph *dst = allocateGlyphs(layout.range.count, copy.region.srcOffset);
+  memcpy(dst, layout.glyphs.data(), sizeof(TextGlyph) * layout.range.count);
+  copy.src = vertexBuffer;
+  copy.region.dstOffset = sizeof(TextGlyph) * layout.range.first;
+  copy.region.size = sizeof(TextGlyph) * layout.range.count;
+  layoutCopies.push_back(copy);
+}
+
+void TextRenderer::recordLayoutUploads(VkCommandBuffer commandBuffer) {
+  if (layoutCopies.empty())
+    return;
+
+  // One copy per ring buffer; the ring only changes if it grew mid-frame
+  std::vector<VkBufferCopy> regions;
+  for (size_t i = 0; i < layoutCopies.size(); i++) {
+    regions.push_back(layoutCopies[i].region);
+    if (i + 1 == layoutCopies.size() ||
+        layoutCopies[i + 1].src != layoutCopies[i].src) {
+      vkCmdCopyBuffer(commandBuffer, layoutCopies[i].src, layoutBuffer,
+                      static_cast<uint32_t>(regions.size()), regions.data());
+      regions.clear();
+    }
+  }
+  layoutCopies.clear();
+
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+}
+
+void TextRenderer::invalidateLayout(TextLayout handle) {
+  layouts.at(handle.id).dirty = true;
+}
+
+void TextRenderer::drawLayout(TextLayout handle) {
+  if (layouts.at(handle.id).range.count > 0) {
+    queuedLayouts.push_back(handle.id);
+  }
+}
+
+void TextRenderer::destroyLayout(TextLayout &handle) {
+  if (!handle.valid()) {
+    return;
+  }
+  RetainedLayout &layout = layouts.at(handle.id);
+  releaseRange(layout.range);
+  layout = RetainedLayout{};
+  handle = TextLayout{};
 }
 
 void TextRenderer::updateVertexBuffer() {
-  if (vertices.empty())
+  if (glyphs.empty())
     return;
 
-  void *data;
-  vkMapMemory(device, vertexMemory, 0, sizeof(TextVertex) * vertices.size(), 0,
-              &data);
-  memcpy(data, vertices.data(), sizeof(TextVertex) * vertices.size());
-  vkUnmapMemory(device, vertexMemory);
+  TextGlyph *dst = allocateGlyphs(glyphCount, preparedOffset);
+  memcpy(dst, glyphs.data(), sizeof(TextGlyph) * glyphs.size());
 }
 
 void TextRenderer::renderText(VkCommandBuffer commandBuffer,
                               const std::string &text, float x, float y,
                               float scale, float color[4]) {
-  prepareText(text, x, y, scale);
+  prepareText(text, x, y, scale, color);
 
-  if (vertexCount == 0)
+  if (glyphCount == 0)
     return;
 
   vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
@@ -485,13 +761,10 @@ void TextRenderer::renderText(VkCommandBuffer commandBuffer,
                           pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
 
   VkBuffer vertexBuffers[] = {vertexBuffer};
-  VkDeviceSize offsets[] = {0};
+  VkDeviceSize offsets[] = {preparedOffset};
   vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
 
-  vkCmdPushConstants(commandBuffer, pipelineLayout,
-                     VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float) * 4, color);
-
-  vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
+  vkCmdDraw(commandBuffer, 4, glyphCount, 0, 0);
 }
 
 void TextRenderer::createPipeline(VkRenderPass renderPass,
@@ -529,22 +802,33 @@ void TextRenderer::createPipeline(VkRenderPass renderPass,
   VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo,
                                                     fragShaderStageInfo};
 
-  // Vertex input
+  // Vertex input: one TextGlyph per instance, the corners come from
+  // gl_VertexIndex
   VkVertexInputBindingDescription bindingDescription{};
   bindingDescription.binding = 0;
-  bindingDescription.stride = sizeof(TextVertex);
-  bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+  bindingDescription.stride = sizeof(TextGlyph);
+  bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
-  std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+  std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions{};
   attributeDescriptions[0].binding = 0;
   attributeDescriptions[0].location = 0;
   attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
-  attributeDescriptions[0].offset = offsetof(TextVertex, pos);
+  attributeDescriptions[0].offset = offsetof(TextGlyph, pos);
 
   attributeDescriptions[1].binding = 0;
   attributeDescriptions[1].location = 1;
-  attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
-  attributeDescriptions[1].offset = offsetof(TextVertex, uv);
+  attributeDescriptions[1].format = VK_FORMAT_R16G16B16A16_UINT;
+  attributeDescriptions[1].offset = offsetof(TextGlyph, atlas);
+
+  attributeDescriptions[2].binding = 0;
+  attributeDescriptions[2].location = 2;
+  attributeDescriptions[2].format = VK_FORMAT_R32_SFLOAT;
+  attributeDescriptions[2].offset = offsetof(TextGlyph, scale);
+
+  attributeDescriptions[3].binding = 0;
+  attributeDescriptions[3].location = 3;
+  attributeDescriptions[3].format = VK_FORMAT_R8G8B8A8_UNORM;
+  attributeDescriptions[3].offset = offsetof(TextGlyph, color);
 
   VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
   vertexInputInfo.sType =
@@ -558,7 +842,7 @@ void TextRenderer::createPipeline(VkRenderPass renderPass,
   VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
   inputAssembly.sType =
       VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
   inputAssembly.primitiveRestartEnable = VK_FALSE;
 
   VkViewport viewport{};
@@ -617,17 +901,10 @@ void TextRenderer::createPipeline(VkRenderPass renderPass,
   colorBlending.attachmentCount = 1;
   colorBlending.pAttachments = &colorBlendAttachment;
 
-  VkPushConstantRange pushConstantRange{};
-  pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-  pushConstantRange.offset = 0;
-  pushConstantRange.size = sizeof(float) * 4;
-
   VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
   pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
   pipelineLayoutInfo.setLayoutCount = 1;
   pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-  pipelineLayoutInfo.pushConstantRangeCount = 1;
-  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
   if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
                              &pipelineLayout) != VK_SUCCESS) {
@@ -648,7 +925,7 @@ void TextRenderer::createPipeline(VkRenderPass renderPass,
   pipelineInfo.renderPass = renderPass;
   pipelineInfo.subpass = 0;
 
-  if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+  if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo,
                                 nullptr, &pipeline) != VK_SUCCESS) {
     throw std::runtime_error("failed to create text graphics pipeline!");
   }
@@ -688,151 +965,3 @@ std::vector<char> TextRenderer::readFile(const std::string &filename) {
 
   return buffer;
 }
-uint32_t TextRenderer::findMemoryType(uint32_t typeFilter,
-                                      VkMemoryPropertyFlags properties) {
-  VkPhysicalDeviceMemoryProperties memProperties;
-  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-    if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags &
-                                    properties) == properties) {
-      return i;
-    }
-  }
-
-  throw std::runtime_error("failed to find suitable memory type!");
-}
-
-void TextRenderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-                                VkMemoryPropertyFlags properties,
-                                VkBuffer &buffer,
-                                VkDeviceMemory &bufferMemory) {
-  VkBufferCreateInfo bufferInfo{};
-  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferInfo.size = size;
-  bufferInfo.usage = usage;
-  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-  if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create buffer!");
-  }
-
-  VkMemoryRequirements memRequirements;
-  vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
-
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex =
-      findMemoryType(memRequirements.memoryTypeBits, properties);
-
-  if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) !=
-      VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate buffer memory!");
-  }
-
-  vkBindBufferMemory(device, buffer, bufferMemory, 0);
-}
-
-VkCommandBuffer
-TextRenderer::beginSingleTimeCommands(VkCommandPool commandPool) {
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandPool = commandPool;
-  allocInfo.commandBufferCount = 1;
-
-  VkCommandBuffer commandBuffer;
-  vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-  VkCommandBufferBeginInfo beginInfo{};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-  vkBeginCommandBuffer(commandBuffer, &beginInfo);
-  return commandBuffer;
-}
-
-void TextRenderer::endSingleTimeCommands(VkCommandPool commandPool,
-                                         VkQueue graphicsQueue,
-                                         VkCommandBuffer commandBuffer) {
-  vkEndCommandBuffer(commandBuffer);
-
-  VkSubmitInfo submitInfo{};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffer;
-
-  vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(graphicsQueue);
-
-  vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-}
-
-void TextRenderer::transitionImageLayout(VkCommandPool commandPool,
-                                         VkQueue graphicsQueue, VkImage image,
-                                         VkFormat format,
-                                         VkImageLayout oldLayout,
-                                         VkImageLayout newLayout) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands(commandPool);
-
-  VkImageMemoryBarrier barrier{};
-  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  barrier.oldLayout = oldLayout;
-  barrier.newLayout = newLayout;
-  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.image = image;
-  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  barrier.subresourceRange.baseMipLevel = 0;
-  barrier.subresourceRange.levelCount = 1;
-  barrier.subresourceRange.baseArrayLayer = 0;
-  barrier.subresourceRange.layerCount = 1;
-
-  VkPipelineStageFlags sourceStage;
-  VkPipelineStageFlags destinationStage;
-
-  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-      newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-  } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-             newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-  } else {
-    throw std::invalid_argument("unsupported layout transition!");
-  }
-
-  vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0,
-                       nullptr, 0, nullptr, 1, &barrier);
-
-  endSingleTimeCommands(commandPool, graphicsQueue, commandBuffer);
-}
-
-void TextRenderer::copyBufferToImage(VkCommandPool commandPool,
-                                     VkQueue graphicsQueue, VkBuffer buffer,
-                                     VkImage image, uint32_t width,
-                                     uint32_t height) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands(commandPool);
-
-  VkBufferImageCopy region{};
-  region.bufferOffset = 0;
-  region.bufferRowLength = 0;
-  region.bufferImageHeight = 0;
-  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  region.imageSubresource.mipLevel = 0;
-  region.imageSubresource.baseArrayLayer = 0;
-  region.imageSubresource.layerCount = 1;
-  region.imageOffset = {0, 0, 0};
-  region.imageExtent = {width, height, 1};
-
-  vkCmdCopyBufferToImage(commandBuffer, buffer, image,
-                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-  endSingleTimeCommands(commandPool, graphicsQueue, commandBuffer);
-}
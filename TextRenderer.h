@@ -2,25 +2,30 @@
 #define TEXT_RENDERER_H
 
 #include <array>
+#include <cstdint>
 #include <string>
-#include <unordered_map>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
-struct CharacterInfo {
-  float ax; // advance x
-  float ay; // advance y
-  float bw; // bitmap width
-  float bh; // bitmap height
-  float bl; // bitmap left
-  float bt; // bitmap top
-  float tx; // texture x offset
-  float ty;
-};
+#include "DeviceAllocator.h"
+#include "GlyphTable.h"
+#include "UploadContext.h"
 
-struct TextVertex {
+// One glyph quad, drawn as a 4-vertex strip instance that text_vert.glsl
+// expands from gl_VertexIndex: the quad spans pos to pos + atlas size *
+// scale and samples the atlas rectangle `atlas` (x, y, w, h in texels)
+struct TextGlyph {
   float pos[2];
-  float uv[2];
+  uint16_t atlas[4];
+  float scale;
+  uint32_t color; // RGBA8, red in the lowest byte
+};
+static_assert(sizeof(TextGlyph) == 24, "TextGlyph is 24 bytes");
+
+// Handle to a retained text layout, see TextRenderer::createLayout()
+struct TextLayout {
+  uint32_t id = ~0u;
+  bool valid() const { return id != ~0u; }
 };
 
 class TextRenderer {
@@ -28,14 +33,27 @@ public:
   TextRenderer();
   ~TextRenderer();
 
-  // Initialize the text renderer with a font file
-  bool init(VkDevice device, VkPhysicalDevice physicalDevice,
-            VkCommandPool commandPool, VkQueue graphicsQueue,
-            const char *fontPath, float fontSize);
+  // Initialize the text renderer with a font file. The atlas upload is
+  // queued on `uploads`; flush it before the first frame draws text.
+  // Glyphs go to a persistently mapped ring with one slice per frame in
+  // flight, so a frame never overwrites what an earlier one still draws.
+  bool init(VkDevice device, DeviceAllocator &allocator,
+            UploadContext &uploads, const char *fontPath, float fontSize,
+            uint32_t framesInFlight);
 
   // Cleanup resources
   void cleanup();
 
+  // Loads the font and bakes its atlas on the CPU only; init() does this
+  // first. Enough for layoutGlyphs() without a device.
+  bool loadGlyphs(const char *fontPath, float fontSize);
+  const GlyphTable &getGlyphTable() const { return glyphTable; }
+
+  // Appends the glyphs of UTF-8 `text` to `out` exactly as addText() lays
+  // them out, colour spans included
+  void layoutGlyphs(const std::string &text, float x, float y, float scale,
+                    float color[4], std::vector<TextGlyph> &out);
+
   // Render text at specified position
   void renderText(VkCommandBuffer commandBuffer, const std::string &text,
                   float x, float y, float scale, float color[4]);
@@ -47,29 +65,68 @@ public:
   VkPipelineLayout getPipelineLayout() const { return pipelineLayout; }
   VkPipeline getPipeline() const { return pipeline; }
 
-  // Update text vertices for a given string
-  void prepareText(const std::string &text, float x, float y, float scale);
+  // Update text glyphs for a given string, colour spans as in addText()
+  void prepareText(const std::string &text, float x, float y, float scale,
+                   float color[4]);
 
-  // Get vertex buffer for binding
+  // Get the glyph instance buffer for binding; prepareText()'s glyphs start
+  // at getVertexOffset()
   VkBuffer getVertexBuffer() const { return vertexBuffer; }
-  uint32_t getVertexCount() const { return vertexCount; }
+  VkDeviceSize getVertexOffset() const { return preparedOffset; }
+  uint32_t getGlyphCount() const { return glyphCount; }
+
+  // Bytes of each frame's slice of the glyph ring; doubles whenever a
+  // frame needs more
+  VkDeviceSize getRingSliceSize() const { return sliceSize; }
 
   // Create graphics pipeline for text rendering
   void createPipeline(VkRenderPass renderPass, VkExtent2D swapChainExtent);
 
-  // Add these public methods:
-  void beginBatch();
+  // Optional cache used by createPipeline()
+  void setPipelineCache(VkPipelineCache cache) { pipelineCache = cache; }
+
+  // Starts the text of frame-in-flight `frameIndex`, whose fence must have
+  // been waited on: its slice of the glyph ring is reused from the start.
+  // renderText() and endBatch() append to the slice until the next call.
+  void beginBatch(uint32_t frameIndex);
+  // Colour travels with each glyph, so a whole batch is one draw. Inside
+  // `text`, "{#rrggbb}" or "{#rrggbbaa}" switches to that colour and "{/}"
+  // back to `color`; anything else in braces is drawn as is.
   void addText(const std::string &text, float x, float y, float scale,
                float color[4]);
   void endBatch(VkCommandBuffer commandBuffer);
 
+  // Retained text: a layout's glyphs stay in a device-local arena shared by
+  // every layout, so a string that does not change between frames is laid
+  // out and uploaded once. setLayoutText() lays the text out again only
+  // when the text, position, scale or colour differ from the last call, or
+  // after invalidateLayout(); recordLayoutUploads() copies it into the arena.
+  // drawLayout() queues the layout for the current batch; endBatch() draws
+  // the queued layouts in call order before the addText() glyphs, with one
+  // draw per run of layouts that sit next to each other in the arena
+  // (layouts set in the order they are drawn usually form a single run).
+  TextLayout createLayout();
+  void setLayoutText(TextLayout layout, const std::string &text, float x,
+                     float y, float scale, float color[4]);
+  void invalidateLayout(TextLayout layout);
+  void drawLayout(TextLayout layout);
+  void destroyLayout(TextLayout &layout);
+  // Records the arena copies of the layouts set since beginBatch(), staged
+  // in this frame's slice of the ring, and a barrier for the vertex input
+  // that draws them. Call after the frame's setLayoutText() calls and
+  // before the render pass endBatch() draws in.
+  void recordLayoutUploads(VkCommandBuffer commandBuffer);
+
+  // Layouts re-laid out since the last beginBatch(); 0 in steady state
+  uint32_t getRelayoutCount() const { return relayoutCount; }
+
 private:
   VkDevice device;
-  VkPhysicalDevice physicalDevice;
+  DeviceAllocator *allocator = nullptr;
 
   // Font bitmap texture
   VkImage fontAtlasImage;
-  VkDeviceMemory fontAtlasMemory;
+  DeviceAllocation fontAtlasMemory;
   VkImageView fontAtlasView;
   VkSampler fontSampler;
 
@@ -81,12 +138,28 @@ private:
   // Pipeline
   VkPipelineLayout pipelineLayout;
   VkPipeline pipeline;
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE;
 
-  // Vertex buffer for text quads
+  // Glyph ring for text quads: framesInFlight slices of sliceSize bytes,
+  // persistently mapped; ringHead is the write offset in frameIndex's slice
   VkBuffer vertexBuffer;
-  VkDeviceMemory vertexMemory;
-  std::vector<TextVertex> vertices;
-  uint32_t vertexCount;
+  DeviceAllocation vertexMemory;
+  VkDeviceSize sliceSize = 0;
+  uint32_t framesInFlight = 1;
+  uint32_t frameIndex = 0;
+  VkDeviceSize ringHead = 0;
+  std::vector<TextGlyph> glyphs;
+  uint32_t glyphCount;
+  VkDeviceSize preparedOffset = 0; // where updateVertexBuffer() put them
+
+  // Ring buffers replaced by a larger one; destroyed once every frame that
+  // may still read them has been waited on (framesLeft beginBatch() calls)
+  struct RetiredBuffer {
+    VkBuffer buffer;
+    DeviceAllocation memory;
+    uint32_t framesLeft;
+  };
+  std::vector<RetiredBuffer> retiredBuffers;
 
   // Font data
   unsigned char *fontBuffer;
@@ -94,7 +167,14 @@ private:
   int atlasWidth;
   int atlasHeight;
   float fontSize;
-  std::unordered_map<char, CharacterInfo> characterMap;
+  // Baked: ASCII 32-126 and Latin-1 160-255
+  GlyphTable glyphTable;
+
+  // layoutText() scratch, one entry per visible glyph: table index, pen
+  // offset along the line at the baked size, colour
+  std::vector<uint16_t> layoutIndex;
+  std::vector<float> layoutPen;
+  std::vector<uint32_t> layoutColor;
 
   // Helper functions
   bool loadFont(const char *fontPath, float fontSize);
@@ -104,32 +184,73 @@ private:
   void createDescriptorSet();
   void createVertexBuffer();
   void updateVertexBuffer();
+  // Appends the glyphs of UTF-8 `text` to `out`, starting in colour `color`
+  void layoutText(const std::string &text, float x, float y, float scale,
+                  uint32_t color, std::vector<TextGlyph> &out);
+  static uint32_t packColor(const float color[4]);
+  // Reserves `count` glyphs in this frame's slice, growing the ring if it
+  // is full; `offset` receives their byte offset in vertexBuffer
+  TextGlyph *allocateGlyphs(uint32_t count, VkDeviceSize &offset);
+  void growRing(VkDeviceSize minSliceSize);
 
-  uint32_t findMemoryType(uint32_t typeFilter,
-                          VkMemoryPropertyFlags properties);
-  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-                    VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                    VkDeviceMemory &bufferMemory);
   void copyBuffer(VkCommandPool commandPool, VkQueue graphicsQueue,
                   VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-  void transitionImageLayout(VkCommandPool commandPool, VkQueue graphicsQueue,
-                             VkImage image, VkFormat format,
-                             VkImageLayout oldLayout, VkImageLayout newLayout);
-  void copyBufferToImage(VkCommandPool commandPool, VkQueue graphicsQueue,
-                         VkBuffer buffer, VkImage image, uint32_t width,
-                         uint32_t height);
-  VkCommandBuffer beginSingleTimeCommands(VkCommandPool commandPool);
-  void endSingleTimeCommands(VkCommandPool commandPool, VkQueue graphicsQueue,
-                             VkCommandBuffer commandBuffer);
   std::vector<char> readFile(const std::string &filename);
   VkShaderModule createShaderModule(const std::vector<char> &code);
 
-  // Add private member:
-  struct TextBatchEntry {
-    std::vector<TextVertex> vertices;
-    float color[4];
+  // Glyphs added since beginBatch()
+  std::vector<TextGlyph> batchGlyphs;
+
+  // Instances [first, first + count) of the layout arena
+  struct GlyphRange {
+    uint32_t first = 0;
+    uint32_t count = 0;
+  };
+
+  struct RetainedLayout {
+    bool used = false;
+    bool dirty = true;
+    std::string text;
+    float x = 0.0f, y = 0.0f, scale = 0.0f;
+    uint32_t color = 0;
+    GlyphRange range;
+    std::vector<TextGlyph> glyphs; // kept to refill a grown arena
   };
-  std::vector<TextBatchEntry> batchEntries;
+  std::vector<RetainedLayout> layouts;
+  std::vector<uint32_t> queuedLayouts; // drawLayout() since beginBatch()
+  uint32_t relayoutCount = 0;
+
+  // Layout arena: layoutCapacity glyphs of device-local memory, filled by
+  // copies from the ring recorded in the frame's command buffer. Ranges
+  // below layoutTop not owned by a layout are in freeRanges (sorted,
+  // coalesced) or, while frames in flight may still draw them, in
+  // pendingFrees.
+  VkBuffer layoutBuffer = VK_NULL_HANDLE;
+  DeviceAllocation layoutMemory;
+  uint32_t layoutCapacity = 0;
+  uint32_t layoutTop = 0;
+  std::vector<GlyphRange> freeRanges;
+  struct PendingFree {
+    GlyphRange range;
+    uint32_t framesLeft;
+  };
+  std::vector<PendingFree> pendingFrees;
+  // Ring -> arena copies waiting for recordLayoutUploads()
+  struct LayoutCopy {
+    VkBuffer src;
+    VkBufferCopy region;
+  };
+  std::vector<LayoutCopy> layoutCopies;
+
+  // Retires `buffer` like growRing() retires the ring
+  void retireBuffer(VkBuffer &buffer, DeviceAllocation &memory);
+  bool allocateRange(uint32_t count, GlyphRange &range);
+  void releaseRange(GlyphRange &range);
+  void freeRange(GlyphRange range);
+  // Moves the arena to a buffer of at least minCapacity glyphs and uploads
+  // every layout again at its unchanged range
+  void growLayoutArena(uint32_t minCapacity);
+  void uploadLayout(const RetainedLayout &layout);
   bool inBatch = false;
 };
 
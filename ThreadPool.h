@@ -0,0 +1,48 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads pulling jobs from one FIFO queue. Jobs are
+// plain callables; submit() returns a future that carries the result or
+// rethrows whatever the job threw on get().
+class ThreadPool {
+public:
+  // 0 = one worker per hardware thread
+  explicit ThreadPool(size_t threadCount = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return workers.size(); }
+
+  template <typename F> auto submit(F &&job) -> std::future<decltype(job())> {
+    using Result = decltype(job());
+    auto task =
+        std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+    std::future<Result> result = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.emplace([task] { (*task)(); });
+    }
+    wake.notify_one();
+    return result;
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  void workerLoop();
+};
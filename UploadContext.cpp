@@ -0,0 +1,373 @@
+#include "UploadContext.h"
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+// Satisfies texel-size and 4-byte bufferOffset rules for every format used
+static const VkDeviceSize kStagingAlignment = 16;
+
+// Stages that may consume uploaded data on the graphics queue
+static const VkPipelineStageFlags kConsumerStages =
+    VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+static const VkAccessFlags kBufferReadAccess =
+    VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+    VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+static VkCommandPool createPool(VkDevice device, uint32_t family) {
+  VkCommandPoolCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
+               VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  info.queueFamilyIndex = family;
+  VkCommandPool pool;
+  if (vkCreateCommandPool(device, &info, nullptr, &pool) != VK_SUCCESS)
+    throw std::runtime_error("UploadContext: failed to create command pool");
+  return pool;
+}
+
+static VkCommandBuffer allocateCommandBuffer(VkDevice device,
+                                             VkCommandPool pool) {
+  VkCommandBufferAllocateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  info.commandPool = pool;
+  info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  info.commandBufferCount = 1;
+  VkCommandBuffer cb;
+  if (vkAllocateCommandBuffers(device, &info, &cb) != VK_SUCCESS)
+    throw std::runtime_error(
+        "UploadContext: failed to allocate command buffer");
+  return cb;
+}
+
+static void beginOneTime(VkCommandBuffer cb) {
+  VkCommandBufferBeginInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(cb, &info);
+}
+
+static VkImageSubresourceRange rangeOf(const VkBufferImageCopy &region) {
+  VkImageSubresourceRange range{};
+  range.aspectMask = region.imageSubresource.aspectMask;
+  range.baseMipLevel = region.imageSubresource.mipLevel;
+  range.levelCount = 1;
+  range.baseArrayLayer = region.imageSubresource.baseArrayLayer;
+  range.layerCount = region.imageSubresource.layerCount;
+  return range;
+}
+
+// ---------------------------------------------------------------------------
+// Public API
+// ---------------------------------------------------------------------------
+
+void UploadContext::init(DeviceAllocator &allocator_, uint32_t graphicsFamily_,
+                         VkQueue graphicsQueue_, uint32_t transferFamily_,
+                         VkQueue transferQueue_, VkDeviceSize stagingSize_) {
+  allocator = &allocator_;
+  device = allocator_.getDevice();
+  graphicsFamily = graphicsFamily_;
+  graphicsQueue = graphicsQueue_;
+  transferFamily = transferFamily_;
+  transferQueue = transferQueue_;
+  dedicatedTransfer = transferFamily != graphicsFamily;
+  stats = Stats{};
+
+  transferPool = createPool(device, transferFamily);
+  transferCmd = allocateCommandBuffer(device, transferPool);
+  if (dedicatedTransfer) {
+    acquirePool = createPool(device, graphicsFamily);
+    acquireCmd = allocateCommandBuffer(device, acquirePool);
+
+    VkSemaphoreCreateInfo semInfo{};
+    semInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    if (vkCreateSemaphore(device, &semInfo, nullptr, &transferDone) !=
+        VK_SUCCESS)
+      throw std::runtime_error("UploadContext: failed to create semaphore");
+  }
+
+  VkFenceCreateInfo fenceInfo{};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+    throw std::runtime_error("UploadContext: failed to create fence");
+
+  createStaging(stagingSize_);
+}
+
+void *UploadContext::stage(VkDeviceSize size, VkDeviceSize &offset) {
+  if (size > stagingSize) {
+    // Larger than the whole ring: drain it and grow
+    flush();
+    allocator->destroyBuffer(staging, stagingMemory);
+    VkDeviceSize newSize = stagingSize;
+    while (newSize < size)
+      newSize *= 2;
+    createStaging(newSize);
+  }
+
+  VkDeviceSize aligned =
+      (head + kStagingAlignment - 1) & ~(kStagingAlignment - 1);
+  if (aligned + size > stagingSize) {
+    flush();
+    aligned = 0;
+  }
+
+  offset = aligned;
+  head = aligned + size;
+  stats.bytes += size;
+  return static_cast<char *>(stagingMemory.mapped) + offset;
+}
+
+bool UploadContext::fits(VkDeviceSize size) const {
+  VkDeviceSize aligned =
+      (head + kStagingAlignment - 1) & ~(kStagingAlignment - 1);
+  return aligned + size <= stagingSize;
+}
+
+void UploadContext::copyToImage(VkImage image, VkExtent3D extent,
+                                VkDeviceSize offset, uint32_t baseLayer,
+                                uint32_t layerCount) {
+  ImageCopy copy{};
+  copy.image = image;
+  copy.region.bufferOffset = offset;
+  copy.region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  copy.region.imageSubresource.mipLevel = 0;
+  copy.region.imageSubresource.baseArrayLayer = baseLayer;
+  copy.region.imageSubresource.layerCount = layerCount;
+  copy.region.imageOffset = {0, 0, 0};
+  copy.region.imageExtent = extent;
+  imageCopies.push_back(copy);
+  stats.images++;
+}
+
+void UploadContext::uploadImage(VkImage image, VkExtent3D extent,
+                                const void *pixels, VkDeviceSize size,
+                                uint32_t layer) {
+  VkDeviceSize offset;
+  memcpy(stage(size, offset), pixels, (size_t)size);
+  copyToImage(image, extent, offset, layer, 1);
+}
+
+void UploadContext::uploadBuffer(VkBuffer buffer, VkDeviceSize dstOffset,
+                                 const void *data, VkDeviceSize size) {
+  BufferCopy copy{};
+  copy.buffer = buffer;
+  memcpy(stage(size, copy.region.srcOffset), data, (size_t)size);
+  copy.region.dstOffset = dstOffset;
+  copy.region.size = size;
+  bufferCopies.push_back(copy);
+  stats.buffers++;
+}
+
+void UploadContext::flush() {
+  if (imageCopies.empty() && bufferCopies.empty()) {
+    head = 0;
+    return;
+  }
+
+  recordTransfer();
+  if (dedicatedTransfer)
+    recordAcquire();
+
+  VkSubmitInfo submit{};
+  submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit.commandBufferCount = 1;
+  submit.pCommandBuffers = &transferCmd;
+  if (dedicatedTransfer) {
+    submit.signalSemaphoreCount = 1;
+    submit.pSignalSemaphores = &transferDone;
+    if (vkQueueSubmit(transferQueue, 1, &submit, VK_NULL_HANDLE) !=
+        VK_SUCCESS)
+      throw std::runtime_error("UploadContext: transfer submit failed");
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo acquire{};
+    acquire.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    acquire.waitSemaphoreCount = 1;
+    acquire.pWaitSemaphores = &transferDone;
+    acquire.pWaitDstStageMask = &waitStage;
+    acquire.commandBufferCount = 1;
+    acquire.pCommandBuffers = &acquireCmd;
+    if (vkQueueSubmit(graphicsQueue, 1, &acquire, fence) != VK_SUCCESS)
+      throw std::runtime_error("UploadContext: acquire submit failed");
+  } else {
+    if (vkQueueSubmit(transferQueue, 1, &submit, fence) != VK_SUCCESS)
+      throw std::runtime_error("UploadContext: submit failed");
+  }
+  stats.submits++;
+
+  auto waitStart = std::chrono::steady_clock::now();
+  vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+  vkResetFences(device, 1, &fence);
+  stats.waitMs += std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - waitStart)
+                      .count();
+
+  imageCopies.clear();
+  bufferCopies.clear();
+  head = 0;
+}
+
+void UploadContext::printStats(std::ostream &out) const {
+  out << "uploads: " << (double)stats.bytes / (1024.0 * 1024.0) << " MiB, "
+      << stats.images << " image / " << stats.buffers << " buffer copies, "
+      << stats.submits << " submit(s), " << stats.waitMs << " ms waiting ("
+      << (dedicatedTransfer ? "transfer" : "graphics") << " queue)"
+      << std::endl;
+}
+
+void UploadContext::cleanup() {
+  if (device == VK_NULL_HANDLE)
+    return;
+  flush();
+
+  allocator->destroyBuffer(staging, stagingMemory);
+  if (fence != VK_NULL_HANDLE)
+    vkDestroyFence(device, fence, nullptr);
+  if (transferDone != VK_NULL_HANDLE)
+    vkDestroySemaphore(device, transferDone, nullptr);
+  if (acquirePool != VK_NULL_HANDLE)
+    vkDestroyCommandPool(device, acquirePool, nullptr);
+  if (transferPool != VK_NULL_HANDLE)
+    vkDestroyCommandPool(device, transferPool, nullptr);
+
+  fence = VK_NULL_HANDLE;
+  transferDone = VK_NULL_HANDLE;
+  acquirePool = transferPool = VK_NULL_HANDLE;
+  acquireCmd = transferCmd = VK_NULL_HANDLE;
+  device = VK_NULL_HANDLE;
+}
+
+// ---------------------------------------------------------------------------
+// Internals
+// ---------------------------------------------------------------------------
+
+void UploadContext::createStaging(VkDeviceSize size) {
+  allocator->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          staging, stagingMemory);
+  stagingSize = size;
+  head = 0;
+}
+
+// All layout transitions go in one barrier batch before the copies and one
+// after, rather than a barrier per image
+void UploadContext::recordTransfer() {
+  beginOneTime(transferCmd);
+
+  std::vector<VkImageMemoryBarrier> toDst;
+  toDst.reserve(imageCopies.size());
+  for (const ImageCopy &copy : imageCopies) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = copy.image;
+    barrier.subresourceRange = rangeOf(copy.region);
+    toDst.push_back(barrier);
+  }
+  if (!toDst.empty())
+    vkCmdPipelineBarrier(transferCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, (uint32_t)toDst.size(), toDst.data());
+
+  for (const ImageCopy &copy : imageCopies)
+    vkCmdCopyBufferToImage(transferCmd, staging, copy.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                           &copy.region);
+  for (const BufferCopy &copy : bufferCopies)
+    vkCmdCopyBuffer(transferCmd, staging, copy.buffer, 1, &copy.region);
+
+  // Without a dedicated family this is the final barrier; with one it is the
+  // release half of the ownership transfer (dst access/stage are ignored)
+  uint32_t srcFamily =
+      dedicatedTransfer ? transferFamily : VK_QUEUE_FAMILY_IGNORED;
+  uint32_t dstFamily =
+      dedicatedTransfer ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+
+  std::vector<VkImageMemoryBarrier> toRead;
+  toRead.reserve(imageCopies.size());
+  for (const ImageCopy &copy : imageCopies) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dedicatedTransfer ? 0 : VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcQueueFamilyIndex = srcFamily;
+    barrier.dstQueueFamilyIndex = dstFamily;
+    barrier.image = copy.image;
+    barrier.subresourceRange = rangeOf(copy.region);
+    toRead.push_back(barrier);
+  }
+  std::vector<VkBufferMemoryBarrier> buffers;
+  buffers.reserve(bufferCopies.size());
+  for (const BufferCopy &copy : bufferCopies) {
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dedicatedTransfer ? 0 : kBufferReadAccess;
+    barrier.srcQueueFamilyIndex = srcFamily;
+    barrier.dstQueueFamilyIndex = dstFamily;
+    barrier.buffer = copy.buffer;
+    barrier.offset = copy.region.dstOffset;
+    barrier.size = copy.region.size;
+    buffers.push_back(barrier);
+  }
+  vkCmdPipelineBarrier(transferCmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       dedicatedTransfer ? static_cast<VkPipelineStageFlags>(
+                                               VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT)
+                                         : kConsumerStages,
+                       0, 0, nullptr, (uint32_t)buffers.size(),
+                       buffers.data(), (uint32_t)toRead.size(), toRead.data());
+
+  vkEndCommandBuffer(transferCmd);
+}
+
+// Acquire half of the ownership transfer; must mirror the release barriers
+void UploadContext::recordAcquire() {
+  beginOneTime(acquireCmd);
+
+  std::vector<VkImageMemoryBarrier> images;
+  images.reserve(imageCopies.size());
+  for (const ImageCopy &copy : imageCopies) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcQueueFamilyIndex = transferFamily;
+    barrier.dstQueueFamilyIndex = graphicsFamily;
+    barrier.image = copy.image;
+    barrier.subresourceRange = rangeOf(copy.region);
+    images.push_back(barrier);
+  }
+  std::vector<VkBufferMemoryBarrier> buffers;
+  buffers.reserve(bufferCopies.size());
+  for (const BufferCopy &copy : bufferCopies) {
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = kBufferReadAccess;
+    barrier.srcQueueFamilyIndex = transferFamily;
+    barrier.dstQueueFamilyIndex = graphicsFamily;
+    barrier.buffer = copy.buffer;
+    barrier.offset = copy.region.dstOffset;
+    barrier.size = copy.region.size;
+    buffers.push_back(barrier);
+  }
+  vkCmdPipelineBarrier(acquireCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       kConsumerStages, 0, 0, nullptr,
+                       (uint32_t)buffers.size(), buffers.data(),
+                       (uint32_t)images.size(), images.data());
+
+  vkEndCommandBuffer(acquireCmd);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "DeviceAllocator.h"
+
+// Batches host -> device uploads. Callers copy their data into a persistent,
+// persistently mapped staging ring and queue copies; flush() records every
+// pending barrier and copy into one command buffer, submits it once and
+// waits on a fence. Startup cost is then one submit per ring's worth of
+// bytes instead of three queue idles per image.
+//
+// When a dedicated transfer queue family is available the copies run there
+// and each resource is released to the graphics family, which acquires it
+// in a second, tiny command buffer that waits on a semaphore.
+class UploadContext {
+public:
+  struct Stats {
+    uint64_t bytes = 0;
+    uint32_t images = 0;  // image regions copied
+    uint32_t buffers = 0; // buffer regions copied
+    uint32_t submits = 0;
+    double waitMs = 0.0; // time spent blocked in flush()
+  };
+
+  // transferQueue may equal graphicsQueue (same family); everything then
+  // runs in a single submit without ownership transfers
+  void init(DeviceAllocator &allocator, uint32_t graphicsFamily,
+            VkQueue graphicsQueue, uint32_t transferFamily,
+            VkQueue transferQueue,
+            VkDeviceSize stagingSize = 16ull * 1024 * 1024);
+
+  // Reserves `size` bytes of staging memory and returns a pointer to fill.
+  // May flush (and wait) when the ring is full, so fill it before the next
+  // call. `offset` receives the ring offset to pass to copyToImage().
+  void *stage(VkDeviceSize size, VkDeviceSize &offset);
+
+  // True if stage(size) would fit without flushing. Lets callers reserve
+  // several ranges up front and fill them later (e.g. from worker threads)
+  bool fits(VkDeviceSize size) const;
+
+  // Queues a copy of staged data into layers [baseLayer, baseLayer +
+  // layerCount) of mip 0, transitioning UNDEFINED -> SHADER_READ_ONLY
+  void copyToImage(VkImage image, VkExtent3D extent, VkDeviceSize offset,
+                   uint32_t baseLayer = 0, uint32_t layerCount = 1);
+
+  // stage() + memcpy + copyToImage()
+  void uploadImage(VkImage image, VkExtent3D extent, const void *pixels,
+                   VkDeviceSize size, uint32_t layer = 0);
+
+  // Queues a copy into a device-local buffer read by shaders or as vertex
+  // input afterwards
+  void uploadBuffer(VkBuffer buffer, VkDeviceSize dstOffset, const void *data,
+                    VkDeviceSize size);
+
+  // Submits everything queued so far and waits for it; a no-op when idle
+  void flush();
+
+  bool usesTransferQueue() const { return dedicatedTransfer; }
+  const Stats &getStats() const { return stats; }
+  void printStats(std::ostream &out) const;
+
+  void cleanup();
+
+private:
+  struct ImageCopy {
+    VkImage image;
+    VkBufferImageCopy region;
+  };
+  struct BufferCopy {
+    VkBuffer buffer;
+    VkBufferCopy region;
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator *allocator = nullptr;
+
+  uint32_t graphicsFamily = 0;
+  uint32_t transferFamily = 0;
+  VkQueue graphicsQueue = VK_NULL_HANDLE;
+  VkQueue transferQueue = VK_NULL_HANDLE;
+  bool dedicatedTransfer = false;
+
+  VkCommandPool transferPool = VK_NULL_HANDLE;
+  VkCommandBuffer transferCmd = VK_NULL_HANDLE;
+  // Only with a dedicated transfer family: ownership acquire on graphics
+  VkCommandPool acquirePool = VK_NULL_HANDLE;
+  VkCommandBuffer acquireCmd = VK_NULL_HANDLE;
+  VkSemaphore transferDone = VK_NULL_HANDLE;
+  VkFence fence = VK_NULL_HANDLE;
+
+  VkBuffer staging = VK_NULL_HANDLE;
+  DeviceAllocation stagingMemory;
+  VkDeviceSize stagingSize = 0;
+  VkDeviceSize head = 0;
+
+  std::vector<ImageCopy> imageCopies;
+  std::vector<BufferCopy> bufferCopies;
+
+  Stats stats;
+
+  void createStaging(VkDeviceSize size);
+  void recordTransfer();
+  void recordAcquire();
+};
@@ -1,2 +1,9 @@
 glslc shader.vert -o vert.spv
 glslc shader.frag -o frag.spv
+glslc -DMAP_COUNTERS_READONLY shader.frag -o frag_nocounters.spv
+glslc sdf_bake.comp -o sdf_bake.comp.spv
+glslc upscale.frag -o upscale.frag.spv
+glslc image_flash.vert -o image_flash.vert.spv
+glslc image_flash.frag -o image_flash.frag.spv
+glslc -fshader-stage=vertex text_vert.glsl -o text_vert.spv
+glslc -fshader-stage=fragment text_frag.glsl -o text_frag.spv
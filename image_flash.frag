@@ -1,10 +1,23 @@
 #version 450
 
-layout(set = 0, binding = 0) uniform sampler2D tex;
+// Flash images live in one array texture (or single-layer arrays when the
+// images differ in size). blend cross-fades from layerA to layerB.
+layout(set = 0, binding = 0) uniform sampler2DArray tex;
+
+layout(push_constant) uniform PushConstants {
+    int layerA;
+    int layerB;
+    float blend;
+} pc;
 
 layout(location = 0) in vec2 inUV;
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = texture(tex, inUV);
+    vec4 a = texture(tex, vec3(inUV, float(pc.layerA)));
+    if (pc.blend > 0.0) {
+        vec4 b = texture(tex, vec3(inUV, float(pc.layerB)));
+        a = mix(a, b, pc.blend);
+    }
+    outColor = a;
 }
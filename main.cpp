@@ -6,20 +6,43 @@
 #include <GLFW/glfw3native.h>
 
 #include <algorithm> // Necessary for std::clamp
+#include <array>
+#include <cctype>
 #include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <cstdint> // Necessary for uint32_t
 #include <cstdlib>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <limits> // Necessary for std::numeric_limits
 #include <optional>
 #include <set>
 #include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "ConePrepass.h"
+#include "CpuRaymarcher.h"
+#include "CpuProfiler.h"
+#include "DeviceAllocator.h"
+#include "GpuProfiler.h"
 #include "ImageFlasher.h"
+#include "ImageWriter.h"
+#include "MapCounters.h"
+#include "OffscreenTarget.h"
+#include "PipelineCache.h"
+#include "RaymarchTarget.h"
+#include "SceneBuffer.h"
+#include "SdfScene.h"
+#include "SdfVolume.h"
 #include "TextRenderer.h"
+#include "UploadContext.h"
 #include "TextSystem.cpp"
 
 const uint32_t WIDTH = 1980;
@@ -40,11 +63,370 @@ const bool enableValidationLayers = false;
 const bool enableValidationLayers = true;
 #endif
 
+// command line options; the defaults run the interactive windowed app
+struct AppOptions {
+  // render into an offscreen image instead of a window and dump frames
+  bool headless = false;
+  std::string outputDir = "frames";
+  std::string imageFormat = "png";
+  // how many times each schedule entry is rendered (for timing)
+  int repeat = 1;
+  // (state, time) pairs rendered in order when headless
+  std::vector<std::pair<int, float>> schedule;
+  // raymarch resolution: a fixed scale, or adapted to hit a GPU budget.
+  // Headless defaults to a fixed full-resolution render.
+  float renderScale = 0.0f; // 0 = adaptive
+  float targetMs = 12.0f;   // raymarch pass budget when adaptive
+  // compiled pipelines are kept here between runs; empty disables it
+  std::string pipelineCachePath = "pipeline_cache.bin";
+  // flash scene image sequence: every image in this directory, sorted by
+  // name (default: the three bundled images)
+  std::string flashDir;
+  // resident texture slots when streaming the sequence; 0 = preload all,
+  // -1 = stream only sequences longer than kAutoStreamImages
+  int flashStreamSlots = -1;
+  // fraction of each flash image's time spent cross-fading into the next
+  float flashFade = 0.0f;
+  // raymarch shader debug bits (kSdfDebug*)
+  int sdfDebug = 0;
+  // read the static bedroom geometry from a baked distance volume
+  bool sdfBake = true;
+  // reuse last frame's shadow and occlusion terms where they reproject
+  bool shadowHistory = true;
+  // start primary rays at a per-tile depth from a low-resolution cone march
+  bool conePrepass = true;
+  // normal estimator for every state (kNormal*), -1 = per-state default
+  int normalMode = -1;
+  // raymarch shading mode at startup (kShading*), F2 cycles at run time
+  int shading = 0;
+  // render the schedule with the CPU reference raymarcher instead of Vulkan
+  bool cpu = false;
+  std::optional<CpuRaymarcher::Isa> cpuIsa; // unset = widest supported
+  int cpuThreads = 0;                       // 0 = one per hardware thread
+  // static geometry from a JSON scene file instead of the hand-written one
+  std::string scenePath;
+  // compile genSceneInput to GLSL in genSceneOutput and exit
+  std::string genSceneInput;
+  std::string genSceneOutput;
+  // time text layout on the CPU and exit
+  bool benchText = false;
+};
+
+// Mirror the DEBUG_* bits in shader.frag
+const int kSdfDebugCount = 1;   // read back map() counters every frame
+const int kSdfDebugHeatmap = 2; // shade by primitive evaluations per pixel
+const int kSdfDebugNoCull = 4;  // evaluate every SDF group
+const int kSdfDebugSteps = 8;   // heatmap of primary march iterations
+const int kSdfDebugNoCone = 16; // march from the camera despite the pre-pass
+
+// raymarch shader push constants, shader.frag's PushConstants block
+struct RaymarchPushConstants {
+  float resolution[2];
+  float time;
+  float starttime;
+  int debug;
+  float prevTime; // frameTime of the raymarch frame that wrote the history
+  int frame;
+  int historyValid;
+  float wallRot[3][4]; // mat3 columns, std430-padded to vec4
+  float maskPos[3];
+  float wallOpen;
+  int checkerParity; // RaymarchTarget::checkerParity()
+};
+static_assert(sizeof(RaymarchPushConstants) <= 128,
+              "push constants beyond the guaranteed 128 bytes");
+
+// The animated part of the scene at shader time `time`, state `state`
+// having begun at `startTime`: the mask's bob and the room walls' opening
+// and turn. map() reads these from the push constants instead of
+// evaluating sin()/smoothstep()/rotatez() for every sample.
+void raymarchTransforms(int state, float time, float startTime,
+                        RaymarchPushConstants &pc) {
+  // the room is still in state 9 and starts moving in state 10
+  float roomTime = state == 9 ? 0.0f : time - startTime;
+
+  float angle = roomTime / 4.0f;
+  float c = std::cos(angle);
+  float s = std::sin(angle);
+  // rotatez(): columns (c, -s, 0), (s, c, 0), (0, 0, 1)
+  const float wallRot[3][4] = {
+      {c, -s, 0.0f, 0.0f}, {s, c, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f, 0.0f}};
+  std::memcpy(pc.wallRot, wallRot, sizeof(wallRot));
+
+  pc.maskPos[0] = 0.0f;
+  pc.maskPos[1] = -3.5f + std::sin(time) * 0.1f;
+  pc.maskPos[2] = 2.0f;
+
+  float open = std::clamp(roomTime / 10.0f, 0.0f, 1.0f);
+  pc.wallOpen = open * open * (3.0f - 2.0f * open) * 10.0f;
+}
+
+// Mirror the NORMAL_* estimators in shader.frag
+const int kNormalForward = 0;  // forward differences, 3 map() calls
+const int kNormalTetra = 1;    // tetrahedral differences, 4 map() calls
+const int kNormalGroup = 2;    // tetrahedral, hit group only
+const int kNormalAnalytic = 3; // closed form where known, else kNormalGroup
+
+// Raymarch shading modes
+const int kShadingFull = 0;         // every pixel, every frame
+const int kShadingCheckerboard = 1; // half the pixels per frame, see
+                                    // RaymarchTarget
+const int kShadingCoarse = 2; // one shade per 2x2 pixels, needs
+                              // VK_KHR_fragment_shading_rate
+const int kShadingModes = 3;
+
+const char *shadingName(int mode) {
+  switch (mode) {
+  case kShadingCheckerboard:
+    return "checkerboard";
+  case kShadingCoarse:
+    return "coarse 2x2";
+  default:
+    return "full";
+  }
+}
+
+// the flash scene draws images instead of raymarching
+const int kFlashState = 8;
+
+// Specialization constants of one raymarch pipeline, shader.frag's
+// constant_id 0-9 in order
+struct RaymarchVariant {
+  int32_t state;
+  int32_t marchSteps;
+  int32_t shadowSteps;
+  VkBool32 shadows;
+  VkBool32 occlusion;
+  VkBool32 staticVolume;
+  int32_t historyRefresh;
+  int32_t coneMode;
+  int32_t normalMode;
+  int32_t sceneSource; // 1 = static geometry from the scene buffer
+};
+
+// Per-state raymarch settings; every scene currently renders at full
+// quality, cheaper states only need their entry changed here. The bedroom
+// (states below 9) reads its static geometry from the baked volume. Shadow
+// and occlusion are recomputed for each tile every 8th frame and reused
+// from the history in between, except from state 10 on, where the walls
+// that cast them turn and slide every frame. Primary rays start at the cone
+// pre-pass depth, and normals come from closed-form gradients where the
+// hit group has them.
+RaymarchVariant raymarchVariant(int state) {
+  return {state, 500, 500, VK_TRUE, VK_TRUE, state < 9, state < 10 ? 8 : 0,
+          1, kNormalAnalytic, 0};
+}
+
+// sequences longer than this are streamed with kAutoStreamSlots slots
+const size_t kAutoStreamImages = 64;
+const int kAutoStreamSlots = 16;
+
+void printUsage(const char *program) {
+  std::cout
+      << "usage: " << program << " [options]\n"
+      << "  --headless            render offscreen and write frames to disk\n"
+      << "  --out <dir>           output directory (default: frames)\n"
+      << "  --format <png|ppm>    frame file format (default: png)\n"
+      << "  --frames <s:t,...>    state:time pairs to render\n"
+      << "                        (default: every state at t=1.0)\n"
+      << "  --repeat <n>          render each frame n times and report the\n"
+      << "                        average frame time\n"
+      << "  --render-scale <f>    raymarch at a fixed fraction of the output\n"
+      << "                        resolution (0.35-1)\n"
+      << "  --target-ms <ms>      adapt the raymarch resolution to this GPU\n"
+      << "                        budget (default: 12)\n"
+      << "  --no-pipeline-cache   start without (and do not write) the\n"
+      << "                        on-disk pipeline cache\n"
+      << "  --flash-dir <dir>     play every image in dir (sorted) in the\n"
+      << "                        flash scene\n"
+      << "  --flash-stream <n>    keep only n flash images on the GPU and\n"
+      << "                        decode ahead of playback; 0 preloads all\n"
+      << "                        (default: stream sequences over 64)\n"
+      << "  --flash-fade <f>      cross-fade over the last fraction f of each\n"
+      << "                        flash image (0-1, default: 0 = hard cuts)\n"
+      << "  --sdf-debug <m,...>   raymarch debug modes: count (report map()\n"
+      << "                        calls per pixel), heatmap, nocull, steps\n"
+      << "                        (heatmap of primary ray iterations),\n"
+      << "                        nocone (ignore the cone pre-pass)\n"
+      << "  --no-sdf-bake         evaluate the static bedroom analytically\n"
+      << "                        instead of baking it into a volume\n"
+      << "  --no-shadow-history   recompute shadows and occlusion for every\n"
+      << "                        pixel each frame\n"
+      << "  --no-cone-prepass     march primary rays from the camera without\n"
+      << "                        the low-resolution cone pre-pass\n"
+      << "  --normals <mode>      normal estimator: forward, tetra, group or\n"
+      << "                        analytic (default)\n"
+      << "  --shading <mode>      raymarch shading: full (default),\n"
+      << "                        checkerboard (from the 2nd repeat when\n"
+      << "                        headless) or coarse; F2 cycles them\n"
+      << "  --cpu                 render the schedule with the CPU reference\n"
+      << "                        raymarcher (no GPU needed), report rays/s\n"
+      << "  --cpu-isa <isa>       scalar, sse or avx2 (default: widest the\n"
+      << "                        CPU supports)\n"
+      << "  --cpu-threads <n>     CPU raymarcher workers (default: one per\n"
+      << "                        hardware thread)\n"
+      << "  --scene <file>        read the static geometry from a JSON scene\n"
+      << "                        file (see scenes/default.json)\n"
+      << "  --gen-scene <in> <out>\n"
+      << "                        compile scene file in to GLSL for a\n"
+      << "                        SCENE_GENERATED shader build, then exit\n"
+      << "  --bench-text          report glyphs laid out per second with the\n"
+      << "                        glyph table and the old per-char map, then\n"
+      << "                        exit\n";
+}
+
+AppOptions parseOptions(int argc, char **argv) {
+  AppOptions options;
+  bool targetGiven = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto next = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("missing value for " + arg);
+      }
+      return argv[++i];
+    };
+
+    if (arg == "--headless") {
+      options.headless = true;
+    } else if (arg == "--out") {
+      options.outputDir = next();
+    } else if (arg == "--format") {
+      options.imageFormat = next();
+      if (options.imageFormat != "png" && options.imageFormat != "ppm") {
+        throw std::runtime_error("unknown image format: " +
+                                 options.imageFormat);
+      }
+    } else if (arg == "--repeat") {
+      options.repeat = std::max(1, std::stoi(next()));
+    } else if (arg == "--render-scale") {
+      options.renderScale = std::stof(next());
+    } else if (arg == "--target-ms") {
+      options.targetMs = std::stof(next());
+      options.renderScale = 0.0f;
+      targetGiven = true;
+    } else if (arg == "--no-pipeline-cache") {
+      options.pipelineCachePath.clear();
+    } else if (arg == "--flash-dir") {
+      options.flashDir = next();
+    } else if (arg == "--flash-stream") {
+      options.flashStreamSlots = std::max(0, std::stoi(next()));
+    } else if (arg == "--flash-fade") {
+      options.flashFade = std::clamp(std::stof(next()), 0.0f, 1.0f);
+    } else if (arg == "--no-sdf-bake") {
+      options.sdfBake = false;
+    } else if (arg == "--no-shadow-history") {
+      options.shadowHistory = false;
+    } else if (arg == "--no-cone-prepass") {
+      options.conePrepass = false;
+    } else if (arg == "--normals") {
+      std::string mode = next();
+      if (mode == "forward") {
+        options.normalMode = kNormalForward;
+      } else if (mode == "tetra") {
+        options.normalMode = kNormalTetra;
+      } else if (mode == "group") {
+        options.normalMode = kNormalGroup;
+      } else if (mode == "analytic") {
+        options.normalMode = kNormalAnalytic;
+      } else {
+        throw std::runtime_error("unknown normal estimator: " + mode);
+      }
+    } else if (arg == "--shading") {
+      std::string mode = next();
+      if (mode == "full") {
+        options.shading = kShadingFull;
+      } else if (mode == "checkerboard") {
+        options.shading = kShadingCheckerboard;
+      } else if (mode == "coarse") {
+        options.shading = kShadingCoarse;
+      } else {
+        throw std::runtime_error("unknown shading mode: " + mode);
+      }
+    } else if (arg == "--cpu") {
+      options.cpu = true;
+    } else if (arg == "--cpu-isa") {
+      std::string isa = next();
+      if (isa == "scalar") {
+        options.cpuIsa = CpuRaymarcher::Isa::Scalar;
+      } else if (isa == "sse") {
+        options.cpuIsa = CpuRaymarcher::Isa::Sse;
+      } else if (isa == "avx2") {
+        options.cpuIsa = CpuRaymarcher::Isa::Avx2;
+      } else {
+        throw std::runtime_error("unknown cpu instruction set: " + isa);
+      }
+    } else if (arg == "--cpu-threads") {
+      options.cpuThreads = std::max(0, std::stoi(next()));
+    } else if (arg == "--scene") {
+      options.scenePath = next();
+    } else if (arg == "--gen-scene") {
+      options.genSceneInput = next();
+      options.genSceneOutput = next();
+    } else if (arg == "--bench-text") {
+      options.benchText = true;
+    } else if (arg == "--sdf-debug") {
+      std::string list = next();
+      size_t pos = 0;
+      while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+          end = list.size();
+        }
+        std::string mode = list.substr(pos, end - pos);
+        if (mode == "count") {
+          options.sdfDebug |= kSdfDebugCount;
+        } else if (mode == "heatmap") {
+          options.sdfDebug |= kSdfDebugHeatmap;
+        } else if (mode == "nocull") {
+          options.sdfDebug |= kSdfDebugNoCull;
+        } else if (mode == "steps") {
+          options.sdfDebug |= kSdfDebugSteps | kSdfDebugHeatmap;
+        } else if (mode == "nocone") {
+          options.sdfDebug |= kSdfDebugNoCone;
+        } else {
+          throw std::runtime_error("unknown sdf debug mode: " + mode);
+        }
+        pos = end + 1;
+      }
+    } else if (arg == "--frames") {
+      std::string list = next();
+      size_t pos = 0;
+      while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+          end = list.size();
+        }
+        std::string entry = list.substr(pos, end - pos);
+        size_t colon = entry.find(':');
+        if (colon == std::string::npos) {
+          throw std::runtime_error("expected state:time, got " + entry);
+        }
+        options.schedule.push_back({std::stoi(entry.substr(0, colon)),
+                                    std::stof(entry.substr(colon + 1))});
+        pos = end + 1;
+      }
+    } else if (arg == "--help" || arg == "-h") {
+      printUsage(argv[0]);
+      std::exit(EXIT_SUCCESS);
+    } else {
+      throw std::runtime_error("unknown option: " + arg);
+    }
+  }
+  // keep headless frames reproducible unless adaptation was asked for
+  if (options.headless && options.renderScale == 0.0f && !targetGiven) {
+    options.renderScale = 1.0f;
+  }
+  return options;
+}
+
 // stores the indicies of the Queue Families
 // these indicies represent queue families availble on the logical device
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphicsFamily;
   std::optional<uint32_t> presentFamily;
+  // transfer-capable family without graphics (a DMA engine), if any
+  std::optional<uint32_t> transferFamily;
 
   bool isComplete() {
     return graphicsFamily.has_value() && presentFamily.has_value();
@@ -86,7 +468,35 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance,
 
 class HelloTriangleApplication {
 public:
+  explicit HelloTriangleApplication(const AppOptions &options)
+      : options(options) {}
+
   void run() {
+    if (!options.genSceneInput.empty()) {
+      generateScene();
+      return;
+    }
+    if (options.benchText) {
+      benchText();
+      return;
+    }
+    if (!options.scenePath.empty()) {
+      sceneFile.load(options.scenePath);
+      std::cout << "scene: " << options.scenePath << ", "
+                << sceneFile.getGroups().size() << " groups, "
+                << sceneFile.getInstructions().size() << " instructions"
+                << std::endl;
+    }
+    if (options.cpu) {
+      renderCpu();
+      return;
+    }
+    if (options.headless) {
+      initVulkan();
+      renderHeadless();
+      cleanup();
+      return;
+    }
     initWindow();
     initVulkan();
     mainLoop();
@@ -94,7 +504,9 @@ public:
   }
 
 private:
-  GLFWwindow *window;
+  AppOptions options;
+
+  GLFWwindow *window = nullptr;
 
   VkInstance instance;
   VkDebugUtilsMessengerEXT debugMessenger;
@@ -104,8 +516,9 @@ private:
 
   VkQueue graphicsQueue;
   VkQueue presentQueue;
+  VkQueue transferQueue;
 
-  VkSurfaceKHR surface;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
 
   VkSwapchainKHR swapChain;
   std::vector<VkImage> swapChainImages;
@@ -115,7 +528,10 @@ private:
 
   VkRenderPass renderPass;
   VkPipelineLayout pipelineLayout;
-  VkPipeline graphicsPipeline;
+  // one raymarch pipeline per state, VK_NULL_HANDLE for kFlashState
+  std::vector<VkPipeline> raymarchPipelines;
+  // matching CONE_MODE 2 variants, empty with --no-cone-prepass
+  std::vector<VkPipeline> conePipelines;
   std::vector<VkFramebuffer> swapChainFramebuffers;
 
   VkCommandPool commandPool;
@@ -126,6 +542,9 @@ private:
   std::vector<VkFence> inFlightFences;
 
   TextRenderer textRenderer;
+  // the question and its three answers only change on qa.advance()
+  TextLayout promptLayout;
+  TextLayout answerLayouts[3];
   bool framebufferResized = false;
 
   std::chrono::steady_clock::time_point lastKeyTime;
@@ -133,8 +552,48 @@ private:
   std::vector<std::string> flashImagePaths = {
       "Assets/img0.png", "Assets/img1.png", "Assets/img2.png"};
 
+  // stands in for the swapchain when headless
+  OffscreenTarget offscreenTarget;
+  // the raymarch renders here at a possibly reduced resolution
+  RaymarchTarget raymarchTarget;
+  // shared by every pipeline we create
+  PipelineCache pipelineCache;
+  // every buffer and image gets its memory from here
+  DeviceAllocator allocator;
+  // batches texture/buffer uploads into as few submits as possible
+  UploadContext uploadContext;
+
+  // per-pass GPU timings; F1 toggles the on-screen summary
+  GpuProfiler gpuProfiler;
+  bool showProfilerOverlay = false;
+  bool profilerKeyDown = false;
+  // kShading* of the raymarch pass; F2 cycles
+  int shadingMode = kShadingFull;
+  bool shadingKeyDown = false;
+  // VK_KHR_fragment_shading_rate with pipelineFragmentShadingRate
+  bool coarseShadingSupported = false;
+  // fragmentStoresAndAtomics; picks frag.spv or frag_nocounters.spv
+  bool fragmentStoresSupported = false;
+  PFN_vkCmdSetFragmentShadingRateKHR cmdSetFragmentShadingRate = nullptr;
+  // where the CPU side of each frame goes
+  CpuProfiler cpuProfiler;
+  // map() call counts from the raymarch shader (--sdf-debug count)
+  MapCounters mapCounters;
+  // static bedroom distance field, baked on the first bedroom frame
+  SdfVolume sdfVolume;
+  // per-tile start depth for the primary rays
+  ConePrepass conePrepass;
+  // --scene geometry, and its copy on the GPU (set 4)
+  SdfScene sceneFile;
+  SceneBuffer sceneBuffer;
+
   QASession qa;
   float sceneStartTime = 0.0f;
+  // time fed to the shaders for the frame being recorded
+  float frameTime = 0.0f;
+  // frameTime of the last raymarched frame, whose history the next reads
+  float lastRaymarchTime = 0.0f;
+  uint32_t raymarchFrame = 0;
   int lastState = -1;
 
   void initWindow() {
@@ -155,29 +614,225 @@ private:
   }
 
   void initVulkan() {
+    auto startupBegin = std::chrono::steady_clock::now();
     createInstance();
     setupDebugMessenger();
-    createSurface();
+    if (!options.headless) {
+      createSurface();
+    }
     pickPhysicalDevice();
     createLogicalDevice();
-    createSwapChain();
+    allocator.init(device, physicalDevice);
+    if (options.headless) {
+      // same format the window path prefers, so output matches on screen
+      swapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+      swapChainExtent = {WIDTH, HEIGHT};
+    } else {
+      createSwapChain();
+      createImageViews();
+    }
 
-    createImageViews();
     createRenderPass();
+    mapCounters.init(allocator, MAX_FRAMES_IN_FLIGHT);
+    pipelineCache.init(device, physicalDevice, options.pipelineCachePath);
+    textRenderer.setPipelineCache(pipelineCache.get());
+    imageFlasher.setPipelineCache(pipelineCache.get());
+    raymarchTarget.setPipelineCache(pipelineCache.get());
+    sdfVolume.setPipelineCache(pipelineCache.get());
+    sdfVolume.init(device, allocator);
+
+    // the raymarch pipelines render into its pass
+    raymarchTarget.init(device, allocator, renderPass, swapChainImageFormat,
+                        swapChainExtent);
+    conePrepass.init(device, allocator, swapChainExtent);
+    setShadingMode(options.shading);
+    sceneBuffer.init(allocator, sceneFile.empty() ? nullptr : &sceneFile);
+
+    auto pipelineBegin = std::chrono::steady_clock::now();
     createGraphicsPipeline();
-    createFramebuffers();
+    double raymarchPipelineMs = std::chrono::duration<double, std::milli>(
+                                    std::chrono::steady_clock::now() -
+                                    pipelineBegin)
+                                    .count();
+    if (options.headless) {
+      offscreenTarget.init(device, allocator, renderPass,
+                           swapChainImageFormat, swapChainExtent);
+    } else {
+      createFramebuffers();
+    }
+    if (options.renderScale > 0.0f) {
+      raymarchTarget.setFixedScale(options.renderScale);
+    } else {
+      raymarchTarget.setTargetMs(options.targetMs);
+    }
     createCommandPool();
-    textRenderer.init(device, physicalDevice, commandPool, graphicsQueue,
-                      "./font.ttf", 32.0f);
+    createUploadContext();
+    textRenderer.init(device, allocator, uploadContext, "./font.ttf", 32.0f,
+                      MAX_FRAMES_IN_FLIGHT);
     textRenderer.createPipeline(renderPass, swapChainExtent);
-    imageFlasher.init(device, physicalDevice, commandPool, graphicsQueue,
-                      renderPass, swapChainExtent, flashImagePaths);
+    promptLayout = textRenderer.createLayout();
+    for (TextLayout &layout : answerLayouts) {
+      layout = textRenderer.createLayout();
+    }
+    configureFlashSequence();
+    imageFlasher.init(device, allocator, uploadContext, renderPass,
+                      swapChainExtent, flashImagePaths);
+    if (imageFlasher.isPacked()) {
+      std::cout << "flash: " << flashImagePaths.size()
+                << " images packed into one array texture" << std::endl;
+    }
+    sceneBuffer.upload(uploadContext);
+    // one submit for the font atlas, every flash image and the scene
+    uploadContext.flush();
     createCommandBuffer();
     createSyncObjects();
+
+    QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+    gpuProfiler.init(device, physicalDevice, indices.graphicsFamily.value(),
+                     MAX_FRAMES_IN_FLIGHT);
+
+    double startupMs = std::chrono::duration<double, std::milli>(
+                           std::chrono::steady_clock::now() - startupBegin)
+                           .count();
+    std::cout << "startup: " << startupMs << " ms, raymarch pipelines "
+              << raymarchPipelineMs << " ms, pipeline cache "
+              << (pipelineCache.getLoadedBytes() > 0 ? "warm (" : "cold (")
+              << pipelineCache.getLoadedBytes() << " bytes)" << std::endl;
+    uploadContext.printStats(std::cout);
+    allocator.printStats(std::cout);
+    if (staticVolumeEnabled()) {
+      VkExtent3D volumeExtent = sdfVolume.getExtent();
+      std::cout << "static sdf volume: " << volumeExtent.width << "x"
+                << volumeExtent.height << "x" << volumeExtent.depth << " ("
+                << sdfVolume.getSizeBytes() / 1024 << " KiB), baked on entering "
+                << "the bedroom" << std::endl;
+    } else if (!sceneFile.empty()) {
+      std::cout << "static sdf volume: off, static geometry from "
+                << sceneFile.getPath() << " (" << sceneBuffer.getSize()
+                << " bytes)" << std::endl;
+    } else if (options.sdfBake) {
+      std::cout << "static sdf volume: r32f not filterable, using analytic "
+                << "scene" << std::endl;
+    }
+  }
+
+  // Falls back to full shading when coarse shading is unsupported
+  void setShadingMode(int mode) {
+    if (mode == kShadingCoarse && !coarseShadingSupported) {
+      std::cerr << "shading: no VK_KHR_fragment_shading_rate, using full"
+                << std::endl;
+      mode = kShadingFull;
+    }
+    shadingMode = mode;
+    raymarchTarget.setCheckerboard(mode == kShadingCheckerboard);
+    std::cout << "shading: " << shadingName(mode) << std::endl;
+  }
+
+  // The bake evaluates the hand-written bedroom, so a scene file always
+  // runs analytically
+  bool staticVolumeEnabled() const {
+    return options.sdfBake && sceneFile.empty() && sdfVolume.isAvailable();
+  }
+
+  // --gen-scene: the scene file as straight-line GLSL, included by
+  // shader.frag when built with SCENE_GENERATED (make SCENE=<file>)
+  void generateScene() {
+    SdfScene scene;
+    scene.load(options.genSceneInput);
+    std::ofstream out(options.genSceneOutput, std::ios::binary);
+    out << scene.generateGlsl();
+    if (!out) {
+      throw std::runtime_error("failed to write " + options.genSceneOutput);
+    }
+    std::cout << options.genSceneOutput << ": " << scene.getGroups().size()
+              << " groups from " << options.genSceneInput << std::endl;
+  }
+
+  // --bench-text: glyphs laid out per second by TextRenderer's glyph table,
+  // and by the unordered_map<char> lookup it replaced for comparison
+  void benchText() {
+    TextRenderer text;
+    if (!text.loadGlyphs("./font.ttf", 32.0f)) {
+      throw std::runtime_error("failed to load ./font.ttf");
+    }
+    const GlyphTable &table = text.getGlyphTable();
+
+    struct LegacyGlyph {
+      float ax, bw, bh, bl, bt;
+      uint16_t tx, ty;
+    };
+    std::unordered_map<char, LegacyGlyph> legacyMap;
+    for (int c = 32; c < 127; c++) {
+      uint16_t g = table.find(c);
+      if (g != GlyphTable::kMissing) {
+        legacyMap[static_cast<char>(c)] = {
+            table.advance[g], static_cast<float>(table.atlasW[g]),
+            static_cast<float>(table.atlasH[g]), table.bearingX[g],
+            table.bearingY[g], table.atlasX[g], table.atlasY[g]};
+      }
+    }
+
+    std::vector<std::string> lines;
+    for (int i = 0; i < 64; i++) {
+      lines.push_back("frame " + std::to_string(i * 37) +
+                      ": The quick brown fox jumps over the lazy dog, "
+                      "raymarch 1980x1020 (100%) 12.34 ms");
+    }
+    float color[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    std::vector<TextGlyph> glyphs;
+
+    // runs `layout` over every line until 0.5 s have passed
+    auto measure = [&](auto layout) {
+      uint64_t count = 0;
+      auto start = std::chrono::steady_clock::now();
+      std::chrono::duration<double> elapsed{};
+      do {
+        for (const std::string &line : lines) {
+          glyphs.clear();
+          layout(line);
+          count += glyphs.size();
+        }
+        elapsed = std::chrono::steady_clock::now() - start;
+      } while (elapsed.count() < 0.5);
+      return count / elapsed.count();
+    };
+
+    double tableRate = measure([&](const std::string &line) {
+      text.layoutGlyphs(line, 20.0f, 40.0f, 0.6f, color, glyphs);
+    });
+    double mapRate = measure([&](const std::string &line) {
+      float cursorX = 20.0f;
+      for (char c : line) {
+        if (legacyMap.find(c) == legacyMap.end()) {
+          continue;
+        }
+        LegacyGlyph &ch = legacyMap[c];
+        if (ch.bw > 0.0f && ch.bh > 0.0f) {
+          TextGlyph glyph;
+          glyph.pos[0] = cursorX + ch.bl * 0.6f;
+          glyph.pos[1] = 40.0f + ch.bt * 0.6f;
+          glyph.atlas[0] = ch.tx;
+          glyph.atlas[1] = ch.ty;
+          glyph.atlas[2] = static_cast<uint16_t>(ch.bw);
+          glyph.atlas[3] = static_cast<uint16_t>(ch.bh);
+          glyph.scale = 0.6f;
+          glyph.color = 0xffffffff;
+          glyphs.push_back(glyph);
+        }
+        cursorX += ch.ax * 0.6f;
+      }
+    });
+
+    std::cout << "text: glyph table " << tableRate / 1e6
+              << " Mglyphs/s, char map " << mapRate / 1e6
+              << " Mglyphs/s (" << tableRate / mapRate << "x)" << std::endl;
   }
 
   void mainLoop() {
     while (!glfwWindowShouldClose(window)) {
+      cpuProfiler.beginFrame(qa.getCurrentIndex());
+      auto pollStart = CpuProfiler::Clock::now();
+
       glfwPollEvents();
       auto now = std::chrono::steady_clock::now();
       auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -196,27 +851,240 @@ private:
           qa.advance();
         }
       }
+
+      bool f1Down = glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS;
+      if (f1Down && !profilerKeyDown) {
+        showProfilerOverlay = !showProfilerOverlay;
+      }
+      profilerKeyDown = f1Down;
+
+      bool f2Down = glfwGetKey(window, GLFW_KEY_F2) == GLFW_PRESS;
+      if (f2Down && !shadingKeyDown) {
+        int next = (shadingMode + 1) % kShadingModes;
+        if (next == kShadingCoarse && !coarseShadingSupported) {
+          next = kShadingFull;
+        }
+        setShadingMode(next);
+      }
+      shadingKeyDown = f2Down;
+
       int currentState = qa.getCurrentIndex();
       float currentTime = glfwGetTime();
 
       if (currentState != lastState) {
         sceneStartTime = currentTime;
         lastState = currentState;
+        raymarchTarget.resetHistory();
       }
+      frameTime = currentTime;
+      cpuProfiler.addStage(CpuProfiler::Poll, pollStart,
+                           CpuProfiler::Clock::now());
+
       drawFrame();
+      cpuProfiler.endFrame();
+
+      if (cpuProfiler.summaryDue()) {
+        cpuProfiler.printSummary(std::cout, &gpuProfiler);
+        mapCounters.printSummary(std::cout);
+      }
     }
 
     vkDeviceWaitIdle(device);
   }
 
+  // (state, time) pairs to render without a window: options.schedule, or
+  // every state at t=1.0
+  std::vector<std::pair<int, float>> frameSchedule() const {
+    std::vector<std::pair<int, float>> schedule = options.schedule;
+    if (schedule.empty()) {
+      for (int state = 0; state < qa.getTotalQuestions(); state++) {
+        schedule.push_back({state, 1.0f});
+      }
+    }
+    for (const auto &entry : schedule) {
+      if (entry.first < 0 || entry.first >= qa.getTotalQuestions()) {
+        throw std::runtime_error("state out of range: " +
+                                 std::to_string(entry.first));
+      }
+    }
+    return schedule;
+  }
+
+  static std::string frameFileName(size_t index, int state, float time,
+                                   const std::string &format) {
+    char name[64];
+    snprintf(name, sizeof(name), "frame_%03zu_state%02d_t%.2f.%s", index,
+             state, time, format.c_str());
+    return name;
+  }
+
+  // Renders every (state, time) pair of the schedule into the offscreen
+  // target and writes each frame to options.outputDir.
+  void renderHeadless() {
+    std::vector<std::pair<int, float>> schedule = frameSchedule();
+
+    std::filesystem::create_directories(options.outputDir);
+
+    std::vector<uint8_t> pixels;
+    for (size_t i = 0; i < schedule.size(); i++) {
+      int state = schedule[i].first;
+      qa.jumpTo(state);
+      sceneStartTime = 0.0f;
+      frameTime = schedule[i].second;
+      // repeats of one entry reuse each other's history, entries do not
+      raymarchTarget.resetHistory();
+
+      double totalMs = 0.0;
+      for (int r = 0; r < options.repeat; r++) {
+        auto start = std::chrono::steady_clock::now();
+        cpuProfiler.beginFrame(state);
+        drawHeadlessFrame();
+        cpuProfiler.endFrame();
+        auto end = std::chrono::steady_clock::now();
+        totalMs +=
+            std::chrono::duration<double, std::milli>(end - start).count();
+      }
+
+      offscreenTarget.readPixels(pixels);
+      std::string path =
+          options.outputDir + "/" +
+          frameFileName(i, state, frameTime, options.imageFormat);
+      if (!writeImage(path, swapChainExtent.width, swapChainExtent.height,
+                      pixels)) {
+        throw std::runtime_error("failed to write " + path);
+      }
+
+      std::cout << path << "  state " << state << "  t " << frameTime << "  "
+                << totalMs / options.repeat << " ms/frame  gpu "
+                << gpuProfiler.getLatestMs(GpuProfiler::Frame) << " ms";
+      if (options.sdfDebug & kSdfDebugCount) {
+        const MapCounters::Stats &counts = mapCounters.getLatest();
+        std::cout << "  " << counts.mapPerPixel() << " map/px  "
+                  << counts.primPerPixel() << " prims/px  "
+                  << counts.stepsPerPixel() << " steps/px";
+      }
+      std::cout << std::endl;
+    }
+
+    cpuProfiler.printSummary(std::cout, &gpuProfiler);
+    mapCounters.printSummary(std::cout);
+    vkDeviceWaitIdle(device);
+  }
+
+  // Renders the schedule with the CPU reference raymarcher at the window
+  // size; touches neither GLFW nor Vulkan. Uses each state's march and
+  // shadow settings, and the flash state, which has no raymarched image, is
+  // skipped.
+  void renderCpu() {
+    std::vector<std::pair<int, float>> schedule = frameSchedule();
+    CpuRaymarcher raymarcher(options.cpuThreads);
+    if (options.cpuIsa) {
+      raymarcher.setIsa(*options.cpuIsa);
+    }
+    raymarcher.setScene(sceneFile.empty() ? nullptr : &sceneFile);
+    std::cout << "cpu raymarcher: "
+              << CpuRaymarcher::isaName(raymarcher.getIsa()) << ", "
+              << CpuRaymarcher::isaLanes(raymarcher.getIsa())
+              << " rays per packet, " << raymarcher.threadCount()
+              << " threads" << std::endl;
+
+    std::filesystem::create_directories(options.outputDir);
+
+    std::vector<uint8_t> pixels;
+    uint64_t totalRays = 0;
+    double totalMs = 0.0;
+    for (size_t i = 0; i < schedule.size(); i++) {
+      int state = schedule[i].first;
+      float time = schedule[i].second;
+      if (state == kFlashState) {
+        std::cout << "state " << state << ": flash scene, skipped" << std::endl;
+        continue;
+      }
+
+      RaymarchVariant variant = raymarchVariant(state);
+      CpuRaymarcher::Settings settings;
+      settings.marchSteps = variant.marchSteps;
+      settings.shadowSteps = variant.shadowSteps;
+      settings.shadows = variant.shadows == VK_TRUE;
+      settings.occlusion = variant.occlusion == VK_TRUE;
+      settings.normalMode = static_cast<CpuRaymarcher::NormalMode>(
+          options.normalMode >= 0 ? options.normalMode : variant.normalMode);
+      raymarcher.setSettings(settings);
+
+      double frameMs = 0.0;
+      for (int r = 0; r < options.repeat; r++) {
+        raymarcher.render(state, time, 0.0f, WIDTH, HEIGHT, pixels);
+        frameMs += raymarcher.getLastStats().ms;
+        totalRays += raymarcher.getLastStats().rays;
+      }
+      totalMs += frameMs;
+
+      std::string path = options.outputDir + "/" +
+                         frameFileName(i, state, time, options.imageFormat);
+      if (!writeImage(path, WIDTH, HEIGHT, pixels)) {
+        throw std::runtime_error("failed to write " + path);
+      }
+      std::cout << path << "  state " << state << "  t " << time << "  "
+                << frameMs / options.repeat << " ms/frame  "
+                << (double)WIDTH * HEIGHT * options.repeat / frameMs / 1000.0
+                << " Mrays/s" << std::endl;
+    }
+    if (totalMs > 0.0) {
+      std::cout << "cpu raymarcher total: " << totalRays << " rays in "
+                << totalMs << " ms, " << totalRays / totalMs / 1000.0
+                << " Mrays/s" << std::endl;
+    }
+  }
+
+  // Records, submits and waits for one frame into the offscreen target.
+  void drawHeadlessFrame() {
+    {
+      CpuProfiler::Scope scope(cpuProfiler, CpuProfiler::Record);
+      vkResetFences(device, 1, &inFlightFences[0]);
+      vkResetCommandBuffer(commandBuffers[0], 0);
+      recordCommandBuffer(commandBuffers[0], 0);
+    }
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffers[0];
+
+    {
+      CpuProfiler::Scope scope(cpuProfiler, CpuProfiler::Submit);
+      if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[0]) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to submit draw command buffer!");
+      }
+    }
+    {
+      CpuProfiler::Scope scope(cpuProfiler, CpuProfiler::WaitFence);
+      vkWaitForFences(device, 1, &inFlightFences[0], VK_TRUE, UINT64_MAX);
+    }
+    gpuProfiler.collect(0);
+    mapCounters.collect(0);
+    raymarchTarget.adaptScale(gpuProfiler.getLatestMs(GpuProfiler::Raymarch));
+  }
+
   void drawFrame() {
-    vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE,
-                    UINT64_MAX);
+    {
+      CpuProfiler::Scope scope(cpuProfiler, CpuProfiler::WaitFence);
+      vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE,
+                      UINT64_MAX);
+    }
+    // the queries of this slot were written MAX_FRAMES_IN_FLIGHT frames ago
+    gpuProfiler.collect(currentFrame);
+    mapCounters.collect(currentFrame);
+    raymarchTarget.adaptScale(gpuProfiler.getLatestMs(GpuProfiler::Raymarch));
 
     uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(
-        device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame],
-        VK_NULL_HANDLE, &imageIndex);
+    VkResult result;
+    {
+      CpuProfiler::Scope scope(cpuProfiler, CpuProfiler::Acquire);
+      result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
+                                     imageAvailableSemaphores[currentFrame],
+                                     VK_NULL_HANDLE, &imageIndex);
+    }
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
         framebufferResized) {
@@ -230,9 +1098,12 @@ private:
     // Only reset the fence if we are submitting work
     vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
-    vkResetCommandBuffer(commandBuffers[currentFrame],
-                         /*VkCommandBufferResetFlagBits*/ 0);
-    recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+    {
+      CpuProfiler::Scope scope(cpuProfiler, CpuProfiler::Record);
+      vkResetCommandBuffer(commandBuffers[currentFrame],
+                           /*VkCommandBufferResetFlagBits*/ 0);
+      recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+    }
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -251,9 +1122,12 @@ private:
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
-                      inFlightFences[currentFrame]) != VK_SUCCESS) {
-      throw std::runtime_error("failed to submit draw command buffer!");
+    {
+      CpuProfiler::Scope scope(cpuProfiler, CpuProfiler::Submit);
+      if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
+                        inFlightFences[currentFrame]) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit draw command buffer!");
+      }
     }
 
     VkPresentInfoKHR presentInfo{};
@@ -268,16 +1142,68 @@ private:
 
     presentInfo.pImageIndices = &imageIndex;
 
-    vkQueuePresentKHR(presentQueue, &presentInfo);
+    {
+      CpuProfiler::Scope scope(cpuProfiler, CpuProfiler::Present);
+      vkQueuePresentKHR(presentQueue, &presentInfo);
+    }
 
     currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
   }
 
   void cleanup() {
-    cleanupSwapChain();
+    std::string profilePath =
+        options.headless ? options.outputDir + "/gpu_profile.csv"
+                         : "gpu_profile.csv";
+    if (gpuProfiler.isEnabled() && gpuProfiler.writeCSV(profilePath)) {
+      std::cout << "GPU timings written to " << profilePath << std::endl;
+    }
+    gpuProfiler.cleanup();
+
+    std::string tracePath = options.headless
+                                ? options.outputDir + "/cpu_trace.json"
+                                : "cpu_trace.json";
+    if (cpuProfiler.writeChromeTrace(tracePath)) {
+      std::cout << "CPU trace written to " << tracePath << std::endl;
+    }
+
+    if (imageFlasher.isStreaming()) {
+      const ImageFlasher::StreamStats &stream = imageFlasher.getStreamStats();
+      std::cout << "flash streaming: " << stream.hits << " hits, "
+                << stream.misses << " misses, " << stream.uploads
+                << " uploads, " << stream.evictions << " evictions"
+                << std::endl;
+    }
+
+    if (options.headless) {
+      offscreenTarget.cleanup();
+    } else {
+      cleanupSwapChain();
+    }
+    pipelineCache.save();
+    pipelineCache.cleanup();
+
+    raymarchTarget.cleanup();
+    textRenderer.destroyLayout(promptLayout);
+    for (TextLayout &layout : answerLayouts) {
+      textRenderer.destroyLayout(layout);
+    }
     textRenderer.cleanup();
     imageFlasher.cleanup();
-    vkDestroyPipeline(device, graphicsPipeline, nullptr);
+    uploadContext.cleanup();
+    mapCounters.cleanup();
+    sdfVolume.cleanup();
+    conePrepass.cleanup();
+    sceneBuffer.cleanup();
+    for (VkPipeline pipeline : conePipelines) {
+      if (pipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(device, pipeline, nullptr);
+      }
+    }
+    for (VkPipeline pipeline : raymarchPipelines) {
+      if (pipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(device, pipeline, nullptr);
+      }
+    }
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 
     vkDestroyRenderPass(device, renderPass, nullptr);
@@ -290,18 +1216,22 @@ private:
 
     vkDestroyCommandPool(device, commandPool, nullptr);
 
+    allocator.cleanup();
     vkDestroyDevice(device, nullptr);
 
     if (enableValidationLayers) {
       DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
     }
 
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (surface != VK_NULL_HANDLE) {
+      vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
     vkDestroyInstance(instance, nullptr);
 
-    glfwDestroyWindow(window);
-
-    glfwTerminate();
+    if (window != nullptr) {
+      glfwDestroyWindow(window);
+      glfwTerminate();
+    }
   }
 
   // creates vulkan instance object
@@ -318,7 +1248,8 @@ private:
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    // 1.1 for vkGetPhysicalDeviceFeatures2 (fragment shading rate query)
+    appInfo.apiVersion = VK_API_VERSION_1_1;
 
     // create app struct
     VkInstanceCreateInfo createInfo{};
@@ -361,6 +1292,9 @@ private:
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(),
                                               indices.presentFamily.value()};
+    if (indices.transferFamily.has_value()) {
+      uniqueQueueFamilies.insert(indices.transferFamily.value());
+    }
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -372,7 +1306,42 @@ private:
       queueCreateInfos.push_back(queueCreateInfo);
     }
 
+    // the raymarch shader's debug counters are stores from a fragment shader
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
     VkPhysicalDeviceFeatures deviceFeatures{};
+    deviceFeatures.fragmentStoresAndAtomics =
+        supportedFeatures.fragmentStoresAndAtomics;
+    fragmentStoresSupported = supportedFeatures.fragmentStoresAndAtomics;
+    if (!fragmentStoresSupported && (options.sdfDebug & kSdfDebugCount)) {
+      std::cerr << "sdf debug: no fragmentStoresAndAtomics, counters disabled"
+                << std::endl;
+      options.sdfDebug &= ~kSdfDebugCount;
+    }
+
+    // headless rendering needs no swapchain
+    std::vector<const char *> extensions;
+    if (!options.headless) {
+      extensions = deviceExtensions;
+    }
+
+    // Coarse shading sets a 2x2 pipeline shading rate on the raymarch draw
+    VkPhysicalDeviceFragmentShadingRateFeaturesKHR shadingRateFeatures{};
+    shadingRateFeatures.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADING_RATE_FEATURES_KHR;
+    if (hasDeviceExtension(VK_KHR_FRAGMENT_SHADING_RATE_EXTENSION_NAME) &&
+        hasDeviceExtension(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME)) {
+      VkPhysicalDeviceProperties props;
+      vkGetPhysicalDeviceProperties(physicalDevice, &props);
+      if (props.apiVersion >= VK_API_VERSION_1_1) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &shadingRateFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+      }
+    }
+    coarseShadingSupported =
+        shadingRateFeatures.pipelineFragmentShadingRate == VK_TRUE;
 
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -383,9 +1352,18 @@ private:
 
     createInfo.pEnabledFeatures = &deviceFeatures;
 
+    if (coarseShadingSupported) {
+      // only the pipeline rate is used
+      shadingRateFeatures.pNext = nullptr;
+      shadingRateFeatures.primitiveFragmentShadingRate = VK_FALSE;
+      shadingRateFeatures.attachmentFragmentShadingRate = VK_FALSE;
+      createInfo.pNext = &shadingRateFeatures;
+      extensions.push_back(VK_KHR_FRAGMENT_SHADING_RATE_EXTENSION_NAME);
+      extensions.push_back(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME);
+    }
     createInfo.enabledExtensionCount =
-        static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        static_cast<uint32_t>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
 
     if (enableValidationLayers) {
       createInfo.enabledLayerCount =
@@ -400,8 +1378,20 @@ private:
       throw std::runtime_error("failed to create logical device!");
     }
 
+    if (coarseShadingSupported) {
+      cmdSetFragmentShadingRate =
+          reinterpret_cast<PFN_vkCmdSetFragmentShadingRateKHR>(
+              vkGetDeviceProcAddr(device, "vkCmdSetFragmentShadingRateKHR"));
+      coarseShadingSupported = cmdSetFragmentShadingRate != nullptr;
+    }
+
     vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
     vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+    transferQueue = graphicsQueue;
+    if (indices.transferFamily.has_value()) {
+      vkGetDeviceQueue(device, indices.transferFamily.value(), 0,
+                       &transferQueue);
+    }
   }
 
   void createSwapChain() {
@@ -493,7 +1483,11 @@ private:
 
   void createGraphicsPipeline() {
     auto vertShaderCode = readFile("vert.spv");
-    auto fragShaderCode = readFile("frag.spv");
+    // without fragmentStoresAndAtomics the shader may not even contain the
+    // counter writes, so use the build that declares them readonly
+    auto fragShaderCode = readFile(fragmentStoresSupported
+                                       ? "frag.spv"
+                                       : "frag_nocounters.spv");
 
     VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
     VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
@@ -512,8 +1506,57 @@ private:
     fragShaderStageInfo.module = fragShaderModule;
     fragShaderStageInfo.pName = "main";
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo,
-                                                      fragShaderStageInfo};
+    // One variant per raymarched state, all compiled here so switching
+    // states never waits on the driver
+    const VkSpecializationMapEntry specEntries[] = {
+        {0, offsetof(RaymarchVariant, state), sizeof(int32_t)},
+        {1, offsetof(RaymarchVariant, marchSteps), sizeof(int32_t)},
+        {2, offsetof(RaymarchVariant, shadowSteps), sizeof(int32_t)},
+        {3, offsetof(RaymarchVariant, shadows), sizeof(VkBool32)},
+        {4, offsetof(RaymarchVariant, occlusion), sizeof(VkBool32)},
+        {5, offsetof(RaymarchVariant, staticVolume), sizeof(VkBool32)},
+        {6, offsetof(RaymarchVariant, historyRefresh), sizeof(int32_t)},
+        {7, offsetof(RaymarchVariant, coneMode), sizeof(int32_t)},
+        {8, offsetof(RaymarchVariant, normalMode), sizeof(int32_t)},
+        {9, offsetof(RaymarchVariant, sceneSource), sizeof(int32_t)},
+    };
+    std::vector<int> states;
+    for (int state = 0; state < qa.getTotalQuestions(); state++) {
+      if (state != kFlashState) {
+        states.push_back(state);
+      }
+    }
+    // With the cone pre-pass each state also gets a CONE_MODE 2 variant,
+    // stored after the main ones
+    size_t variantCount = states.size() * (options.conePrepass ? 2 : 1);
+    std::vector<RaymarchVariant> variants(variantCount);
+    std::vector<VkSpecializationInfo> specInfos(variantCount);
+    std::vector<std::array<VkPipelineShaderStageCreateInfo, 2>> shaderStages(
+        variantCount);
+    for (size_t i = 0; i < variantCount; i++) {
+      variants[i] = raymarchVariant(states[i % states.size()]);
+      variants[i].staticVolume =
+          variants[i].staticVolume && staticVolumeEnabled();
+      if (!options.shadowHistory) {
+        variants[i].historyRefresh = 0;
+      }
+      if (options.normalMode >= 0) {
+        variants[i].normalMode = options.normalMode;
+      }
+      variants[i].sceneSource = sceneFile.empty() ? 0 : 1;
+      if (!options.conePrepass) {
+        variants[i].coneMode = 0;
+      } else if (i >= states.size()) {
+        variants[i].coneMode = 2;
+      }
+      specInfos[i].mapEntryCount =
+          static_cast<uint32_t>(std::size(specEntries));
+      specInfos[i].pMapEntries = specEntries;
+      specInfos[i].dataSize = sizeof(RaymarchVariant);
+      specInfos[i].pData = &variants[i];
+      shaderStages[i] = {vertShaderStageInfo, fragShaderStageInfo};
+      shaderStages[i][1].pSpecializationInfo = &specInfos[i];
+    }
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
     vertexInputInfo.sType =
@@ -560,15 +1603,26 @@ private:
         VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
     colorBlending.logicOpEnable = VK_FALSE;
     colorBlending.logicOp = VK_LOGIC_OP_COPY;
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
+    // color and shadow/occlusion history, see RaymarchTarget
+    VkPipelineColorBlendAttachmentState colorBlendAttachments[] = {
+        colorBlendAttachment, colorBlendAttachment};
+    colorBlending.attachmentCount = 2;
+    colorBlending.pAttachments = colorBlendAttachments;
     colorBlending.blendConstants[0] = 0.0f;
     colorBlending.blendConstants[1] = 0.0f;
     colorBlending.blendConstants[2] = 0.0f;
     colorBlending.blendConstants[3] = 0.0f;
 
+    // the pre-pass writes only the tile depth
+    VkPipelineColorBlendStateCreateInfo coneBlending = colorBlending;
+    coneBlending.attachmentCount = 1;
+    coneBlending.pAttachments = &colorBlendAttachment;
+
     std::vector<VkDynamicState> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT,
                                                  VK_DYNAMIC_STATE_SCISSOR};
+    if (coarseShadingSupported) {
+      dynamicStates.push_back(VK_DYNAMIC_STATE_FRAGMENT_SHADING_RATE_KHR);
+    }
     VkPipelineDynamicStateCreateInfo dynamicState{};
     dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
     dynamicState.dynamicStateCount =
@@ -577,13 +1631,20 @@ private:
 
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 0;
+    // set 0: debug counters, set 1: static volume, set 2: history,
+    // set 3: cone pre-pass depth, set 4: scene file
+    VkDescriptorSetLayout setLayouts[] = {
+        mapCounters.getSetLayout(), sdfVolume.getSetLayout(),
+        raymarchTarget.getHistorySetLayout(), conePrepass.getSetLayout(),
+        sceneBuffer.getSetLayout()};
+    pipelineLayoutInfo.setLayoutCount = 5;
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
     pipelineLayoutInfo.pushConstantRangeCount = 0;
 
     VkPushConstantRange pushConstantRange{};
     pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
     pushConstantRange.offset = 0;
-    pushConstantRange.size = 20;
+    pushConstantRange.size = sizeof(RaymarchPushConstants);
     pipelineLayoutInfo.pushConstantRangeCount = 1;
     pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
     if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
@@ -594,7 +1655,6 @@ private:
     VkGraphicsPipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
 
     pipelineInfo.pVertexInputState = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &inputAssembly;
@@ -606,15 +1666,38 @@ private:
     pipelineInfo.pDynamicState = &dynamicState;
 
     pipelineInfo.layout = pipelineLayout;
-    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.renderPass = raymarchTarget.getRenderPass();
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
     pipelineInfo.basePipelineIndex = -1;              // Optional
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                  nullptr, &graphicsPipeline) != VK_SUCCESS) {
+    std::vector<VkGraphicsPipelineCreateInfo> pipelineInfos(variantCount,
+                                                            pipelineInfo);
+    for (size_t i = 0; i < variantCount; i++) {
+      pipelineInfos[i].pStages = shaderStages[i].data();
+      if (i >= states.size()) {
+        pipelineInfos[i].renderPass = conePrepass.getRenderPass();
+        pipelineInfos[i].pColorBlendState = &coneBlending;
+      }
+    }
+    std::vector<VkPipeline> pipelines(variantCount);
+    if (vkCreateGraphicsPipelines(
+            device, pipelineCache.get(),
+            static_cast<uint32_t>(pipelineInfos.size()), pipelineInfos.data(),
+            nullptr, pipelines.data()) != VK_SUCCESS) {
       throw std::runtime_error("failed to create graphics pipeline!");
     }
+    raymarchPipelines.assign(qa.getTotalQuestions(), VK_NULL_HANDLE);
+    conePipelines.assign(options.conePrepass ? qa.getTotalQuestions() : 0,
+                         VK_NULL_HANDLE);
+    for (size_t i = 0; i < variantCount; i++) {
+      int state = states[i % states.size()];
+      if (i < states.size()) {
+        raymarchPipelines[state] = pipelines[i];
+      } else {
+        conePipelines[state] = pipelines[i];
+      }
+    }
 
     vkDestroyShaderModule(device, fragShaderModule, nullptr);
     vkDestroyShaderModule(device, vertShaderModule, nullptr);
@@ -642,7 +1725,10 @@ private:
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // headless frames are copied out for readback instead of presented
+    colorAttachment.finalLayout = options.headless
+                                      ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                      : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     VkAttachmentReference colorAttachmentRef{};
     colorAttachmentRef.attachment = 0;
@@ -670,8 +1756,20 @@ private:
 
     dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+
+    // make the color writes visible to the readback copy
+    VkSubpassDependency readbackDependency{};
+    readbackDependency.srcSubpass = 0;
+    readbackDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    readbackDependency.srcStageMask =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    readbackDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    readbackDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    readbackDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    VkSubpassDependency dependencies[] = {dependency, readbackDependency};
+    renderPassInfo.dependencyCount = options.headless ? 2 : 1;
+    renderPassInfo.pDependencies = dependencies;
 
     if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) !=
         VK_SUCCESS) {
@@ -714,6 +1812,47 @@ private:
     }
   }
 
+  void createUploadContext() {
+    QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+    uint32_t graphicsFamily = indices.graphicsFamily.value();
+    uploadContext.init(allocator, graphicsFamily, graphicsQueue,
+                       indices.transferFamily.value_or(graphicsFamily),
+                       transferQueue);
+  }
+
+  void configureFlashSequence() {
+    if (!options.flashDir.empty()) {
+      flashImagePaths.clear();
+      for (const auto &entry :
+           std::filesystem::directory_iterator(options.flashDir)) {
+        std::string ext = entry.path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (entry.is_regular_file() &&
+            (ext == ".png" || ext == ".jpg" || ext == ".jpeg" ||
+             ext == ".bmp" || ext == ".tga")) {
+          flashImagePaths.push_back(entry.path().string());
+        }
+      }
+      std::sort(flashImagePaths.begin(), flashImagePaths.end());
+      if (flashImagePaths.empty()) {
+        throw std::runtime_error("no images in " + options.flashDir);
+      }
+    }
+
+    int slots = options.flashStreamSlots;
+    if (slots < 0) {
+      slots = flashImagePaths.size() > kAutoStreamImages ? kAutoStreamSlots
+                                                         : 0;
+    }
+    if (slots > 0) {
+      // headless frames must show exactly the scheduled image
+      imageFlasher.enableStreaming(slots, MAX_FRAMES_IN_FLIGHT,
+                                   options.headless);
+      std::cout << "flash: streaming " << flashImagePaths.size()
+                << " images through " << slots << " slots" << std::endl;
+    }
+  }
+
   void createCommandBuffer() {
     commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
     VkCommandBufferAllocateInfo allocInfo{};
@@ -775,6 +1914,8 @@ private:
     createImageViews();
     createFramebuffers();
     imageFlasher.onSwapchainRecreate(renderPass, swapChainExtent);
+    raymarchTarget.onSwapchainRecreate(renderPass, swapChainExtent);
+    conePrepass.onSwapchainRecreate(swapChainExtent);
   }
 
   void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
@@ -787,10 +1928,126 @@ private:
       throw std::runtime_error("failed to begin recording command buffer!");
     }
 
+    gpuProfiler.beginFrame(commandBuffer, currentFrame, qa.getCurrentIndex());
+
+    // The raymarch gets its own pass at the scaled resolution; the main pass
+    // below upscales it and draws text at native resolution
+    bool raymarching = qa.getCurrentIndex() != kFlashState;
+    // 0.1 seconds per image; other scenes prefetch the start of the sequence
+    float flashPosition =
+        raymarching ? 0.0f
+                    : std::max(0.0f, (frameTime - sceneStartTime) / 0.1f);
+    int flashIndex = (int)flashPosition;
+    float flashBlend = 0.0f;
+    if (options.flashFade > 0.0f) {
+      float into = flashPosition - (float)flashIndex;
+      flashBlend = std::clamp(
+          (into - (1.0f - options.flashFade)) / options.flashFade, 0.0f, 1.0f);
+    }
+    imageFlasher.update(commandBuffer, currentFrame, flashIndex);
+
+    if (raymarching && !sdfVolume.isBaked() && staticVolumeEnabled() &&
+        raymarchVariant(qa.getCurrentIndex()).staticVolume) {
+      sdfVolume.bake(commandBuffer);
+    }
+
+    if (raymarching) {
+      VkExtent2D renderExtent = raymarchTarget.getRenderExtent();
+      // the pre-pass shares the layout, so sets and push constants are
+      // bound once for both passes
+      mapCounters.bind(commandBuffer, pipelineLayout, currentFrame,
+                       options.sdfDebug & kSdfDebugCount);
+      sdfVolume.bind(commandBuffer, pipelineLayout, 1);
+      raymarchTarget.bindHistory(commandBuffer, pipelineLayout, 2);
+      conePrepass.bind(commandBuffer, pipelineLayout, 3);
+      sceneBuffer.bind(commandBuffer, pipelineLayout, 4);
+
+      RaymarchPushConstants pc;
+      pc.resolution[0] = (float)renderExtent.width;
+      pc.resolution[1] = (float)renderExtent.height;
+      pc.time = frameTime;
+      pc.starttime = sceneStartTime;
+      pc.debug = options.sdfDebug;
+      pc.prevTime = lastRaymarchTime;
+      pc.frame = (int)(raymarchFrame++ & 0xffff);
+      pc.historyValid = raymarchTarget.historyValid() ? 1 : 0;
+      raymarchTransforms(qa.getCurrentIndex(), frameTime, sceneStartTime, pc);
+      pc.checkerParity = raymarchTarget.checkerParity();
+      lastRaymarchTime = frameTime;
+
+      vkCmdPushConstants(commandBuffer, pipelineLayout,
+                         VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                         sizeof(RaymarchPushConstants), &pc);
+
+      // the Raymarch scope covers the pre-pass so adaptScale() sees both
+      gpuProfiler.beginScope(commandBuffer, GpuProfiler::Raymarch);
+      // the pre-pass always shades at full rate
+      const VkFragmentShadingRateCombinerOpKHR combiners[2] = {
+          VK_FRAGMENT_SHADING_RATE_COMBINER_OP_KEEP_KHR,
+          VK_FRAGMENT_SHADING_RATE_COMBINER_OP_KEEP_KHR};
+      const VkExtent2D fullRate = {1, 1};
+      const VkExtent2D coarseRate = {2, 2};
+      if (coarseShadingSupported) {
+        cmdSetFragmentShadingRate(commandBuffer, &fullRate, combiners);
+      }
+      if (!conePipelines.empty()) {
+        conePrepass.beginPass(commandBuffer, renderExtent);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          conePipelines[qa.getCurrentIndex()]);
+        vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+        conePrepass.endPass(commandBuffer);
+      }
+
+      raymarchTarget.beginPass(commandBuffer);
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                        raymarchPipelines[qa.getCurrentIndex()]);
+      if (coarseShadingSupported) {
+        cmdSetFragmentShadingRate(
+            commandBuffer,
+            shadingMode == kShadingCoarse ? &coarseRate : &fullRate,
+            combiners);
+      }
+      vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+      gpuProfiler.endScope(commandBuffer, GpuProfiler::Raymarch);
+      raymarchTarget.endPass(commandBuffer);
+      if (options.sdfDebug & kSdfDebugCount) {
+        mapCounters.endPass(commandBuffer);
+      }
+    }
+
+    // Retained text is laid out before the main pass so the copies of
+    // changed layouts into the arena are recorded outside it
+    textRenderer.beginBatch(currentFrame);
+    if (raymarching) {
+      float textColor[4] = {1.0f, 1.0f, 1.0f, 1.0f}; // White color
+      float titleColor[4] = {0.5f, 0.5f, 0.0f, 1.0f};
+      if (qa.getCurrentIndex() > 8) {
+        titleColor[0] = 1.0f;
+        titleColor[1] = 1.0f;
+        titleColor[2] = 1.0f;
+        titleColor[3] = 1.0f;
+
+        textColor[0] = 0.5f;
+        textColor[1] = 0.5f;
+        textColor[2] = 0.0f;
+        textColor[3] = 1.0f;
+      }
+
+      textRenderer.setLayoutText(promptLayout, qa.getCurrentPrompt(), 100.0f,
+                                 800.0f, 2.0f, titleColor);
+      for (int i = 0; i < 3; i++) {
+        textRenderer.setLayoutText(answerLayouts[i], qa.getAnswer(i), 100.0f,
+                                   850.0f + 50.0f * i, 1.0f, textColor);
+      }
+    }
+    textRenderer.recordLayoutUploads(commandBuffer);
+
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = renderPass;
-    renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+    renderPassInfo.framebuffer = options.headless
+                                     ? offscreenTarget.getFramebuffer()
+                                     : swapChainFramebuffers[imageIndex];
 
     renderPassInfo.renderArea.offset = {0, 0};
     renderPassInfo.renderArea.extent = swapChainExtent;
@@ -815,58 +2072,53 @@ private:
     scissor.offset = {0, 0};
     scissor.extent = swapChainExtent;
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-    if (qa.getCurrentIndex() == 8) {
-      float localTime = glfwGetTime() - sceneStartTime;
-      int flashIndex = (int)(localTime / 0.1f); // seconds per image
-      imageFlasher.draw(commandBuffer, flashIndex);
+    if (!raymarching) {
+      gpuProfiler.beginScope(commandBuffer, GpuProfiler::Flash);
+      imageFlasher.draw(commandBuffer, flashIndex, flashBlend);
+      gpuProfiler.endScope(commandBuffer, GpuProfiler::Flash);
     } else {
-      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                        graphicsPipeline);
-
-      struct PushConstants {
-        float resolution[2];
-        float time;
-        float starttime;
-        int state;
-      } pc;
-
-      pc.resolution[0] = (float)swapChainExtent.width;
-      pc.resolution[1] = (float)swapChainExtent.height;
-      pc.time = glfwGetTime();
-      pc.state = qa.getCurrentIndex();
-      pc.starttime = sceneStartTime;
-
-      vkCmdPushConstants(commandBuffer, pipelineLayout,
-                         VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstants),
-                         &pc);
+      gpuProfiler.beginScope(commandBuffer, GpuProfiler::Upscale);
+      raymarchTarget.drawUpscale(commandBuffer);
+      gpuProfiler.endScope(commandBuffer, GpuProfiler::Upscale);
 
-      vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+      textRenderer.drawLayout(promptLayout);
+      for (int i = 0; i < 3; i++) {
+        textRenderer.drawLayout(answerLayouts[i]);
+      }
 
-      float textColor[4] = {1.0f, 1.0f, 1.0f, 1.0f}; // White color
-      float titleColor[4] = {0.5f, 0.5f, 0.0f, 1.0f};
-      if (qa.getCurrentIndex() > 8) {
-        titleColor[0] = 1.0f;
-        titleColor[1] = 1.0f;
-        titleColor[2] = 1.0f;
-        titleColor[3] = 1.0f;
+      // add as many as you want...
+    }
 
-        textColor[0] = 0.5f;
-        textColor[1] = 0.5f;
-        textColor[2] = 0.0f;
-        textColor[3] = 1.0f;
+    if (showProfilerOverlay) {
+      float overlayColor[4] = {0.2f, 1.0f, 0.2f, 1.0f};
+      float y = 40.0f;
+      for (const std::string &line : gpuProfiler.formatOverlay()) {
+        textRenderer.addText(line, 20.0f, y, 0.6f, overlayColor);
+        y += 24.0f;
       }
+      char scaleLine[96];
+      VkExtent2D renderExtent = raymarchTarget.getRenderExtent();
+      snprintf(scaleLine, sizeof(scaleLine),
+               "raymarch %ux%u (%.0f%%) {#ffd040}%s{/}",
+               renderExtent.width, renderExtent.height,
+               raymarchTarget.getScale() * 100.0f, shadingName(shadingMode));
+      textRenderer.addText(scaleLine, 20.0f, y, 0.6f, overlayColor);
+      y += 24.0f;
+      char textLine[64];
+      snprintf(textLine, sizeof(textLine), "text relayouts %u",
+               textRenderer.getRelayoutCount());
+      textRenderer.addText(textLine, 20.0f, y, 0.6f, overlayColor);
+    }
 
-      textRenderer.beginBatch();
-      textRenderer.addText(qa.getCurrentPrompt(), 100.0f, 800.0f, 2.0f,
-                           titleColor);
-      textRenderer.addText(qa.getAnswer(0), 100.0f, 850.0f, 1.0f, textColor);
-      textRenderer.addText(qa.getAnswer(1), 100.0f, 900.0f, 1.0f, textColor);
-      textRenderer.addText(qa.getAnswer(2), 100.0f, 950.0f, 1.0f, textColor);
+    gpuProfiler.beginScope(commandBuffer, GpuProfiler::Text);
+    textRenderer.endBatch(commandBuffer);
+    gpuProfiler.endScope(commandBuffer, GpuProfiler::Text);
 
-      // add as many as you want...
-      textRenderer.endBatch(commandBuffer);
-    }
     vkCmdEndRenderPass(commandBuffer);
+    if (options.headless) {
+      offscreenTarget.recordReadback(commandBuffer);
+    }
+    gpuProfiler.endFrame(commandBuffer);
     if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
       throw std::runtime_error("failed to record command buffer!");
     }
@@ -924,6 +2176,9 @@ private:
 
   bool isDeviceSuitable(VkPhysicalDevice device) {
     QueueFamilyIndices indices = findQueueFamilies(device);
+    if (options.headless) {
+      return indices.isComplete();
+    }
 
     bool extensionsSupported = checkDeviceExtensionSupport(device);
 
@@ -983,6 +2238,22 @@ private:
     }
   }
 
+  bool hasDeviceExtension(const char *name) {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+                                         &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+                                         &extensionCount,
+                                         availableExtensions.data());
+    for (const auto &extension : availableExtensions) {
+      if (std::strcmp(extension.extensionName, name) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
     uint32_t extensionCount;
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
@@ -1016,10 +2287,17 @@ private:
     int i = 0;
     for (const auto &queueFamily : queueFamilies) {
       VkBool32 presentSupport = false;
-      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+      if (surface != VK_NULL_HANDLE) {
+        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+                                             &presentSupport);
+      }
 
       if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
         indices.graphicsFamily = i;
+        // without a surface nothing is presented; reuse the graphics queue
+        if (surface == VK_NULL_HANDLE) {
+          presentSupport = true;
+        }
       }
       if (presentSupport) {
         indices.presentFamily = i;
@@ -1032,6 +2310,21 @@ private:
       i++;
     }
 
+    // Prefer a transfer-only family (typically a copy engine) over one that
+    // also does compute; never pick the graphics family itself
+    int transferScore = 0;
+    for (uint32_t f = 0; f < queueFamilyCount; f++) {
+      VkQueueFlags flags = queueFamilies[f].queueFlags;
+      if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT)) {
+        continue;
+      }
+      int score = (flags & VK_QUEUE_COMPUTE_BIT) ? 1 : 2;
+      if (score > transferScore) {
+        transferScore = score;
+        indices.transferFamily = f;
+      }
+    }
+
     return indices;
   }
 
@@ -1065,12 +2358,15 @@ private:
   // get required instance extensions and validation layer extension
   // return a list of extensions
   std::vector<const char *> getRequiredExtensions() {
-    uint32_t glfwExtensionCount = 0;
-    const char **glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-    std::vector<const char *> extensions(glfwExtensions,
-                                         glfwExtensions + glfwExtensionCount);
+    std::vector<const char *> extensions;
+
+    // GLFW is never initialised when headless, so no surface extensions
+    if (!options.headless) {
+      uint32_t glfwExtensionCount = 0;
+      const char **glfwExtensions;
+      glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+      extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
 
     if (enableValidationLayers) {
       extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -1133,10 +2429,9 @@ private:
   }
 };
 
-int main() {
-  HelloTriangleApplication app;
-
+int main(int argc, char **argv) {
   try {
+    HelloTriangleApplication app(parseOptions(argc, argv));
     app.run();
   } catch (const std::exception &e) {
     std::cerr << e.what() << std::endl;
@@ -0,0 +1,491 @@
+// Shared by shader.frag and sdf_bake.comp: SDF primitives and operators,
+// group bounds and the static part of the bedroom scene. Includers define
+// SDF_COUNT(n), called with the number of primitives a group evaluates,
+// SDF_NO_CULL, true to evaluate every group, and SDF_GROUP(id, d), called
+// with each evaluated group's GROUP_* id and its own distance.
+
+// SDF struct with color
+struct SDF {
+  float dist; // distance to surface
+  vec3 color; // associated color
+};
+
+// The macros are constant expressions for constant angles, so fixed
+// rotations (kEndTableRot etc.) are folded by the compiler rather than
+// evaluated per sample
+#define ROTATEY(t) mat3(vec3(cos(t), 0.0, sin(t)), \
+    vec3(0.0, 1.0, 0.0), \
+    vec3(-sin(t), 0.0, cos(t)))
+#define ROTATEX(t) mat3(vec3(1.0, 0.0, 0.0), \
+    vec3(0.0, cos(t), -sin(t)), \
+    vec3(0.0, sin(t), cos(t)))
+#define ROTATEZ(t) mat3(vec3(cos(t), -sin(t), 0.0), \
+    vec3(sin(t), cos(t), 0.0), \
+    vec3(0.0, 0.0, 1.0))
+
+mat3 rotatey(float theta) {
+  return ROTATEY(theta);
+}
+
+mat3 rotatex(float theta) {
+  return ROTATEX(theta);
+}
+
+mat3 rotatez(float theta) {
+  return ROTATEZ(theta);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// BOOLEAN OPERATORS (branchless, color-aware) //
+// Union
+SDF opUnion(SDF a, SDF b) {
+  float k = step(b.dist, a.dist);
+  SDF outSDF;
+  outSDF.dist = min(a.dist, b.dist);
+  outSDF.color = mix(a.color, b.color, k);
+  return outSDF;
+}
+
+// Subtraction
+SDF opSubtraction(SDF a, SDF b) {
+  float d = max(-a.dist, b.dist);
+  float k = step(b.dist, -a.dist);
+  SDF outSDF;
+  outSDF.dist = d;
+  outSDF.color = mix(a.color, b.color, k);
+  return outSDF;
+}
+
+// Intersection
+SDF opIntersection(SDF a, SDF b) {
+  float d = max(a.dist, b.dist);
+  float k = step(b.dist, a.dist);
+  SDF outSDF;
+  outSDF.dist = d;
+  outSDF.color = mix(a.color, b.color, k);
+  return outSDF;
+}
+
+// Smooth Union
+SDF opSmoothUnion(SDF a, SDF b, float k) {
+  float h = clamp(0.5 + 0.5 * (b.dist - a.dist) / k, 0.0, 1.0);
+  SDF outSDF;
+  outSDF.dist = mix(b.dist, a.dist, h) - k * h * (1.0 - h);
+  outSDF.color = mix(b.color, a.color, h);
+  return outSDF;
+}
+
+// Smooth Subtraction
+SDF opSmoothSubtraction(SDF a, SDF b, float k) {
+  float h = clamp(0.5 - 0.5 * (b.dist + a.dist) / k, 0.0, 1.0);
+  SDF outSDF;
+  outSDF.dist = mix(b.dist, -a.dist, h) + k * h * (1.0 - h);
+  outSDF.color = mix(b.color, a.color, h);
+  return outSDF;
+}
+
+// Smooth Intersection
+SDF opSmoothIntersection(SDF a, SDF b, float k) {
+  float h = clamp(0.5 - 0.5 * (b.dist - a.dist) / k, 0.0, 1.0);
+  SDF outSDF;
+  outSDF.dist = mix(b.dist, a.dist, h) + k * h * (1.0 - h);
+  outSDF.color = mix(b.color, a.color, h);
+  return outSDF;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// PRIMITIVES //
+
+SDF sdfSphere(vec3 p, vec3 pos, mat3 rot, float s, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  SDF o;
+  o.dist = length(pl) - s;
+  o.color = color;
+  return o;
+}
+
+SDF sdfBox(vec3 p, vec3 pos, mat3 rot, vec3 b, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  vec3 q = abs(pl) - b;
+  SDF o;
+  o.dist = length(max(q, 0.0)) + min(max(q.x, max(q.y, q.z)), 0.0);
+  o.color = color;
+  return o;
+}
+
+SDF sdfRoundBox(vec3 p, vec3 pos, mat3 rot, vec3 b, float r, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  vec3 q = abs(pl) - b + r;
+  SDF o;
+  o.dist = length(max(q, 0.0)) + min(max(q.x, max(q.y, q.z)), 0.0) - r;
+  o.color = color;
+  return o;
+}
+
+SDF sdfBoxFrame(vec3 p, vec3 pos, mat3 rot, vec3 b, float e, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  vec3 pp = abs(pl) - b;
+  vec3 q = abs(pp + e) - e;
+  SDF o;
+  o.dist = min(min(
+        length(max(vec3(pp.x, q.y, q.z), 0.0)) + min(max(pp.x, max(q.y, q.z)), 0.0),
+        length(max(vec3(q.x, pp.y, q.z), 0.0)) + min(max(q.x, max(pp.y, q.z)), 0.0)),
+      length(max(vec3(q.x, q.y, pp.z), 0.0)) + min(max(q.x, max(q.y, pp.z)), 0.0));
+  o.color = color;
+  return o;
+}
+
+SDF sdfRoundedBoxFrame(vec3 p, vec3 pos, mat3 rot, vec3 b, float e, float r, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  vec3 pp = abs(pl) - b;
+  vec3 q = abs(pp + e) - e;
+  float d = min(min(
+        length(max(vec3(pp.x, q.y, q.z), 0.0)) + min(max(pp.x, max(q.y, q.z)), 0.0),
+        length(max(vec3(q.x, pp.y, q.z), 0.0)) + min(max(q.x, max(pp.y, q.z)), 0.0)),
+      length(max(vec3(q.x, q.y, pp.z), 0.0)) + min(max(q.x, max(q.y, pp.z)), 0.0)
+    );
+  SDF o;
+  o.dist = d - r;
+  o.color = color;
+  return o;
+}
+
+SDF sdfTorus(vec3 p, vec3 pos, mat3 rot, vec2 t, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  vec2 q = vec2(length(pl.xz) - t.x, pl.y);
+  SDF o;
+  o.dist = length(q) - t.y;
+  o.color = color;
+  return o;
+}
+
+SDF sdfCappedTorus(vec3 p, vec3 pos, mat3 rot, vec2 sc, float ra, float rb, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  pl.x = abs(pl.x);
+  float k = (sc.y * pl.x > sc.x * pl.y) ? dot(pl.xy, sc) : length(pl.xy);
+  SDF o;
+  o.dist = sqrt(dot(pl, pl) + ra * ra - 2.0 * ra * k) - rb;
+  o.color = color;
+  return o;
+}
+
+SDF sdfLink(vec3 p, vec3 pos, mat3 rot, float le, float r1, float r2, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  vec3 q = vec3(pl.x, max(abs(pl.y) - le, 0.0), pl.z);
+  SDF o;
+  o.dist = length(vec2(length(q.xy) - r1, q.z)) - r2;
+  o.color = color;
+  return o;
+}
+
+SDF sdfCylinder(vec3 p, vec3 pos, mat3 rot, vec3 c, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  SDF o;
+  o.dist = length(pl.xz - c.xy) - c.z;
+  o.color = color;
+  return o;
+}
+
+SDF sdfCone(vec3 p, vec3 pos, mat3 rot, vec2 c, float h, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  vec2 q = h * vec2(c.x / c.y, -1.0);
+  vec2 w = vec2(length(pl.xz), pl.y);
+  vec2 a = w - q * clamp(dot(w, q) / dot(q, q), 0.0, 1.0);
+  vec2 b = w - q * vec2(clamp(w.x / q.x, 0.0, 1.0), 1.0);
+  float k = sign(q.y);
+  float d = min(dot(a, a), dot(b, b));
+  float s = max(k * (w.x * q.y - w.y * q.x), k * (w.y - q.y));
+  SDF o;
+  o.dist = sqrt(d) * sign(s);
+  o.color = color;
+  return o;
+}
+
+SDF sdfPlane(vec3 p, vec3 pos, mat3 rot, vec3 n, float h, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  SDF o;
+  o.dist = dot(pl, n) + h;
+  o.color = color;
+  return o;
+}
+
+// Closed-form gradients of the primitives above, in world space; same
+// parameters as the distance functions. pl = rot * (p - pos), so a local
+// gradient g maps back as transpose(rot) * g.
+vec3 gradSphere(vec3 p, vec3 pos, mat3 rot) {
+  return normalize(p - pos);
+}
+
+vec3 gradBox(vec3 p, vec3 pos, mat3 rot, vec3 b) {
+  vec3 pl = rot * (p - pos);
+  vec3 q = abs(pl) - b;
+  vec3 g;
+  if (max(q.x, max(q.y, q.z)) > 0.0) {
+    g = max(q, 0.0) / length(max(q, 0.0));
+  } else if (q.x > q.y && q.x > q.z) {
+    g = vec3(1.0, 0.0, 0.0);
+  } else if (q.y > q.z) {
+    g = vec3(0.0, 1.0, 0.0);
+  } else {
+    g = vec3(0.0, 0.0, 1.0);
+  }
+  return (g * sign(pl)) * rot;
+}
+
+vec3 gradPlane(mat3 rot, vec3 n) {
+  return n * rot;
+}
+
+SDF sdfHexPrism(vec3 p, vec3 pos, mat3 rot, vec2 h, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  const vec3 k = vec3(-0.8660254, 0.5, 0.57735);
+  pl = abs(pl);
+  pl.xy -= 2.0 * min(dot(k.xy, pl.xy), 0.0) * k.xy;
+  vec2 d = vec2(
+      length(pl.xy - vec2(clamp(pl.x, -k.z * h.x, k.z * h.x), h.x)) * sign(pl.y - h.x),
+      pl.z - h.y
+    );
+  SDF o;
+  o.dist = min(max(d.x, d.y), 0.0) + length(max(d, 0.0));
+  o.color = color;
+  return o;
+}
+
+SDF sdfTriPrism(vec3 p, vec3 pos, mat3 rot, vec2 h, vec3 color) {
+  vec3 pl = abs(rot * (p - pos));
+  SDF o;
+  o.dist = max(pl.z - h.y, max(pl.x * 0.866025 + pl.y * 0.5, -pl.y) - h.x * 0.5);
+  o.color = color;
+  return o;
+}
+
+SDF sdfCapsule(vec3 p, vec3 pos, mat3 rot, vec3 a, vec3 b, float r, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  vec3 pa = pl - a;
+  vec3 ba = b - a;
+  float h = clamp(dot(pa, ba) / dot(ba, ba), 0.0, 1.0);
+  SDF o;
+  o.dist = length(pa - ba * h) - r;
+  o.color = color;
+  return o;
+}
+
+SDF sdfVerticalCapsule(vec3 p, vec3 pos, mat3 rot, float h, float r, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  pl.y -= clamp(pl.y, 0.0, h);
+  SDF o;
+  o.dist = length(pl) - r;
+  o.color = color;
+  return o;
+}
+
+SDF sdfCappedCylinder(vec3 p, vec3 pos, mat3 rot, float r, float h, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  vec2 d = abs(vec2(length(pl.xz), pl.y)) - vec2(r, h);
+  SDF o;
+  o.dist = min(max(d.x, d.y), 0.0) + length(max(d, 0.0));
+  o.color = color;
+  return o;
+}
+
+SDF sdfRoundedCylinder(vec3 p, vec3 pos, mat3 rot, float ra, float rb, float h, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  vec2 d = vec2(length(pl.xz) - ra + rb, abs(pl.y) - h + rb);
+  SDF o;
+  o.dist = min(max(d.x, d.y), 0.0) + length(max(d, 0.0)) - rb;
+  o.color = color;
+  return o;
+}
+
+SDF sdfCappedCone(vec3 p, vec3 pos, mat3 rot, float h, float r1, float r2, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  vec2 q = vec2(length(pl.xz), pl.y);
+  vec2 k1 = vec2(r2, h);
+  vec2 k2 = vec2(r2 - r1, 2.0 * h);
+  vec2 ca = vec2(q.x - min(q.x, (q.y < 0.0) ? r1 : r2), abs(q.y) - h);
+  vec2 cb = q - k1 + k2 * clamp(dot(k1 - q, k2) / dot(k2, k2), 0.0, 1.0);
+  float s = (cb.x < 0.0 && ca.y < 0.0) ? -1.0 : 1.0;
+  SDF o;
+  o.dist = s * sqrt(min(dot(ca, ca), dot(cb, cb)));
+  o.color = color;
+  return o;
+}
+
+SDF sdfRoundCone(vec3 p, vec3 pos, mat3 rot, float r1, float r2, float h, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  float b = (r1 - r2) / h;
+  float a = sqrt(1.0 - b * b);
+  vec2 q = vec2(length(pl.xz), pl.y);
+  float k = dot(q, vec2(a, b));
+  SDF o;
+  if (k < 0.0) o.dist = length(q) - r1;
+  else if (k > a * h) o.dist = length(q - vec2(0.0, h)) - r2;
+  else o.dist = dot(q, vec2(a, b)) - r1;
+  o.color = color;
+  return o;
+}
+
+SDF sdfEllipsoid(vec3 p, vec3 pos, mat3 rot, vec3 r, vec3 color) {
+  vec3 pl = rot * (p - pos);
+  float k0 = length(pl / r);
+  float k1 = length(pl / (r * r));
+  SDF o;
+  o.dist = k0 * (k0 - 1.0) / k1;
+  o.color = color;
+  return o;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// BOUNDING VOLUMES //
+
+// Signed distance to an axis-aligned box around a group of primitives; never
+// more than the distance to anything inside it
+float boundDist(vec3 p, vec3 center, vec3 halfSize) {
+  vec3 q = abs(p - center) - halfSize;
+  return length(max(q, 0.0)) + min(max(q.x, max(q.y, q.z)), 0.0);
+}
+
+// True when nothing inside the bound can change `best`. Unioning the bound
+// distance instead of the children would leave best as it is, so the group
+// is skipped outright. k is the largest smooth-union radius the group is
+// merged into the scene with; a smooth union only reaches k past the nearer
+// operand.
+bool cullGroup(vec3 p, vec3 center, vec3 halfSize, float best, float k) {
+  SDF_COUNT(1);
+  if (SDF_NO_CULL) return false;
+  return boundDist(p, center, halfSize) > best + k;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// STATIC BEDROOM //
+
+// The static volume covers the inside of the bedroom (the room's hole) at
+// 0.1 units per texel
+#define VOLUME_MIN vec3(-3.2, -5.6, -3.2)
+#define VOLUME_SIZE vec3(6.4, 19.2, 6.4)
+
+// SDF_GROUP ids; the normal estimators re-evaluate just the group a ray
+// hit (see mapGroup() in shader.frag)
+#define GROUP_ROOM 0
+#define GROUP_BED 1
+#define GROUP_END_TABLE 2
+#define GROUP_PERSON 3
+#define GROUP_MASK 4
+#define GROUP_WALLS 5
+#define GROUP_CHAIR 6
+#define GROUP_SCENE_FILE 7 // everything a scene file adds (shader.frag)
+
+const vec3 blanketPos = vec3(1.5, -4.5, 1.0);
+const mat3 kEndTableRot = ROTATEX(1.6);
+const mat3 kTorsoRot = ROTATEZ(1.6) * ROTATEY(1.3); // also the lower leg
+const mat3 kUpperLegRot = ROTATEZ(1.6) * ROTATEY(0.5);
+
+// Inside of the room: a box with a box-shaped hole. grad is the exact
+// gradient, which only the hole's walls contribute from inside.
+SDF bedroomRoom(vec3 p, out vec3 grad) {
+  vec3 globalPos = vec3(0.0, 0.0, 0.0);
+  vec3 roomPos = vec3(0.0, 4.0, 0.0);
+  vec3 roomSize = vec3(10.0);
+  vec3 holeSize = vec3(3.0, 9.0, 3.0);
+  vec3 roomColor = vec3(1.2, 1.0, 1.0);
+  SDF roomGeometry = sdfBox(p, roomPos + globalPos, mat3(1.0), roomSize, roomColor); // blue
+  SDF roomHole = sdfBox(p, roomPos + globalPos, mat3(1.0), holeSize, roomColor);
+  grad = -roomHole.dist > roomGeometry.dist
+      ? -gradBox(p, roomPos + globalPos, mat3(1.0), holeSize)
+      : gradBox(p, roomPos + globalPos, mat3(1.0), roomSize);
+  SDF_COUNT(2);
+  return opSubtraction(roomHole, roomGeometry);
+}
+
+SDF bedroomBed(vec3 p) {
+  vec3 globalPos = vec3(0.0, 0.0, 0.0);
+  vec3 bedColor = vec3(1.0, 1.0, 1.0) * 2.0;
+  vec3 bedPos = vec3(1.5, -5.0, 5.0);
+  vec3 bedSize = vec3(1.0, 0.5, 5.0);
+  SDF bed = sdfRoundBox(p, bedPos + globalPos, mat3(1.0), bedSize, 0.1, bedColor);
+
+  vec3 rimPos = vec3(1.5, -4.5, 1.55);
+  SDF bedRim = sdfRoundedBoxFrame(p, rimPos + globalPos, mat3(1.0), vec3(0.95, 0.0, 1.44), 0.0, 0.02, bedColor);
+  bed = opSmoothUnion(bed, bedRim, 0.03);
+  SDF_COUNT(2);
+  return bed;
+}
+
+SDF bedroomEndTable(vec3 p) {
+  vec3 globalPos = vec3(0.0, 0.0, 0.0);
+  vec3 roomColor = vec3(1.2, 1.0, 1.0);
+  vec3 endTablePos = vec3(-1.4, -4.0, 3.0);
+  vec3 cutoutPos = endTablePos + vec3(0.0, 1.0, 0.0);
+  SDF endtable = sdfCappedCylinder(p, endTablePos + globalPos, kEndTableRot, 1.0, 0.5, roomColor * 1.2);
+  SDF cutout = sdfBox(p, cutoutPos + globalPos, mat3(1.0), vec3(1.2), vec3(1.2, 1.0, 1.0));
+  endtable = opSubtraction(cutout, endtable);
+  SDF_COUNT(2);
+  return endtable;
+}
+
+// The blanket and the person under it, smoothly merged into `scene` part by
+// part; personDist is the distance to the parts alone
+SDF bedroomPerson(vec3 p, SDF scene, out float personDist) {
+  vec3 globalPos = vec3(0.0, 0.0, 0.0);
+  vec3 bedColor = vec3(1.0, 1.0, 1.0) * 2.0;
+  vec3 blanketSize = vec3(1.0, 0.1, 1.0);
+  vec3 blanketColor = bedColor * 0.3;
+  SDF blanket = sdfRoundBox(p, blanketPos + globalPos, mat3(1.0), blanketSize, 0.1, blanketColor);
+  scene = opSmoothUnion(blanket, scene, 0.1);
+
+  vec3 torsoSize = vec3(0.2, 0.1, 0.4);
+  SDF torso = sdfRoundedCylinder(p, vec3(0.0, 0.1, 0.0) + blanketPos + globalPos, kTorsoRot, torsoSize.x, torsoSize.y, torsoSize.z, blanketColor);
+  scene = opSmoothUnion(torso, scene, 0.1);
+
+  vec3 upperLegSize = vec3(0.1, 0.1, 0.4);
+  SDF upperLeg = sdfRoundedCylinder(p, vec3(-0.2, 0.1, -0.2) + blanketPos + globalPos, kUpperLegRot, upperLegSize.x, upperLegSize.y, upperLegSize.z, blanketColor);
+  scene = opSmoothUnion(upperLeg, scene, 0.2);
+
+  vec3 lowerLegSize = vec3(0.1, 0.1, 0.4);
+  SDF lowerLeg = sdfRoundedCylinder(p, vec3(-0.4, 0.1, -0.3) + blanketPos + globalPos, kTorsoRot, lowerLegSize.x, lowerLegSize.y, lowerLegSize.z, blanketColor);
+  scene = opSmoothUnion(lowerLeg, scene, 0.1);
+
+  SDF headInBed = sdfSphere(p, vec3(-0.2, 0.1, 0.5) + blanketPos + globalPos, mat3(1.0), 0.2, blanketColor);
+  scene = opSmoothUnion(headInBed, scene, 0.1);
+  SDF_COUNT(5);
+
+  personDist = min(min(min(blanket.dist, torso.dist), min(upperLeg.dist, lowerLeg.dist)), headInBed.dist);
+  return scene;
+}
+
+// Room, bed, end table and the person in bed: everything in the bedroom that
+// does not move. sdf_bake.comp samples it into the static volume.
+SDF bedroomStatic(vec3 p) {
+  vec3 globalPos = vec3(0.0, 0.0, 0.0);
+  vec3 roomGrad;
+  SDF scene = bedroomRoom(p, roomGrad);
+  SDF_GROUP(GROUP_ROOM, scene.dist);
+
+  // The room is the baseline; every group below is only evaluated when its
+  // bound is closer than the scene so far
+
+  //bed
+  if (!cullGroup(p, vec3(1.5, -5.0, 5.0) + globalPos, vec3(1.1, 0.6, 5.1), scene.dist, 0.0))
+  {
+    SDF bed = bedroomBed(p);
+    SDF_GROUP(GROUP_BED, bed.dist);
+    scene = opUnion(bed, scene);
+  }
+
+  //end table
+  if (!cullGroup(p, vec3(-1.4, -4.6, 3.0) + globalPos, vec3(1.1, 0.5, 0.6), scene.dist, 0.0))
+  {
+    SDF endtable = bedroomEndTable(p);
+    SDF_GROUP(GROUP_END_TABLE, endtable.dist);
+    scene = opUnion(endtable, scene);
+  }
+
+  //bed and person
+  if (!cullGroup(p, vec3(0.0, 0.1, 0.0) + blanketPos + globalPos, vec3(1.15, 0.45, 1.2), scene.dist, 0.2))
+  {
+    float personDist;
+    scene = bedroomPerson(p, scene, personDist);
+    SDF_GROUP(GROUP_PERSON, personDist);
+  }
+  return scene;
+}
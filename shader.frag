@@ -1,22 +1,150 @@
 
 #version 450
+#extension GL_GOOGLE_include_directive : require
 
 #define EPSILON 0.0001
-#define MAX_STEPS 500
 #define MAX_DISTANCE 1000.0
 #define MIN_DISTANCE 0.0001
 precision highp float;
 precision highp int;
 
 layout(location = 0) out vec4 outColor;
+// This frame's shadow/occlusion history: (shadow, occlusion, hit distance
+// from the camera or 0 for background, 1)
+layout(location = 1) out vec4 outHistory;
 
 layout(push_constant) uniform PushConstants {
   vec2 resolution;
   float time;
   float starttime;
-  int state;
+  int debug; // DEBUG_* bits
+  float prevTime; // time of the frame that wrote the history
+  int frame;      // raymarch frame counter, staggers history refreshes
+  int historyValid;
+  // Animated transforms, evaluated once per frame on the host rather than
+  // in every map() call (raymarchTransforms() in main.cpp)
+  mat3 wallRot;   // rotatez(room time / 4.0), room time 0 in state 9
+  vec3 maskPos;   // mask position, bobbing with sin(time)
+  float wallOpen; // smoothstep(0.0, 10.0, room time) * 10.0
+  // Checkerboard mode: shade only pixels with (x + y) & 1 == checkerParity
+  // and copy the previous pass's color and history into the rest, which
+  // the upscale pass then rebuilds; -1 shades every pixel
+  int checkerParity;
 } pc;
 
+// Every raymarched state gets its own pipeline, so each variant only carries
+// the camera, scene and lighting it uses (see raymarchVariant() in main.cpp)
+layout(constant_id = 0) const int SCENE_STATE = 0;
+layout(constant_id = 1) const int MARCH_STEPS = 500;
+layout(constant_id = 2) const int SHADOW_STEPS = 500;
+layout(constant_id = 3) const bool SHADOWS = true;
+layout(constant_id = 4) const bool OCCLUSION = true;
+// Read the static bedroom geometry from the baked volume (set 1)
+layout(constant_id = 5) const bool STATIC_VOLUME = false;
+// Reuse reprojected shadow/occlusion from the history and recompute each
+// 8x8 tile every HISTORY_REFRESH frames; 0 recomputes every pixel
+layout(constant_id = 6) const int HISTORY_REFRESH = 0;
+// 0: march from the camera, 1: start at the cone pre-pass depth (set 3),
+// 2: this is the pre-pass, one fragment per CONE_TILE x CONE_TILE tile
+layout(constant_id = 7) const int CONE_MODE = 0;
+#define CONE_TILE 8 // ConePrepass::kTileSize
+// Surface normal estimator, see normal()
+layout(constant_id = 8) const int NORMAL_MODE = 0;
+#define NORMAL_FORWARD 0  // forward differences of the whole scene, 3 taps
+#define NORMAL_TETRA 1    // tetrahedral differences of the whole scene, 4 taps
+#define NORMAL_GROUP 2    // tetrahedral differences of the hit group only
+#define NORMAL_ANALYTIC 3 // closed-form gradient, else NORMAL_GROUP
+// Static geometry: 0 = hand-written below, 1 = the scene file in set 4,
+// walked by mapSceneBuffer(). Builds with SCENE_GENERATED defined compile
+// the scene file in instead (see --gen-scene).
+layout(constant_id = 9) const int SCENE_SOURCE = 0;
+
+// Debug modes (pc.debug bits)
+#define DEBUG_COUNT 1    // add map()/primitive counts to the counter buffer
+#define DEBUG_HEATMAP 2  // shade by primitive evaluations per pixel
+#define DEBUG_NO_CULL 4  // evaluate every group, as a baseline for the above
+#define DEBUG_STEPS 8    // heatmap shows primary march iterations instead
+#define DEBUG_NO_CONE 16 // ignore the cone pre-pass depth, as a baseline
+
+// Totals over the sampled pixels (every 4th in x and y), read back by the
+// host once the frame's fence has signalled. Devices without
+// fragmentStoresAndAtomics get the MAP_COUNTERS_READONLY build
+// (frag_nocounters.spv), which never writes the buffer.
+#ifdef MAP_COUNTERS_READONLY
+layout(set = 0, binding = 0) readonly buffer MapCounters {
+#else
+layout(set = 0, binding = 0) buffer MapCounters {
+#endif
+  uint mapCalls;
+  uint primEvals;
+  uint pixels;
+  uint marchSteps; // primary ray iterations
+} counters;
+
+// Per-pixel counts; bound tests count as one primitive
+uint gMapCalls = 0u;
+uint gPrimEvals = 0u;
+uint gMarchSteps = 0u;
+
+// GROUP_* nearest to the last map() point and its distance
+int gGroup = -1;
+float gGroupDist = MAX_DISTANCE;
+
+// bedroomStatic() baked by sdf_bake.comp; distance in r
+layout(set = 1, binding = 0) uniform sampler3D staticVolume;
+
+// outHistory and outColor of the previous raymarch frame, same resolution
+layout(set = 2, binding = 0) uniform sampler2D history;
+layout(set = 2, binding = 1) uniform sampler2D prevColor;
+
+// Per-tile distance the primary rays may skip, written by the CONE_MODE 2
+// variant of this shader
+layout(set = 3, binding = 0) uniform sampler2D coneDepth;
+
+// Scene file compiled to postfix programs (SdfScene.h): primitives push an
+// SDF, operators pop a (top) and b and push op(a, b); the stack's bottom
+// entry is the scene so far
+#define SCENE_MAX_GROUPS 32 // SdfScene::kMaxGroups
+#define SCENE_STACK 8       // SdfScene::kStackSize
+#define SCENE_SPHERE 0
+#define SCENE_BOX 1
+#define SCENE_ROUND_BOX 2
+#define SCENE_ROUNDED_BOX_FRAME 3
+#define SCENE_CAPPED_CYLINDER 4
+#define SCENE_ROUNDED_CYLINDER 5
+#define SCENE_ELLIPSOID 6
+#define SCENE_UNION 16
+#define SCENE_SUBTRACTION 17
+#define SCENE_SMOOTH_UNION 18
+#define SCENE_SMOOTH_SUBTRACTION 19
+
+struct SceneInstr {
+  int type;        // SCENE_*
+  float k;         // smooth operator radius
+  uint mirrorAxes; // bits 0-2: mirror x/y/z about mirror
+  int pad;
+  vec4 position;   // w: box frame edge
+  vec4 params;     // dimensions, see SdfScene::Type
+  vec4 color;
+  vec4 mirror;
+  vec4 rotation[3]; // mat3 columns
+};
+
+struct SceneGroup {
+  int first; // instruction range
+  int count;
+  uint stateMask; // bit SCENE_STATE set when the group is visible
+  int bounded;
+  vec4 boundCenter; // w = k of cullGroup()
+  vec4 boundHalf;
+};
+
+layout(std430, set = 4, binding = 0) readonly buffer SceneData {
+  int groupCount;
+  SceneGroup groups[SCENE_MAX_GROUPS];
+  SceneInstr instrs[];
+} sceneData;
+
 struct Light {
   vec3 position;
   vec3 direction;
@@ -28,12 +156,7 @@ struct Light {
 struct RayInfo {
   vec3 origin;
   vec3 dir;
-};
-
-// SDF struct with color
-struct SDF {
-  float dist; // distance to surface
-  vec3 color; // associated color
+  float start; // distance along dir known to be empty
 };
 
 float hash(float n) {
@@ -65,27 +188,6 @@ float noise(vec3 x) {
   );
 }
 
-mat3 rotatey(float theta) {
-  return mat3(vec3(cos(theta), 0.0, sin(theta)),
-    vec3(0.0, 1.0, 0.0),
-    vec3(-sin(theta), 0.0, cos(theta)));
-}
-
-mat3 rotatex(float theta) {
-  return mat3(vec3(1.0, 0.0, 0.0),
-    vec3(0.0, cos(theta), -sin(theta)),
-    vec3(0.0, sin(theta), cos(theta)));
-  ;
-}
-
-mat3 rotatez(float theta) {
-  return mat3(
-    vec3(cos(theta), -sin(theta), 0.0),
-    vec3(sin(theta), cos(theta), 0.0),
-    vec3(0.0, 0.0, 1.0)
-  );
-}
-
 ///////////////////////////////////////////////////////////////////////////////////////
 // INIT FUNCTIONS //
 
@@ -94,307 +196,72 @@ void initLight() {
   light.direction = vec3(0.0, 0.3, -1.0);
 }
 
-///////////////////////////////////////////////////////////////////////////////////////
-// BOOLEAN OPERATORS (branchless, color-aware) //
-// Union
-SDF opUnion(SDF a, SDF b) {
-  float k = step(b.dist, a.dist);
-  SDF outSDF;
-  outSDF.dist = min(a.dist, b.dist);
-  outSDF.color = mix(a.color, b.color, k);
-  return outSDF;
-}
-
-// Subtraction
-SDF opSubtraction(SDF a, SDF b) {
-  float d = max(-a.dist, b.dist);
-  float k = step(b.dist, -a.dist);
-  SDF outSDF;
-  outSDF.dist = d;
-  outSDF.color = mix(a.color, b.color, k);
-  return outSDF;
-}
-
-// Intersection
-SDF opIntersection(SDF a, SDF b) {
-  float d = max(a.dist, b.dist);
-  float k = step(b.dist, a.dist);
-  SDF outSDF;
-  outSDF.dist = d;
-  outSDF.color = mix(a.color, b.color, k);
-  return outSDF;
-}
-
-// Smooth Union
-SDF opSmoothUnion(SDF a, SDF b, float k) {
-  float h = clamp(0.5 + 0.5 * (b.dist - a.dist) / k, 0.0, 1.0);
-  SDF outSDF;
-  outSDF.dist = mix(b.dist, a.dist, h) - k * h * (1.0 - h);
-  outSDF.color = mix(b.color, a.color, h);
-  return outSDF;
-}
-
-// Smooth Subtraction
-SDF opSmoothSubtraction(SDF a, SDF b, float k) {
-  float h = clamp(0.5 - 0.5 * (b.dist + a.dist) / k, 0.0, 1.0);
-  SDF outSDF;
-  outSDF.dist = mix(b.dist, -a.dist, h) + k * h * (1.0 - h);
-  outSDF.color = mix(b.color, a.color, h);
-  return outSDF;
-}
-
-// Smooth Intersection
-SDF opSmoothIntersection(SDF a, SDF b, float k) {
-  float h = clamp(0.5 - 0.5 * (b.dist - a.dist) / k, 0.0, 1.0);
-  SDF outSDF;
-  outSDF.dist = mix(b.dist, a.dist, h) + k * h * (1.0 - h);
-  outSDF.color = mix(b.color, a.color, h);
-  return outSDF;
+#define SDF_COUNT(n) gPrimEvals += uint(n)
+#define SDF_NO_CULL ((pc.debug & DEBUG_NO_CULL) != 0)
+#define SDF_GROUP(id, d) if ((d) < gGroupDist) { gGroupDist = (d); gGroup = (id); }
+#include "sdf_scene.glsl"
+
+// Trilinear filtering overestimates a distance field by at most the texel
+// diagonal (0.1 * sqrt(3)), so volume samples are lowered by that much.
+// Closer than VOLUME_NEAR the exact function is used instead, which keeps
+// hits, normals and occlusion identical to the analytic scene.
+#define VOLUME_ERROR 0.18
+#define VOLUME_NEAR 0.25
+
+SDF staticScene(vec3 p) {
+  if (STATIC_VOLUME) {
+    vec3 uvw = (p - VOLUME_MIN) / VOLUME_SIZE;
+    if (all(greaterThanEqual(uvw, vec3(0.0))) && all(lessThanEqual(uvw, vec3(1.0)))) {
+      SDF_COUNT(1);
+      float d = textureLod(staticVolume, uvw, 0.0).r - VOLUME_ERROR;
+      if (d > VOLUME_NEAR) {
+        SDF far;
+        far.dist = d;
+        far.color = vec3(0.0); // never hit: d is well above MIN_DISTANCE
+        return far;
+      }
+    }
+  }
+  return bedroomStatic(p);
+}
+
+vec3 cameraOrigin(float time) {
+  vec3 origin = vec3(-2.0, -2.0, 0.0);
+  if (SCENE_STATE <= 2) {
+    origin = vec3(-2.0, -2.0, 0.0);
+  } else if (SCENE_STATE == 3) {
+    origin = vec3(1.0, -3.5, 0.0);
+  } else if (SCENE_STATE >= 4 && SCENE_STATE < 8) {
+    origin = vec3(2.0, -3.5, 2.0);
+  } else if (SCENE_STATE == 9) {
+    origin = vec3(0.0, 0.0, -2.0);
+  } else if (SCENE_STATE == 10) {
+    origin = vec3(0.0, 0.0, -2.0 - smoothstep(0.0, 10.0, time - pc.starttime) * 10.0);
+  } else if (SCENE_STATE >= 11) {
+    origin = vec3(0.0, 0.0, -12.0);
+  }
+  return origin;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////
-// PRIMITIVES //
-
-SDF sdfSphere(vec3 p, vec3 pos, mat3 rot, float s, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  SDF o;
-  o.dist = length(pl) - s;
-  o.color = color;
-  return o;
-}
-
-SDF sdfBox(vec3 p, vec3 pos, mat3 rot, vec3 b, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  vec3 q = abs(pl) - b;
-  SDF o;
-  o.dist = length(max(q, 0.0)) + min(max(q.x, max(q.y, q.z)), 0.0);
-  o.color = color;
-  return o;
-}
-
-SDF sdfRoundBox(vec3 p, vec3 pos, mat3 rot, vec3 b, float r, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  vec3 q = abs(pl) - b + r;
-  SDF o;
-  o.dist = length(max(q, 0.0)) + min(max(q.x, max(q.y, q.z)), 0.0) - r;
-  o.color = color;
-  return o;
-}
-
-SDF sdfBoxFrame(vec3 p, vec3 pos, mat3 rot, vec3 b, float e, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  vec3 pp = abs(pl) - b;
-  vec3 q = abs(pp + e) - e;
-  SDF o;
-  o.dist = min(min(
-        length(max(vec3(pp.x, q.y, q.z), 0.0)) + min(max(pp.x, max(q.y, q.z)), 0.0),
-        length(max(vec3(q.x, pp.y, q.z), 0.0)) + min(max(q.x, max(pp.y, q.z)), 0.0)),
-      length(max(vec3(q.x, q.y, pp.z), 0.0)) + min(max(q.x, max(q.y, pp.z)), 0.0));
-  o.color = color;
-  return o;
-}
-
-SDF sdfRoundedBoxFrame(vec3 p, vec3 pos, mat3 rot, vec3 b, float e, float r, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  vec3 pp = abs(pl) - b;
-  vec3 q = abs(pp + e) - e;
-  float d = min(min(
-        length(max(vec3(pp.x, q.y, q.z), 0.0)) + min(max(pp.x, max(q.y, q.z)), 0.0),
-        length(max(vec3(q.x, pp.y, q.z), 0.0)) + min(max(q.x, max(pp.y, q.z)), 0.0)),
-      length(max(vec3(q.x, q.y, pp.z), 0.0)) + min(max(q.x, max(q.y, pp.z)), 0.0)
-    );
-  SDF o;
-  o.dist = d - r;
-  o.color = color;
-  return o;
-}
-
-SDF sdfTorus(vec3 p, vec3 pos, mat3 rot, vec2 t, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  vec2 q = vec2(length(pl.xz) - t.x, pl.y);
-  SDF o;
-  o.dist = length(q) - t.y;
-  o.color = color;
-  return o;
-}
-
-SDF sdfCappedTorus(vec3 p, vec3 pos, mat3 rot, vec2 sc, float ra, float rb, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  pl.x = abs(pl.x);
-  float k = (sc.y * pl.x > sc.x * pl.y) ? dot(pl.xy, sc) : length(pl.xy);
-  SDF o;
-  o.dist = sqrt(dot(pl, pl) + ra * ra - 2.0 * ra * k) - rb;
-  o.color = color;
-  return o;
-}
-
-SDF sdfLink(vec3 p, vec3 pos, mat3 rot, float le, float r1, float r2, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  vec3 q = vec3(pl.x, max(abs(pl.y) - le, 0.0), pl.z);
-  SDF o;
-  o.dist = length(vec2(length(q.xy) - r1, q.z)) - r2;
-  o.color = color;
-  return o;
-}
-
-SDF sdfCylinder(vec3 p, vec3 pos, mat3 rot, vec3 c, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  SDF o;
-  o.dist = length(pl.xz - c.xy) - c.z;
-  o.color = color;
-  return o;
-}
-
-SDF sdfCone(vec3 p, vec3 pos, mat3 rot, vec2 c, float h, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  vec2 q = h * vec2(c.x / c.y, -1.0);
-  vec2 w = vec2(length(pl.xz), pl.y);
-  vec2 a = w - q * clamp(dot(w, q) / dot(q, q), 0.0, 1.0);
-  vec2 b = w - q * vec2(clamp(w.x / q.x, 0.0, 1.0), 1.0);
-  float k = sign(q.y);
-  float d = min(dot(a, a), dot(b, b));
-  float s = max(k * (w.x * q.y - w.y * q.x), k * (w.y - q.y));
-  SDF o;
-  o.dist = sqrt(d) * sign(s);
-  o.color = color;
-  return o;
-}
-
-SDF sdfPlane(vec3 p, vec3 pos, mat3 rot, vec3 n, float h, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  SDF o;
-  o.dist = dot(pl, n) + h;
-  o.color = color;
-  return o;
-}
-
-SDF sdfHexPrism(vec3 p, vec3 pos, mat3 rot, vec2 h, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  const vec3 k = vec3(-0.8660254, 0.5, 0.57735);
-  pl = abs(pl);
-  pl.xy -= 2.0 * min(dot(k.xy, pl.xy), 0.0) * k.xy;
-  vec2 d = vec2(
-      length(pl.xy - vec2(clamp(pl.x, -k.z * h.x, k.z * h.x), h.x)) * sign(pl.y - h.x),
-      pl.z - h.y
-    );
-  SDF o;
-  o.dist = min(max(d.x, d.y), 0.0) + length(max(d, 0.0));
-  o.color = color;
-  return o;
-}
-
-SDF sdfTriPrism(vec3 p, vec3 pos, mat3 rot, vec2 h, vec3 color) {
-  vec3 pl = abs(rot * (p - pos));
-  SDF o;
-  o.dist = max(pl.z - h.y, max(pl.x * 0.866025 + pl.y * 0.5, -pl.y) - h.x * 0.5);
-  o.color = color;
-  return o;
-}
-
-SDF sdfCapsule(vec3 p, vec3 pos, mat3 rot, vec3 a, vec3 b, float r, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  vec3 pa = pl - a;
-  vec3 ba = b - a;
-  float h = clamp(dot(pa, ba) / dot(ba, ba), 0.0, 1.0);
-  SDF o;
-  o.dist = length(pa - ba * h) - r;
-  o.color = color;
-  return o;
-}
-
-SDF sdfVerticalCapsule(vec3 p, vec3 pos, mat3 rot, float h, float r, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  pl.y -= clamp(pl.y, 0.0, h);
-  SDF o;
-  o.dist = length(pl) - r;
-  o.color = color;
-  return o;
-}
-
-SDF sdfCappedCylinder(vec3 p, vec3 pos, mat3 rot, float r, float h, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  vec2 d = abs(vec2(length(pl.xz), pl.y)) - vec2(r, h);
-  SDF o;
-  o.dist = min(max(d.x, d.y), 0.0) + length(max(d, 0.0));
-  o.color = color;
-  return o;
-}
-
-SDF sdfRoundedCylinder(vec3 p, vec3 pos, mat3 rot, float ra, float rb, float h, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  vec2 d = vec2(length(pl.xz) - ra + rb, abs(pl.y) - h + rb);
-  SDF o;
-  o.dist = min(max(d.x, d.y), 0.0) + length(max(d, 0.0)) - rb;
-  o.color = color;
-  return o;
-}
-
-SDF sdfCappedCone(vec3 p, vec3 pos, mat3 rot, float h, float r1, float r2, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  vec2 q = vec2(length(pl.xz), pl.y);
-  vec2 k1 = vec2(r2, h);
-  vec2 k2 = vec2(r2 - r1, 2.0 * h);
-  vec2 ca = vec2(q.x - min(q.x, (q.y < 0.0) ? r1 : r2), abs(q.y) - h);
-  vec2 cb = q - k1 + k2 * clamp(dot(k1 - q, k2) / dot(k2, k2), 0.0, 1.0);
-  float s = (cb.x < 0.0 && ca.y < 0.0) ? -1.0 : 1.0;
-  SDF o;
-  o.dist = s * sqrt(min(dot(ca, ca), dot(cb, cb)));
-  o.color = color;
-  return o;
-}
-
-SDF sdfRoundCone(vec3 p, vec3 pos, mat3 rot, float r1, float r2, float h, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  float b = (r1 - r2) / h;
-  float a = sqrt(1.0 - b * b);
-  vec2 q = vec2(length(pl.xz), pl.y);
-  float k = dot(q, vec2(a, b));
-  SDF o;
-  if (k < 0.0) o.dist = length(q) - r1;
-  else if (k > a * h) o.dist = length(q - vec2(0.0, h)) - r2;
-  else o.dist = dot(q, vec2(a, b)) - r1;
-  o.color = color;
-  return o;
-}
-
-SDF sdfEllipsoid(vec3 p, vec3 pos, mat3 rot, vec3 r, vec3 color) {
-  vec3 pl = rot * (p - pos);
-  float k0 = length(pl / r);
-  float k1 = length(pl / (r * r));
-  SDF o;
-  o.dist = k0 * (k0 - 1.0) / k1;
-  o.color = color;
-  return o;
+mat3 cameraRotation() {
+  if (SCENE_STATE <= 2) {
+    return rotatex(0.7) * rotatey(0.4);
+  } else if (SCENE_STATE >= 4 && SCENE_STATE < 8) {
+    return rotatey(-1.6);
+  }
+  return mat3(1.0);
 }
 
-void initRayout(out RayInfo ray)
-{
-  vec2 uv = (gl_FragCoord.xy / pc.resolution.xy) * 2.0 - 1.0; // [-1,1]
+// Aspect-corrected [-1,1] screen position of a fragment, y up
+vec2 screenUV(vec2 fragCoord) {
+  vec2 uv = (fragCoord / pc.resolution.xy) * 2.0 - 1.0; // [-1,1]
   uv.y = -uv.y;
   uv.x *= pc.resolution.x / pc.resolution.y; // aspect correction
-  mat3 camRot = mat3(1.0);
-  ray.origin = vec3(-2.0, -2.0, 0.0);
-
-  if (pc.state <= 2) {
-    ray.origin = vec3(-2.0, -2.0, 0.0);
-    camRot = rotatex(0.7) * rotatey(0.4);
-  } else if (pc.state == 3) {
-    ray.origin = vec3(1.0, -3.5, 0.0);
-    camRot = mat3(1.0);
-  } else if (pc.state >= 4 && pc.state < 8) {
-    ray.origin = vec3(2.0, -3.5, 2.0);
-    camRot = rotatey(-1.6);
-  } else if (pc.state == 9) {
-    ray.origin = vec3(0.0, 0.0, -2.0);
-    camRot = mat3(1.0);
-  } else if (pc.state == 10) {
-    ray.origin = vec3(0.0, 0.0, -2.0 - smoothstep(0.0, 10.0, pc.time - pc.starttime) * 10.0);
-    camRot = mat3(1.0);
-  } else if (pc.state >= 11) {
-    ray.origin = vec3(0.0, 0.0, -12.0);
-    camRot = mat3(1.0);
-  }
+  return uv;
+}
 
+// Ray direction for a screen position before the camera rotation
+vec3 cameraDir(vec2 uv) {
   // Camera frame
   vec3 forward = normalize(vec3(uv, 1.0)); // camera looks along this
   vec3 worldUp = vec3(0.0, 1.0, 0.0);
@@ -406,178 +273,358 @@ void initRayout(out RayInfo ray)
   float halfHeight = tan(fovRad / 2.0);
   float halfWidth = halfHeight * (pc.resolution.x / pc.resolution.y);
 
+  return normalize(forward + uv.x * halfWidth * right + uv.y * halfHeight * up);
+}
+
+void initRayout(out RayInfo ray)
+{
+  ray.origin = cameraOrigin(pc.time);
   // Ray in world space
-  ray.dir = normalize(forward + uv.x * halfWidth * right + uv.y * halfHeight * up);
-  ray.dir *= camRot;
+  ray.dir = cameraDir(screenUV(gl_FragCoord.xy));
+  ray.dir *= cameraRotation();
+
+  ray.start = 0.0;
+  if (CONE_MODE == 1 && (pc.debug & DEBUG_NO_CONE) == 0) {
+    ray.start = texelFetch(coneDepth, ivec2(gl_FragCoord.xy) / CONE_TILE, 0).r;
+  }
+}
+
+// Fragment position of world point p as seen by the previous frame's camera.
+// cameraDir() is close to normalize(vec3(uv, 1)); one correction step
+// removes the small field-of-view term.
+vec2 reprojectPrev(vec3 p) {
+  vec3 local = cameraRotation() * (p - cameraOrigin(pc.prevTime));
+  vec2 target = local.xy / local.z;
+  vec2 uv = target;
+  vec3 d = cameraDir(uv);
+  uv += target - d.xy / d.z;
+
+  uv.x /= pc.resolution.x / pc.resolution.y;
+  uv.y = -uv.y;
+  return (uv * 0.5 + 0.5) * pc.resolution.xy;
+}
+
+vec3 maskPosition() {
+  return pc.maskPos;
+}
+
+const mat3 kEyeBagRot = ROTATEZ(-0.3); // also the nostrils
+const mat3 kEyeHoleRot = ROTATEZ(-0.6);
+const mat3 kNoseBridgeRot = ROTATEZ(0.5);
+
+SDF bedroomMask(vec3 p) {
+  vec3 globalPos = vec3(0.0, 0.0, 0.0);
+  vec3 maskPos = maskPosition();
+  vec3 maskEllipseSize = vec3(0.3, 0.4, 0.23);
+  vec3 maskColor = vec3(1.3, 355.0 / 255.0, 355.0 / 255.0);
+  vec3 accentColor = vec3(0.0, 0.0, 0.0);
+  SDF maskEllipse1 = sdfEllipsoid(p, vec3(0.0, 0.0, 0.0) + maskPos + globalPos, mat3(1.0), maskEllipseSize, maskColor);
+  SDF maskEllipse2 = sdfEllipsoid(p, vec3(-0.13, 0.0, 0.0) + maskPos + globalPos, mat3(1.0), maskEllipseSize, maskColor);
+
+  SDF mask = maskEllipse1;
+
+  vec3 headSize = vec3(0.25, 0.28, 0.2);
+  SDF head = sdfEllipsoid(p, vec3(0.1, 0.1, 0.0) + maskPos + globalPos, mat3(1.0), headSize, maskColor);
+  mask = opSmoothUnion(head, mask, 0.05);
+
+  vec3 chinSize = vec3(0.25, 0.28, 0.2) - p.x * vec3(0.0, 0.0, 0.1);
+  SDF chin = sdfEllipsoid(p, vec3(0.1, -0.1, 0.0) + maskPos + globalPos, mat3(1.0), chinSize, maskColor);
+  mask = opSmoothUnion(chin, mask, 0.05);
+
+  vec3 eyeBagSize = vec3(0.03, 0.06, 0.03);
+  vec3 mirrorP = p;
+  mirrorP.z = abs(mirrorP.z - (maskPos.z + globalPos.z))
+      + (maskPos.z + globalPos.z);
+  SDF eyeBag = sdfEllipsoid(mirrorP, vec3(0.35, 0.0, 0.1) + maskPos + globalPos, kEyeBagRot, eyeBagSize, accentColor);
+  mask = opSmoothSubtraction(eyeBag, mask, 0.1);
+
+  vec3 eyeHoleSize = vec3(0.06, 0.02, 0.04);
+  mirrorP = p;
+  mirrorP.z = abs(mirrorP.z - (maskPos.z + globalPos.z))
+      + (maskPos.z + globalPos.z);
+  SDF eyeHole = sdfEllipsoid(mirrorP, vec3(0.25, 0.05, 0.08) + maskPos + globalPos, kEyeHoleRot, eyeHoleSize, maskColor);
+  mask = opSmoothSubtraction(eyeHole, mask, 0.05);
+
+  vec3 noseBridgeSize = vec3(0.02, 0.02, 0.12);
+  SDF noseBridge = sdfRoundedCylinder(p, vec3(0.33, 0.0, 0.0) + maskPos + globalPos, kNoseBridgeRot, noseBridgeSize.x, noseBridgeSize.y, noseBridgeSize.z, maskColor);
+  mask = opSmoothUnion(noseBridge, mask, 0.05);
+
+  vec3 nostrilSize = vec3(0.02, 0.02, 0.02);
+  mirrorP = p;
+  mirrorP.z = abs(mirrorP.z - (maskPos.z + globalPos.z))
+      + (maskPos.z + globalPos.z);
+  SDF nostril = sdfEllipsoid(mirrorP, vec3(0.35, -0.09, 0.03) + maskPos + globalPos, kEyeBagRot, nostrilSize, maskColor);
+  mask = opSmoothUnion(nostril, mask, 0.02);
+
+  mask = opSmoothSubtraction(maskEllipse2, mask, 0.1);
+  SDF_COUNT(8);
+  return mask;
+}
+
+// Back, side and top walls and the floor. grad is the exact gradient of
+// the nearest wall; the side and top walls are evaluated in a rotated
+// (and for the side walls mirrored) frame, which it undoes. Both slide
+// open and turn with the room's time (pc.wallOpen, pc.wallRot).
+SDF roomWalls(vec3 p, out vec3 grad) {
+  vec3 wallColor = vec3(2.0);
+  vec3 backWallPos = vec3(0.0, 0.0, 5.0);
+  vec3 backWallSize = vec3(4.0, 2.0, 0.1);
+  SDF backWall = sdfBox(p, backWallPos, mat3(1.0), backWallSize, wallColor);
+
+  vec3 sideWallPos = vec3(4.0 + pc.wallOpen, 0.0, 5.0);
+  vec3 sideWallSize = vec3(0.1, 2.0, 2.0);
+  vec3 sideWallp = p;
+  vec3 pivot = vec3(0.0, 0.0, 5.0);
+  mat3 wallRot = pc.wallRot;
+  sideWallp = pivot + wallRot * (sideWallp - pivot);
+  float mirror = sideWallp.x < 0.0 ? -1.0 : 1.0;
+  sideWallp.x = abs(sideWallp.x);
+  SDF sideWall = sdfBox(sideWallp, sideWallPos, mat3(1.0), sideWallSize, wallColor);
+
+  vec3 topWallPos = vec3(0.0, 1.9 + pc.wallOpen, 5.0);
+  vec3 topWallSize = vec3(4.0, 0.1, 2.0);
+  vec3 topWallp = p;
+  topWallp = pivot + wallRot * (topWallp - pivot);
+  SDF topWall = sdfBox(topWallp, topWallPos, mat3(1.0), topWallSize, wallColor);
+
+  vec3 floorPos = vec3(0.0, -1.9, 5.0);
+  vec3 floorSize = vec3(4.0, 0.1, 2.0);
+  SDF floors = sdfBox(p, floorPos, mat3(1.0), floorSize, wallColor);
+
+  SDF wall = opUnion(backWall, sideWall);
+  wall = opUnion(wall, topWall);
+  wall = opUnion(wall, floors);
+  gPrimEvals += 4u;
+
+  if (wall.dist == backWall.dist) {
+    grad = gradBox(p, backWallPos, mat3(1.0), backWallSize);
+  } else if (wall.dist == sideWall.dist) {
+    vec3 g = gradBox(sideWallp, sideWallPos, mat3(1.0), sideWallSize);
+    grad = (g * vec3(mirror, 1.0, 1.0)) * wallRot;
+  } else if (wall.dist == topWall.dist) {
+    grad = gradBox(topWallp, topWallPos, mat3(1.0), topWallSize) * wallRot;
+  } else {
+    grad = gradBox(p, floorPos, mat3(1.0), floorSize);
+  }
+  return wall;
+}
+
+// grad is exact on the seat and its back (boxes) and zero on the legs,
+// which have no closed form here
+SDF roomChair(vec3 p, out vec3 grad) {
+  vec3 wallColor = vec3(2.0);
+  SDF chair;
+  vec3 chairLegPos = vec3(0.5, -1.5, 4.0);
+  vec3 chairp = p;
+  chairp.x = abs(chairp.x);
+  chairp.z = abs(chairp.z - 3.8) + 3.8;
+  SDF chairLeg = sdfCappedCylinder(chairp, chairLegPos, mat3(1.0), 0.1, 0.5, wallColor);
+  chair = chairLeg;
+
+  vec3 seatPos = vec3(0.0, -1.0, 4.0);
+  vec3 seatSize = vec3(0.6, 0.1, 0.6);
+  SDF seat = sdfBox(p, seatPos, mat3(1.0), seatSize, wallColor);
+  chair = opUnion(seat, chair);
+
+  vec3 seatBackPos = vec3(0.0, 0.0, 4.0);
+  vec3 seatBackSize = vec3(0.6, 1.0, 0.1);
+  SDF seatBack = sdfBox(p, seatBackPos, mat3(1.0), seatBackSize, wallColor);
+  chair = opUnion(seatBack, chair);
+  gPrimEvals += 3u;
+
+  grad = vec3(0.0);
+  if (chair.dist == seatBack.dist) {
+    grad = gradBox(p, seatBackPos, mat3(1.0), seatBackSize);
+  } else if (chair.dist == seat.dist) {
+    grad = gradBox(p, seatPos, mat3(1.0), seatSize);
+  }
+  return chair;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// SCENE FILE //
+
+SDF scenePrimitive(int i, vec3 p) {
+  SceneInstr ins = sceneData.instrs[i];
+  if (ins.mirrorAxes != 0u) {
+    bvec3 axes = notEqual(uvec3(ins.mirrorAxes) & uvec3(1u, 2u, 4u), uvec3(0u));
+    p = mix(p, abs(p - ins.mirror.xyz) + ins.mirror.xyz, axes);
+  }
+  vec3 pos = ins.position.xyz;
+  mat3 rot = mat3(ins.rotation[0].xyz, ins.rotation[1].xyz, ins.rotation[2].xyz);
+  vec4 k = ins.params;
+  vec3 color = ins.color.rgb;
+  SDF_COUNT(1);
+  if (ins.type == SCENE_SPHERE) return sdfSphere(p, pos, rot, k.x, color);
+  if (ins.type == SCENE_BOX) return sdfBox(p, pos, rot, k.xyz, color);
+  if (ins.type == SCENE_ROUND_BOX) return sdfRoundBox(p, pos, rot, k.xyz, k.w, color);
+  if (ins.type == SCENE_ROUNDED_BOX_FRAME) return sdfRoundedBoxFrame(p, pos, rot, k.xyz, ins.position.w, k.w, color);
+  if (ins.type == SCENE_CAPPED_CYLINDER) return sdfCappedCylinder(p, pos, rot, k.x, k.y, color);
+  if (ins.type == SCENE_ROUNDED_CYLINDER) return sdfRoundedCylinder(p, pos, rot, k.x, k.y, k.z, color);
+  return sdfEllipsoid(p, pos, rot, k.xyz, color);
+}
+
+SDF sceneOperator(int type, float k, SDF a, SDF b) {
+  if (type == SCENE_UNION) return opUnion(a, b);
+  if (type == SCENE_SUBTRACTION) return opSubtraction(a, b);
+  if (type == SCENE_SMOOTH_UNION) return opSmoothUnion(a, b, k);
+  return opSmoothSubtraction(a, b, k);
+}
+
+// Merges the scene file's groups into `scene`, skipping groups that are
+// hidden in this state or culled by their bound
+SDF mapSceneBuffer(vec3 p, SDF scene) {
+  SDF stack[SCENE_STACK];
+  stack[0] = scene;
+  for (int g = 0; g < sceneData.groupCount; g++) {
+    SceneGroup group = sceneData.groups[g];
+    if (((group.stateMask >> uint(SCENE_STATE)) & 1u) == 0u) continue;
+    if (group.bounded != 0 && cullGroup(p, group.boundCenter.xyz, group.boundHalf.xyz, stack[0].dist, group.boundCenter.w)) continue;
+
+    int top = 0;
+    for (int i = group.first; i < group.first + group.count; i++) {
+      int type = sceneData.instrs[i].type;
+      if (type < SCENE_UNION) {
+        top++;
+        stack[top] = scenePrimitive(i, p);
+      } else {
+        top--;
+        stack[top] = sceneOperator(type, sceneData.instrs[i].k, stack[top + 1], stack[top]);
+      }
+    }
+  }
+  return stack[0];
+}
+
+#ifdef SCENE_GENERATED
+#include "scene_generated.glsl"
+#define SCENE_FILE true
+#else
+#define SCENE_FILE (SCENE_SOURCE == 1)
+#endif
+
+// Scene file geometry merged into `scene`; recorded as one group, whose
+// normals come from the whole scene
+SDF mapSceneFile(vec3 p, SDF scene) {
+#ifdef SCENE_GENERATED
+  scene = mapSceneGenerated(p, scene);
+#else
+  scene = mapSceneBuffer(p, scene);
+#endif
+  SDF_GROUP(GROUP_SCENE_FILE, scene.dist);
+  return scene;
 }
 
 SDF map(vec3 p) {
   // Example primitives
+  gMapCalls++;
+  gGroup = -1;
+  gGroupDist = MAX_DISTANCE;
 
-  vec3 globalPos = vec3(0.0, 0.0, 0.0);
   //scene 1:
-  if (pc.state < 9)
+  if (SCENE_STATE < 9)
   {
-    vec3 roomPos = vec3(0.0, 4.0, 0.0);
-    vec3 roomSize = vec3(10.0);
-    vec3 roomColor = vec3(1.2, 1.0, 1.0);
-    SDF roomGeometry = sdfBox(p, roomPos + globalPos, mat3(1.0), roomSize, roomColor); // blue
-
-    roomSize = vec3(3.0, 9.0, 3.0);
-    SDF roomHole = sdfBox(p, roomPos + globalPos, mat3(1.0), roomSize, roomColor);
-    roomGeometry = opSubtraction(roomHole, roomGeometry);
-
-    SDF scene = roomGeometry;
-
-    //bed
-    vec3 bedPos = vec3(1.5, -5.0, 5.0);
-    vec3 bedSize = vec3(1.0, 0.5, 5.0);
-    vec3 bedColor = vec3(1.0, 1.0, 1.0) * 2.0;
-    SDF bed = sdfRoundBox(p, bedPos + globalPos, mat3(1.0), bedSize, 0.1, bedColor);
-
-    vec3 rimPos = vec3(1.5, -4.5, 1.55);
-    SDF bedRim = sdfRoundedBoxFrame(p, rimPos + globalPos, mat3(1.0), vec3(0.95, 0.0, 1.44), 0.0, 0.02, bedColor);
-    bed = opSmoothUnion(bed, bedRim, 0.03);
-    scene = opUnion(bed, scene);
-
-    //end table
-    vec3 endTablePos = vec3(-1.4, -4.0, 3.0);
-    vec3 cutoutPos = endTablePos + vec3(0.0, 1.0, 0.0);
-    SDF endtable = sdfCappedCylinder(p, endTablePos + globalPos, rotatex(1.6), 1.0, 0.5, roomColor * 1.2);
-    SDF cutout = sdfBox(p, cutoutPos + globalPos, mat3(1.0), vec3(1.2), vec3(1.2, 1.0, 1.0));
-    endtable = opSubtraction(cutout, endtable);
-    scene = opUnion(endtable, scene);
+    SDF scene;
+    if (SCENE_FILE) {
+      scene.dist = MAX_DISTANCE;
+      scene.color = vec3(0.0);
+      scene = mapSceneFile(p, scene);
+    } else {
+      scene = staticScene(p);
+    }
+
+    // the mask bobs with time, so it is always evaluated analytically
+    vec3 globalPos = vec3(0.0, 0.0, 0.0);
 
     //mask
-    vec3 maskPos = vec3(0.0, -3.5, 2.0);
-    maskPos.y += sin(pc.time) * 0.1;
-    vec3 maskEllipseSize = vec3(0.3, 0.4, 0.23);
-    vec3 maskColor = vec3(1.3, 355.0 / 255.0, 355.0 / 255.0);
-    vec3 accentColor = vec3(0.0, 0.0, 0.0);
-    SDF maskEllipse1 = sdfEllipsoid(p, vec3(0.0, 0.0, 0.0) + maskPos + globalPos, mat3(1.0), maskEllipseSize, maskColor);
-    SDF maskEllipse2 = sdfEllipsoid(p, vec3(-0.13, 0.0, 0.0) + maskPos + globalPos, mat3(1.0), maskEllipseSize, maskColor);
-
-    SDF mask = maskEllipse1;
-
-    vec3 headSize = vec3(0.25, 0.28, 0.2);
-    SDF head = sdfEllipsoid(p, vec3(0.1, 0.1, 0.0) + maskPos + globalPos, mat3(1.0), headSize, maskColor);
-    mask = opSmoothUnion(head, mask, 0.05);
-
-    vec3 chinSize = vec3(0.25, 0.28, 0.2) - p.x * vec3(0.0, 0.0, 0.1);
-    SDF chin = sdfEllipsoid(p, vec3(0.1, -0.1, 0.0) + maskPos + globalPos, mat3(1.0), chinSize, maskColor);
-    mask = opSmoothUnion(chin, mask, 0.05);
-
-    vec3 eyeBagSize = vec3(0.03, 0.06, 0.03);
-    vec3 mirrorP = p;
-    mirrorP.z = abs(mirrorP.z - (maskPos.z + globalPos.z))
-        + (maskPos.z + globalPos.z);
-    SDF eyeBag = sdfEllipsoid(mirrorP, vec3(0.35, 0.0, 0.1) + maskPos + globalPos, rotatez(-0.3), eyeBagSize, accentColor);
-    mask = opSmoothSubtraction(eyeBag, mask, 0.1);
-
-    vec3 eyeHoleSize = vec3(0.06, 0.02, 0.04);
-    mirrorP = p;
-    mirrorP.z = abs(mirrorP.z - (maskPos.z + globalPos.z))
-        + (maskPos.z + globalPos.z);
-    SDF eyeHole = sdfEllipsoid(mirrorP, vec3(0.25, 0.05, 0.08) + maskPos + globalPos, rotatez(-0.6), eyeHoleSize, maskColor);
-    mask = opSmoothSubtraction(eyeHole, mask, 0.05);
-
-    vec3 noseBridgeSize = vec3(0.02, 0.02, 0.12);
-    SDF noseBridge = sdfRoundedCylinder(p, vec3(0.33, 0.0, 0.0) + maskPos + globalPos, rotatez(0.5), noseBridgeSize.x, noseBridgeSize.y, noseBridgeSize.z, maskColor);
-    mask = opSmoothUnion(noseBridge, mask, 0.05);
-
-    vec3 nostrilSize = vec3(0.02, 0.02, 0.02);
-    mirrorP = p;
-    mirrorP.z = abs(mirrorP.z - (maskPos.z + globalPos.z))
-        + (maskPos.z + globalPos.z);
-    SDF nostril = sdfEllipsoid(mirrorP, vec3(0.35, -0.09, 0.03) + maskPos + globalPos, rotatez(-0.3), nostrilSize, maskColor);
-    mask = opSmoothUnion(nostril, mask, 0.02);
-
-    mask = opSmoothSubtraction(maskEllipse2, mask, 0.1);
-    scene = opUnion(mask, scene);
-
-    //bed and person
-    vec3 blanketPos = vec3(1.5, -4.5, 1.0);
-    vec3 blanketSize = vec3(1.0, 0.1, 1.0);
-    vec3 blanketColor = bedColor * 0.3;
-    SDF blanket = sdfRoundBox(p, blanketPos + globalPos, mat3(1.0), blanketSize, 0.1, blanketColor);
-    scene = opSmoothUnion(blanket, scene, 0.1);
-
-    vec3 torsoSize = vec3(0.2, 0.1, 0.4);
-    SDF torso = sdfRoundedCylinder(p, vec3(0.0, 0.1, 0.0) + blanketPos + globalPos, rotatez(1.6) * rotatey(1.3), torsoSize.x, torsoSize.y, torsoSize.z, blanketColor);
-    scene = opSmoothUnion(torso, scene, 0.1);
-
-    vec3 upperLegSize = vec3(0.1, 0.1, 0.4);
-    SDF upperLeg = sdfRoundedCylinder(p, vec3(-0.2, 0.1, -0.2) + blanketPos + globalPos, rotatez(1.6) * rotatey(0.5), upperLegSize.x, upperLegSize.y, upperLegSize.z, blanketColor);
-    scene = opSmoothUnion(upperLeg, scene, 0.2);
-
-    vec3 lowerLegSize = vec3(0.1, 0.1, 0.4);
-    SDF lowerLeg = sdfRoundedCylinder(p, vec3(-0.4, 0.1, -0.3) + blanketPos + globalPos, rotatez(1.6) * rotatey(1.3), lowerLegSize.x, lowerLegSize.y, lowerLegSize.z, blanketColor);
-    scene = opSmoothUnion(lowerLeg, scene, 0.1);
-
-    SDF headInBed = sdfSphere(p, vec3(-0.2, 0.1, 0.5) + blanketPos + globalPos, mat3(1.0), 0.2, blanketColor);
-    scene = opSmoothUnion(headInBed, scene, 0.1);
+    vec3 maskPos = maskPosition();
+    if (!cullGroup(p, vec3(0.05, 0.0, 0.0) + maskPos + globalPos, vec3(0.5, 0.55, 0.35), scene.dist, 0.0))
+    {
+      SDF mask = bedroomMask(p);
+      SDF_GROUP(GROUP_MASK, mask.dist);
+      scene = opUnion(mask, scene);
+    }
     return scene;
   } else {
-    float localtime = pc.time - pc.starttime;
-    if (pc.state == 9)
+    vec3 grad;
+    SDF scene = roomWalls(p, grad);
+    SDF_GROUP(GROUP_WALLS, scene.dist);
+    if (SCENE_FILE) {
+      return mapSceneFile(p, scene);
+    }
+
+    if (cullGroup(p, vec3(0.0, -0.5, 4.0), vec3(0.7, 1.6, 0.7), scene.dist, 0.0))
     {
-      localtime = 0.0;
+      return scene;
     }
-    vec3 wallColor = vec3(2.0);
-    vec3 backWallPos = vec3(0.0, 0.0, 5.0);
-    vec3 backWallSize = vec3(4.0, 2.0, 0.1);
-    SDF backWall = sdfBox(p, backWallPos, mat3(1.0), backWallSize, wallColor);
-
-    vec3 sideWallPos = vec3(4.0 + smoothstep(0.0, 10.0, localtime) * 10.0, 0.0, 5.0);
-    vec3 sideWallSize = vec3(0.1, 2.0, 2.0);
-    vec3 sideWallp = p;
-    vec3 pivot = vec3(0.0, 0.0, 5.0);
-    sideWallp = pivot + rotatez(localtime / 4.0) * (sideWallp - pivot);
-    sideWallp.x = abs(sideWallp.x);
-    SDF sideWall = sdfBox(sideWallp, sideWallPos, mat3(1.0), sideWallSize, wallColor);
-
-    vec3 topWallPos = vec3(0.0, 1.9 + smoothstep(0.0, 10.0, localtime) * 10.0, 5.0);
-    vec3 topWallSize = vec3(4.0, 0.1, 2.0);
-    vec3 topWallp = p;
-    topWallp = pivot + rotatez(localtime / 4.0) * (topWallp - pivot);
-    SDF topWall = sdfBox(topWallp, topWallPos, mat3(1.0), topWallSize, wallColor);
-
-    vec3 floorPos = vec3(0.0, -1.9, 5.0);
-    vec3 floorSize = vec3(4.0, 0.1, 2.0);
-    SDF floors = sdfBox(p, floorPos, mat3(1.0), floorSize, wallColor);
-
-    SDF wall = opUnion(backWall, sideWall);
-    wall = opUnion(wall, topWall);
-    wall = opUnion(wall, floors);
-    SDF scene = wall;
-
-    SDF chair;
-    vec3 chairLegPos = vec3(0.5, -1.5, 4.0);
-    vec3 chairp = p;
-    chairp.x = abs(chairp.x);
-    chairp.z = abs(chairp.z - 3.8) + 3.8;
-    SDF chairLeg = sdfCappedCylinder(chairp, chairLegPos, mat3(1.0), 0.1, 0.5, wallColor);
-    chair = chairLeg;
-
-    vec3 seatPos = vec3(0.0, -1.0, 4.0);
-    vec3 seatSize = vec3(0.6, 0.1, 0.6);
-    SDF seat = sdfBox(p, seatPos, mat3(1.0), seatSize, wallColor);
-    chair = opUnion(seat, chair);
-
-    vec3 seatBackPos = vec3(0.0, 0.0, 4.0);
-    vec3 seatBackSize = vec3(0.6, 1.0, 0.1);
-    SDF seatBack = sdfBox(p, seatBackPos, mat3(1.0), seatBackSize, wallColor);
-    chair = opUnion(seatBack, chair);
 
+    SDF chair = roomChair(p, grad);
+    SDF_GROUP(GROUP_CHAIR, chair.dist);
     scene = opUnion(scene, chair);
     return scene;
   }
 }
 
+// One group of the scene on its own, as recorded by SDF_GROUP; any other
+// id evaluates the whole scene. The person is merged into the bed, which it
+// lies on, so its smooth blend survives.
+SDF mapGroup(vec3 p, int group) {
+  vec3 grad;
+  float personDist;
+  if (SCENE_STATE < 9) {
+    if (group == GROUP_ROOM) return bedroomRoom(p, grad);
+    if (group == GROUP_BED) return bedroomBed(p);
+    if (group == GROUP_END_TABLE) return bedroomEndTable(p);
+    if (group == GROUP_PERSON) return bedroomPerson(p, bedroomBed(p), personDist);
+    if (group == GROUP_MASK) return bedroomMask(p);
+  } else {
+    if (group == GROUP_WALLS) return roomWalls(p, grad);
+    if (group == GROUP_CHAIR) return roomChair(p, grad);
+  }
+  return map(p);
+}
+
+// Closed-form gradient of the group at p, or zero when it has none
+vec3 analyticGradient(vec3 p, int group) {
+  vec3 grad = vec3(0.0);
+  if (SCENE_STATE < 9) {
+    if (group == GROUP_ROOM) bedroomRoom(p, grad);
+  } else {
+    if (group == GROUP_WALLS) roomWalls(p, grad);
+    if (group == GROUP_CHAIR) roomChair(p, grad);
+  }
+  return grad;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////
 // NORMAL FUNCTION //
 
+// Tetrahedral differences: four taps at the corners of a tetrahedron, whose
+// weighted sum is the gradient without a bias towards +x/+y/+z
+vec3 normalTetra(vec3 p, int group) {
+  float offset = 0.001;
+  const vec2 k = vec2(1.0, -1.0);
+  return normalize(k.xyy * mapGroup(p + k.xyy * offset, group).dist +
+                   k.yyx * mapGroup(p + k.yyx * offset, group).dist +
+                   k.yxy * mapGroup(p + k.yxy * offset, group).dist +
+                   k.xxx * mapGroup(p + k.xxx * offset, group).dist);
+}
+
+// Normal at hit point p with scene distance d. Must be called right after
+// the map() call that found the hit, which recorded its group.
 vec3 normal(in vec3 p, float d) {
+  int group = gGroup;
+  if (NORMAL_MODE == NORMAL_ANALYTIC) {
+    vec3 grad = analyticGradient(p, group);
+    if (dot(grad, grad) > 0.0) return normalize(grad);
+  }
+  if (NORMAL_MODE == NORMAL_GROUP || NORMAL_MODE == NORMAL_ANALYTIC) {
+    return normalTetra(p, group);
+  }
+  if (NORMAL_MODE == NORMAL_TETRA) {
+    return normalTetra(p, -1);
+  }
+
   float offset = 0.001;
   vec3 distances = vec3(
       map(p + vec3(offset, 0.0, 0.0)).dist - d,
@@ -594,7 +641,7 @@ float calcShadow(in vec3 ro, in vec3 rd, float k) {
   float res = 1.0;
   float t = EPSILON + hash(ro) * 0.02;
 
-  for (int i = 0; i < MAX_STEPS && t < MAX_DISTANCE; i++) {
+  for (int i = 0; i < SHADOW_STEPS && t < MAX_DISTANCE; i++) {
     float h = map(ro + rd * t).dist;
     if (h < MIN_DISTANCE) return 0.0;
 
@@ -620,14 +667,52 @@ float calcOcclusion(vec3 p, vec3 norm) {
   return clamp(1.0 - occ, 0.0, 1.0);
 }
 
-void calcLighting(inout vec3 color, in vec3 p, in vec3 norm)
-{
+// True when the bobbing mask may have changed the shadow or occlusion at p
+// since the last frame. Its bound is the sphere around map()'s cull box,
+// grown by the whole bob range so that it also holds last frame's mask. The
+// occlusion taps reach 0.1 along the normal; calcShadow(p, L, k) darkens
+// where k * h / t < 1 and takes shorter steps where h < 0.25.
+bool maskMayShade(vec3 p, vec3 L, float k) {
+  vec3 center = vec3(0.05, 0.0, 0.0) + maskPosition();
+  float radius = length(vec3(0.5, 0.55, 0.35)) + 0.2;
+  vec3 toMask = center - p;
+  if (length(toMask) - radius < 0.2) return true;
+  float along = dot(toMask, L);
+  // min over t of |p + L * t - center| - t / k is below radius
+  if (sqrt(k * k - 1.0) * length(toMask - L * along) - along < k * radius) return true;
+  return length(toMask - L * max(along, 0.0)) - radius < 0.25;
+}
+
+// Shadow and occlusion at surface point p. Reuses the previous frame's
+// terms when p lands on the same surface there, its tile is not due for a
+// refresh and no moving geometry can have changed them. The mask is the only
+// moving occluder of the bedroom; the walls of the later states move every
+// frame, so those variants run with HISTORY_REFRESH 0.
+vec2 shadowAndOcclusion(vec3 p, vec3 norm) {
   vec3 L = normalize(light.position - p);
+  if (HISTORY_REFRESH > 0 && pc.historyValid != 0) {
+    ivec2 tile = ivec2(gl_FragCoord.xy) / 8;
+    bool refresh = (tile.x + tile.y * 3 + pc.frame) % HISTORY_REFRESH == 0;
+    if (SCENE_STATE < 9 && maskMayShade(p, L, 4.0)) refresh = true;
+    vec2 prev = reprojectPrev(p);
+    if (!refresh && all(greaterThanEqual(prev, vec2(0.0))) && all(lessThan(prev, pc.resolution))) {
+      vec4 h = texelFetch(history, ivec2(prev), 0);
+      float prevDepth = length(p - cameraOrigin(pc.prevTime));
+      // a moving surface or a disocclusion changes the distance
+      if (h.z > 0.0 && abs(h.z - prevDepth) < 0.01 * prevDepth) {
+        return h.xy;
+      }
+    }
+  }
 
-  float occ = calcOcclusion(p, norm);
-  float sha = calcShadow(p, L, 4.0);
+  float sha = SHADOWS ? smoothstep(0.2, 1.0, calcShadow(p, L, 4.0)) : 1.0;
+  float occ = OCCLUSION ? calcOcclusion(p, norm) : 1.0;
+  return vec2(sha, occ);
+}
 
-  sha = smoothstep(0.2, 1.0, sha);
+void calcLighting(inout vec3 color, in vec3 p, in vec3 norm, float sha, float occ)
+{
+  vec3 L = normalize(light.position - p);
 
   float sunLighting = clamp(dot(norm, L), 0.0, 1.0);
   float skyLighting = clamp(0.5 + 0.5 * norm.y, 0.0, 1.0);
@@ -643,7 +728,7 @@ void calcLighting(inout vec3 color, in vec3 p, in vec3 norm)
 
   float distance = length(light.position - p);
   float radius = 6.0 - abs(sin(pc.time * 0.5)) * 0.5;
-  if (pc.state >= 8)
+  if (SCENE_STATE >= 8)
   {
     radius += 2.0;
   }
@@ -659,9 +744,10 @@ void calcLighting(inout vec3 color, in vec3 p, in vec3 norm)
 // MARCHING FUNCTION //
 
 SDF march(out vec3 p, in RayInfo ray) {
-  float distance = 0.0;
+  float distance = ray.start;
   SDF hit;
-  for (int i = 0; i < MAX_STEPS && distance < MAX_DISTANCE; i++) {
+  for (int i = 0; i < MARCH_STEPS && distance < MAX_DISTANCE; i++) {
+    gMarchSteps++;
     p = ray.origin + ray.dir * distance;
     hit = map(p);
     if (hit.dist <= MIN_DISTANCE) return hit;
@@ -674,19 +760,52 @@ SDF march(out vec3 p, in RayInfo ray) {
   return bg;
 }
 
+// Cone pre-pass: marches one cone around every ray of this fragment's tile
+// and returns how far all of them can skip. A step of s from t stays inside
+// the empty sphere of radius d while s + (t + s) * tan(angle) <= d; a
+// pixel ray is never further than t * tan(angle) from the axis at the same
+// distance.
+float coneMarch() {
+  vec2 tileMin = floor(gl_FragCoord.xy) * float(CONE_TILE);
+  vec2 tileMax = min(tileMin + float(CONE_TILE), pc.resolution);
+  vec3 axis = cameraDir(screenUV(0.5 * (tileMin + tileMax)));
+  float cosAngle = 1.0;
+  cosAngle = min(cosAngle, dot(axis, cameraDir(screenUV(tileMin))));
+  cosAngle = min(cosAngle, dot(axis, cameraDir(screenUV(tileMax))));
+  cosAngle = min(cosAngle, dot(axis, cameraDir(screenUV(vec2(tileMin.x, tileMax.y)))));
+  cosAngle = min(cosAngle, dot(axis, cameraDir(screenUV(vec2(tileMax.x, tileMin.y)))));
+  float tanAngle = sqrt(max(1.0 - cosAngle * cosAngle, 0.0)) / cosAngle;
+
+  vec3 origin = cameraOrigin(pc.time);
+  vec3 dir = axis * cameraRotation();
+  float distance = 0.0;
+  for (int i = 0; i < MARCH_STEPS && distance < MAX_DISTANCE; i++) {
+    float d = map(origin + dir * distance).dist;
+    float radius = distance * tanAngle;
+    if (d <= radius + MIN_DISTANCE) break;
+    distance += (d - radius) / (1.0 + tanAngle);
+  }
+  // leave the full-resolution rays a few steps to converge on their own
+  return max(distance - 0.01, 0.0);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////
 // DRAW FUNCTION //
 
-void draw(inout vec4 color, in RayInfo ray) {
+void draw(inout vec4 color, out vec4 historyOut, in RayInfo ray) {
   vec3 p;
   SDF hit = march(p, ray);
   if (hit.dist != -1.0) {
     vec3 norm = normal(p, hit.dist);
+    float depth = length(p - ray.origin);
+    vec2 terms = shadowAndOcclusion(p, norm);
     vec3 col = hit.color;
-    calcLighting(col, p, norm);
+    calcLighting(col, p, norm, terms.x, terms.y);
     color = vec4(col, 1.0);
+    historyOut = vec4(terms, depth, 1.0);
   } else {
     color = vec4(0.0, 0.0, 0.0, 1.0);
+    historyOut = vec4(1.0, 1.0, 0.0, 1.0);
   }
 }
 
@@ -694,10 +813,48 @@ void draw(inout vec4 color, in RayInfo ray) {
 // MAIN //
 
 void main() {
+  if (CONE_MODE == 2) {
+    outColor = vec4(coneMarch());
+    outHistory = vec4(0.0);
+    return;
+  }
+  if (pc.checkerParity >= 0) {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    if (((pixel.x + pixel.y) & 1) != pc.checkerParity) {
+      outColor = texelFetch(prevColor, pixel, 0);
+      outHistory = texelFetch(history, pixel, 0);
+      return;
+    }
+  }
+
   RayInfo ray;
   vec4 color = vec4(0.0);
   initRayout(ray);
   initLight();
-  draw(color, ray);
+  vec4 historyOut;
+  draw(color, historyOut, ray);
+
+  if ((pc.debug & DEBUG_HEATMAP) != 0) {
+    // blue -> green -> red over 0..4096 primitive evaluations, or over
+    // 0..512 primary iterations with DEBUG_STEPS
+    float heat = (pc.debug & DEBUG_STEPS) != 0
+        ? log2(float(gMarchSteps) + 1.0) / 9.0
+        : log2(float(gPrimEvals) + 1.0) / 12.0;
+    heat = clamp(heat, 0.0, 1.0);
+    color = vec4(clamp(vec3(2.0 * heat - 1.0, 1.0 - abs(2.0 * heat - 1.0),
+            1.0 - 2.0 * heat), 0.0, 1.0), 1.0);
+  }
+#ifndef MAP_COUNTERS_READONLY
+  if ((pc.debug & DEBUG_COUNT) != 0) {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    if ((pixel.x & 3) == 0 && (pixel.y & 3) == 0) {
+      atomicAdd(counters.mapCalls, gMapCalls);
+      atomicAdd(counters.primEvals, gPrimEvals);
+      atomicAdd(counters.pixels, 1u);
+      atomicAdd(counters.marchSteps, gMarchSteps);
+    }
+  }
+#endif
   outColor = color;
+  outHistory = historyOut;
 }
@@ -2,15 +2,13 @@
 
 layout(binding = 0) uniform sampler2D fontAtlas;
 
-layout(location = 0) in vec2 fragTexCoord;
+layout(location = 0) in vec2 fragTexCoord; // atlas texels
+layout(location = 1) flat in vec4 fragColor;
 
 layout(location = 0) out vec4 outColor;
 
-layout(push_constant) uniform PushConstants {
-  vec4 color;
-} pc;
-
 void main() {
-  float alpha = texture(fontAtlas, fragTexCoord).r;
-  outColor = vec4(pc.color.rgb, pc.color.a * alpha);
+  vec2 uv = fragTexCoord / vec2(textureSize(fontAtlas, 0));
+  float alpha = texture(fontAtlas, uv).r;
+  outColor = vec4(fragColor.rgb, fragColor.a * alpha);
 }
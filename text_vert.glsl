@@ -1,15 +1,24 @@
 #version 450
 
-layout(location = 0) in vec2 inPosition;
-layout(location = 1) in vec2 inTexCoord;
+// One TextGlyph per instance
+layout(location = 0) in vec2 inPosition; // top-left corner, screen space
+layout(location = 1) in uvec4 inAtlas;   // atlas rect in texels
+layout(location = 2) in float inScale;
+layout(location = 3) in vec4 inColor;
 
-layout(location = 0) out vec2 fragTexCoord;
+layout(location = 0) out vec2 fragTexCoord; // atlas texels
+layout(location = 1) flat out vec4 fragColor;
 
 void main() {
+  // 4-vertex strip: (0,0) (1,0) (0,1) (1,1)
+  vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+  vec2 size = vec2(inAtlas.zw);
+  vec2 position = inPosition + corner * size * inScale;
+
   // Convert screen coordinates to normalized device coordinates
-  // Assuming inPosition is in screen space coordinates
-  vec2 ndc = inPosition / vec2(1980.0, 1020.0) * 2.0 - 1.0;
+  vec2 ndc = position / vec2(1980.0, 1020.0) * 2.0 - 1.0;
 
   gl_Position = vec4(ndc, 0.0, 1.0);
-  fragTexCoord = inTexCoord;
+  fragTexCoord = vec2(inAtlas.xy) + corner * size;
+  fragColor = inColor;
 }
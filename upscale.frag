@@ -0,0 +1,72 @@
+#version 450
+
+// Upscales the raymarch target (rendered into the top-left corner of a
+// larger image) to the full swapchain. sharpness = 0 is plain bilinear;
+// above that a cross-shaped unsharp mask restores edges, clamped to the
+// local min/max so it never overshoots into halos.
+//
+// After a checkerboard raymarch pass only the texels with (x + y) & 1 ==
+// checkerParity are new; the others hold the previous pass's color, copied
+// over by the raymarch shader, which is clamped to the range of their four new neighbours before
+// filtering so moving edges do not leave trails.
+layout(set = 0, binding = 0) uniform sampler2D src;
+
+layout(push_constant) uniform PushConstants {
+  vec2 uvScale;   // rendered size / image size
+  vec2 texelSize; // 1 / image size
+  float sharpness;
+  int checkerParity; // -1: every texel was shaded by the last pass
+} pc;
+
+vec3 resolved(ivec2 texel, ivec2 maxTexel) {
+  vec3 c = texelFetch(src, texel, 0).rgb;
+  if (((texel.x + texel.y) & 1) == pc.checkerParity) return c;
+
+  vec3 n = texelFetch(src, clamp(texel + ivec2(0, -1), ivec2(0), maxTexel), 0).rgb;
+  vec3 s = texelFetch(src, clamp(texel + ivec2(0, 1), ivec2(0), maxTexel), 0).rgb;
+  vec3 e = texelFetch(src, clamp(texel + ivec2(1, 0), ivec2(0), maxTexel), 0).rgb;
+  vec3 w = texelFetch(src, clamp(texel + ivec2(-1, 0), ivec2(0), maxTexel), 0).rgb;
+  return clamp(c, min(min(n, s), min(e, w)), max(max(n, s), max(e, w)));
+}
+
+// Bilinear filtering of resolved texels
+vec3 fetchCheckerboard(vec2 uv) {
+  ivec2 maxTexel = ivec2(pc.uvScale / pc.texelSize + 0.5) - 1;
+  vec2 pos = uv / pc.texelSize - 0.5;
+  ivec2 base = ivec2(floor(pos));
+  vec2 f = pos - floor(pos);
+  vec3 a = resolved(clamp(base, ivec2(0), maxTexel), maxTexel);
+  vec3 b = resolved(clamp(base + ivec2(1, 0), ivec2(0), maxTexel), maxTexel);
+  vec3 c = resolved(clamp(base + ivec2(0, 1), ivec2(0), maxTexel), maxTexel);
+  vec3 d = resolved(clamp(base + ivec2(1, 1), ivec2(0), maxTexel), maxTexel);
+  return mix(mix(a, b, f.x), mix(c, d, f.x), f.y);
+}
+
+layout(location = 0) in vec2 inUV;
+layout(location = 0) out vec4 outColor;
+
+vec3 fetch(vec2 uv) {
+  // keep the bilinear footprint inside the rendered region
+  uv = clamp(uv, 0.5 * pc.texelSize, pc.uvScale - 0.5 * pc.texelSize);
+  if (pc.checkerParity >= 0) return fetchCheckerboard(uv);
+  return texture(src, uv).rgb;
+}
+
+void main() {
+  vec2 uv = inUV * pc.uvScale;
+  vec3 c = fetch(uv);
+
+  if (pc.sharpness > 0.0) {
+    vec3 n = fetch(uv + vec2(0.0, -pc.texelSize.y));
+    vec3 s = fetch(uv + vec2(0.0, pc.texelSize.y));
+    vec3 e = fetch(uv + vec2(pc.texelSize.x, 0.0));
+    vec3 w = fetch(uv + vec2(-pc.texelSize.x, 0.0));
+
+    vec3 mn = min(c, min(min(n, s), min(e, w)));
+    vec3 mx = max(c, max(max(n, s), max(e, w)));
+    vec3 sharpened = c + pc.sharpness * (4.0 * c - n - s - e - w) * 0.25;
+    c = clamp(sharpened, mn, mx);
+  }
+
+  outColor = vec4(c, 1.0);
+}